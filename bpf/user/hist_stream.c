@@ -0,0 +1,305 @@
+// Copyright 2022 Google LLC
+//
+// Use of this source code is governed by a BSD-style
+// license that can be found in the LICENSE file or at
+// https://developers.google.com/open-source/licenses/bsd
+
+#include "bpf/user/hist_stream.h"
+
+#include <errno.h>
+#include <linux/membarrier.h>
+#include <stdbool.h>
+#include <stdlib.h>
+#include <string.h>
+#include <sys/syscall.h>
+#include <unistd.h>
+
+#include "third_party/iovisor_bcc/trace_helpers.h"
+#include "libbpf/bpf.h"
+#include "libbpf/libbpf.h"
+
+int hist_stream_parse_format(const char *arg, enum hist_stream_format *format)
+{
+	if (!strcmp(arg, "csv"))
+		*format = HIST_STREAM_CSV;
+	else if (!strcmp(arg, "bin"))
+		*format = HIST_STREAM_BIN;
+	else
+		return -1;
+	return 0;
+}
+
+int hist_stream_init(struct hist_stream *hs, int map_fd, uint32_t *gen,
+		     const struct hist_desc *descs, int nr_hists,
+		     enum hist_stream_format format, FILE *out)
+{
+	int nr_cpus = libbpf_num_possible_cpus();
+
+	if (nr_cpus < 0)
+		return nr_cpus;
+
+	memset(hs, 0, sizeof(*hs));
+	hs->map_fd = map_fd;
+	hs->gen = gen;
+	hs->descs = descs;
+	hs->nr_hists = nr_hists;
+	hs->nr_cpus = nr_cpus;
+	hs->format = format;
+	hs->out = out;
+
+	/*
+	 * Each element we read from the PERCPU_ARRAY is an *array[nr_cpus]* of
+	 * struct ll_hist, one for each cpu.  This differs from accessing an
+	 * element from within a BPF program, where we only get the percpu
+	 * element.
+	 */
+	hs->percpu = calloc(nr_cpus, sizeof(struct ll_hist));
+	hs->delta = calloc(nr_hists, sizeof(struct hist_counts));
+	hs->total = calloc(nr_hists, sizeof(struct hist_counts));
+	if (!hs->percpu || !hs->delta || !hs->total) {
+		hist_stream_destroy(hs);
+		return -ENOMEM;
+	}
+	hs->snapshot_ns = get_ktime_ns();
+
+	if (format == HIST_STREAM_CSV)
+		hist_stream_write_csv_header(out);
+	return 0;
+}
+
+void hist_stream_destroy(struct hist_stream *hs)
+{
+	free(hs->percpu);
+	free(hs->delta);
+	free(hs->total);
+	hs->percpu = NULL;
+	hs->delta = NULL;
+	hs->total = NULL;
+}
+
+/*
+ * Waits until no BPF program is counting into a set we switched away from.
+ *
+ * Tracing programs run under rcu_read_lock(), and MEMBARRIER_CMD_GLOBAL waits
+ * for an RCU grace period.  It fails on nohz_full kernels, where we settle for
+ * a sleep that is far longer than any of our programs run.
+ */
+static void wait_for_bpf_progs(void)
+{
+	if (syscall(__NR_membarrier, MEMBARRIER_CMD_GLOBAL, 0))
+		usleep(1000);
+}
+
+static int drain_set(struct hist_stream *hs, uint32_t set)
+{
+	for (int i = 0; i < hs->nr_hists; i++) {
+		uint32_t key = set * hs->nr_hists + i;
+
+		if (bpf_map_lookup_elem(hs->map_fd, &key, hs->percpu))
+			return -errno;
+		for (int c = 0; c < hs->nr_cpus; c++) {
+			for (int s = 0; s < LL_HIST_NR_SLOTS; s++)
+				hs->delta[i].slots[s] += hs->percpu[c].slots[s];
+		}
+		memset(hs->percpu, 0, hs->nr_cpus * sizeof(struct ll_hist));
+		if (bpf_map_update_elem(hs->map_fd, &key, hs->percpu, BPF_ANY))
+			return -errno;
+	}
+	return 0;
+}
+
+int hist_stream_snapshot(struct hist_stream *hs)
+{
+	uint32_t old_gen = __atomic_load_n(hs->gen, __ATOMIC_RELAXED);
+	uint64_t now;
+	int err;
+
+	__atomic_store_n(hs->gen, old_gen + 1, __ATOMIC_RELEASE);
+	now = get_ktime_ns();
+	wait_for_bpf_progs();
+
+	memset(hs->delta, 0, hs->nr_hists * sizeof(struct hist_counts));
+	err = drain_set(hs, old_gen % 2);
+	if (err)
+		return err;
+	for (int i = 0; i < hs->nr_hists; i++) {
+		for (int s = 0; s < LL_HIST_NR_SLOTS; s++)
+			hs->total[i].slots[s] += hs->delta[i].slots[s];
+	}
+
+	hs->interval_ns = now - hs->snapshot_ns;
+	hs->snapshot_ns = now;
+	return 0;
+}
+
+int hist_stream_emit(struct hist_stream *hs)
+{
+	for (int i = 0; i < hs->nr_hists; i++) {
+		switch (hs->format) {
+		case HIST_STREAM_CSV:
+			hist_stream_write_csv(hs->out, hs->descs[i].name,
+					      hs->snapshot_ns, hs->interval_ns,
+					      &hs->delta[i]);
+			break;
+		case HIST_STREAM_BIN:
+			if (hist_stream_write_bin(hs->out, i, hs->snapshot_ns,
+						  hs->interval_ns,
+						  hs->delta[i].slots,
+						  LL_HIST_NR_SLOTS))
+				return -EIO;
+			break;
+		case HIST_STREAM_NONE:
+			break;
+		}
+	}
+	if (fflush(hs->out) || ferror(hs->out))
+		return -EIO;
+	return 0;
+}
+
+int hist_stream_print_totals(struct hist_stream *hs)
+{
+	unsigned int log2_slots[HIST_STREAM_LOG2_SLOTS];
+	int err;
+
+	/* Twice, to get both sets. */
+	for (int i = 0; i < 2; i++) {
+		err = hist_stream_snapshot(hs);
+		if (err)
+			return err;
+	}
+
+	for (int i = 0; i < hs->nr_hists; i++) {
+		const struct hist_counts *c = &hs->total[i];
+
+		fprintf(hs->out, "\n%s:\n----------\n", hs->descs[i].title);
+		hist_counts_fold_log2_us(c, log2_slots);
+		print_log2_hist_to(hs->out, log2_slots, HIST_STREAM_LOG2_SLOTS,
+				   "usec");
+		fprintf(hs->out,
+			"count %lu p50 %luns p90 %luns p99 %luns p99.9 %luns max %luns\n",
+			hist_counts_total(c),
+			hist_counts_percentile(c, 50),
+			hist_counts_percentile(c, 90),
+			hist_counts_percentile(c, 99),
+			hist_counts_percentile(c, 99.9),
+			hist_counts_max(c));
+	}
+	return 0;
+}
+
+uint64_t hist_counts_total(const struct hist_counts *c)
+{
+	uint64_t total = 0;
+
+	for (int s = 0; s < LL_HIST_NR_SLOTS; s++)
+		total += c->slots[s];
+	return total;
+}
+
+uint64_t hist_counts_percentile(const struct hist_counts *c, double percentile)
+{
+	uint64_t total = hist_counts_total(c);
+	uint64_t seen = 0;
+	double target;
+
+	if (!total)
+		return 0;
+	if (percentile < 0)
+		percentile = 0;
+	if (percentile > 100)
+		percentile = 100;
+	target = total * percentile / 100;
+
+	for (int s = 0; s < LL_HIST_NR_SLOTS; s++) {
+		seen += c->slots[s];
+		if (c->slots[s] && seen >= target)
+			return ll_hist_slot_upper(s);
+	}
+	return hist_counts_max(c);
+}
+
+uint64_t hist_counts_max(const struct hist_counts *c)
+{
+	for (int s = LL_HIST_NR_SLOTS - 1; s >= 0; s--) {
+		if (c->slots[s])
+			return ll_hist_slot_upper(s);
+	}
+	return 0;
+}
+
+void hist_counts_fold_log2_us(const struct hist_counts *c,
+			      unsigned int log2_slots[HIST_STREAM_LOG2_SLOTS])
+{
+	memset(log2_slots, 0, HIST_STREAM_LOG2_SLOTS * sizeof(log2_slots[0]));
+
+	for (int s = 0; s < LL_HIST_NR_SLOTS; s++) {
+		uint64_t us = ll_hist_slot_lower(s) / 1000;
+		uint32_t i = us ? ll_hist_msb(us) : 0;
+		uint64_t sum;
+
+		if (i >= HIST_STREAM_LOG2_SLOTS)
+			i = HIST_STREAM_LOG2_SLOTS - 1;
+		sum = log2_slots[i] + c->slots[s];
+		log2_slots[i] = sum > UINT32_MAX ? UINT32_MAX : sum;
+	}
+}
+
+void hist_stream_write_csv_header(FILE *out)
+{
+	fprintf(out, "ts_ns,interval_ns,hist,count,p50_ns,p90_ns,p99_ns,p999_ns,max_ns,slots\n");
+}
+
+void hist_stream_write_csv(FILE *out, const char *name, uint64_t ts_ns,
+			   uint64_t interval_ns, const struct hist_counts *c)
+{
+	const char *sep = "";
+
+	fprintf(out, "%lu,%lu,%s,%lu,%lu,%lu,%lu,%lu,%lu,", ts_ns, interval_ns,
+		name, hist_counts_total(c),
+		hist_counts_percentile(c, 50),
+		hist_counts_percentile(c, 90),
+		hist_counts_percentile(c, 99),
+		hist_counts_percentile(c, 99.9),
+		hist_counts_max(c));
+	for (int s = 0; s < LL_HIST_NR_SLOTS; s++) {
+		if (!c->slots[s])
+			continue;
+		fprintf(out, "%s%lu:%lu", sep, ll_hist_slot_lower(s),
+			c->slots[s]);
+		sep = " ";
+	}
+	fprintf(out, "\n");
+}
+
+int hist_stream_write_bin(FILE *out, uint16_t hist_id, uint64_t ts_ns,
+			  uint64_t interval_ns, const uint64_t *slots,
+			  uint32_t nr_slots)
+{
+	struct hist_stream_record rec = {
+		.magic = HIST_STREAM_MAGIC,
+		.version = HIST_STREAM_VERSION,
+		.hist_id = hist_id,
+		.ts_ns = ts_ns,
+		.interval_ns = interval_ns,
+		.nr_slots = nr_slots,
+	};
+
+	for (uint32_t s = 0; s < nr_slots; s++)
+		rec.nr_buckets += slots[s] != 0;
+	if (fwrite(&rec, sizeof(rec), 1, out) != 1)
+		return -1;
+
+	for (uint32_t s = 0; s < nr_slots; s++) {
+		struct hist_stream_bucket b = {
+			.slot = s,
+			.count = slots[s] > UINT32_MAX ? UINT32_MAX : slots[s],
+		};
+
+		if (!slots[s])
+			continue;
+		if (fwrite(&b, sizeof(b), 1, out) != 1)
+			return -1;
+	}
+	return 0;
+}
@@ -0,0 +1,134 @@
+// Copyright 2022 Google LLC
+//
+// Use of this source code is governed by a BSD-style
+// license that can be found in the LICENSE file or at
+// https://developers.google.com/open-source/licenses/bsd
+
+// Reads the log-linear histograms (third_party/bpf/ll_hist.h) of the BPF
+// tracing tools, e.g. schedlat and schedrun.
+//
+// The tools keep two sets of histograms in a PERCPU_ARRAY, NR_HISTS entries
+// each, and count into set (hist_gen % 2), where hist_gen is a global in the
+// BPF program.  To take a snapshot, we bump hist_gen, wait until no BPF program
+// can still be counting into the old set, sum the old set over the cpus and
+// zero it.  That way we never race with the BPF programs, and a snapshot covers
+// exactly the events since the previous one.
+//
+// The tools either print the totals at exit, like they always did, or stream
+// the histogram of every interval as CSV or as binary records.
+
+#ifndef GHOST_BPF_USER_HIST_STREAM_H_
+#define GHOST_BPF_USER_HIST_STREAM_H_
+
+#include <stdint.h>
+#include <stdio.h>
+
+#include "third_party/bpf/ll_hist.h"
+
+#ifdef __cplusplus
+extern "C" {
+#endif
+
+enum hist_stream_format {
+	HIST_STREAM_NONE,	/* Only print the totals at exit. */
+	HIST_STREAM_CSV,
+	HIST_STREAM_BIN,
+};
+
+struct hist_desc {
+	const char *name;	/* For the stream, e.g. "runnable_to_run". */
+	const char *title;	/* For the totals. */
+};
+
+// A histogram summed over the cpus.
+struct hist_counts {
+	uint64_t slots[LL_HIST_NR_SLOTS];
+};
+
+// The totals are printed with print_log2_hist(), in usec, which needs this many
+// slots for values up to 2^LL_HIST_MAX_SHIFT nsec.
+#define HIST_STREAM_LOG2_SLOTS (LL_HIST_MAX_SHIFT - 10)
+
+// A binary record is a struct hist_stream_record followed by nr_buckets struct
+// hist_stream_bucket, one per non-empty slot, in the host's byte order.
+#define HIST_STREAM_MAGIC 0x54534847  // "GHST"
+#define HIST_STREAM_VERSION 1
+
+struct hist_stream_record {
+	uint32_t magic;
+	uint16_t version;
+	uint16_t hist_id;
+	uint64_t ts_ns;		/* CLOCK_MONOTONIC at the end of the interval. */
+	uint64_t interval_ns;
+	uint32_t nr_slots;	/* e.g. LL_HIST_NR_SLOTS, to decode the slots. */
+	uint32_t nr_buckets;
+};
+
+struct hist_stream_bucket {
+	uint32_t slot;
+	uint32_t count;		/* Saturates. */
+};
+
+struct hist_stream {
+	int map_fd;
+	uint32_t *gen;
+	const struct hist_desc *descs;
+	int nr_hists;
+	unsigned int nr_cpus;
+	enum hist_stream_format format;
+	FILE *out;
+
+	struct ll_hist *percpu;		/* nr_cpus */
+	struct hist_counts *delta;	/* nr_hists, for the last interval */
+	struct hist_counts *total;	/* nr_hists, since hist_stream_init() */
+	uint64_t snapshot_ns;
+	uint64_t interval_ns;
+};
+
+// Parses "csv" or "bin".  Returns 0 on success.
+int hist_stream_parse_format(const char *arg, enum hist_stream_format *format);
+
+// `map_fd` is the hists map, and `gen` points to hist_gen in the BPF program's
+// mmapped bss.  Returns 0 on success or -errno.
+int hist_stream_init(struct hist_stream *hs, int map_fd, uint32_t *gen,
+		     const struct hist_desc *descs, int nr_hists,
+		     enum hist_stream_format format, FILE *out);
+void hist_stream_destroy(struct hist_stream *hs);
+
+// Switches sets and drains the old one into the deltas and the totals.
+// Returns 0 on success or -errno.
+int hist_stream_snapshot(struct hist_stream *hs);
+
+// Writes the deltas of the last snapshot in the stream's format.  Returns 0 on
+// success or -EIO if writing to the stream failed.
+int hist_stream_emit(struct hist_stream *hs);
+
+// Drains both sets and prints the totals.  Returns 0 on success or -errno.
+int hist_stream_print_totals(struct hist_stream *hs);
+
+// Returns the upper bound of the slot below which `percentile` (in [0, 100])
+// of the values in `c` lie, or 0 if `c` is empty.
+uint64_t hist_counts_percentile(const struct hist_counts *c, double percentile);
+// Returns the upper bound of the highest non-empty slot, or 0.
+uint64_t hist_counts_max(const struct hist_counts *c);
+uint64_t hist_counts_total(const struct hist_counts *c);
+// Folds `c` (in nsec) into power of 2 usec slots for print_log2_hist().
+void hist_counts_fold_log2_us(const struct hist_counts *c,
+			      unsigned int log2_slots[HIST_STREAM_LOG2_SLOTS]);
+
+void hist_stream_write_csv_header(FILE *out);
+// Writes a CSV row: the count, percentiles and max in nsec, and the non-empty
+// slots as space-separated lower_bound:count pairs.
+void hist_stream_write_csv(FILE *out, const char *name, uint64_t ts_ns,
+			   uint64_t interval_ns, const struct hist_counts *c);
+// Writes a binary record of the `nr_slots` counts in `slots`.  Returns 0 on
+// success or -1 if the write failed.
+int hist_stream_write_bin(FILE *out, uint16_t hist_id, uint64_t ts_ns,
+			  uint64_t interval_ns, const uint64_t *slots,
+			  uint32_t nr_slots);
+
+#ifdef __cplusplus
+}  /* extern "C" */
+#endif
+
+#endif  // GHOST_BPF_USER_HIST_STREAM_H_
@@ -16,6 +16,7 @@
 #include <unistd.h>
 
 #include "third_party/bpf/schedfair.h"
+#include "bpf/user/hist_stream.h"
 #include "bpf/user/schedfair_bpf.skel.h"
 #include "third_party/iovisor_bcc/trace_helpers.h"
 #include "libbpf/bpf.h"
@@ -133,6 +134,84 @@ static void sig_hand(int signr)
 
 static struct sigaction sigact = {.sa_handler = sig_hand};
 
+#define NR_PRIOS 40
+#define NR_FAIR_BINS 20
+
+/*
+ * Streams the wake-to-block table of each interval, one row per priority that
+ * had any data.  BPF only ever adds to the counters in the table, so we diff
+ * snapshots rather than switch between two tables like schedlat does.
+ */
+static int emit_wtb_interval(const uint64_t *wtb_data, uint64_t *prev,
+			     enum hist_stream_format format, uint64_t ts_ns,
+			     uint64_t interval_ns)
+{
+	uint64_t delta[NR_FAIR_BINS];
+
+	for (int prio = 0; prio < NR_PRIOS; prio++) {
+		uint64_t *p = prev + prio * NR_FAIR_BINS;
+		uint64_t row_total = 0;
+
+		for (int bin = 0; bin < NR_FAIR_BINS; bin++) {
+			uint64_t cur = __atomic_load_n(&wtb_data[prio * NR_FAIR_BINS + bin],
+						       __ATOMIC_RELAXED);
+
+			delta[bin] = cur - p[bin];
+			p[bin] = cur;
+			row_total += delta[bin];
+		}
+		if (!row_total)
+			continue;
+
+		if (format == HIST_STREAM_BIN) {
+			if (hist_stream_write_bin(stdout, prio, ts_ns,
+						  interval_ns, delta,
+						  NR_FAIR_BINS))
+				return -EIO;
+			continue;
+		}
+		printf("%lu,%lu,%d,%lu", ts_ns, interval_ns, prio, row_total);
+		for (int bin = 0; bin < NR_FAIR_BINS; bin++)
+			printf(",%lu", delta[bin]);
+		printf("\n");
+	}
+	if (fflush(stdout) || ferror(stdout))
+		return -EIO;
+	return 0;
+}
+
+static void stream_wtb(const uint64_t *wtb_data, long interval_ms,
+		       enum hist_stream_format format)
+{
+	uint64_t *prev;
+	uint64_t last, now;
+	int err;
+
+	prev = calloc(NR_PRIOS * NR_FAIR_BINS, sizeof(uint64_t));
+	assert(prev);
+
+	if (format == HIST_STREAM_CSV) {
+		printf("ts_ns,interval_ns,prio,total");
+		for (int bin = 0; bin < NR_FAIR_BINS; bin++)
+			printf(",bin%d", bin);
+		printf("\n");
+	}
+
+	last = get_ktime_ns();
+	do {
+		/* SIGINT cuts the sleep short: we emit what we got. */
+		usleep(interval_ms * 1000);
+		now = get_ktime_ns();
+		err = emit_wtb_interval(wtb_data, prev, format, now,
+					now - last);
+		last = now;
+	} while (!exiting && !err);
+	if (err)
+		fprintf(stderr, "Failed to stream the table: %d\n", err);
+
+	free(prev);
+}
+
 static size_t map_mmap_sz(struct bpf_map *map)
 {
 	size_t mmap_sz;
@@ -183,6 +262,31 @@ int main(int argc, char **argv)
 	int err;
 	uint64_t *wtb_data;
 	uint64_t start_time, stop_time;
+	enum hist_stream_format format = HIST_STREAM_CSV;
+	long interval_ms = 0;
+	int opt;
+
+	while ((opt = getopt(argc, argv, "i:f:")) != -1) {
+		switch (opt) {
+		case 'i':
+			interval_ms = strtol(optarg, NULL, 10);
+			if (interval_ms <= 0) {
+				fprintf(stderr, "Invalid interval: %s\n", optarg);
+				return -1;
+			}
+			break;
+		case 'f':
+			if (hist_stream_parse_format(optarg, &format)) {
+				fprintf(stderr, "Invalid format: %s\n", optarg);
+				return -1;
+			}
+			break;
+		default:
+			fprintf(stderr, "Usage: %s [-i interval_ms [-f csv|bin]]\n",
+				argv[0]);
+			return -1;
+		}
+	}
 
 	sigaction(SIGINT, &sigact, 0);
 	err = bump_memlock_rlimit();
@@ -217,6 +321,12 @@ int main(int argc, char **argv)
 		goto cleanup;
 	}
 
+	if (interval_ms) {
+		fprintf(stderr, "Streaming Wake-to-block Fairness, Ctrl-c to exit\n");
+		stream_wtb(wtb_data, interval_ms, format);
+		goto cleanup;
+	}
+
 	printf("Measuring \"Task Fairness\": actual runtime / theoretical weighted fair share.\n");
 	print_help_text();
 
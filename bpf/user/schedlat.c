@@ -13,51 +13,19 @@
 #include <unistd.h>
 
 #include "third_party/bpf/schedlat.h"
+#include "bpf/user/hist_stream.h"
 #include "bpf/user/schedlat_bpf.skel.h"
 #include "third_party/iovisor_bcc/trace_helpers.h"
 #include "libbpf/bpf.h"
 #include "libbpf/libbpf.h"
 
-#define handle_error(msg) \
-        do { perror(msg); exit(-1); } while (0)
-
-static const char *titles[] = {
-	[RUNNABLE_TO_LATCHED] = "Latency from Runnable to Latched",
-	[LATCHED_TO_RUN] = "Latency from Latched to Run",
-	[RUNNABLE_TO_RUN] = "Latency from Runnable to Run",
+static const struct hist_desc hists[] = {
+	[RUNNABLE_TO_LATCHED] = {"runnable_to_latched",
+				 "Latency from Runnable to Latched"},
+	[LATCHED_TO_RUN] = {"latched_to_run", "Latency from Latched to Run"},
+	[RUNNABLE_TO_RUN] = {"runnable_to_run", "Latency from Runnable to Run"},
 };
 
-static void print_hists(int fd)
-{
-	unsigned int nr_cpus = libbpf_num_possible_cpus();
-	struct hist *hist;
-	uint32_t total[MAX_NR_HIST_SLOTS];
-
-	/*
-	 * There are NR_HISTS members of the PERCPU_ARRAY.  Each one we read is
-	 * an *array[nr_cpus]* of the struct hist, one for each cpu.  This
-	 * differs from a accessing an element from within a BPF program, where
-	 * we only get the percpu element.
-	 */
-	hist = calloc(nr_cpus, sizeof(struct hist));
-	if (!hist)
-		handle_error("calloc");
-
-	for (int i = 0; i < NR_HISTS; i++) {
-		if (bpf_map_lookup_elem(fd, &i, hist))
-			handle_error("lookup");
-		memset(total, 0, sizeof(total));
-		for (int c = 0; c < nr_cpus; c++) {
-			for (int s = 0; s < MAX_NR_HIST_SLOTS; s++)
-				total[s] += hist[c].slots[s];
-		}
-		printf("\n%s:\n----------\n", titles[i]);
-		print_log2_hist(total, MAX_NR_HIST_SLOTS, "usec");
-	}
-
-	free(hist);
-}
-
 static volatile bool exiting;
 
 static void sig_hand(int signr)
@@ -67,10 +35,43 @@ static void sig_hand(int signr)
 
 static struct sigaction sigact = {.sa_handler = sig_hand};
 
+static void usage(const char *prog)
+{
+	fprintf(stderr, "Usage: %s [-i interval_ms [-f csv|bin]]\n", prog);
+	fprintf(stderr, "  -i: stream the histograms of each interval\n");
+	fprintf(stderr, "  -f: stream format (default: csv)\n");
+}
+
 int main(int argc, char **argv)
 {
 	struct schedlat_bpf *obj;
-	int err;
+	struct hist_stream hs;
+	enum hist_stream_format format = HIST_STREAM_CSV;
+	long interval_ms = 0;
+	int opt, err;
+
+	while ((opt = getopt(argc, argv, "i:f:")) != -1) {
+		switch (opt) {
+		case 'i':
+			interval_ms = strtol(optarg, NULL, 10);
+			if (interval_ms <= 0) {
+				fprintf(stderr, "Invalid interval: %s\n", optarg);
+				return -1;
+			}
+			break;
+		case 'f':
+			if (hist_stream_parse_format(optarg, &format)) {
+				fprintf(stderr, "Invalid format: %s\n", optarg);
+				return -1;
+			}
+			break;
+		default:
+			usage(argv[0]);
+			return -1;
+		}
+	}
+	if (!interval_ms)
+		format = HIST_STREAM_NONE;
 
 	sigaction(SIGINT, &sigact, 0);
 	err = bump_memlock_rlimit();
@@ -91,13 +92,35 @@ int main(int argc, char **argv)
 		goto cleanup;
 	}
 
-	printf("Ctrl-c to exit\n");
-	while (!exiting)
-		sleep(9999999);
+	err = hist_stream_init(&hs, bpf_map__fd(obj->maps.hists),
+			       &obj->bss->hist_gen, hists, NR_HISTS, format,
+			       stdout);
+	if (err) {
+		fprintf(stderr, "failed to init hists: %d\n", err);
+		goto cleanup;
+	}
 
-	print_hists(bpf_map__fd(obj->maps.hists));
+	/* Keep stdout for the stream. */
+	fprintf(stderr, "Ctrl-c to exit\n");
+
+	if (!interval_ms) {
+		while (!exiting)
+			sleep(9999999);
+		err = hist_stream_print_totals(&hs);
+	} else {
+		do {
+			/* SIGINT cuts the sleep short: we emit what we got. */
+			usleep(interval_ms * 1000);
+			err = hist_stream_snapshot(&hs);
+			if (!err)
+				err = hist_stream_emit(&hs);
+		} while (!exiting && !err);
+	}
+	if (err)
+		fprintf(stderr, "failed to stream hists: %d\n", err);
 
-	printf("Exiting\n");
+	hist_stream_destroy(&hs);
+	fprintf(stderr, "Exiting\n");
 
 cleanup:
 	schedlat_bpf__destroy(obj);
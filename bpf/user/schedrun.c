@@ -13,6 +13,7 @@
 #include <unistd.h>
 
 #include "third_party/bpf/schedrun.h"
+#include "bpf/user/hist_stream.h"
 #include "bpf/user/schedrun_bpf.skel.h"
 #include "third_party/iovisor_bcc/trace_helpers.h"
 #include "libbpf/bpf.h"
@@ -26,47 +27,22 @@
 static bool ghost_only = false;
 static pid_t pid = 0;
 
-static const char *titles[] = {
-	[RUNTIMES_PREEMPTED_YIELDED] = "Runtimes of preempted/yielded tasks",
-	[RUNTIMES_BLOCKED] = "Runtimes of tasks that blocked",
-	[RUNTIMES_ALL] = "All task runtimes",
+static const struct hist_desc hists[] = {
+	[RUNTIMES_PREEMPTED_YIELDED] = {"preempted_yielded",
+					"Runtimes of preempted/yielded tasks"},
+	[RUNTIMES_BLOCKED] = {"blocked", "Runtimes of tasks that blocked"},
+	[RUNTIMES_ALL] = {"all", "All task runtimes"},
 };
 
-// TODO: refactor (copied from schedlat.c).
-static void print_hists(int fd)
-{
-	unsigned int nr_cpus = libbpf_num_possible_cpus();
-	struct hist *hist;
-	uint32_t total[MAX_NR_HIST_SLOTS];
-
-	/*
-	 * There are NR_HISTS members of the PERCPU_ARRAY.  Each one we read is
-	 * an *array[nr_cpus]* of the struct hist, one for each cpu.  This
-	 * differs from accessing an element from within a BPF program, where
-	 * we only get the percpu element.
-	 */
-	hist = calloc(nr_cpus, sizeof(struct hist));
-	if (!hist)
-		error_exit("calloc");
-
-	for (int i = 0; i < NR_HISTS; i++) {
-		if (bpf_map_lookup_elem(fd, &i, hist))
-			error_exit("bpf_map_lookup_elem");
-		memset(total, 0, sizeof(total));
-		for (int c = 0; c < nr_cpus; c++) {
-			for (int s = 0; s < MAX_NR_HIST_SLOTS; s++)
-				total[s] += hist[c].slots[s];
-		}
-		printf("\n%s:\n----------\n", titles[i]);
-		print_log2_hist(total, MAX_NR_HIST_SLOTS, "usec");
-	}
-}
-
 int main(int argc, char **argv)
 {
 	sigset_t set;
 	int opt, err, sig;
 	struct schedrun_bpf *skel;
+	struct hist_stream hs;
+	enum hist_stream_format format = HIST_STREAM_CSV;
+	long interval_ms = 0;
+	struct timespec interval;
 
 	if (sigemptyset(&set))
 		error_exit("sigemptyset");
@@ -75,7 +51,7 @@ int main(int argc, char **argv)
 	if (sigprocmask(SIG_BLOCK, &set, NULL))
 		error_exit("sigprocmask");
 
-	while ((opt = getopt(argc, argv, "gp:")) != -1) {
+	while ((opt = getopt(argc, argv, "gp:i:f:")) != -1) {
 		switch (opt) {
 			case 'g':
 				ghost_only = true;
@@ -90,11 +66,26 @@ int main(int argc, char **argv)
 					return 1;
 				}
 				break;
+			case 'i':
+				interval_ms = strtol(optarg, NULL, 10);
+				if (interval_ms <= 0) {
+					fprintf(stderr, "Invalid interval: %s\n", optarg);
+					return 1;
+				}
+				break;
+			case 'f':
+				if (hist_stream_parse_format(optarg, &format)) {
+					fprintf(stderr, "Invalid format: %s\n", optarg);
+					return 1;
+				}
+				break;
 			default:
-				fprintf(stderr, "Usage: %s [-p pid | -g]\n", argv[0]);
+				fprintf(stderr, "Usage: %s [-p pid | -g] [-i interval_ms [-f csv|bin]]\n", argv[0]);
 				return 1;
 		}
 	}
+	if (!interval_ms)
+		format = HIST_STREAM_NONE;
 
 	if (ghost_only && pid) {
 		fprintf(stderr, "-g and -p options are mutually exclusive\n");
@@ -125,13 +116,39 @@ int main(int argc, char **argv)
 		goto cleanup;
 	}
 
-	printf("Ctrl-c to exit\n");
+	err = hist_stream_init(&hs, bpf_map__fd(skel->maps.hists),
+			       &skel->bss->hist_gen, hists, NR_HISTS, format,
+			       stdout);
+	if (err) {
+		fprintf(stderr, "Failed to init hists: %d\n", err);
+		goto cleanup;
+	}
 
-	if (sigwait(&set, &sig))
-		error_exit("sigwait");
+	/* Keep stdout for the stream. */
+	fprintf(stderr, "Ctrl-c to exit\n");
+
+	if (!interval_ms) {
+		if (sigwait(&set, &sig))
+			error_exit("sigwait");
+		err = hist_stream_print_totals(&hs);
+	} else {
+		interval.tv_sec = interval_ms / 1000;
+		interval.tv_nsec = (interval_ms % 1000) * 1000000;
+		do {
+			sig = sigtimedwait(&set, NULL, &interval);
+			if (sig < 0 && errno != EAGAIN && errno != EINTR)
+				error_exit("sigtimedwait");
+			/* On SIGINT, we emit the partial interval. */
+			err = hist_stream_snapshot(&hs);
+			if (!err)
+				err = hist_stream_emit(&hs);
+		} while (sig != SIGINT && !err);
+	}
+	if (err)
+		fprintf(stderr, "Failed to stream hists: %d\n", err);
 
-	print_hists(bpf_map__fd(skel->maps.hists));
-	printf("Exiting\n");
+	hist_stream_destroy(&hs);
+	fprintf(stderr, "Exiting\n");
 
 cleanup:
 	schedrun_bpf__destroy(skel);
@@ -75,6 +75,8 @@ GhostOrchestrator::GhostOrchestrator(Options opts)
   for (uint32_t i = 0; i < opts.load_generator_cpus.Size(); i++) {
     idle_sids_.push_back(std::vector<uint32_t>());
     idle_sids_.back().reserve(opts.num_workers);
+    runnable_sids_.push_back(std::vector<uint32_t>());
+    runnable_sids_.back().reserve(opts.num_workers);
   }
   // We include a sched item for the load generator even though the load
   // generator is scheduled by CFS (Linux Completely Fair Scheduler) rather
@@ -119,17 +121,20 @@ void GhostOrchestrator::Terminate() {
        i < thread_pool().NumThreads(); ++i) {
     thread_pool().MarkExit(i);
   }
+  // We start after the load generators' SIDs since the load generators are not
+  // scheduled by ghOSt and are always runnable.
+  std::vector<uint32_t> worker_sids;
+  for (size_t i = 0; i < options().num_workers; ++i) {
+    worker_sids.push_back(i + options().load_generator_cpus.Size());
+  }
   while (thread_pool().NumExited() < total_threads()) {
     // Makes ghOSt threads runnable so that they can exit.
-    for (size_t i = 0; i < options().num_workers; ++i) {
-      // We start at SID 1 (the first worker) since the load generator (SID 0)
-      // is not scheduled by ghOSt and is always runnable.
-      if (UsesPrioTable()) {
-        prio_table_helper_->MarkRunnable(i +
-                                         options().load_generator_cpus.Size());
-      } else {
-        CHECK(UsesFutex());
-        thread_wait_->MarkRunnable(i + options().load_generator_cpus.Size());
+    if (UsesPrioTable()) {
+      prio_table_helper_->MarkRunnable(worker_sids);
+    } else {
+      CHECK(UsesFutex());
+      for (uint32_t worker_sid : worker_sids) {
+        thread_wait_->MarkRunnable(worker_sid);
       }
     }
   }
@@ -190,6 +195,7 @@ void GhostOrchestrator::LoadGenerator(uint32_t sid) {
   }
 
   GetIdleWorkerSIDs(sid);
+  runnable_sids_[sid].clear();
   uint32_t size = idle_sids_[sid].size();
   for (uint32_t i = 0; i < size; ++i) {
     uint32_t worker_sid = idle_sids_[sid][i];
@@ -207,12 +213,6 @@ void GhostOrchestrator::LoadGenerator(uint32_t sid) {
       continue;
     }
 
-    // We assign a deadline to the worker just in case we want to run the
-    // experiment with the ghOSt EDF (Earliest-Deadline-First) scheduler. The
-    // deadline is not needed and is ignored for the centralized queuing
-    // scheduler, the Shinjuku scheduler, and the Shenango scheduler.
-    constexpr absl::Duration deadline = absl::Microseconds(100);
-
     worker_work()[worker_sid]->requests.clear();
     Request request;
     for (size_t i = 0; i < options().batch; ++i) {
@@ -234,14 +234,9 @@ void GhostOrchestrator::LoadGenerator(uint32_t sid) {
 
       if (UsesPrioTable()) {
         CHECK(prio_table_helper_->IsIdle(worker_sid));
-        ghost::sched_item si;
-        prio_table_helper_->GetSchedItem(worker_sid, si);
-        si.deadline =
-            PrioTableHelper::ToRawDeadline(ghost::MonotonicNow() + deadline);
-        si.flags |= SCHED_ITEM_RUNNABLE;
-        // All other flags were set in 'InitGhost' and do not need to be
-        // changed.
-        prio_table_helper_->SetSchedItem(worker_sid, si);
+        // The worker is marked runnable below along with the other workers
+        // that get work in this round.
+        runnable_sids_[sid].push_back(worker_sid);
       } else {
         CHECK(UsesFutex());
         thread_wait_->MarkRunnable(worker_sid);
@@ -251,6 +246,20 @@ void GhostOrchestrator::LoadGenerator(uint32_t sid) {
       break;
     }
   }
+
+  if (UsesPrioTable() && !runnable_sids_[sid].empty()) {
+    // We assign a deadline to the workers just in case we want to run the
+    // experiment with the ghOSt EDF (Earliest-Deadline-First) scheduler. The
+    // deadline is not needed and is ignored for the centralized queuing
+    // scheduler, the Shinjuku scheduler, and the Shenango scheduler.
+    constexpr absl::Duration deadline = absl::Microseconds(100);
+
+    // Publish all of the workers at once so that the agent picks them up in a
+    // single pass rather than one stream entry at a time. All other flags
+    // were set in 'InitGhost' and do not need to be changed.
+    prio_table_helper_->MarkRunnable(runnable_sids_[sid],
+                                     ghost::MonotonicNow() + deadline);
+  }
 }
 
 void GhostOrchestrator::Worker(uint32_t sid) {
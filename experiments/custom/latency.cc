@@ -225,6 +225,15 @@ void Print(const std::vector<Request>& requests, absl::Duration runtime,
                  request_start, options);
     HANDLE_STAGE("Worker Handle Time", requests, runtime, request_start,
                  request_finished, options);
+    PrintStage(GetStageResults(
+                   requests,
+                   [](const Request& r) -> bool {
+                     return r.request_finished != absl::UnixEpoch();
+                   },
+                   [](const Request& r) -> absl::Duration {
+                     return r.handle_cpu_time;
+                   }),
+               runtime, "Worker CPU Time", options);
   }
   // Total time in system
   HANDLE_STAGE("Total", requests, runtime, request_generated, request_finished,
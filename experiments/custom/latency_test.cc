@@ -61,6 +61,7 @@ TEST(LatencyTest, EmptyResultsPretty) {
 Repeatable Handle Time - - - - - - - -
 Worker Queue Time - - - - - - - -
 Worker Handle Time - - - - - - - -
+Worker CPU Time - - - - - - - -
 Total - - - - - - - -
 )");
 
@@ -81,6 +82,7 @@ TEST(LatencyTest, EmptyResultsCsv) {
 -,-,-,-,-,-,-,-
 -,-,-,-,-,-,-,-
 -,-,-,-,-,-,-,-
+-,-,-,-,-,-,-,-
 )";
 
   EXPECT_THAT(RemoveSpaces(actual.str()), Eq(RemoveSpaces(expected)));
@@ -106,6 +108,7 @@ std::vector<Request> GetData(std::default_random_engine& random_engine) {
     r.request_assigned = now + 3 * absl::Microseconds(i);
     r.request_start = now + 4 * absl::Microseconds(i);
     r.request_finished = now + 5 * absl::Microseconds(i);
+    r.handle_cpu_time = absl::Microseconds(i);
     requests.push_back(r);
   }
   // Randomly shuffle the vector of requests so that we know the latency methods
@@ -130,6 +133,7 @@ TEST(LatencyTest, StandardResultsPretty) {
 Repeatable Handle Time 1000 250 1 500 990 995 999 1000
 Worker Queue Time 1000 250 1 500 990 995 999 1000
 Worker Handle Time 1000 250 1 500 990 995 999 1000
+Worker CPU Time 1000 250 1 500 990 995 999 1000
 Total 1000 250 4 2000 3960 3980 3996 4000
 )");
 
@@ -151,6 +155,7 @@ TEST(LatencyTest, StandardResultsCsv) {
 1000,250,1,500,990,995,999,1000
 1000,250,1,500,990,995,999,1000
 1000,250,1,500,990,995,999,1000
+1000,250,1,500,990,995,999,1000
 1000,250,4,2000,3960,3980,3996,4000
 )";
 
@@ -174,6 +179,7 @@ TEST(LatencyTest, StandardResultsPrettyNs) {
 Repeatable Handle Time 1000 250 1000 500000 990000 995000 999000 1000000
 Worker Queue Time 1000 250 1000 500000 990000 995000 999000 1000000
 Worker Handle Time 1000 250 1000 500000 990000 995000 999000 1000000
+Worker CPU Time 1000 250 1000 500000 990000 995000 999000 1000000
 Total 1000 250 4000 2000000 3960000 3980000 3996000 4000000
 )");
 
@@ -195,6 +201,7 @@ TEST(LatencyTest, StandardResultsCsvNs) {
 1000,250,1000,500000,990000,995000,999000,1000000
 1000,250,1000,500000,990000,995000,999000,1000000
 1000,250,1000,500000,990000,995000,999000,1000000
+1000,250,1000,500000,990000,995000,999000,1000000
 1000,250,4000,2000000,3960000,3980000,3996000,4000000
 )";
 
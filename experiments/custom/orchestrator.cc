@@ -58,10 +58,17 @@ std::ostream& operator<<(std::ostream& os, const Options& options) {
     }
   }
 
-  flags["cfs_wait_type"] =
-      options.cfs_wait_type == ghost_test::ThreadWait::WaitType::kSpin
-          ? "spin"
-          : "futex";
+  switch (options.cfs_wait_type) {
+    case ghost_test::ThreadWait::WaitType::kSpin:
+      flags["cfs_wait_type"] = "spin";
+      break;
+    case ghost_test::ThreadWait::WaitType::kFutex:
+      flags["cfs_wait_type"] = "futex";
+      break;
+    case ghost_test::ThreadWait::WaitType::kAdaptive:
+      flags["cfs_wait_type"] = "adaptive";
+      break;
+  }
   flags["ghost_wait_type"] =
       options.ghost_wait_type == GhostWaitType::kPrioTable ? "prio_table"
                                                            : "futex";
@@ -93,6 +100,7 @@ std::ostream& operator<<(std::ostream& os, const Options& options) {
 Orchestrator::Orchestrator(Options options, size_t total_threads)
     : options_(options),
       total_threads_(total_threads),
+      synthetic_work_(SyntheticWork::Mix::kAlu),
       database_(options_.rocksdb_db_path),
       gen_(total_threads),
       first_run_(total_threads),
@@ -189,10 +197,9 @@ void Orchestrator::HandleGet(Request& request, std::string& response,
   Request::Get& get = std::get<Request::Get>(request.work);
   CHECK(database_.Get(get.entry, response));
 
-  absl::Duration now_duration = GetThreadCpuTime();
-  if (now_duration - start_duration < service_time) {
-    Spin(service_time - (now_duration - start_duration), now_duration);
-  }
+  absl::Duration handle_duration = GetThreadCpuTime() - start_duration;
+  request.handle_cpu_time =
+      handle_duration + Spin(service_time - handle_duration);
 }
 
 void Orchestrator::HandleRange(Request& request, std::string& response,
@@ -205,10 +212,9 @@ void Orchestrator::HandleRange(Request& request, std::string& response,
   Request::Range& range = std::get<Request::Range>(request.work);
   CHECK(database_.RangeQuery(range.start_entry, range.size, response));
 
-  absl::Duration now_duration = GetThreadCpuTime();
-  if (now_duration - start_duration < service_time) {
-    Spin(service_time - (now_duration - start_duration), now_duration);
-  }
+  absl::Duration handle_duration = GetThreadCpuTime() - start_duration;
+  request.handle_cpu_time =
+      handle_duration + Spin(service_time - handle_duration);
 }
 
 void Orchestrator::PrintResultsHelper(
@@ -263,23 +269,16 @@ void Orchestrator::PrintResults(absl::Duration experiment_duration) const {
       }));
 }
 
-void Orchestrator::Spin(absl::Duration duration,
-                        absl::Duration start_duration) const {
+absl::Duration Orchestrator::Spin(absl::Duration duration) const {
   if (duration <= absl::ZeroDuration()) {
-    return;
+    return absl::ZeroDuration();
   }
 
-  // We are using the CPU time consumed by the thread to determine how much
-  // synthetic work has been performed. We are not just looking at wall clock
-  // times, since the thread could be preempted and the clock would still
-  // advance, wrongly causing us to think that the thread has performed
-  // synthetic work while it was preempted. Using the CPU time consumed by the
-  // thread is an accurate way of tracking synthetic work since the CPU time
-  // only advances while the thread is running on a CPU, not while the thread is
-  // preempted.
-  while (GetThreadCpuTime() - start_duration < duration) {
-    // We are doing synthetic work, so do not issue 'pause' instructions.
-  }
+  // We do a calibrated number of iterations rather than loop until the CPU time
+  // consumed by the thread has advanced by 'duration'. Reading the CPU time is
+  // a system call, so polling it would make the work depend on what the clock
+  // costs to read and how often the loop gets to check it.
+  return synthetic_work_.RunFor(duration);
 }
 
 }  // namespace ghost_test
@@ -0,0 +1,158 @@
+// Copyright 2022 Google LLC
+//
+// Use of this source code is governed by a BSD-style
+// license that can be found in the LICENSE file or at
+// https://developers.google.com/open-source/licenses/bsd
+
+// Measures the `CpuList` operations that global schedulers run in their
+// scheduling loops: iteration, `GetNthCpu()`, `Front()`/`Clear()` loops, and
+// set algebra. Iteration through a `const CpuMap&` is the baseline, since it
+// goes through the virtual `GetNthMap()` for each word.
+//
+// Benchmark argument: the number of CPUs in the topology.
+
+#include <random>
+#include <vector>
+
+#include "benchmark/benchmark.h"
+#include "lib/topology.h"
+
+namespace ghost {
+namespace {
+
+// Makes a custom topology with `num_cpus` CPUs, 2 hardware threads per core
+// and 2 NUMA nodes, numbered the way Linux numbers them.
+const Topology& MakeTopology(int num_cpus) {
+  const int num_cores = num_cpus / 2;
+  std::vector<Cpu::Raw> raw_cpus;
+  for (int i = 0; i < num_cpus; i++) {
+    Cpu::Raw raw_cpu;
+    raw_cpu.cpu = i;
+    raw_cpu.core = i % num_cores;
+    raw_cpu.smt_idx = i / num_cores;
+    raw_cpu.siblings = {raw_cpu.core, raw_cpu.core + num_cores};
+    raw_cpu.numa_node = raw_cpu.core / (num_cores / 2);
+    for (int j = 0; j < num_cpus; j++) {
+      if ((j % num_cores) / (num_cores / 2) == raw_cpu.numa_node) {
+        raw_cpu.l3_siblings.push_back(j);
+      }
+    }
+    raw_cpus.push_back(raw_cpu);
+  }
+  UpdateCustomTopology(raw_cpus);
+  return *CustomTopology();
+}
+
+// Returns a list with each CPU in `topology` set with probability `density`.
+CpuList RandomCpuList(const Topology& topology, double density, int seed) {
+  std::mt19937 rng(seed);
+  std::bernoulli_distribution set(density);
+  CpuList list = topology.EmptyCpuList();
+  for (int i = 0; i < topology.num_cpus(); i++) {
+    if (set(rng)) {
+      list.Set(i);
+    }
+  }
+  return list;
+}
+
+void BM_CpuList_Iterate(benchmark::State& state) {
+  const Topology& topology = MakeTopology(state.range(0));
+  const CpuList list = RandomCpuList(topology, /*density=*/0.5, /*seed=*/0);
+  for (auto _ : state) {
+    for (const Cpu& cpu : list) {
+      benchmark::DoNotOptimize(cpu.id());
+    }
+  }
+  state.SetItemsProcessed(state.iterations() * list.Size());
+}
+
+void BM_CpuMap_Iterate(benchmark::State& state) {
+  const Topology& topology = MakeTopology(state.range(0));
+  const CpuList list = RandomCpuList(topology, /*density=*/0.5, /*seed=*/0);
+  const CpuMap& map = list;
+  for (auto _ : state) {
+    for (const Cpu& cpu : map) {
+      benchmark::DoNotOptimize(cpu.id());
+    }
+  }
+  state.SetItemsProcessed(state.iterations() * list.Size());
+}
+
+void BM_CpuList_Size(benchmark::State& state) {
+  const Topology& topology = MakeTopology(state.range(0));
+  const CpuList list = RandomCpuList(topology, /*density=*/0.5, /*seed=*/0);
+  for (auto _ : state) {
+    benchmark::DoNotOptimize(list.Size());
+    benchmark::DoNotOptimize(list.Empty());
+  }
+}
+
+void BM_CpuList_GetNthCpu(benchmark::State& state) {
+  const Topology& topology = MakeTopology(state.range(0));
+  const CpuList list = RandomCpuList(topology, /*density=*/0.5, /*seed=*/0);
+  std::mt19937 rng(1);
+  std::uniform_int_distribution<uint32_t> dist(0, list.Size() - 1);
+  std::vector<uint32_t> n(1024);
+  for (uint32_t& i : n) {
+    i = dist(rng);
+  }
+
+  size_t i = 0;
+  for (auto _ : state) {
+    benchmark::DoNotOptimize(list.GetNthCpu(n[i++ & (n.size() - 1)]).id());
+  }
+}
+
+// Takes CPUs off the front of the list until it is empty, as schedulers do
+// with their list of available CPUs.
+void BM_CpuList_FrontClear(benchmark::State& state) {
+  const Topology& topology = MakeTopology(state.range(0));
+  const CpuList list = RandomCpuList(topology, /*density=*/0.5, /*seed=*/0);
+  for (auto _ : state) {
+    CpuList available = list;
+    while (!available.Empty()) {
+      const Cpu cpu = available.Front();
+      benchmark::DoNotOptimize(cpu.id());
+      available.Clear(cpu);
+    }
+  }
+  state.SetItemsProcessed(state.iterations() * list.Size());
+}
+
+void BM_CpuList_SetAlgebra(benchmark::State& state) {
+  const Topology& topology = MakeTopology(state.range(0));
+  const CpuList a = RandomCpuList(topology, /*density=*/0.5, /*seed=*/0);
+  const CpuList b = RandomCpuList(topology, /*density=*/0.5, /*seed=*/1);
+  const CpuList c = RandomCpuList(topology, /*density=*/0.25, /*seed=*/2);
+  for (auto _ : state) {
+    CpuList result = a;
+    result.Union(b);
+    result.Intersection(c);
+    result.Subtract(a);
+    benchmark::DoNotOptimize(result);
+  }
+  state.SetItemsProcessed(state.iterations() * 3);
+}
+
+// `MAX_CPUS` is 512, so that is the largest topology.
+void Args(benchmark::internal::Benchmark* b) {
+  for (int num_cpus : {64, 256, MAX_CPUS}) {
+    b->Arg(num_cpus);
+  }
+}
+
+BENCHMARK(BM_CpuList_Iterate)->Apply(Args);
+BENCHMARK(BM_CpuMap_Iterate)->Apply(Args);
+BENCHMARK(BM_CpuList_Size)->Apply(Args);
+BENCHMARK(BM_CpuList_GetNthCpu)->Apply(Args);
+BENCHMARK(BM_CpuList_FrontClear)->Apply(Args);
+BENCHMARK(BM_CpuList_SetAlgebra)->Apply(Args);
+
+}  // namespace
+}  // namespace ghost
+
+int main(int argc, char** argv) {
+  ::benchmark::Initialize(&argc, argv);
+  ::benchmark::RunSpecifiedBenchmarks();
+}
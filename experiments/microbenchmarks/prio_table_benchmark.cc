@@ -0,0 +1,115 @@
+// Copyright 2022 Google LLC
+//
+// Use of this source code is governed by a BSD-style
+// license that can be found in the LICENSE file or at
+// https://developers.google.com/open-source/licenses/bsd
+
+// Measures how many sched item updates per second an application can hand to
+// an agent through a PrioTable, one stream entry per update versus a
+// `PrioTable::UpdateBatch`. Each benchmark iteration does what a load
+// generator does when it hands work to a set of idle workers (writes their
+// sched items under the seqcount and marks them as updated) and then what the
+// agent does to pick the updates up.
+//
+// Benchmark argument: the number of sched items updated together.
+
+#include <algorithm>
+#include <random>
+#include <vector>
+
+#include "benchmark/benchmark.h"
+#include "shared/prio_table.h"
+
+namespace ghost {
+namespace {
+
+constexpr uint32_t kNumSchedItems = 512;
+constexpr int kNumUpdatedIndexRetries = 3;
+
+// Returns `n` distinct sched item indices in ascending order, as a load
+// generator finds idle workers.
+std::vector<int> RandomIndices(int n) {
+  std::vector<int> indices(kNumSchedItems);
+  for (int i = 0; i < kNumSchedItems; i++) {
+    indices[i] = i;
+  }
+  std::shuffle(indices.begin(), indices.end(), std::mt19937(0));
+  indices.resize(n);
+  std::sort(indices.begin(), indices.end());
+  return indices;
+}
+
+void MarkRunnable(PrioTable& table, int idx) {
+  struct sched_item* si = table.sched_item(idx);
+  uint32_t begin = si->seqcount.write_begin();
+  si->flags |= SCHED_ITEM_RUNNABLE;
+  si->seqcount.write_end(begin);
+}
+
+void BM_PrioTable_MarkUpdatedIndex(benchmark::State& state) {
+  PrioTable table(kNumSchedItems, /*num_classes=*/1,
+                  PrioTable::StreamCapacity::kStreamCapacity83);
+  const std::vector<int> indices = RandomIndices(state.range(0));
+  int64_t overflows = 0;
+
+  for (auto _ : state) {
+    for (int idx : indices) {
+      MarkRunnable(table, idx);
+      table.MarkUpdatedIndex(idx, kNumUpdatedIndexRetries);
+    }
+    // The agent side, one index at a time.
+    for (uint32_t i = 0; i < table.hdr()->st_cap; i++) {
+      const int idx = table.NextUpdatedIndex();
+      if (idx == PrioTable::kStreamNoEntries) {
+        break;
+      }
+      if (idx == PrioTable::kStreamOverflow) {
+        // The agent would scan every sched item now.
+        overflows++;
+        break;
+      }
+      benchmark::DoNotOptimize(idx);
+    }
+  }
+  state.SetItemsProcessed(state.iterations() * indices.size());
+  state.counters["overflows"] = overflows;
+}
+
+void BM_PrioTable_UpdateBatch(benchmark::State& state) {
+  PrioTable table(kNumSchedItems, /*num_classes=*/1,
+                  PrioTable::StreamCapacity::kStreamCapacity83);
+  const std::vector<int> indices = RandomIndices(state.range(0));
+  PrioTable::UpdateBatch batch(table);
+  int64_t overflows = 0;
+
+  for (auto _ : state) {
+    for (int idx : indices) {
+      MarkRunnable(table, idx);
+      batch.Add(idx);
+    }
+    batch.Publish();
+    if (!table.DrainUpdatedIndices(
+            [](int idx) { benchmark::DoNotOptimize(idx); })) {
+      overflows++;
+    }
+  }
+  state.SetItemsProcessed(state.iterations() * indices.size());
+  state.counters["overflows"] = overflows;
+}
+
+void Args(benchmark::internal::Benchmark* b) {
+  for (int batch_size : {1, 4, 16, 64, 256}) {
+    b->Arg(batch_size);
+  }
+}
+
+BENCHMARK(BM_PrioTable_MarkUpdatedIndex)->Apply(Args);
+BENCHMARK(BM_PrioTable_UpdateBatch)->Apply(Args);
+
+}  // namespace
+}  // namespace ghost
+
+int main(int argc, char** argv) {
+  ::benchmark::Initialize(&argc, argv);
+  ::benchmark::RunSpecifiedBenchmarks();
+}
@@ -0,0 +1,133 @@
+// Copyright 2021 Google LLC
+//
+// Use of this source code is governed by a BSD-style
+// license that can be found in the LICENSE file or at
+// https://developers.google.com/open-source/licenses/bsd
+
+// Measures RPC round trips between a client and a server thread, with payloads
+// the size of `AgentProcess` RPCs.
+//
+// `BM_Notification` is the protocol `AgentProcess` used before `RpcRing`: the
+// client posts the request and notifies the server, which posts the response
+// and notifies back. `BM_RpcRing` does one synchronous RPC at a time on the
+// ring, and `BM_RpcRingPipelined` keeps the ring full.
+
+#include <memory>
+#include <thread>
+
+#include "benchmark/benchmark.h"
+#include "lib/base.h"
+#include "lib/rpc_ring.h"
+
+namespace ghost {
+namespace {
+
+// The size of `AgentRpcArgs` and `AgentRpcResponse`.
+struct Payload {
+  int64_t code;
+  char buffer[16384];
+};
+
+constexpr uint32_t kSlots = 8;
+using BenchRing = RpcRing<Payload, Payload, kSlots>;
+
+void BM_Notification(benchmark::State& state) {
+  struct {
+    Payload req, resp;
+    Notification pending, done;
+    bool stop = false;
+  } channel;
+
+  std::thread server([&channel]() {
+    for (;;) {
+      channel.pending.WaitForNotification();
+      channel.pending.Reset();
+      if (channel.stop) {
+        return;
+      }
+      channel.resp = Payload();
+      channel.resp.code = channel.req.code;
+      channel.done.Notify();
+    }
+  });
+
+  Payload req = {};
+  for (auto _ : state) {
+    channel.req = req;
+    channel.pending.Notify();
+    channel.done.WaitForNotification();
+    channel.done.Reset();
+    benchmark::DoNotOptimize(channel.resp.code);
+  }
+
+  channel.stop = true;
+  channel.pending.Notify();
+  server.join();
+}
+
+// Runs a server thread that echoes request codes. A negative code stops it.
+std::thread StartServer(BenchRing& ring) {
+  return std::thread([&ring]() {
+    bool stop = false;
+    while (!stop) {
+      ring.WaitForRequest();
+      ring.ServeOne([&stop](const Payload& req, Payload& resp) {
+        stop = req.code < 0;
+        resp.code = req.code;
+      });
+    }
+  });
+}
+
+void StopServer(BenchRing& ring, std::thread& server) {
+  Payload req = {};
+  req.code = -1;
+  ring.Complete(ring.Submit(req), [](const Payload&) { return 0; });
+  server.join();
+}
+
+void BM_RpcRing(benchmark::State& state) {
+  auto ring = std::make_unique<BenchRing>();
+  std::thread server = StartServer(*ring);
+
+  Payload req = {};
+  for (auto _ : state) {
+    BenchRing::Ticket t = ring->Submit(req);
+    benchmark::DoNotOptimize(
+        ring->Complete(t, [](const Payload& resp) { return resp.code; }));
+  }
+
+  StopServer(*ring, server);
+}
+
+void BM_RpcRingPipelined(benchmark::State& state) {
+  auto ring = std::make_unique<BenchRing>();
+  std::thread server = StartServer(*ring);
+
+  Payload req = {};
+  BenchRing::Ticket tickets[kSlots];
+  for (auto _ : state) {
+    for (uint32_t i = 0; i < kSlots; ++i) {
+      tickets[i] = ring->Submit(req);
+    }
+    for (uint32_t i = 0; i < kSlots; ++i) {
+      benchmark::DoNotOptimize(ring->Complete(
+          tickets[i], [](const Payload& resp) { return resp.code; }));
+    }
+  }
+  state.SetItemsProcessed(state.iterations() * kSlots);
+
+  StopServer(*ring, server);
+}
+
+BENCHMARK(BM_Notification)->UseRealTime();
+BENCHMARK(BM_RpcRing)->UseRealTime();
+BENCHMARK(BM_RpcRingPipelined)->UseRealTime();
+
+}  // namespace
+}  // namespace ghost
+
+int main(int argc, char** argv) {
+  ::benchmark::Initialize(&argc, argv);
+  ::benchmark::RunSpecifiedBenchmarks();
+}
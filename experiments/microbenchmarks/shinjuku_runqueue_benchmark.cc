@@ -0,0 +1,165 @@
+// Copyright 2021 Google LLC
+//
+// Use of this source code is governed by a BSD-style
+// license that can be found in the LICENSE file or at
+// https://developers.google.com/open-source/licenses/bsd
+
+// Compares the Shinjuku `QosRunqueue` against the `std::map` of `std::deque`s
+// that it replaced, under a mixed-QoS enqueue/dequeue load.
+//
+// Benchmark arguments: {number of QoS levels in use, number of queued tasks}.
+
+#include <deque>
+#include <map>
+#include <random>
+#include <vector>
+
+#include "benchmark/benchmark.h"
+#include "schedulers/shinjuku/shinjuku_runqueue.h"
+
+namespace ghost {
+namespace {
+
+struct FakeTask {
+  uint32_t qos = 0;
+  IntrusiveFifoHook<FakeTask> hook;
+};
+
+std::vector<FakeTask> MakeTasks(int num_tasks, int num_qos) {
+  std::vector<FakeTask> tasks(num_tasks);
+  std::mt19937 rng(0);
+  std::uniform_int_distribution<uint32_t> dist(0, num_qos - 1);
+  for (FakeTask& t : tasks) {
+    t.qos = dist(rng);
+  }
+  return tasks;
+}
+
+// The previous Shinjuku runqueue, kept here as the baseline.
+class MapDequeRunqueue {
+ public:
+  void Enqueue(FakeTask* t, bool back) {
+    if (back) {
+      rq_[t->qos].push_back(t);
+    } else {
+      rq_[t->qos].push_front(t);
+    }
+  }
+
+  FakeTask* Dequeue() {
+    for (auto it = rq_.rbegin(); it != rq_.rend(); it++) {
+      if (!it->second.empty()) {
+        FakeTask* t = it->second.front();
+        it->second.pop_front();
+        return t;
+      }
+    }
+    return nullptr;
+  }
+
+  void Remove(FakeTask* t) {
+    for (auto& [qos, rq] : rq_) {
+      for (int pos = rq.size() - 1; pos >= 0; pos--) {
+        if (rq[pos] == t) {
+          rq.erase(rq.cbegin() + pos);
+          return;
+        }
+      }
+    }
+  }
+
+ private:
+  std::map<uint32_t, std::deque<FakeTask*>> rq_;
+};
+
+using Runqueue = QosRunqueue<FakeTask, &FakeTask::hook>;
+
+// Steady state: the runqueue holds `num_tasks` tasks; each iteration dequeues
+// the highest-priority task and re-enqueues it (at the front one time in
+// eight, as for a prio-boosted task).
+template <class RQ>
+void EnqueueDequeue(benchmark::State& state, RQ& rq) {
+  std::vector<FakeTask> tasks = MakeTasks(state.range(1), state.range(0));
+  for (FakeTask& t : tasks) {
+    rq.Enqueue(&t, /*back=*/true);
+  }
+
+  uint64_t i = 0;
+  for (auto _ : state) {
+    FakeTask* t = rq.Dequeue();
+    benchmark::DoNotOptimize(t);
+    rq.Enqueue(t, /*back=*/(++i & 7) != 0);
+  }
+  state.SetItemsProcessed(state.iterations() * 2);
+}
+
+// Each iteration removes a random queued task (as when a task blocks or its
+// sched item loses its work) and enqueues it again.
+template <class RQ>
+void RemoveEnqueue(benchmark::State& state, RQ& rq) {
+  std::vector<FakeTask> tasks = MakeTasks(state.range(1), state.range(0));
+  for (FakeTask& t : tasks) {
+    rq.Enqueue(&t, /*back=*/true);
+  }
+
+  std::mt19937 rng(1);
+  std::uniform_int_distribution<size_t> dist(0, tasks.size() - 1);
+  for (auto _ : state) {
+    FakeTask* t = &tasks[dist(rng)];
+    rq.Remove(t);
+    rq.Enqueue(t, /*back=*/true);
+  }
+  state.SetItemsProcessed(state.iterations() * 2);
+}
+
+// Adapts `QosRunqueue` to the interface above.
+class QosRunqueueAdapter {
+ public:
+  void Enqueue(FakeTask* t, bool back) { rq_.Enqueue(t, t->qos, back); }
+  FakeTask* Dequeue() { return rq_.Dequeue(); }
+  void Remove(FakeTask* t) { rq_.Remove(t); }
+
+ private:
+  Runqueue rq_;
+};
+
+void BM_QosRunqueue_EnqueueDequeue(benchmark::State& state) {
+  QosRunqueueAdapter rq;
+  EnqueueDequeue(state, rq);
+}
+
+void BM_MapDeque_EnqueueDequeue(benchmark::State& state) {
+  MapDequeRunqueue rq;
+  EnqueueDequeue(state, rq);
+}
+
+void BM_QosRunqueue_RemoveEnqueue(benchmark::State& state) {
+  QosRunqueueAdapter rq;
+  RemoveEnqueue(state, rq);
+}
+
+void BM_MapDeque_RemoveEnqueue(benchmark::State& state) {
+  MapDequeRunqueue rq;
+  RemoveEnqueue(state, rq);
+}
+
+void Args(benchmark::internal::Benchmark* b) {
+  for (int num_qos : {1, 4, 16, 64}) {
+    for (int num_tasks : {16, 256, 4096}) {
+      b->Args({num_qos, num_tasks});
+    }
+  }
+}
+
+BENCHMARK(BM_QosRunqueue_EnqueueDequeue)->Apply(Args);
+BENCHMARK(BM_MapDeque_EnqueueDequeue)->Apply(Args);
+BENCHMARK(BM_QosRunqueue_RemoveEnqueue)->Apply(Args);
+BENCHMARK(BM_MapDeque_RemoveEnqueue)->Apply(Args);
+
+}  // namespace
+}  // namespace ghost
+
+int main(int argc, char** argv) {
+  ::benchmark::Initialize(&argc, argv);
+  ::benchmark::RunSpecifiedBenchmarks();
+}
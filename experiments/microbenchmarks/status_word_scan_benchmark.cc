@@ -0,0 +1,128 @@
+// Copyright 2021 Google LLC
+//
+// Use of this source code is governed by a BSD-style
+// license that can be found in the LICENSE file or at
+// https://developers.google.com/open-source/licenses/bsd
+
+// Measures the status word table scan that task discovery does when an agent
+// starts (e.g., during an upgrade), on a synthetic table in ordinary memory.
+//
+// `BM_Scan*` only scan the table. `BM_Discover*` also make one cheap syscall
+// per task, standing in for the `AssociateTask` ioctl that discovery issues for
+// every task it finds, to show the effect of scanning with several workers.
+//
+// Benchmark arguments: {number of tasks, number of workers}.
+
+#include <sys/syscall.h>
+#include <unistd.h>
+
+#include <functional>
+#include <memory>
+#include <random>
+
+#include "benchmark/benchmark.h"
+#include "lib/ghost.h"
+#include "tests/synthetic_status_word_table.h"
+
+namespace ghost {
+namespace {
+
+// Large enough for 50k tasks, matching the largest hosts we care about.
+constexpr uint32_t kCapacity = 65536;
+
+// Makes a table with `num_tasks` randomly chosen status words in use by tasks.
+std::unique_ptr<SyntheticStatusWordTable> MakeTable(uint32_t num_tasks) {
+  auto table = std::make_unique<SyntheticStatusWordTable>(kCapacity);
+  std::mt19937 rng(0);
+  uint32_t remaining = num_tasks;
+  for (uint32_t i = 0; i < kCapacity; ++i) {
+    // Selection sampling: picks exactly `num_tasks` words.
+    if (rng() % (kCapacity - i) < remaining) {
+      table->word(i).flags = GHOST_SW_F_INUSE;
+      table->word(i).gtid = i;
+      --remaining;
+    }
+  }
+  return table;
+}
+
+// The scan that discovery used to do: a bounds-checked `get` and a check of the
+// flags for every status word, with a `std::function` callback.
+void ForEachTaskStatusWordBaseline(
+    StatusWordTable& table,
+    const std::function<void(ghost_status_word* sw, uint32_t region_id,
+                             uint32_t idx)>
+        l) {
+  for (int i = 0; i < table.capacity(); ++i) {
+    ghost_status_word* sw = table.get(i);
+    if (!(sw->flags & GHOST_SW_F_INUSE)) {
+      continue;
+    }
+    if (sw->flags & GHOST_SW_TASK_IS_AGENT) {
+      continue;
+    }
+    l(sw, table.id(), i);
+  }
+}
+
+void AssociateStandIn() { syscall(SYS_getppid); }
+
+void BM_ScanBaseline(benchmark::State& state) {
+  std::unique_ptr<SyntheticStatusWordTable> table = MakeTable(state.range(0));
+  for (auto _ : state) {
+    uint64_t sum = 0;
+    ForEachTaskStatusWordBaseline(
+        *table, [&sum](ghost_status_word* sw, uint32_t, uint32_t) {
+          sum += sw->gtid;
+        });
+    benchmark::DoNotOptimize(sum);
+  }
+  state.SetItemsProcessed(state.iterations() * state.range(0));
+}
+
+void BM_Scan(benchmark::State& state) {
+  std::unique_ptr<SyntheticStatusWordTable> table = MakeTable(state.range(0));
+  for (auto _ : state) {
+    uint64_t sum = 0;
+    table->ForEachTaskStatusWord(
+        [&sum](ghost_status_word* sw, uint32_t, uint32_t) { sum += sw->gtid; });
+    benchmark::DoNotOptimize(sum);
+  }
+  state.SetItemsProcessed(state.iterations() * state.range(0));
+}
+
+void BM_DiscoverBaseline(benchmark::State& state) {
+  std::unique_ptr<SyntheticStatusWordTable> table = MakeTable(state.range(0));
+  for (auto _ : state) {
+    ForEachTaskStatusWordBaseline(
+        *table,
+        [](ghost_status_word*, uint32_t, uint32_t) { AssociateStandIn(); });
+  }
+  state.SetItemsProcessed(state.iterations() * state.range(0));
+}
+
+void BM_Discover(benchmark::State& state) {
+  std::unique_ptr<SyntheticStatusWordTable> table = MakeTable(state.range(0));
+  for (auto _ : state) {
+    table->ForEachTaskStatusWordParallel(
+        state.range(1), [](int, ghost_status_word*, uint32_t, uint32_t) {
+          AssociateStandIn();
+        });
+  }
+  state.SetItemsProcessed(state.iterations() * state.range(0));
+}
+
+BENCHMARK(BM_ScanBaseline)->Arg(10000)->Arg(50000);
+BENCHMARK(BM_Scan)->Arg(10000)->Arg(50000);
+BENCHMARK(BM_DiscoverBaseline)->Arg(10000)->Arg(50000)->UseRealTime();
+BENCHMARK(BM_Discover)
+    ->ArgsProduct({{10000, 50000}, {1, 2, 4, 8}})
+    ->UseRealTime();
+
+}  // namespace
+}  // namespace ghost
+
+int main(int argc, char** argv) {
+  ::benchmark::Initialize(&argc, argv);
+  ::benchmark::RunSpecifiedBenchmarks();
+}
@@ -0,0 +1,88 @@
+// Copyright 2022 Google LLC
+//
+// Use of this source code is governed by a BSD-style
+// license that can be found in the LICENSE file or at
+// https://developers.google.com/open-source/licenses/bsd
+
+// Measures the per-call cost of the clocks the agents read on their hot paths:
+// `TscClock::Now()` against `MonotonicNow()` (clock_gettime through the vDSO
+// plus a conversion to absl::Time), the bare vDSO call, and `absl::Now()`.
+//
+// `BM_*SliceCheck` is the per-cpu time slice check in the global schedulers'
+// loops, before and after they kept ticks.
+
+#include <time.h>
+
+#include "absl/time/clock.h"
+#include "benchmark/benchmark.h"
+#include "lib/base.h"
+#include "lib/tsc_clock.h"
+
+namespace ghost {
+namespace {
+
+void BM_TscClockNow(benchmark::State& state) {
+  for (auto _ : state) {
+    benchmark::DoNotOptimize(TscClock::Now());
+  }
+}
+
+void BM_MonotonicNow(benchmark::State& state) {
+  for (auto _ : state) {
+    benchmark::DoNotOptimize(MonotonicNow());
+  }
+}
+
+void BM_ClockGettime(benchmark::State& state) {
+  timespec ts;
+  for (auto _ : state) {
+    clock_gettime(CLOCK_MONOTONIC, &ts);
+    benchmark::DoNotOptimize(ts);
+  }
+}
+
+void BM_AbslNow(benchmark::State& state) {
+  for (auto _ : state) {
+    benchmark::DoNotOptimize(absl::Now());
+  }
+}
+
+void BM_MonotonicSliceCheck(benchmark::State& state) {
+  const absl::Duration slice = absl::Microseconds(50);
+  const absl::Time last_commit = MonotonicNow();
+  for (auto _ : state) {
+    benchmark::DoNotOptimize((MonotonicNow() - last_commit) < slice);
+  }
+}
+
+void BM_TscSliceCheck(benchmark::State& state) {
+  const uint64_t slice = TscClock::FromDuration(absl::Microseconds(50));
+  const uint64_t last_commit = TscClock::Now();
+  for (auto _ : state) {
+    benchmark::DoNotOptimize((TscClock::Now() - last_commit) < slice);
+  }
+}
+
+void BM_SpinFor(benchmark::State& state) {
+  for (auto _ : state) {
+    SpinFor(absl::Microseconds(state.range(0)));
+  }
+}
+
+BENCHMARK(BM_TscClockNow);
+BENCHMARK(BM_MonotonicNow);
+BENCHMARK(BM_ClockGettime);
+BENCHMARK(BM_AbslNow);
+BENCHMARK(BM_MonotonicSliceCheck);
+BENCHMARK(BM_TscSliceCheck);
+BENCHMARK(BM_SpinFor)->Arg(1)->Arg(10)->Arg(100);
+
+}  // namespace
+}  // namespace ghost
+
+int main(int argc, char** argv) {
+  // Calibrate outside of the measurements.
+  ghost::TscClock::Now();
+  ::benchmark::Initialize(&argc, argv);
+  ::benchmark::RunSpecifiedBenchmarks();
+}
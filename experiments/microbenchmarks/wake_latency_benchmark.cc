@@ -0,0 +1,115 @@
+// Copyright 2022 Google LLC
+//
+// Use of this source code is governed by a BSD-style
+// license that can be found in the LICENSE file or at
+// https://developers.google.com/open-source/licenses/bsd
+
+// Measures handoff round trips between two threads that wait on each other the
+// way `ThreadTrigger` and the experiments' workers do, for three kinds of
+// waits:
+//
+// `BM_Futex`: a `Notification` that never spins, so every wait that isn't
+// already notified sleeps on the futex.
+// `BM_Spin`: an atomic flag that waiters spin on with `Pause()`.
+// `BM_Adaptive`: a `SpinningNotification`, which spins for an `AdaptiveSpin`
+// budget before it sleeps.
+//
+// The argument is how many microseconds the peer takes to respond, so each
+// round trip takes at least that long. With no delay, the futex round trips
+// show the cost of sleeping and waking up; with a long one, spinning burns
+// the waiting cpu for all of it. `parks_per_wait` counts how many of the
+// benchmark thread's waits slept.
+
+#include <atomic>
+#include <thread>
+
+#include "benchmark/benchmark.h"
+#include "lib/base.h"
+
+namespace ghost {
+namespace {
+
+// Has the interface of `Notification` that the benchmark uses, but only spins.
+class SpinOnlyNotification {
+ public:
+  void Notify() { notified_.store(true, std::memory_order_release); }
+  void WaitForNotification() {
+    while (!notified_.load(std::memory_order_acquire)) {
+      Pause();
+    }
+  }
+  void Reset() { notified_.store(false, std::memory_order_relaxed); }
+
+ private:
+  std::atomic<bool> notified_{false};
+};
+
+// Bounces between the benchmark thread and a peer thread that responds after
+// `state.range(0)` microseconds. Each side resets its own notification before
+// it responds, so neither is reset while the other side may notify it.
+template <class N>
+void RoundTrips(benchmark::State& state, N& ping, N& pong) {
+  const absl::Duration delay = absl::Microseconds(state.range(0));
+  std::atomic<bool> stop = false;
+
+  std::thread peer([&ping, &pong, &stop, delay]() {
+    for (;;) {
+      ping.WaitForNotification();
+      ping.Reset();
+      if (stop.load(std::memory_order_relaxed)) {
+        return;
+      }
+      if (delay > absl::ZeroDuration()) {
+        SpinFor(delay);
+      }
+      pong.Notify();
+    }
+  });
+
+  for (auto _ : state) {
+    ping.Notify();
+    pong.WaitForNotification();
+    pong.Reset();
+  }
+
+  stop.store(true, std::memory_order_relaxed);
+  ping.Notify();
+  peer.join();
+}
+
+void SetSpinCounters(benchmark::State& state, const Notification& pong) {
+  AdaptiveSpin::Stats stats = pong.spin_stats();
+  state.counters["parks_per_wait"] =
+      stats.waits ? static_cast<double>(stats.parks) / stats.waits : 0.0;
+}
+
+void BM_Futex(benchmark::State& state) {
+  Notification ping, pong;
+  RoundTrips(state, ping, pong);
+  SetSpinCounters(state, pong);
+}
+
+void BM_Spin(benchmark::State& state) {
+  SpinOnlyNotification ping, pong;
+  RoundTrips(state, ping, pong);
+}
+
+void BM_Adaptive(benchmark::State& state) {
+  SpinningNotification ping, pong;
+  RoundTrips(state, ping, pong);
+  SetSpinCounters(state, pong);
+}
+
+BENCHMARK(BM_Futex)->Arg(0)->Arg(5)->Arg(50)->UseRealTime();
+BENCHMARK(BM_Spin)->Arg(0)->Arg(5)->Arg(50)->UseRealTime();
+BENCHMARK(BM_Adaptive)->Arg(0)->Arg(5)->Arg(50)->UseRealTime();
+
+}  // namespace
+}  // namespace ghost
+
+int main(int argc, char** argv) {
+  // Calibrate outside of the measurements.
+  ghost::TscClock::Now();
+  ::benchmark::Initialize(&argc, argv);
+  ::benchmark::RunSpecifiedBenchmarks();
+}
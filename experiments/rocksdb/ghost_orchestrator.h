@@ -105,6 +105,11 @@ class GhostOrchestrator final : public Orchestrator {
   // repeatedly allocating memory for the list backing in the load generators'
   // common case, which is expensive.
   std::vector<std::vector<uint32_t>> idle_sids_;
+
+  // The load generators use this to collect the SIDs of the workers that they
+  // hand work to in a round, which they then mark runnable in the PrioTable
+  // together. This is a class member for the same reason as 'idle_sids_'.
+  std::vector<std::vector<uint32_t>> runnable_sids_;
 };
 
 }  // namespace ghost_test
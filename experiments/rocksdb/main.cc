@@ -55,7 +55,8 @@ ABSL_FLAG(std::string, worker_cpus, "12-17",
           "used. (default: 12-17).");
 ABSL_FLAG(std::string, cfs_wait_type, "spin",
           "For CFS experiments, the way that worker threads wait until they "
-          "are assigned more work by the dispatcher (\"spin\" or \"futex\", "
+          "are assigned more work by the dispatcher (\"spin\", \"futex\", or "
+          "\"adaptive\", which spins for a while and then sleeps on a futex, "
           "default: \"spin\").");
 ABSL_FLAG(std::string, ghost_wait_type, "prio_table",
           "For ghOSt experiments, the way that worker threads interact with "
@@ -119,10 +120,15 @@ ghost_test::Options GetOptions() {
       ghost::MachineTopology()->ParseCpuStr(absl::GetFlag(FLAGS_worker_cpus));
 
   std::string cfs_wait_type = absl::GetFlag(FLAGS_cfs_wait_type);
-  CHECK(cfs_wait_type == "spin" || cfs_wait_type == "futex");
-  options.cfs_wait_type = (cfs_wait_type == "spin")
-                              ? ghost_test::ThreadWait::WaitType::kSpin
-                              : ghost_test::ThreadWait::WaitType::kFutex;
+  CHECK(cfs_wait_type == "spin" || cfs_wait_type == "futex" ||
+        cfs_wait_type == "adaptive");
+  if (cfs_wait_type == "spin") {
+    options.cfs_wait_type = ghost_test::ThreadWait::WaitType::kSpin;
+  } else if (cfs_wait_type == "futex") {
+    options.cfs_wait_type = ghost_test::ThreadWait::WaitType::kFutex;
+  } else {
+    options.cfs_wait_type = ghost_test::ThreadWait::WaitType::kAdaptive;
+  }
 
   std::string ghost_wait_type = absl::GetFlag(FLAGS_ghost_wait_type);
   CHECK(ghost_wait_type == "prio_table" || ghost_wait_type == "futex");
@@ -13,6 +13,7 @@
 #include "experiments/rocksdb/ingress.h"
 #include "experiments/rocksdb/latency.h"
 #include "experiments/rocksdb/request.h"
+#include "experiments/shared/synthetic_work.h"
 #include "experiments/shared/thread_pool.h"
 #include "experiments/shared/thread_wait.h"
 
@@ -196,7 +197,7 @@ class Orchestrator {
   // Handles 'request' which is either a Get request or a Range query. 'gen' is
   // a random bit generator used for Get requests that have an exponential
   // service time. 'gen' is used to generate a sample from the exponential
-  // distribution.
+  // distribution. Fills in 'request.handle_cpu_time'.
   void HandleRequest(Request& request, std::string& response,
                      absl::BitGen& gen);
 
@@ -258,11 +259,10 @@ class Orchestrator {
   // after the discard and should be included in the results.
   bool ShouldDiscard(const Request& request) const;
 
-  // Spins for 'duration'. 'start_duration' is the CPU time consumed by the
-  // thread when calling this method. There is overhead to calling this method,
-  // such as creating the stack frame, so passing 'start_duration' allows the
-  // method to count this overhead toward its synthetic work.
-  void Spin(absl::Duration duration, absl::Duration start_duration) const;
+  // Does 'duration' of synthetic work, measured in CPU time consumed by the
+  // calling thread. Returns the CPU time that the work actually took, which is
+  // zero if 'duration' is not positive.
+  absl::Duration Spin(absl::Duration duration) const;
 
   // Orchestrator options.
   const Options options_;
@@ -272,6 +272,12 @@ class Orchestrator {
   // thread.
   const size_t total_threads_;
 
+  // The synthetic work that workers do on top of the RocksDB work for each
+  // request. It is calibrated when the orchestrator is constructed so that
+  // requests get the same amount of work no matter how often the worker is
+  // preempted.
+  const SyntheticWork synthetic_work_;
+
   // The RocksDB database.
   Database database_;
 
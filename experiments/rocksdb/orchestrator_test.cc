@@ -17,6 +17,7 @@ namespace {
 
 using ::testing::Ge;
 using ::testing::IsTrue;
+using ::testing::Le;
 
 // This class fills in the pure virtual methods from 'Orchestrator' so that we
 // can instantiate an orchestrator and test it.
@@ -122,6 +123,8 @@ TEST(OrchestratorTest, GetRequest) {
     absl::Duration start_cpu_time = GetThreadCpuTime();
     orchestrator.Handle(get);
     handle_durations.push_back(GetThreadCpuTime() - start_cpu_time);
+    // The request's own CPU time is measured inside 'Handle'.
+    EXPECT_THAT(get.handle_cpu_time, Le(handle_durations.back()));
   }
 
   std::sort(handle_durations.begin(), handle_durations.end());
@@ -153,6 +156,8 @@ TEST(OrchestratorTest, RangeQuery) {
     absl::Duration start_cpu_time = GetThreadCpuTime();
     orchestrator.Handle(range);
     handle_durations.push_back(GetThreadCpuTime() - start_cpu_time);
+    // The request's own CPU time is measured inside 'Handle'.
+    EXPECT_THAT(range.handle_cpu_time, Le(handle_durations.back()));
   }
 
   std::sort(handle_durations.begin(), handle_durations.end());
@@ -66,6 +66,10 @@ struct Request {
   absl::Time request_start;
   // When the worker finished handling the request.
   absl::Time request_finished;
+  // The CPU time that the worker spent handling the request, including the
+  // synthetic work. Unlike the stages between the timestamps above, this does
+  // not include time that the worker spent preempted.
+  absl::Duration handle_cpu_time;
 
   // The work to do. The request is either a Get request or a Range query.
   std::variant<Get, Range> work;
@@ -75,6 +75,24 @@ void PrioTableHelper::MarkRunnable(uint32_t sid) {
   MarkRunnability(sid, /*runnable=*/true);
 }
 
+void PrioTableHelper::MarkRunnable(absl::Span<const uint32_t> sids,
+                                   std::optional<absl::Time> deadline) {
+  ghost::PrioTable::UpdateBatch batch(table_);
+  for (uint32_t sid : sids) {
+    CheckSchedItemInRange(sid);
+
+    ghost::sched_item* si = table_.sched_item(sid);
+    uint32_t begin = si->seqcount.write_begin();
+    si->flags |= SCHED_ITEM_RUNNABLE;
+    if (deadline.has_value()) {
+      si->deadline = ToRawDeadline(*deadline);
+    }
+    si->seqcount.write_end(begin);
+    batch.Add(sid);
+  }
+  batch.Publish();
+}
+
 void PrioTableHelper::MarkIdle(uint32_t sid) {
   MarkRunnability(sid, /*runnable=*/false);
 }
@@ -7,6 +7,9 @@
 #ifndef GHOST_EXPERIMENTS_SHARED_PRIO_TABLE_HELPER_H_
 #define GHOST_EXPERIMENTS_SHARED_PRIO_TABLE_HELPER_H_
 
+#include <optional>
+
+#include "absl/types/span.h"
 #include "shared/prio_table.h"
 
 namespace ghost_test {
@@ -34,6 +37,9 @@ namespace ghost_test {
 // (Thread with SID 3 is descheduled by ghOSt.)
 // Thread with SID 1: helper_.MarkRunnable(/*sid=*/3);
 // (ghOSt eventually schedules the thread with SID 3.)
+// ...
+// Thread with SID 1: helper_.MarkRunnable(/*sids=*/{3, 4, 5});
+// (ghOSt picks up all three sched items in one pass over the PrioTable.)
 class PrioTableHelper {
  public:
   // Constructs the class. 'num_sched_items' is the number of sched items in the
@@ -76,6 +82,13 @@ class PrioTableHelper {
   void SetSchedItem(uint32_t sid, const ghost::sched_item& si);
   // Marks 'sid' as runnable.
   void MarkRunnable(uint32_t sid);
+  // Marks each SID in 'sids' as runnable, setting its deadline to 'deadline'
+  // if there is one, and then marks all of them as updated together with a
+  // 'PrioTable::UpdateBatch' rather than one stream entry each. Use this when
+  // updating several sched items at once, such as when a load generator hands
+  // out work to several workers, so that the agent picks them up in one pass.
+  void MarkRunnable(absl::Span<const uint32_t> sids,
+                    std::optional<absl::Time> deadline = std::nullopt);
   // Marks 'sid' as idle.
   void MarkIdle(uint32_t sid);
   // Waits until 'sid' is runnable.
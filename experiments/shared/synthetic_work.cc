@@ -0,0 +1,155 @@
+// Copyright 2022 Google LLC
+//
+// Use of this source code is governed by a BSD-style
+// license that can be found in the LICENSE file or at
+// https://developers.google.com/open-source/licenses/bsd
+
+#include "experiments/shared/synthetic_work.h"
+
+#include <time.h>
+
+#include <algorithm>
+#include <cmath>
+#include <numeric>
+#include <vector>
+
+#include "absl/random/random.h"
+#include "lib/base.h"
+
+namespace ghost_test {
+
+namespace {
+
+// `Mix::kMemory` strides through this many bytes, which fit in the L1/L2 cache
+// of the machines we run on.
+constexpr size_t kMemoryBytes = 32 * 1024;
+constexpr size_t kCacheLineBytes = 64;
+constexpr size_t kWordsPerLine = kCacheLineBytes / sizeof(uint64_t);
+constexpr size_t kMemoryWords = kMemoryBytes / sizeof(uint64_t);
+
+// `Mix::kCacheMiss` chases through this many cache lines (64 MiB), which is
+// far more than the last-level cache holds.
+constexpr size_t kChaseLines = 1 << 20;
+constexpr size_t kChaseEntriesPerLine = kCacheLineBytes / sizeof(uint32_t);
+
+// Keeps `value`, and so everything it was computed from, without storing it
+// anywhere that threads would share.
+inline void KeepValue(uint64_t value) { asm volatile("" : : "r"(value)); }
+
+}  // namespace
+
+SyntheticWork::SyntheticWork(Mix mix, absl::Duration calibration_time)
+    : mix_(mix) {
+  if (mix_ == Mix::kCacheMiss) {
+    // Sattolo's algorithm, which gives a random permutation that is a single
+    // cycle, so the chase visits every line before it repeats.
+    std::vector<uint32_t> order(kChaseLines);
+    std::iota(order.begin(), order.end(), 0);
+    absl::BitGen gen;
+    for (size_t i = kChaseLines - 1; i > 0; i--) {
+      std::swap(order[i], order[absl::Uniform<size_t>(gen, 0, i)]);
+    }
+    chase_ = std::make_unique<uint32_t[]>(kChaseLines * kChaseEntriesPerLine);
+    for (size_t i = 0; i < kChaseLines; i++) {
+      chase_[i * kChaseEntriesPerLine] = order[i];
+    }
+  }
+
+  // Warms up, then doubles the iterations until a run takes a good part of
+  // `calibration_time`. The fastest of a few runs of that size is the least
+  // disturbed by interrupts and preemption.
+  uint64_t iterations = 1024;
+  Run(iterations);
+  while (Run(iterations) < calibration_time / 4) {
+    iterations *= 2;
+  }
+  absl::Duration fastest = absl::InfiniteDuration();
+  for (int i = 0; i < 3; i++) {
+    fastest = std::min(fastest, Run(iterations));
+  }
+  ns_per_iteration_ = absl::ToDoubleNanoseconds(fastest) / iterations;
+  CHECK_GT(ns_per_iteration_, 0.0);
+}
+
+SyntheticWork::~SyntheticWork() = default;
+
+// static
+absl::Duration SyntheticWork::ThreadCpuTime() {
+  timespec ts;
+  CHECK_EQ(clock_gettime(CLOCK_THREAD_CPUTIME_ID, &ts), 0);
+  return absl::DurationFromTimespec(ts);
+}
+
+uint64_t SyntheticWork::IterationsFor(absl::Duration duration) const {
+  if (duration <= absl::ZeroDuration()) {
+    return 0;
+  }
+  return std::llround(absl::ToDoubleNanoseconds(duration) / ns_per_iteration_);
+}
+
+absl::Duration SyntheticWork::Run(uint64_t iterations) const {
+  const absl::Duration start = ThreadCpuTime();
+  switch (mix_) {
+    case Mix::kAlu:
+      KeepValue(RunAlu(iterations));
+      break;
+    case Mix::kMemory:
+      KeepValue(RunMemory(iterations));
+      break;
+    case Mix::kCacheMiss:
+      KeepValue(RunCacheMiss(iterations));
+      break;
+  }
+  return ThreadCpuTime() - start;
+}
+
+// static
+uint64_t SyntheticWork::RunAlu(uint64_t iterations) {
+  uint64_t x = iterations | 1;
+  for (uint64_t i = 0; i < iterations; i++) {
+    // Eight rounds of a 64-bit LCG step and an xorshift, each depending on the
+    // last, so the iteration can't be vectorized or overlapped much.
+    for (int j = 0; j < 8; j++) {
+      x = x * 6364136223846793005ULL + 1442695040888963407ULL;
+      x ^= x >> 29;
+    }
+  }
+  return x;
+}
+
+// static
+uint64_t SyntheticWork::RunMemory(uint64_t iterations) {
+  // Each thread touches its own working set so that threads don't contend for
+  // cache lines.
+  thread_local std::unique_ptr<uint64_t[]> words =
+      std::make_unique<uint64_t[]>(kMemoryWords);
+  // Where the last run on this thread left off.
+  thread_local size_t next = 0;
+
+  uint64_t sum = 0;
+  size_t w = next;
+  for (uint64_t i = 0; i < iterations; i++) {
+    // Eight read-modify-writes, each on its own cache line.
+    for (int j = 0; j < 8; j++) {
+      sum += ++words[w];
+      w = (w + kWordsPerLine) % kMemoryWords;
+    }
+  }
+  next = w;
+  return sum;
+}
+
+uint64_t SyntheticWork::RunCacheMiss(uint64_t iterations) const {
+  // Where the last run on this thread left off, so that runs don't keep
+  // chasing through the lines that the previous one brought into the cache.
+  thread_local uint32_t next = 0;
+
+  uint32_t line = next;
+  for (uint64_t i = 0; i < iterations; i++) {
+    line = chase_[static_cast<size_t>(line) * kChaseEntriesPerLine];
+  }
+  next = line;
+  return line;
+}
+
+}  // namespace ghost_test
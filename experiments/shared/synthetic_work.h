@@ -0,0 +1,104 @@
+// Copyright 2022 Google LLC
+//
+// Use of this source code is governed by a BSD-style
+// license that can be found in the LICENSE file or at
+// https://developers.google.com/open-source/licenses/bsd
+
+#ifndef GHOST_EXPERIMENTS_SHARED_SYNTHETIC_WORK_H_
+#define GHOST_EXPERIMENTS_SHARED_SYNTHETIC_WORK_H_
+
+#include <cstdint>
+#include <memory>
+#include <ostream>
+
+#include "absl/time/time.h"
+
+namespace ghost_test {
+
+// Synthetic work for experiments' requests. Spinning until a clock says that
+// the service time has passed makes the work depend on what reading the clock
+// costs and on how preemption is detected. Instead, this runs a fixed number
+// of iterations of an instruction mix, so a request's work is the same no
+// matter how it is interleaved with other threads. The engine is calibrated
+// when it is constructed, so that `RunFor()` can turn a service time into
+// iterations on this machine. Each run returns the CPU time that the calling
+// thread actually spent (`CLOCK_THREAD_CPUTIME_ID`), so service times can be
+// reported exactly and compared across hosts.
+//
+// `Run()` and `RunFor()` may be called from any number of threads at once.
+//
+// Example:
+// const SyntheticWork work(SyntheticWork::Mix::kAlu);
+// ...
+// Worker: absl::Duration service_time = work.RunFor(absl::Microseconds(10));
+class SyntheticWork {
+ public:
+  enum class Mix {
+    // Dependent integer multiplies and shifts on registers.
+    kAlu,
+    // Read-modify-writes that stride through a working set that fits in the
+    // L1/L2 cache.
+    kMemory,
+    // A dependent pointer chase through a working set far bigger than the
+    // last-level cache, so nearly every iteration misses.
+    kCacheMiss,
+  };
+
+  // Calibrates by running iterations for about `calibration_time` of CPU time,
+  // a few times, and keeping the fastest rate.
+  explicit SyntheticWork(
+      Mix mix, absl::Duration calibration_time = absl::Milliseconds(20));
+
+  SyntheticWork(const SyntheticWork&) = delete;
+  SyntheticWork& operator=(const SyntheticWork&) = delete;
+  ~SyntheticWork();
+
+  // Runs `iterations` iterations and returns the CPU time they took.
+  absl::Duration Run(uint64_t iterations) const;
+
+  // Runs as many iterations as calibration says take `duration` of CPU time
+  // and returns the CPU time they actually took.
+  absl::Duration RunFor(absl::Duration duration) const {
+    return Run(IterationsFor(duration));
+  }
+
+  // Returns the number of iterations that take `duration` of CPU time.
+  uint64_t IterationsFor(absl::Duration duration) const;
+
+  Mix mix() const { return mix_; }
+
+  // The CPU time that an iteration took during calibration.
+  double ns_per_iteration() const { return ns_per_iteration_; }
+
+  // Returns the CPU time that the calling thread has consumed.
+  static absl::Duration ThreadCpuTime();
+
+  friend std::ostream& operator<<(std::ostream& os, Mix mix) {
+    switch (mix) {
+      case Mix::kAlu:
+        return os << "alu";
+      case Mix::kMemory:
+        return os << "memory";
+      case Mix::kCacheMiss:
+        return os << "cache_miss";
+    }
+    return os;
+  }
+
+ private:
+  // The loops behind `Run()`. Each returns a value computed from all of its
+  // iterations so that the compiler cannot drop them.
+  static uint64_t RunAlu(uint64_t iterations);
+  static uint64_t RunMemory(uint64_t iterations);
+  uint64_t RunCacheMiss(uint64_t iterations) const;
+
+  const Mix mix_;
+  // For `Mix::kCacheMiss`: a single cycle through all of the entries, in
+  // random order, where each entry holds the index of the next one.
+  std::unique_ptr<uint32_t[]> chase_;
+  double ns_per_iteration_ = 0.0;
+};
+
+}  // namespace ghost_test
+
+#endif  // GHOST_EXPERIMENTS_SHARED_SYNTHETIC_WORK_H_
@@ -0,0 +1,70 @@
+// Copyright 2022 Google LLC
+//
+// Use of this source code is governed by a BSD-style
+// license that can be found in the LICENSE file or at
+// https://developers.google.com/open-source/licenses/bsd
+
+#include "experiments/shared/synthetic_work.h"
+
+#include <algorithm>
+
+#include "gmock/gmock.h"
+#include "gtest/gtest.h"
+
+namespace ghost_test {
+namespace {
+
+using ::testing::Eq;
+using ::testing::Gt;
+using ::testing::Le;
+using ::testing::Lt;
+using ::testing::Values;
+
+class SyntheticWorkTest : public testing::TestWithParam<SyntheticWork::Mix> {};
+
+INSTANTIATE_TEST_SUITE_P(SyntheticWorkTestGroup, SyntheticWorkTest,
+                         Values(SyntheticWork::Mix::kAlu,
+                                SyntheticWork::Mix::kMemory,
+                                SyntheticWork::Mix::kCacheMiss));
+
+// Tests that a run takes about as much CPU time as it was asked to. The bounds
+// are loose since the test may share the machine with other tests.
+TEST_P(SyntheticWorkTest, RunFor) {
+  const SyntheticWork work(GetParam());
+  EXPECT_THAT(work.mix(), Eq(GetParam()));
+  EXPECT_THAT(work.ns_per_iteration(), Gt(0.0));
+
+  const absl::Duration target = absl::Milliseconds(50);
+  absl::Duration shortest = absl::InfiniteDuration();
+  for (int i = 0; i < 3; i++) {
+    const absl::Duration start = SyntheticWork::ThreadCpuTime();
+    const absl::Duration cpu_time = work.RunFor(target);
+    // The returned CPU time is what the calling thread consumed.
+    EXPECT_THAT(cpu_time, Le(SyntheticWork::ThreadCpuTime() - start));
+    shortest = std::min(shortest, cpu_time);
+  }
+  EXPECT_THAT(shortest, Gt(target / 2));
+  EXPECT_THAT(shortest, Lt(target * 2));
+}
+
+TEST_P(SyntheticWorkTest, IterationsFor) {
+  const SyntheticWork work(GetParam());
+  EXPECT_THAT(work.IterationsFor(absl::ZeroDuration()), Eq(0));
+  EXPECT_THAT(work.IterationsFor(absl::Microseconds(-1)), Eq(0));
+
+  const uint64_t iterations = work.IterationsFor(absl::Milliseconds(1));
+  EXPECT_THAT(iterations, Gt(0));
+  EXPECT_THAT(work.IterationsFor(absl::Milliseconds(10)),
+              Eq(work.IterationsFor(absl::Milliseconds(1) * 10)));
+  EXPECT_THAT(work.IterationsFor(absl::Milliseconds(10)),
+              Gt(iterations * 9));
+}
+
+TEST_P(SyntheticWorkTest, RunNothing) {
+  const SyntheticWork work(GetParam());
+  EXPECT_THAT(work.Run(0), Lt(absl::Milliseconds(1)));
+  EXPECT_THAT(work.RunFor(absl::ZeroDuration()), Lt(absl::Milliseconds(1)));
+}
+
+}  // namespace
+}  // namespace ghost_test
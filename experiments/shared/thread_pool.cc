@@ -22,12 +22,13 @@ void ExperimentThreadPool::Init(
   CHECK_EQ(ksched.size(), num_threads_);
   CHECK_EQ(ksched.size(), thread_work.size());
 
-  threads_.reserve(num_threads_);
+  std::vector<std::function<void()>> work;
+  work.reserve(num_threads_);
   for (uint32_t i = 0; i < num_threads_; i++) {
-    threads_.push_back(std::make_unique<ghost::GhostThread>(
-        ksched[i],
-        std::bind(&ExperimentThreadPool::ThreadMain, this, i, thread_work[i])));
+    work.push_back(
+        std::bind(&ExperimentThreadPool::ThreadMain, this, i, thread_work[i]));
   }
+  threads_ = ghost::GhostThread::CreateMany(ksched, std::move(work));
 }
 
 void ExperimentThreadPool::MarkExit(uint32_t sid) {
@@ -17,7 +17,8 @@ namespace ghost_test {
 // This class allows threads to be triggered by themselves or external code.
 // Essentially, the "trigger" acts as a memory barrier that the caller and the
 // thread can synchronize on. When the caller notices an event, it triggers the
-// thread affected by the event. Each thread can only be triggered once.
+// thread affected by the event. Each thread can only be triggered once until
+// its trigger is reset.
 //
 // Example:
 // ThreadTrigger triggers_(/*num_threads=*/5);
@@ -32,28 +33,26 @@ namespace ghost_test {
 class ThreadTrigger {
  public:
   // Constructs this class to trigger `num_threads` threads.
-  explicit ThreadTrigger(uint32_t num_threads) {
-    thread_trigger_.reserve(num_threads);
-    for (uint32_t i = 0; i < num_threads; i++) {
-      thread_trigger_.push_back(std::make_unique<ghost::Notification>());
-    }
-  }
+  explicit ThreadTrigger(uint32_t num_threads)
+      : num_threads_(num_threads),
+        thread_trigger_(
+            std::make_unique<ghost::SpinningNotification[]>(num_threads)) {}
 
   // Returns true if the thread with SID `sid` has been triggered.
   // Returns false otherwise.
   bool Triggered(uint32_t sid) const {
-    CHECK_LT(sid, thread_trigger_.size());
-    return thread_trigger_[sid]->HasBeenNotified();
+    CHECK_LT(sid, num_threads_);
+    return thread_trigger_[sid].HasBeenNotified();
   }
 
   // Triggers the thread with SID `sid` if that thread has not already been
   // triggered. Returns true if the thread was triggered for the first time.
   // Returns false if the thread has already been triggered.
   bool Trigger(uint32_t sid) {
-    CHECK_LT(sid, thread_trigger_.size());
+    CHECK_LT(sid, num_threads_);
     bool triggered = Triggered(sid);
     if (!triggered) {
-      thread_trigger_[sid]->Notify();
+      thread_trigger_[sid].Notify();
     }
     return !triggered;
   }
@@ -62,14 +61,24 @@ class ThreadTrigger {
   // function returns immediately *without blocking* if the thread has already
   // been triggered.
   void WaitForTrigger(uint32_t sid) const {
-    CHECK_LT(sid, thread_trigger_.size());
-    thread_trigger_[sid]->WaitForNotification();
+    CHECK_LT(sid, num_threads_);
+    thread_trigger_[sid].WaitForNotification();
+  }
+
+  // Resets the trigger for the thread with SID `sid` so that it can be
+  // triggered again. The thread must not be waiting for its trigger.
+  void Reset(uint32_t sid) {
+    CHECK_LT(sid, num_threads_);
+    thread_trigger_[sid].Reset();
   }
 
  private:
+  const uint32_t num_threads_;
   // The notification at index `i` is not "notified" by default. Once `Trigger`
   // is called for the thread with SID `i`, this notification is notified.
-  std::vector<std::unique_ptr<ghost::Notification>> thread_trigger_;
+  // These live in one allocation rather than one per thread. Triggers usually
+  // come within microseconds, so waiters spin for a while before they sleep.
+  std::unique_ptr<ghost::SpinningNotification[]> thread_trigger_;
 };
 
 // Creates and manages a pool of threads. These threads may be scheduled by
@@ -14,14 +14,29 @@ ThreadWait::ThreadWait(uint32_t num_threads, WaitType wait_type)
     : num_threads_(num_threads), wait_type_(wait_type) {
   runnability_.reserve(num_threads);
   for (uint32_t i = 0; i < num_threads_; i++) {
-    runnability_.push_back(std::make_unique<std::atomic<int>>(0));
+    runnability_.push_back(std::make_unique<std::atomic<int>>(kIdle));
+  }
+  if (wait_type_ == WaitType::kAdaptive) {
+    spin_.reserve(num_threads);
+    for (uint32_t i = 0; i < num_threads_; i++) {
+      spin_.push_back(std::make_unique<ghost::AdaptiveSpin>());
+    }
   }
 }
 
 void ThreadWait::MarkRunnable(uint32_t sid) {
   CHECK_LT(sid, num_threads_);
 
-  runnability_[sid]->store(1, std::memory_order_release);
+  if (wait_type_ == WaitType::kAdaptive) {
+    // Only pay for the futex syscall if the thread went to sleep.
+    if (runnability_[sid]->exchange(kRunnable, std::memory_order_release) ==
+        kIdleWithWaiter) {
+      ghost::Futex::Wake(runnability_[sid].get(), 1);
+    }
+    return;
+  }
+
+  runnability_[sid]->store(kRunnable, std::memory_order_release);
   if (wait_type_ == WaitType::kFutex) {
     ghost::Futex::Wake(runnability_[sid].get(), 1);
   }
@@ -30,7 +45,7 @@ void ThreadWait::MarkRunnable(uint32_t sid) {
 void ThreadWait::MarkIdle(uint32_t sid) {
   CHECK_LT(sid, num_threads_);
 
-  runnability_[sid]->store(0, std::memory_order_release);
+  runnability_[sid]->store(kIdle, std::memory_order_release);
 }
 
 void ThreadWait::WaitUntilRunnable(uint32_t sid) const {
@@ -38,14 +53,41 @@ void ThreadWait::WaitUntilRunnable(uint32_t sid) const {
 
   const std::unique_ptr<std::atomic<int>>& r = runnability_[sid];
   if (wait_type_ == WaitType::kSpin) {
-    while (r->load(std::memory_order_acquire) == 0) {
+    while (r->load(std::memory_order_acquire) == kIdle) {
       ghost::Pause();
     }
+  } else if (wait_type_ == WaitType::kFutex) {
+    ghost::Futex::Wait(r.get(), kIdle);
   } else {
-    CHECK_EQ(wait_type_, WaitType::kFutex);
+    CHECK_EQ(wait_type_, WaitType::kAdaptive);
 
-    ghost::Futex::Wait(r.get(), 0);
+    ghost::AdaptiveSpin& spin = *spin_[sid];
+    const uint64_t start = spin.Start();
+    if (spin.Spin(start, [&r] {
+          return r->load(std::memory_order_acquire) == kRunnable;
+        })) {
+      return;
+    }
+    // Tell `MarkRunnable()` to wake us up. If we lose the race, we're
+    // runnable already.
+    int expected = kIdle;
+    if (!r->compare_exchange_strong(expected, kIdleWithWaiter,
+                                    std::memory_order_acq_rel) &&
+        expected == kRunnable) {
+      return;
+    }
+    while (r->load(std::memory_order_acquire) != kRunnable) {
+      ghost::Futex::Wait(r.get(), kIdleWithWaiter);
+    }
+    spin.Parked(start);
   }
 }
 
+ghost::AdaptiveSpin::Stats ThreadWait::spin_stats(uint32_t sid) const {
+  CHECK_LT(sid, num_threads_);
+  CHECK_EQ(wait_type_, WaitType::kAdaptive);
+
+  return spin_[sid]->stats();
+}
+
 }  // namespace ghost_test
@@ -15,8 +15,8 @@ namespace ghost_test {
 
 // Support class for test apps that run experiments with threads that need to
 // wait. This class allows threads to be marked as idle/runnable and lets them
-// wait if they are idle until they are marked runnable again either by spinning
-// or sleeping on a futex.
+// wait if they are idle until they are marked runnable again either by spinning,
+// sleeping on a futex, or spinning for a while and then sleeping.
 //
 // Example:
 // ThreadWait thread_wait_;
@@ -41,6 +41,11 @@ class ThreadWait {
     // waiting but will return from 'WaitUntilRunnable' more slowly when marked
     // runnable.
     kFutex,
+    // Spin for as long as a `ghost::AdaptiveSpin` decides from the thread's
+    // recent waits, then sleep on a futex. Threads that are marked runnable
+    // within microseconds return about as quickly as with `kSpin`, and
+    // threads that stay idle for longer don't burn up their CPU.
+    kAdaptive,
   };
 
   ThreadWait(uint32_t num_threads, WaitType wait_type);
@@ -52,10 +57,23 @@ class ThreadWait {
   // Waits until 'sid' is runnable.
   void WaitUntilRunnable(uint32_t sid) const;
 
+  // Returns how often 'sid' has waited with `WaitType::kAdaptive`, and how
+  // many of those waits slept.
+  ghost::AdaptiveSpin::Stats spin_stats(uint32_t sid) const;
+
  private:
+  // The values of `runnability_`.
+  static constexpr int kIdle = 0;
+  static constexpr int kRunnable = 1;
+  // Idle and a thread is sleeping on the futex (`WaitType::kAdaptive` only).
+  static constexpr int kIdleWithWaiter = 2;
+
   const uint32_t num_threads_;
   const WaitType wait_type_;
   std::vector<std::unique_ptr<std::atomic<int>>> runnability_;
+  // One per thread, for `WaitType::kAdaptive`. These are tuned while waiting,
+  // hence mutable.
+  mutable std::vector<std::unique_ptr<ghost::AdaptiveSpin>> spin_;
 };
 
 inline std::ostream& operator<<(std::ostream& os,
@@ -65,6 +83,8 @@ inline std::ostream& operator<<(std::ostream& os,
       return os << "Spin";
     case ThreadWait::WaitType::kFutex:
       return os << "Futex";
+    case ThreadWait::WaitType::kAdaptive:
+      return os << "Adaptive";
   }
 }
 
@@ -19,6 +19,8 @@
 #include <functional>
 #include <memory>
 #include <thread>
+#include <utility>
+#include <vector>
 
 #include "absl/base/optimization.h"
 #include "absl/status/status.h"
@@ -27,6 +29,7 @@
 #include "lib/base.h"
 #include "lib/enclave.h"
 #include "lib/ghost.h"
+#include "lib/rpc_ring.h"
 #include "lib/topology.h"
 #include "lib/trivial_status.h"
 #include "shared/shmem.h"
@@ -502,7 +505,7 @@ inline To agent_down_cast(From* f) {
 // An AgentProcess is a forked process that runs a FullAgent.  The child runs
 // the actual FullAgent.  The parent can communicate with the child via a shared
 // memory region.  The primary mechanism for communication is a hand-rolled RPC
-// system, built on top of Notifications.
+// system, built on top of an RpcRing.
 //
 // We fork a separate process for the FullAgent in order to keep the agent
 // process as slim as possible, isolating it from any random threads that may be
@@ -519,6 +522,18 @@ inline To agent_down_cast(From* f) {
 template <class FullAgentType, class AgentConfigType>
 class AgentProcess {
  public:
+  struct AgentRpcRequest {
+    int64_t req;
+    AgentRpcArgs args;
+  };
+
+  // Maximum number of RPCs in flight.  Each slot holds a request and a
+  // response (about 32KiB).
+  static constexpr uint32_t kRpcSlots = 8;
+
+  using RpcTicket =
+      typename RpcRing<AgentRpcRequest, AgentRpcResponse, kRpcSlots>::Ticket;
+
   // This helper class is a blob of shared memory for sync between parent and
   // forked child.  It should only be constructed in-place in a shmem region,
   // otherwise the parent and child will have separate copies of the blob.  We
@@ -533,8 +548,6 @@ class AgentProcess {
       // get killed by a signal.
       agent_ready_.Reset();
       kill_agent_.Reset();
-      rpc_pending_.Reset();
-      rpc_done_.Reset();
     }
 
     void* operator new(size_t sz) {
@@ -555,14 +568,9 @@ class AgentProcess {
     Notification agent_ready_;  // child to parent
     Notification kill_agent_;   // parent to child
 
-    // Simple RPC channel, passed to FullAgentType's Rpc() method.
-    // Parent posts request, then notifies rpc_pending_.
-    // Child posts response, then notifies rpc_done_.
-    int64_t rpc_req_;
-    AgentRpcArgs rpc_args_;
-    AgentRpcResponse rpc_res_;
-    Notification rpc_pending_;  // parent to child
-    Notification rpc_done_;     // child_to_parent
+    // RPC channel, passed to FullAgentType's RpcHandler() method.  Parent
+    // threads submit requests, the child's rpc_handler thread posts responses.
+    RpcRing<AgentRpcRequest, AgentRpcResponse, kRpcSlots> rpc_ring_;
 
    private:
     GhostShmem* blob_;
@@ -595,18 +603,22 @@ class AgentProcess {
     // We could make 'ready' and 'kill' be Rpcs too, but it's simpler to have a
     // thread for the RPCs for our derived class FullAgents and let this thread
     // handle ready/kill for the AgentProcess.
+    //
+    // RPCs are handled one at a time in the order they were submitted, so
+    // RpcHandler() implementations need not be thread-safe with respect to
+    // each other.
     auto rpc_handler = std::thread([this]() {
       CHECK_EQ(prctl(PR_SET_NAME, "ap_rpc"), 0);
       for (;;) {
-        sb_->rpc_pending_.WaitForNotification();
-        sb_->rpc_pending_.Reset();
-        if (full_agent_->enclave_.IsOnline()) {
-          sb_->rpc_res_ = AgentRpcResponse();  // Reset the response.
-          full_agent_->RpcHandler(sb_->rpc_req_, sb_->rpc_args_, sb_->rpc_res_);
-        } else {
-          sb_->rpc_res_.response_code = -ENODEV;
-        }
-        sb_->rpc_done_.Notify();
+        sb_->rpc_ring_.WaitForRequest();
+        sb_->rpc_ring_.ServeOne(
+            [this](const AgentRpcRequest& request, AgentRpcResponse& response) {
+              if (full_agent_->enclave_.IsOnline()) {
+                full_agent_->RpcHandler(request.req, request.args, response);
+              } else {
+                response.response_code = -ENODEV;
+              }
+            });
       }
     });
     rpc_handler.detach();
@@ -636,10 +648,7 @@ class AgentProcess {
   // DISCLAIMER: This RPC mechanism is only meant to be used for the shared
   // memory region on a single machine. See AgentRpcBuffer for more details.
   int64_t Rpc(uint64_t req, const AgentRpcArgs& args = AgentRpcArgs()) {
-    absl::MutexLock lock(&rpc_mutex_);
-
-    PerformRpc(req, args);
-    return sb_->rpc_res_.response_code;
+    return RpcWait(RpcAsync(req, args));
   }
 
   // Issues the given RPC and returns the full response data. Since this is
@@ -651,10 +660,64 @@ class AgentProcess {
   // details.
   virtual AgentRpcResponse RpcWithResponse(
       uint64_t req, const AgentRpcArgs& args = AgentRpcArgs()) {
-    absl::MutexLock lock(&rpc_mutex_);
+    return RpcWaitWithResponse(RpcAsync(req, args));
+  }
+
+  // Issues the given RPC without waiting for it to complete.  Several RPCs may
+  // be in flight at once, from one or more threads; the agent handles them in
+  // the order they were issued.  Blocks if kRpcSlots RPCs are already in
+  // flight.
+  //
+  // Every ticket must be passed to RpcWait() or RpcWaitWithResponse() exactly
+  // once, even if the response is not needed, to free its slot.
+  RpcTicket RpcAsync(uint64_t req, const AgentRpcArgs& args = AgentRpcArgs()) {
+    CHECK(!agent_proc_->IsChild());
+
+    return sb_->rpc_ring_.SubmitWith([req, &args](AgentRpcRequest& request) {
+      request.req = req;
+      request.args = args;
+    });
+  }
+
+  // Returns true if the RPC for `ticket` has completed, i.e. RpcWait() would
+  // not block.
+  bool RpcPoll(RpcTicket ticket) const { return sb_->rpc_ring_.Poll(ticket); }
 
-    PerformRpc(req, args);
-    return sb_->rpc_res_;
+  // Waits for the RPC for `ticket` to complete and returns its response code.
+  int64_t RpcWait(RpcTicket ticket) {
+    return sb_->rpc_ring_.Complete(ticket, [](const AgentRpcResponse& response) {
+      return response.response_code;
+    });
+  }
+
+  // Waits for the RPC for `ticket` to complete and returns its full response.
+  AgentRpcResponse RpcWaitWithResponse(RpcTicket ticket) {
+    return sb_->rpc_ring_.Complete(
+        ticket, [](const AgentRpcResponse& response) { return response; });
+  }
+
+  // Issues a batch of RPCs, pipelining them through the ring, and returns their
+  // response codes in order.  This is much faster than issuing them one at a
+  // time with Rpc(), e.g. to set a tunable for each of many cpus.
+  std::vector<int64_t> RpcBatch(
+      const std::vector<std::pair<uint64_t, AgentRpcArgs>>& rpcs) {
+    std::vector<int64_t> codes;
+    codes.reserve(rpcs.size());
+
+    std::vector<RpcTicket> tickets;
+    tickets.reserve(rpcs.size());
+    for (const auto& [req, args] : rpcs) {
+      // Keep the ring from filling up with our own requests, which would
+      // leave Submit() waiting on us.
+      if (tickets.size() - codes.size() == kRpcSlots) {
+        codes.push_back(RpcWait(tickets[codes.size()]));
+      }
+      tickets.push_back(RpcAsync(req, args));
+    }
+    while (codes.size() < tickets.size()) {
+      codes.push_back(RpcWait(tickets[codes.size()]));
+    }
+    return codes;
   }
 
   void AddExitHandler(std::function<bool(pid_t, int)> handler) {
@@ -674,23 +737,7 @@ class AgentProcess {
   std::unique_ptr<FullAgentType> full_agent_;
 
   // set in both
-  std::unique_ptr<SharedBlob> sb_ ABSL_GUARDED_BY(rpc_mutex_);
-
- private:
-  // Sends the RPC notification.
-  void PerformRpc(uint64_t req, const AgentRpcArgs& args)
-      ABSL_EXCLUSIVE_LOCKS_REQUIRED(rpc_mutex_) {
-    CHECK(!agent_proc_->IsChild());
-
-    sb_->rpc_req_ = req;
-    sb_->rpc_args_ = args;
-    sb_->rpc_pending_.Notify();
-    sb_->rpc_done_.WaitForNotification();
-    sb_->rpc_done_.Reset();
-  }
-
-  // Prevents concurrent use of the shared memory region.
-  absl::Mutex rpc_mutex_;
+  std::unique_ptr<SharedBlob> sb_;
 };
 
 }  // namespace ghost
@@ -13,6 +13,7 @@
 #include <sys/wait.h>
 #include <unistd.h>
 
+#include <algorithm>
 #include <filesystem>
 #include <fstream>
 #include <iostream>
@@ -20,15 +21,15 @@
 #include <unordered_map>
 #include <utility>
 
-#include "absl/base/internal/spinlock.h"
 #include "absl/base/macros.h"
-#include "absl/container/node_hash_map.h"
 #include "absl/debugging/stacktrace.h"
 #include "absl/debugging/symbolize.h"
 #include "absl/status/status.h"
 #include "absl/strings/str_format.h"
 #include "absl/time/time.h"
+#include "lib/gtid_names.h"
 #include "lib/logging.h"
+#include "lib/tsc_clock.h"
 
 // procfs may have been mounted somewhere other than root (eg. for testing
 // purposes).
@@ -67,6 +68,16 @@ void Notification::Notify() {
 }
 
 void Notification::WaitForNotification() {
+  // Spinning first saves both us and the notifier a futex syscall if the
+  // notification is about to come. We don't advertise a waiter until we stop.
+  const uint64_t start = spin_.Start();
+  if (spin_.Spin(start, [this] {
+        return notified_.load(std::memory_order_acquire) ==
+               NotifiedState::kNotified;
+      })) {
+    return;
+  }
+
   while (true) {
     NotifiedState v = notified_.load(std::memory_order_acquire);
     if (v == NotifiedState::kNotified) {
@@ -83,6 +94,7 @@ void Notification::WaitForNotification() {
     }
   }
   Futex::Wait(&notified_, NotifiedState::kWaiter);
+  spin_.Parked(start);
 }
 
 // 64-bit gtids referring to normal tasks always have a positive value:
@@ -220,35 +232,15 @@ pid_t Gtid::tid() const { return gtid_raw_ >> ghost_tid_seqnum_bits(); }
 
 absl::StatusOr<int64_t> GetGtid() { return gtid(GetTID()); }
 
-ABSL_CONST_INIT static absl::base_internal::SpinLock gtid_name_map_lock(
-    absl::kConstInit, absl::base_internal::SCHEDULE_KERNEL_ONLY);
-
-static absl::node_hash_map<int64_t, std::string>& get_gtid_name_map() {
-  static auto map = new absl::node_hash_map<int64_t, std::string>;
-  return *map;
-}
-
-// Returns the name previously assigned via 'assign_name()' or an
-// auto-generated unique name.
-static const std::string& get_gtid_name(int64_t gtid) {
-  absl::base_internal::SpinLockHolder lock(&gtid_name_map_lock);
-  auto& name_map = get_gtid_name_map();
-
-  if (auto it = name_map.find(gtid); it == name_map.end()) {
-    int idx = name_map.size();
-    name_map[gtid] = absl::StrFormat("%c%d/%d/%lld", 'A' + (idx % 26), idx / 26,
-                                     Gtid(gtid).tid(), gtid);
-  }
-
-  return name_map[gtid];
+static GtidNameRegistry& gtid_names() {
+  static auto names = new GtidNameRegistry;
+  return *names;
 }
 
 void Gtid::assign_name(std::string name) const {
   CHECK_NE(id(), 0);  // Note: This is useful for catching uninitialized gtids.
 
-  absl::base_internal::SpinLockHolder lock(&gtid_name_map_lock);
-  auto& name_map = get_gtid_name_map();
-  name_map[id()] = std::move(name);
+  gtid_names().Assign(id(), name);
 }
 
 absl::string_view Gtid::describe() const {
@@ -282,7 +274,9 @@ absl::string_view Gtid::describe() const {
     }
   }
 
-  return get_gtid_name(gtid);
+  // Returns the name previously assigned via 'assign_name()' or an
+  // auto-generated unique name.
+  return gtid_names().Lookup(gtid);
 }
 
 absl::StatusOr<Gtid> Gtid::FromTid(int64_t tid) {
@@ -343,26 +337,30 @@ size_t GetFileSize(int fd) {
 }
 
 void SpinFor(absl::Duration remaining) {
-  while (remaining > absl::ZeroDuration()) {
-    // We use MonotonicNow instead of absl::Now(), since the latter can acquire
-    // a lock and sleep.
-    absl::Time start = MonotonicNow();
-    absl::Duration delta;
+  // We count TscClock ticks instead of using absl::Now(), since the latter can
+  // acquire a lock and sleep, and MonotonicNow() is a clock_gettime() and a
+  // conversion per read.
+  const uint64_t slow_read = TscClock::FromDuration(absl::Microseconds(10));
+  const uint64_t preempted = TscClock::FromDuration(absl::Microseconds(100));
+  uint64_t remaining_ticks = TscClock::FromDuration(remaining);
+  while (remaining_ticks > 0) {
+    const uint64_t start = TscClock::Now();
+    uint64_t delta;
 
     for (int i = 0; i < 100; ++i) {
-      delta = MonotonicNow() - start;
+      delta = TscClock::Now() - start;
 
-      // If clock_gettime is slow, we don't want to mistake that for a
+      // If reading the clock is slow, we don't want to mistake that for a
       // preemption.
-      if (delta > absl::Microseconds(10)) {
+      if (delta > slow_read) {
         break;
       }
     }
 
     // Don't count preempted time; if we were off cpu, the large delta
     // represents time we were waiting, not running.
-    if (delta < absl::Microseconds(100)) {
-      remaining -= delta;
+    if (delta < preempted) {
+      remaining_ticks -= std::min(delta, remaining_ticks);
     }
   }
 }
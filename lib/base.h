@@ -18,6 +18,7 @@
 #include <sys/syscall.h>
 #include <unistd.h>
 
+#include <algorithm>
 #include <atomic>
 #include <functional>
 #include <string>
@@ -33,6 +34,7 @@
 #include "absl/time/clock.h"
 #include "absl/time/time.h"
 #include "lib/logging.h"
+#include "lib/tsc_clock.h"
 
 ABSL_DECLARE_FLAG(std::string, ghost_procfs_prefix);
 ABSL_DECLARE_FLAG(bool, emit_fork_warnings);
@@ -280,12 +282,140 @@ class Futex {
   }
 };
 
+// Decides how long a waiter spins before it parks on a futex, based on how its
+// recent waits went. When the wake is a few microseconds away, spinning wins:
+// parking costs a futex syscall on both sides plus waking the waiter's cpu
+// back up. When the wake is further out, spinning only burns the cpu.
+//
+// After a wait that parked, the budget doubles (up to `max_spin`) if spinning
+// for `max_spin` would have covered that wait, and halves if not. Waits that
+// end while spinning leave the budget alone. There is no point in spinning on a
+// uniprocessor, where the notifier cannot run meanwhile, so waiters there
+// don't. A `max_spin` of zero never spins and never reads the TSC.
+//
+// The budget is converted to TSC ticks on first use rather than on
+// construction, since the first conversion calibrates the `TscClock`.
+//
+// Example:
+// const uint64_t start = spin_.Start();
+// if (!spin_.Spin(start, [this] { return ready_.load(); })) {
+//   /* Park on a futex until ready. */
+//   spin_.Parked(start);
+// }
+class AdaptiveSpin {
+ public:
+  static constexpr absl::Duration kDefaultMaxSpin = absl::Microseconds(20);
+
+  struct Stats {
+    uint64_t waits;
+    // Waits that ended up on a futex.
+    uint64_t parks;
+    // The current spin budget.
+    absl::Duration budget;
+  };
+
+  explicit AdaptiveSpin(absl::Duration max_spin = kDefaultMaxSpin)
+      : max_spin_(max_spin) {}
+
+  // Whether waiters spin at all.
+  bool enabled() const { return max_spin_ > absl::ZeroDuration(); }
+
+  // Returns the start of a wait to pass to `Spin()` and `Parked()`: a
+  // `TscClock::Now()` reading, or 0 if waiters never spin.
+  uint64_t Start() const { return enabled() ? TscClock::Now() : 0; }
+
+  // Spins until `done()` returns true or the budget since `start` runs out.
+  // Returns the last `done()`.
+  template <class Done>
+  bool Spin(uint64_t start, Done done) {
+    waits_.fetch_add(1, std::memory_order_relaxed);
+    if (!enabled() || Uniprocessor()) {
+      return done();
+    }
+    InitTicks();
+    const uint64_t budget = budget_ticks_.load(std::memory_order_relaxed);
+    while (!done()) {
+      if (TscClock::Now() - start >= budget) {
+        return false;
+      }
+      Pause();
+    }
+    return true;
+  }
+
+  // Called after a wait that started at `start` had to park.
+  void Parked(uint64_t start) {
+    parks_.fetch_add(1, std::memory_order_relaxed);
+    if (enabled()) {
+      Adjust(TscClock::Now() - start);
+    }
+  }
+
+  // Adjusts the budget after a wait of `wait_ticks` that parked.
+  void Adjust(uint64_t wait_ticks) {
+    InitTicks();
+    // Concurrent waiters may race here and lose an adjustment, which is fine
+    // for a heuristic.
+    uint64_t budget = budget_ticks_.load(std::memory_order_relaxed);
+    if (wait_ticks <= max_ticks_) {
+      budget = std::min(max_ticks_, budget * 2 + step_ticks_);
+    } else {
+      budget /= 2;
+    }
+    budget_ticks_.store(budget, std::memory_order_relaxed);
+  }
+
+  Stats stats() const {
+    Stats stats = {
+        .waits = waits_.load(std::memory_order_relaxed),
+        .parks = parks_.load(std::memory_order_relaxed),
+        .budget = absl::ZeroDuration(),
+    };
+    if (enabled()) {
+      InitTicks();
+      stats.budget =
+          TscClock::ToDuration(budget_ticks_.load(std::memory_order_relaxed));
+    }
+    return stats;
+  }
+
+ private:
+  static bool Uniprocessor() {
+    static const bool uniprocessor = std::thread::hardware_concurrency() <= 1;
+    return uniprocessor;
+  }
+
+  void InitTicks() const {
+    absl::call_once(ticks_once_, [this] {
+      max_ticks_ = TscClock::FromDuration(max_spin_);
+      step_ticks_ = max_ticks_ / 16;
+      budget_ticks_.store(max_ticks_ / 4, std::memory_order_relaxed);
+    });
+  }
+
+  const absl::Duration max_spin_;
+  // Set by `InitTicks()`.
+  mutable absl::once_flag ticks_once_;
+  mutable uint64_t max_ticks_ = 0;
+  // How far one doubling gets from a budget of zero.
+  mutable uint64_t step_ticks_ = 0;
+  mutable std::atomic<uint64_t> budget_ticks_{0};
+  std::atomic<uint64_t> waits_{0};
+  std::atomic<uint64_t> parks_{0};
+};
+
 // This class is a notification, which is essentially a trigger. Threads can
 // sleep while the trigger has not been set (i.e., the notification is not yet
 // notified) and will wake up once the trigger is set (i.e., the notification is
 // notified). This class is similar to `absl::Notification` but contains extra
 // functionality, such as the ability to reset.
 //
+// By default a waiter sleeps right away, since the waiter may be a ghOSt thread
+// whose spinning takes cpu time from the scheduler under test. Pass a nonzero
+// `max_spin` (or use `SpinningNotification`) for microsecond handoffs, where a
+// waiter should spin for a while before it sleeps, for as long as an
+// `AdaptiveSpin` decides from the notification's recent waits.
+//
 // Notifications act as memory barriers.
 //
 // Example:
@@ -300,7 +430,8 @@ class Futex {
 // notification_.Notify();
 class Notification {
  public:
-  Notification() {}
+  Notification() : spin_(absl::ZeroDuration()) {}
+  explicit Notification(absl::Duration max_spin) : spin_(max_spin) {}
 
   // Disallow copy and assign.
   Notification(const Notification&) = delete;
@@ -315,7 +446,9 @@ class Notification {
            NotifiedState::kNotified;
   }
 
-  // Resets the notification back to the `unnotified` state.
+  // Resets the notification back to the `unnotified` state, so that it can be
+  // reused rather than reallocated. It keeps its spin budget, which is tuned
+  // to how it is used.
   // Careful using this - you need to communicate to whoever will call Notify
   // *after* you reset, e.g. with another Notification. There is no way for the
   // notifier to 'notice' that this object is ready for another notification.
@@ -332,6 +465,9 @@ class Notification {
   // to `Notify()`.
   void WaitForNotification();
 
+  // Returns how many waits there were, and how many of them had to sleep.
+  AdaptiveSpin::Stats spin_stats() const { return spin_.stats(); }
+
  private:
   enum class NotifiedState {
     kNoWaiter,
@@ -353,6 +489,17 @@ class Notification {
 
   // The notification state.
   std::atomic<NotifiedState> notified_ = NotifiedState::kNoWaiter;
+  AdaptiveSpin spin_;
+};
+
+// A `Notification` whose waiters spin for up to `max_spin` before they sleep,
+// for handoffs that usually take microseconds. Default-constructible so that
+// it can be allocated in arrays.
+class SpinningNotification : public Notification {
+ public:
+  explicit SpinningNotification(
+      absl::Duration max_spin = AdaptiveSpin::kDefaultMaxSpin)
+      : Notification(max_spin) {}
 };
 
 // Parent and child are codependent.  If the parent dies, the child dies.  If
@@ -0,0 +1,165 @@
+// Copyright 2022 Google LLC
+//
+// Use of this source code is governed by a BSD-style
+// license that can be found in the LICENSE file or at
+// https://developers.google.com/open-source/licenses/bsd
+
+#include "lib/bpf_rescue.h"
+
+#include <sys/epoll.h>
+#include <sys/eventfd.h>
+#include <sys/mman.h>
+#include <unistd.h>
+
+#include <algorithm>
+#include <cstring>
+
+#include "lib/base.h"
+
+namespace ghost {
+
+BpfRingConsumer::BpfRingConsumer(std::atomic<uint64_t>* consumer_pos,
+                                 const std::atomic<uint64_t>* producer_pos,
+                                 const char* data, size_t size)
+    : consumer_pos_(consumer_pos),
+      producer_pos_(producer_pos),
+      data_(data),
+      mask_(size - 1) {
+  CHECK_NE(size, 0);
+  CHECK_EQ(size & (size - 1), 0);
+}
+
+BpfRingConsumer::~BpfRingConsumer() {
+  if (consumer_map_) {
+    CHECK_EQ(munmap(consumer_map_, getpagesize()), 0);
+  }
+  if (producer_map_) {
+    CHECK_EQ(munmap(producer_map_, producer_map_size_), 0);
+  }
+}
+
+// static
+std::unique_ptr<BpfRingConsumer> BpfRingConsumer::FromMap(int map_fd,
+                                                          size_t size) {
+  const size_t page_size = getpagesize();
+
+  // The first page holds the consumer position and is the only writable one.
+  void* consumer_map = mmap(nullptr, page_size, PROT_READ | PROT_WRITE,
+                            MAP_SHARED, map_fd, 0);
+  CHECK_NE(consumer_map, MAP_FAILED);
+
+  // Then the producer position, followed by the data area, which the kernel
+  // maps twice.
+  const size_t producer_map_size = page_size + 2 * size;
+  void* producer_map =
+      mmap(nullptr, producer_map_size, PROT_READ, MAP_SHARED, map_fd,
+           page_size);
+  CHECK_NE(producer_map, MAP_FAILED);
+
+  auto consumer = std::make_unique<BpfRingConsumer>(
+      static_cast<std::atomic<uint64_t>*>(consumer_map),
+      static_cast<const std::atomic<uint64_t>*>(producer_map),
+      static_cast<const char*>(producer_map) + page_size, size);
+  consumer->consumer_map_ = consumer_map;
+  consumer->producer_map_ = producer_map;
+  consumer->producer_map_size_ = producer_map_size;
+  return consumer;
+}
+
+void BpfTaskRescuer::Receive(const bpf_rescue_msg& msg) {
+  stats_.received++;
+  auto [it, inserted] = pending_.try_emplace(msg.gtid, msg);
+  if (!inserted) {
+    // bpf gave up on the task again, e.g. it woke up again before we could
+    // hand it back. The newer barrier is the one that will let us run it.
+    it->second = msg;
+    stats_.merged++;
+    return;
+  }
+  order_.push_back(msg.gtid);
+  stats_.backlog = order_.size();
+  stats_.max_backlog = std::max(stats_.max_backlog, stats_.backlog);
+}
+
+size_t BpfTaskRescuer::Reinject() {
+  while (!order_.empty()) {
+    auto it = pending_.find(order_.front());
+    CHECK(it != pending_.end());
+    if (!reinject_(it->second)) {
+      stats_.retries++;
+      break;
+    }
+    stats_.reinjected++;
+    pending_.erase(it);
+    order_.pop_front();
+  }
+  stats_.backlog = order_.size();
+  return order_.size();
+}
+
+BpfRescueChannel::BpfRescueChannel(
+    int ring_map_fd, size_t ring_size,
+    std::function<bool(const bpf_rescue_msg&)> reinject,
+    absl::Duration retry_period)
+    : ring_map_fd_(ring_map_fd),
+      consumer_(BpfRingConsumer::FromMap(ring_map_fd, ring_size)),
+      retry_ms_(std::max<int64_t>(1, absl::ToInt64Milliseconds(retry_period))),
+      rescuer_(std::move(reinject)) {
+  stop_fd_ = eventfd(0, EFD_CLOEXEC);
+  CHECK_GE(stop_fd_, 0);
+  thread_ = std::thread(&BpfRescueChannel::Loop, this);
+}
+
+BpfRescueChannel::~BpfRescueChannel() {
+  uint64_t one = 1;
+  CHECK_EQ(write(stop_fd_, &one, sizeof(one)), sizeof(one));
+  thread_.join();
+  close(stop_fd_);
+}
+
+BpfTaskRescuer::Stats BpfRescueChannel::stats() const {
+  absl::MutexLock lock(&mu_);
+  return rescuer_.stats();
+}
+
+void BpfRescueChannel::Loop() {
+  int epfd = epoll_create1(EPOLL_CLOEXEC);
+  CHECK_GE(epfd, 0);
+  struct epoll_event ev = {};
+  ev.events = EPOLLIN;
+  ev.data.fd = ring_map_fd_;
+  CHECK_EQ(epoll_ctl(epfd, EPOLL_CTL_ADD, ring_map_fd_, &ev), 0);
+  ev.data.fd = stop_fd_;
+  CHECK_EQ(epoll_ctl(epfd, EPOLL_CTL_ADD, stop_fd_, &ev), 0);
+
+  size_t backlog = 0;
+  for (;;) {
+    struct epoll_event events[2];
+    int ret = epoll_wait(epfd, events, 2, backlog ? retry_ms_ : -1);
+    if (ret < 0) {
+      CHECK_EQ(errno, EINTR);
+      continue;
+    }
+    bool stop = false;
+    for (int i = 0; i < ret; ++i) {
+      stop |= events[i].data.fd == stop_fd_;
+    }
+    if (stop) {
+      break;
+    }
+
+    absl::MutexLock lock(&mu_);
+    consumer_->Consume([this](const void* record, uint32_t len) {
+      mu_.AssertHeld();
+      // bpf only writes bpf_rescue_msgs, so anything else is a bug.
+      CHECK_EQ(len, sizeof(bpf_rescue_msg));
+      bpf_rescue_msg msg;
+      memcpy(&msg, record, sizeof(msg));
+      rescuer_.Receive(msg);
+    });
+    backlog = rescuer_.Reinject();
+  }
+  close(epfd);
+}
+
+}  // namespace ghost
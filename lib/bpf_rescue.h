@@ -0,0 +1,177 @@
+// Copyright 2022 Google LLC
+//
+// Use of this source code is governed by a BSD-style
+// license that can be found in the LICENSE file or at
+// https://developers.google.com/open-source/licenses/bsd
+
+// Userspace side of the BPF rescue channel (third_party/bpf/rescue.bpf.h):
+// BPF schedulers send the tasks they could not track or enqueue over a
+// BPF_MAP_TYPE_RINGBUF, and the agent hands them back.
+
+#ifndef GHOST_LIB_BPF_RESCUE_H_
+#define GHOST_LIB_BPF_RESCUE_H_
+
+#include <atomic>
+#include <cstddef>
+#include <cstdint>
+#include <deque>
+#include <functional>
+#include <memory>
+#include <thread>
+
+#include "absl/base/thread_annotations.h"
+#include "absl/container/flat_hash_map.h"
+#include "absl/synchronization/mutex.h"
+#include "absl/time/time.h"
+#include "third_party/bpf/rescue.bpf.h"
+
+namespace ghost {
+
+// Consumes records from a BPF ring buffer (BPF_MAP_TYPE_RINGBUF). This is what
+// libbpf's ring_buffer does, but it works on any memory laid out like the
+// kernel's ring, which lets us test it.
+//
+// The layout is:
+// - The consumer position, written by us.
+// - The producer position, written by the kernel.
+// - The data area of `size` bytes (a power of 2), mapped twice in a row so that
+//   records that wrap around are contiguous. Each record starts with an 8 byte
+//   header: its length, with the BUSY bit set while the producer is writing the
+//   record and the DISCARD bit set if the producer discarded it. Records are 8
+//   byte aligned.
+class BpfRingConsumer {
+ public:
+  BpfRingConsumer(std::atomic<uint64_t>* consumer_pos,
+                  const std::atomic<uint64_t>* producer_pos, const char* data,
+                  size_t size);
+  ~BpfRingConsumer();
+
+  // Maps the ring of `map_fd`, a BPF_MAP_TYPE_RINGBUF whose data area is `size`
+  // bytes (i.e. its max_entries).
+  static std::unique_ptr<BpfRingConsumer> FromMap(int map_fd, size_t size);
+
+  // Calls `f(const void* record, uint32_t len)` for each record that is ready,
+  // in order, and returns how many records it consumed. Stops at the first
+  // record the producer is still writing.
+  template <class F>
+  int Consume(F f) {
+    int nr_consumed = 0;
+    uint64_t cons = consumer_pos_->load(std::memory_order_relaxed);
+    const uint64_t prod = producer_pos_->load(std::memory_order_acquire);
+    while (cons < prod) {
+      const auto* hdr = reinterpret_cast<const std::atomic<uint32_t>*>(
+          data_ + (cons & mask_));
+      const uint32_t len = hdr->load(std::memory_order_acquire);
+      if (len & kBusyBit) {
+        break;
+      }
+      const uint32_t payload = len & ~(kBusyBit | kDiscardBit);
+      if (!(len & kDiscardBit)) {
+        f(static_cast<const void*>(data_ + (cons & mask_) + kHeaderSize),
+          payload);
+        nr_consumed++;
+      }
+      cons += RecordSize(payload);
+      // Free the space as we go, so the producer can reuse it.
+      consumer_pos_->store(cons, std::memory_order_release);
+    }
+    return nr_consumed;
+  }
+
+  // Number of bytes a record with `len` bytes of payload takes in the ring.
+  static uint64_t RecordSize(uint32_t len) {
+    return (static_cast<uint64_t>(len) + kHeaderSize + 7) & ~7ull;
+  }
+
+  static constexpr uint32_t kBusyBit = 1u << 31;
+  static constexpr uint32_t kDiscardBit = 1u << 30;
+  static constexpr uint32_t kHeaderSize = 8;
+
+ private:
+  std::atomic<uint64_t>* consumer_pos_;
+  const std::atomic<uint64_t>* producer_pos_;
+  const char* data_;
+  uint64_t mask_;
+
+  // Set by FromMap(), for unmapping.
+  void* consumer_map_ = nullptr;
+  void* producer_map_ = nullptr;
+  size_t producer_map_size_ = 0;
+};
+
+// Hands rescued tasks back to bpf. Tasks that `reinject` does not take (e.g.
+// because the rescue_rq is full) stay in a backlog and are retried by later
+// calls to `Reinject`. A task appears in the backlog at most once, with the
+// barrier of its latest record.
+//
+// Not thread-safe.
+class BpfTaskRescuer {
+ public:
+  struct Stats {
+    uint64_t received = 0;
+    uint64_t reinjected = 0;
+    // Failed attempts to reinject.
+    uint64_t retries = 0;
+    // Records for tasks that were already in the backlog.
+    uint64_t merged = 0;
+    uint64_t backlog = 0;
+    uint64_t max_backlog = 0;
+  };
+
+  // `reinject(msg)` returns false if it could not hand the task back.
+  explicit BpfTaskRescuer(std::function<bool(const bpf_rescue_msg&)> reinject)
+      : reinject_(std::move(reinject)) {}
+
+  void Receive(const bpf_rescue_msg& msg);
+
+  // Tries to reinject the backlog, oldest first, stopping at the first
+  // failure. Returns the size of the remaining backlog.
+  size_t Reinject();
+
+  const Stats& stats() const { return stats_; }
+
+ private:
+  std::function<bool(const bpf_rescue_msg&)> reinject_;
+  // Backlog, in the order the tasks were received.
+  std::deque<uint64_t> order_;
+  absl::flat_hash_map<uint64_t, bpf_rescue_msg> pending_;
+  Stats stats_;
+};
+
+// The rescue counters of a scheduler: bpf's, from its bss, and the agent's.
+// Schedulers return this in their RPC response buffer.
+struct BpfRescueReport {
+  bpf_rescue_stats bpf;
+  BpfTaskRescuer::Stats agent;
+};
+
+// Runs a thread that epolls on a rescue ring, drains it into a BpfTaskRescuer
+// and reinjects the tasks. While there is a backlog, it retries every
+// `retry_period`.
+class BpfRescueChannel {
+ public:
+  BpfRescueChannel(int ring_map_fd, size_t ring_size,
+                   std::function<bool(const bpf_rescue_msg&)> reinject,
+                   absl::Duration retry_period = absl::Milliseconds(1));
+  ~BpfRescueChannel();
+
+  BpfRescueChannel(const BpfRescueChannel&) = delete;
+  BpfRescueChannel& operator=(const BpfRescueChannel&) = delete;
+
+  BpfTaskRescuer::Stats stats() const;
+
+ private:
+  void Loop();
+
+  int ring_map_fd_;
+  std::unique_ptr<BpfRingConsumer> consumer_;
+  int stop_fd_;
+  int retry_ms_;
+  mutable absl::Mutex mu_;
+  BpfTaskRescuer rescuer_ ABSL_GUARDED_BY(mu_);
+  std::thread thread_;
+};
+
+}  // namespace ghost
+
+#endif  // GHOST_LIB_BPF_RESCUE_H_
@@ -0,0 +1,153 @@
+// Copyright 2022 Google LLC
+//
+// Use of this source code is governed by a BSD-style
+// license that can be found in the LICENSE file or at
+// https://developers.google.com/open-source/licenses/bsd
+
+#include "lib/bpf_telemetry.h"
+
+#include <algorithm>
+#include <cstring>
+
+namespace ghost {
+
+// static
+int BpfTelemetryStats::LatencyBucket(uint64_t us) {
+  // Bucket i > 0 holds [2^(i-1), 2^i), i.e. the latencies with i significant
+  // bits.
+  int bucket = us ? 64 - __builtin_clzll(us) : 0;
+  return std::min(bucket, kLatencyBuckets - 1);
+}
+
+// static
+uint64_t BpfTelemetryStats::LatencyPercentile(const LatencyStats& latency,
+                                              double percentile) {
+  if (!latency.count) {
+    return 0;
+  }
+  const double target = latency.count * std::clamp(percentile, 0.0, 100.0) /
+                        100.0;
+  uint64_t seen = 0;
+  for (int i = 0; i < kLatencyBuckets - 1; ++i) {
+    seen += latency.buckets[i];
+    if (seen >= target) {
+      return 1ull << i;
+    }
+  }
+  return latency.max_us;
+}
+
+bool BpfTelemetryPage::Read(BpfTelemetryStats* out) const {
+  uint64_t begin = seq.load(std::memory_order_acquire);
+  if (begin & 1) {
+    return false;
+  }
+  memcpy(out, &stats, sizeof(stats));
+  std::atomic_thread_fence(std::memory_order_acquire);
+  return seq.load(std::memory_order_relaxed) == begin;
+}
+
+void BpfTelemetryPage::Write(const BpfTelemetryStats& in) {
+  uint64_t s = seq.load(std::memory_order_relaxed);
+  seq.store(s + 1, std::memory_order_relaxed);
+  std::atomic_thread_fence(std::memory_order_release);
+  memcpy(&stats, &in, sizeof(stats));
+  seq.store(s + 2, std::memory_order_release);
+}
+
+BpfTelemetrySampler::BpfTelemetrySampler(uint32_t nr_slots)
+    : stats_(std::make_unique<BpfTelemetryStats>()),
+      last_ran_at_(nr_slots) {}
+
+void BpfTelemetrySampler::SampleCpu(int cpu, bool busy) {
+  CHECK_GE(cpu, 0);
+  CHECK_LT(cpu, BpfTelemetryStats::kMaxCpus);
+  BpfTelemetryStats::CpuStats& cs = stats_->cpus[cpu];
+  cs.samples++;
+  cs.busy_samples += busy;
+  stats_->nr_cpus = std::max<uint32_t>(stats_->nr_cpus, cpu + 1);
+}
+
+void BpfTelemetrySampler::SampleTask(uint32_t slot, uint64_t ran_at,
+                                     uint64_t runnable_at) {
+  CHECK_LT(slot, last_ran_at_.size());
+  uint64_t& last = last_ran_at_[slot];
+  if (ran_at == last) {
+    return;
+  }
+  last = ran_at;
+  // Before the first round ends, we don't know whether the task ran recently.
+  // If runnable_at is later, the task became runnable again after running and
+  // we lost its latency.
+  if (primed_ && ran_at && runnable_at && runnable_at <= ran_at) {
+    RecordLatency(ran_at - runnable_at);
+  }
+}
+
+void BpfTelemetrySampler::RecordLatency(uint64_t us) {
+  BpfTelemetryStats::LatencyStats& lat = stats_->latency;
+  lat.count++;
+  lat.sum_us += us;
+  lat.max_us = std::max(lat.max_us, us);
+  lat.buckets[BpfTelemetryStats::LatencyBucket(us)]++;
+}
+
+void BpfTelemetrySampler::EndRound(absl::Time now) {
+  primed_ = true;
+  stats_->nr_samples++;
+  stats_->updated_at_ns = absl::ToUnixNanos(now);
+}
+
+BpfTelemetry::BpfTelemetry(uint32_t nr_slots,
+                           std::function<void(BpfTelemetrySampler&)> sample,
+                           absl::Duration period)
+    : sample_(std::move(sample)),
+      period_(period),
+      sampler_(nr_slots),
+      shmem_(kVersion, kShmemName, sizeof(BpfTelemetryPage)) {
+  page_ = new (shmem_.bytes()) BpfTelemetryPage();
+  sampler_.set_period(period_);
+  page_->Write(sampler_.stats());
+  shmem_.MarkReady();
+  thread_ = std::thread(&BpfTelemetry::Loop, this);
+}
+
+BpfTelemetry::~BpfTelemetry() {
+  stop_.Notify();
+  thread_.join();
+}
+
+void BpfTelemetry::Loop() {
+  // Sample at fixed times rather than at fixed intervals after each round, so
+  // that the time we spend sampling doesn't skew the period.
+  absl::Time next = MonotonicNow();
+  for (;;) {
+    next += period_;
+    if (stop_.WaitForNotificationWithTimeout(next - MonotonicNow())) {
+      return;
+    }
+    sample_(sampler_);
+    sampler_.EndRound(MonotonicNow());
+    page_->Write(sampler_.stats());
+  }
+}
+
+// static
+std::unique_ptr<BpfTelemetryReader> BpfTelemetryReader::Attach(pid_t pid) {
+  auto reader = std::unique_ptr<BpfTelemetryReader>(new BpfTelemetryReader());
+  if (!reader->shmem_.Attach(BpfTelemetry::kVersion, BpfTelemetry::kShmemName,
+                             pid)) {
+    return nullptr;
+  }
+  reader->page_ =
+      reinterpret_cast<const BpfTelemetryPage*>(reader->shmem_.bytes());
+  return reader;
+}
+
+void BpfTelemetryReader::Read(BpfTelemetryStats* out) const {
+  while (!page_->Read(out)) {
+    Pause();
+  }
+}
+
+}  // namespace ghost
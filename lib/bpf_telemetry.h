@@ -0,0 +1,168 @@
+// Copyright 2022 Google LLC
+//
+// Use of this source code is governed by a BSD-style
+// license that can be found in the LICENSE file or at
+// https://developers.google.com/open-source/licenses/bsd
+
+// Live telemetry for BPF schedulers, which have no userspace scheduling loop to
+// instrument. A thread in the agent periodically samples the scheduler's
+// mmapped bpf maps, which costs no syscalls, and publishes per-cpu utilization
+// and a histogram of runnable-to-run latencies in a shared memory page. Other
+// processes (e.g. Orca or util/bpf_telemetry) attach to the page with
+// `BpfTelemetryReader`.
+//
+// All the counters are cumulative: diff two snapshots to get the stats of an
+// interval.
+
+#ifndef GHOST_LIB_BPF_TELEMETRY_H_
+#define GHOST_LIB_BPF_TELEMETRY_H_
+
+#include <atomic>
+#include <cstdint>
+#include <functional>
+#include <memory>
+#include <thread>
+#include <vector>
+
+#include "absl/synchronization/notification.h"
+#include "absl/time/time.h"
+#include "lib/base.h"
+#include "shared/shmem.h"
+
+namespace ghost {
+
+// The stats in the telemetry page.
+struct BpfTelemetryStats {
+  static constexpr int kMaxCpus = 1024;
+  // Latency bucket 0 counts latencies under 1us and bucket i > 0 counts
+  // latencies in [2^(i-1), 2^i) us. The last bucket also counts anything
+  // longer.
+  static constexpr int kLatencyBuckets = 32;
+
+  struct CpuStats {
+    uint64_t samples;
+    // Samples in which the cpu was running a task.
+    uint64_t busy_samples;
+  };
+
+  struct LatencyStats {
+    uint64_t count;
+    uint64_t sum_us;
+    uint64_t max_us;
+    uint64_t buckets[kLatencyBuckets];
+  };
+
+  // Number of sampling rounds.
+  uint64_t nr_samples;
+  int64_t period_ns;
+  // MonotonicNow() at the end of the last round.
+  int64_t updated_at_ns;
+  // 1 + the highest cpu id that is sampled.
+  uint32_t nr_cpus;
+  CpuStats cpus[kMaxCpus];
+  // Time from a task becoming runnable to it getting on cpu.
+  LatencyStats latency;
+
+  // Returns the bucket for a latency of `us`.
+  static int LatencyBucket(uint64_t us);
+  // Returns the upper bound in us of the latency below which `percentile` (in
+  // [0, 100]) of the latencies in `latency` lie, at the bucket granularity.
+  static uint64_t LatencyPercentile(const LatencyStats& latency,
+                                    double percentile);
+};
+
+// The shared memory page. The agent updates the stats under a seqlock.
+struct BpfTelemetryPage {
+  std::atomic<uint64_t> seq;
+  BpfTelemetryStats stats;
+
+  // Copies the stats into `out`. Returns false if the writer got in the way, in
+  // which case the caller should retry.
+  bool Read(BpfTelemetryStats* out) const;
+  void Write(const BpfTelemetryStats& in);
+};
+
+// Turns samples of a scheduler's bpf maps into `BpfTelemetryStats`. Not
+// thread-safe.
+class BpfTelemetrySampler {
+ public:
+  // `nr_slots` is the number of per-task entries in the scheduler's maps.
+  explicit BpfTelemetrySampler(uint32_t nr_slots);
+
+  // Records whether `cpu` is running a task.
+  void SampleCpu(int cpu, bool busy);
+
+  // Records the timestamps (in us) of the task in `slot`: when it last got on
+  // cpu and when it last became runnable. Counts a latency when `ran_at`
+  // changed since the previous round and follows `runnable_at`.
+  //
+  // Since we sample, we miss the latencies of tasks that ran more than once in
+  // a round, or that ran and became runnable again within a round.
+  void SampleTask(uint32_t slot, uint64_t ran_at, uint64_t runnable_at);
+
+  // Ends a round of samples. The first round only establishes the tasks'
+  // baselines.
+  void EndRound(absl::Time now);
+
+  const BpfTelemetryStats& stats() const { return *stats_; }
+  void set_period(absl::Duration period) {
+    stats_->period_ns = absl::ToInt64Nanoseconds(period);
+  }
+
+ private:
+  void RecordLatency(uint64_t us);
+
+  // BpfTelemetryStats is too big for the stack.
+  std::unique_ptr<BpfTelemetryStats> stats_;
+  std::vector<uint64_t> last_ran_at_;
+  bool primed_ = false;
+};
+
+// Runs a thread that calls `sample` every `period` and publishes the results in
+// a shared memory page.
+class BpfTelemetry {
+ public:
+  static constexpr int64_t kVersion = 1;
+  static constexpr char kShmemName[] = "bpf-telemetry";
+
+  // `sample(sampler)` reads the bpf maps and reports what it finds with
+  // `sampler.SampleCpu()` and `sampler.SampleTask()`.
+  BpfTelemetry(uint32_t nr_slots,
+               std::function<void(BpfTelemetrySampler&)> sample,
+               absl::Duration period = absl::Milliseconds(10));
+  ~BpfTelemetry();
+
+  BpfTelemetry(const BpfTelemetry&) = delete;
+  BpfTelemetry& operator=(const BpfTelemetry&) = delete;
+
+ private:
+  void Loop();
+
+  std::function<void(BpfTelemetrySampler&)> sample_;
+  absl::Duration period_;
+  BpfTelemetrySampler sampler_;
+  GhostShmem shmem_;
+  BpfTelemetryPage* page_;
+  absl::Notification stop_;
+  std::thread thread_;
+};
+
+// Reads the telemetry page of the agent `pid`.
+class BpfTelemetryReader {
+ public:
+  // Returns nullptr if `pid` does not publish telemetry.
+  static std::unique_ptr<BpfTelemetryReader> Attach(pid_t pid);
+
+  // Copies the current stats into `out`.
+  void Read(BpfTelemetryStats* out) const;
+
+ private:
+  BpfTelemetryReader() = default;
+
+  GhostShmem shmem_;
+  const BpfTelemetryPage* page_ = nullptr;
+};
+
+}  // namespace ghost
+
+#endif  // GHOST_LIB_BPF_TELEMETRY_H_
@@ -17,6 +17,7 @@
 #include "absl/strings/numbers.h"
 #include "bpf/user/agent.h"
 #include "lib/agent.h"
+#include "lib/live_update.h"
 #include "lib/scheduler.h"
 
 namespace ghost {
@@ -150,14 +151,18 @@ std::string ReadString(int fd) {
   return std::string(buf, p - buf);
 }
 
+StatusWordTable* LocalEnclave::GetStatusWordTable() {
+  // TODO: Need to support more than one SW region.
+  StatusWordTable* tbl = GhostHelper()->GetGlobalStatusWordTable();
+  CHECK_NE(tbl, nullptr);
+  return tbl;
+}
+
 void LocalEnclave::ForEachTaskStatusWord(
     const std::function<void(ghost_status_word* sw, uint32_t region_id,
                              uint32_t idx)>
         l) {
-  // TODO: Need to support more than one SW region.
-  StatusWordTable* tbl = GhostHelper()->GetGlobalStatusWordTable();
-  CHECK_NE(tbl, nullptr);
-  tbl->ForEachTaskStatusWord(l);
+  GetStatusWordTable()->ForEachTaskStatusWord(l);
 }
 
 // Makes the next available enclave from ghostfs.  Returns the FD for the ctl
@@ -701,6 +706,15 @@ void LocalEnclave::PrepareToExit() {
 }
 
 void LocalEnclave::WaitForOldAgent() {
+  if (nr_waiting_for_old_agent_.fetch_add(1) + 1 == enclave_cpus_.Size()) {
+    int online;
+    if (absl::SimpleAtoi(ReadEnclaveTunable(dir_fd_, "agent_online"),
+                         &online) &&
+        online) {
+      printf("%s\n", kReadyForHandoffMsg);
+      fflush(stdout);
+    }
+  }
   WaitForAgentOnlineValue(dir_fd_, /*until=*/0);
 }
 
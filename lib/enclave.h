@@ -19,6 +19,7 @@
 #ifndef GHOST_LIB_ENCLAVE_H_
 #define GHOST_LIB_ENCLAVE_H_
 
+#include <atomic>
 #include <list>
 
 #include "absl/synchronization/mutex.h"
@@ -137,6 +138,10 @@ class Enclave {
 
   virtual Agent* GetAgent(const Cpu& cpu) = 0;
 
+  // Returns the status word table holding the status words of the enclave's
+  // tasks.
+  virtual StatusWordTable* GetStatusWordTable() = 0;
+
   // Runs l on every non-agent, ghost-task status word.
   virtual void ForEachTaskStatusWord(
       std::function<void(ghost_status_word* sw, uint32_t region_id,
@@ -549,6 +554,8 @@ class LocalEnclave final : public Enclave {
     WriteEnclaveTunable(dir_fd_, "ctl", "discover tasks");
   }
 
+  StatusWordTable* GetStatusWordTable() final;
+
   // Runs l on every non-agent, ghost-task status word.
   void ForEachTaskStatusWord(
       const std::function<void(ghost_status_word* sw, uint32_t region_id,
@@ -560,6 +567,11 @@ class LocalEnclave final : public Enclave {
 
   // If there was an old agent attached to the enclave (i.e. holding a RW fd on
   // agent_online), this blocks until that FD is closed.
+  //
+  // Once every agent task is waiting here on an old agent, prints
+  // `kReadyForHandoffMsg` (lib/live_update.h) to stdout: the new agent is
+  // ready to take over, and whoever drives the live update (e.g. Orca) can tell
+  // the old agent to exit.
   void WaitForOldAgent() final;
   void InsertBpfPrograms() final;
 
@@ -611,6 +623,7 @@ class LocalEnclave final : public Enclave {
   int dir_fd_ = -1;
   int ctl_fd_ = -1;
   int agent_online_fd_ = -1;
+  std::atomic<int> nr_waiting_for_old_agent_ = 0;
 };
 
 }  // namespace ghost
@@ -23,6 +23,7 @@
 #include <vector>
 
 #include "absl/container/flat_hash_map.h"
+#include "absl/synchronization/blocking_counter.h"
 
 // The open source Google benchmarks library includes its own verbose flag (`v`)
 // and it does not use absl to parse this flag. Thus, to avoid a symbol
@@ -181,6 +182,8 @@ int Ghost::GetSupportedVersions(std::vector<uint32_t>& versions) {
 void Ghost::InitCore() {
   Gtid::Current().assign_name("main");
   GhostSignals::Init();
+  // Flags are parsed by now. Start tracing before any agent thread prints.
+  DprintTracer::StartFromFlags();
 
   // Some of the tests don't have agents, but they call InitCore()
   CheckVersion();
@@ -217,6 +220,29 @@ int Ghost::SchedTaskEnterGhost(const Gtid& gtid, int dir_fd) {
   return SchedTaskEnterGhost(gtid.id(), dir_fd);
 }
 
+int Ghost::SchedTasksEnterGhost(const std::vector<int64_t>& pids, int dir_fd) {
+  if (dir_fd == -1) {
+    dir_fd = GhostHelper()->GetGlobalEnclaveDirFd();
+  }
+  int tasks_fd = openat(dir_fd, "tasks", O_WRONLY);
+  if (tasks_fd < 0) {
+    return -1;
+  }
+  // The tasks file takes one pid per write.
+  int ret = 0;
+  for (int64_t pid : pids) {
+    std::string pid_s = std::to_string(pid);
+    if (write(tasks_fd, pid_s.c_str(), pid_s.length()) != pid_s.length()) {
+      ret = -1;
+      break;
+    }
+  }
+  int old_errno = errno;
+  close(tasks_fd);
+  errno = old_errno;
+  return ret;
+}
+
 int Ghost::SchedAgentEnterGhost(int ctl_fd, const Cpu& cpu, int queue_fd) {
   std::string cmd = absl::StrCat("become agent ", cpu.id(), " ", queue_fd);
   ssize_t ret = write(ctl_fd, cmd.c_str(), cmd.length());
@@ -249,6 +275,17 @@ void GhostSignals::Init() {
   std::signal(SIGUSR1, SigHand);
   // Don't handle `SIGCHLD`; it's used by `ForkedProcess`.
 
+  // Writes out the `GHOST_DPRINT` trace rings. SIGUSR1 stays fatal for
+  // processes that don't trace and have no handlers of their own.
+  AddHandler(SIGUSR1, [](int) {
+    DprintTracer* tracer = DprintTracer::instance();
+    if (!tracer) {
+      return true;
+    }
+    tracer->RequestFlush();
+    return false;
+  });
+
   struct sigaction sigsegv_act = {{0}};
   sigsegv_act.sa_sigaction = SigSegvAction;
   sigsegv_act.sa_flags = SA_SIGINFO;
@@ -274,6 +311,9 @@ void GhostSignals::SigHand(int signum) {
 
   if (fatal) {
     std::cerr << "Fatal signal " << strsignal(signum) << ": " << std::endl;
+    if (DprintTracer* tracer = DprintTracer::instance()) {
+      tracer->Dump();
+    }
     Exit(1);
   }
 }
@@ -282,6 +322,9 @@ void GhostSignals::SigSegvAction(int signum, siginfo_t* info, void* uctx) {
   std::cerr << "PID " << Gtid::Current().tid() << " Fatal segfault at addr "
             << info->si_addr << ": " << std::endl;
   PrintBacktrace(stderr, uctx);
+  if (DprintTracer* tracer = DprintTracer::instance()) {
+    tracer->Dump();
+  }
   std::exit(1);
 }
 
@@ -345,6 +388,110 @@ GhostThread::GhostThread(KernelScheduler ksched, std::function<void()> work,
 
 GhostThread::~GhostThread() { CHECK(!thread_.joinable()); }
 
+// static
+std::vector<std::unique_ptr<GhostThread>> GhostThread::CreateMany(
+    const std::vector<KernelScheduler>& ksched,
+    std::vector<std::function<void()>> work, int dir_fd) {
+  CHECK_EQ(ksched.size(), work.size());
+  GhostThread::SetGlobalEnclaveFdsOnce();
+
+  // Shared with the threads, which may still be returning from
+  // `WaitForNotification()` after we return.
+  struct Startup {
+    explicit Startup(int num_threads) : started(num_threads) {}
+
+    absl::BlockingCounter started;
+    Notification ready;
+  };
+  auto startup = std::make_shared<Startup>(ksched.size());
+
+  std::vector<std::unique_ptr<GhostThread>> threads;
+  threads.reserve(ksched.size());
+  for (size_t i = 0; i < ksched.size(); i++) {
+    // `dir_fd` must only be set when the scheduler is ghOSt.
+    CHECK(ksched[i] == KernelScheduler::kGhost || dir_fd == -1);
+
+    GhostThread* t = new GhostThread(ksched[i]);
+    threads.emplace_back(t);
+    t->thread_ = std::thread([t, startup, w = std::move(work[i])] {
+      t->tid_ = GetTID();
+      t->gtid_ = Gtid::Current();
+
+      startup->started.DecrementCount();
+      startup->ready.WaitForNotification();
+
+      std::move(w)();
+    });
+  }
+  startup->started.Wait();
+
+  std::vector<int64_t> pids;
+  for (const std::unique_ptr<GhostThread>& t : threads) {
+    if (t->ksched_ == KernelScheduler::kGhost) {
+      pids.push_back(t->tid());
+    }
+  }
+  if (!pids.empty()) {
+    CHECK_EQ(GhostHelper()->SchedTasksEnterGhost(pids, dir_fd), 0);
+  }
+
+  startup->ready.Notify();
+  return threads;
+}
+
+GhostThreadPool::GhostThreadPool(GhostThread::KernelScheduler ksched,
+                                 int num_threads, int dir_fd) {
+  std::vector<std::function<void()>> work(num_threads,
+                                          [this] { ThreadMain(); });
+  threads_ = GhostThread::CreateMany(
+      std::vector<GhostThread::KernelScheduler>(num_threads, ksched),
+      std::move(work), dir_fd);
+}
+
+GhostThreadPool::~GhostThreadPool() {
+  Wait();
+  {
+    absl::MutexLock lock(&mu_);
+    stopping_ = true;
+  }
+  for (std::unique_ptr<GhostThread>& t : threads_) {
+    t->Join();
+  }
+}
+
+void GhostThreadPool::Submit(std::function<void()> work) {
+  absl::MutexLock lock(&mu_);
+  CHECK(!stopping_);
+  queue_.push_back(std::move(work));
+  pending_++;
+}
+
+void GhostThreadPool::Wait() {
+  absl::MutexLock lock(&mu_);
+  mu_.Await(absl::Condition(this, &GhostThreadPool::Idle));
+}
+
+void GhostThreadPool::ThreadMain() {
+  while (true) {
+    std::function<void()> work;
+    {
+      absl::MutexLock lock(&mu_);
+      mu_.Await(absl::Condition(this, &GhostThreadPool::HasWorkOrStopping));
+      if (queue_.empty()) {
+        // Stopping, and there is no work left.
+        return;
+      }
+      work = std::move(queue_.front());
+      queue_.pop_front();
+    }
+
+    work();
+
+    absl::MutexLock lock(&mu_);
+    pending_--;
+  }
+}
+
 void RemoteThreadTester::Run(std::function<void()> thread_work,
                              std::function<void(GhostThread*)> remote_work) {
   for (int i = 0; i < num_threads_; ++i) {
@@ -11,15 +11,20 @@
 #include <sys/ioctl.h>
 #include <sys/timerfd.h>
 
+#include <algorithm>
 #include <csignal>
 #include <cstdint>
+#include <deque>
 #include <fstream>
+#include <thread>
 #include <unordered_map>
+#include <vector>
 
 #include "absl/container/flat_hash_map.h"
 #include "absl/flags/declare.h"
 #include "absl/flags/flag.h"
 #include "absl/strings/str_split.h"
+#include "absl/synchronization/mutex.h"
 #include "kernel/ghost_uapi.h"
 #include "lib/base.h"
 #include "lib/logging.h"
@@ -51,23 +56,88 @@ class StatusWordTable {
   StatusWordTable(const StatusWordTable&) = delete;
   StatusWordTable(StatusWordTable&&) = delete;
 
-  // Runs l on every non-agent, ghost-task status word.
-  void ForEachTaskStatusWord(
-      const std::function<void(ghost_status_word* sw, uint32_t region_id,
-                               uint32_t idx)>
-          l) {
-    for (int i = 0; i < header_->capacity; ++i) {
-      ghost_status_word* sw = get(i);
-      if (!(sw->flags & GHOST_SW_F_INUSE)) {
-        continue;
+  uint32_t capacity() const { return header_->capacity; }
+
+  // Runs `l(sw, region_id, idx)` on every non-agent, ghost-task status word, in
+  // index order.
+  template <class F>
+  void ForEachTaskStatusWord(F l) {
+    ForEachTaskStatusWordInRange(0, capacity(), l);
+  }
+
+  // Like `ForEachTaskStatusWord`, but only visits indices in [begin, end).
+  //
+  // The table is scanned in chunks of `kScanChunk` status words. The flags of a
+  // chunk are first gathered into a bitmap of task status words (prefetching
+  // ahead, since status words are 32 bytes apart), and `l` is only called for
+  // the set bits. The kernel keeps no summary of which status words are in use,
+  // so every status word's flags are still loaded; the bitmap only keeps the
+  // flag loads free of branches and apart from the calls to `l`.
+  template <class F>
+  void ForEachTaskStatusWordInRange(uint32_t begin, uint32_t end, F l) {
+    static_assert(kScanChunk <= 64, "A chunk must fit in one bitmap word");
+    end = std::min(end, capacity());
+    for (uint32_t base = begin; base < end; base += kScanChunk) {
+      const uint32_t n = std::min(kScanChunk, end - base);
+      uint64_t tasks = 0;
+      for (uint32_t i = 0; i < n; ++i) {
+        if (base + i + kScanPrefetch < end) {
+          __builtin_prefetch(&table_[base + i + kScanPrefetch]);
+        }
+        const uint32_t flags = READ_ONCE(table_[base + i].flags);
+        const bool is_task = (flags & (GHOST_SW_F_INUSE |
+                                       GHOST_SW_TASK_IS_AGENT)) ==
+                             GHOST_SW_F_INUSE;
+        tasks |= uint64_t{is_task} << i;
       }
-      if (sw->flags & GHOST_SW_TASK_IS_AGENT) {
-        continue;
+      while (tasks) {
+        const uint32_t i = __builtin_ctzll(tasks);
+        tasks &= tasks - 1;
+        l(&table_[base + i], id(), base + i);
       }
-      l(sw, id(), i);
     }
   }
 
+  // Splits the table into `num_workers` contiguous ranges (multiples of
+  // `kScanChunk`) and scans them concurrently. `l(worker, sw, region_id, idx)`
+  // is called on the thread for `worker`, where worker 0 is the calling thread
+  // and the others are spawned for the duration of the call. Each worker visits
+  // its status words in index order and worker `w`'s range precedes worker
+  // `w + 1`'s, so concatenating per-worker results preserves index order.
+  template <class F>
+  void ForEachTaskStatusWordParallel(int num_workers, F l) {
+    CHECK_GT(num_workers, 0);
+    const uint32_t num_chunks = (capacity() + kScanChunk - 1) / kScanChunk;
+    const uint32_t chunks_per_worker =
+        (num_chunks + num_workers - 1) / num_workers;
+    auto scan = [this, chunks_per_worker, &l](int worker) {
+      const uint64_t begin =
+          static_cast<uint64_t>(worker) * chunks_per_worker * kScanChunk;
+      const uint64_t end = begin + chunks_per_worker * kScanChunk;
+      if (begin >= capacity()) {
+        return;
+      }
+      ForEachTaskStatusWordInRange(
+          begin, std::min<uint64_t>(end, capacity()),
+          [worker, &l](ghost_status_word* sw, uint32_t region_id,
+                       uint32_t idx) { l(worker, sw, region_id, idx); });
+    };
+
+    std::vector<std::thread> threads;
+    threads.reserve(num_workers - 1);
+    for (int worker = 1; worker < num_workers; ++worker) {
+      threads.emplace_back(scan, worker);
+    }
+    scan(0);
+    for (std::thread& t : threads) {
+      t.join();
+    }
+  }
+
+  // See `ForEachTaskStatusWordInRange`.
+  static constexpr uint32_t kScanChunk = 64;
+  static constexpr uint32_t kScanPrefetch = 8;
+
  protected:
   // Empty constructor for subclasses.
   StatusWordTable() {}
@@ -377,6 +447,12 @@ class Ghost {
   // the enclave dir_fd previously set with SetGlobalEnclaveFds().
   virtual int SchedTaskEnterGhost(int64_t pid, int dir_fd);
   virtual int SchedTaskEnterGhost(const Gtid& gtid, int dir_fd);
+  // Moves each of `pids` to the ghOSt scheduling class like
+  // `SchedTaskEnterGhost()`, but opens the enclave's tasks file once for all of
+  // them rather than once per thread. Stops at the first thread that fails to
+  // move and returns -1 with errno set. Otherwise, returns 0.
+  virtual int SchedTasksEnterGhost(const std::vector<int64_t>& pids,
+                                   int dir_fd);
   // Makes calling thread the ghost agent on `cpu`.  Note that the calling
   // thread must have the `CAP_SYS_NICE` capability to make itself an agent.
   virtual int SchedAgentEnterGhost(int ctl_fd, const Cpu& cpu, int queue_fd);
@@ -577,7 +653,21 @@ class GhostThread {
   // Used by client processes who don't care which enclave they are in.
   static void SetGlobalEnclaveFdsOnce();
 
+  // Creates a thread that runs `work[i]` in the kernel scheduling class
+  // `ksched[i]` for each `i`. Constructing hundreds of threads one at a time
+  // waits for each to start before spawning the next, and has each ghOSt
+  // thread open the enclave's tasks file to move itself. This spawns all of
+  // the threads before waiting for any, and then moves the ghOSt ones into the
+  // enclave in one batch. Returns once every thread is running in its
+  // scheduling class. No thread starts its work before then.
+  static std::vector<std::unique_ptr<GhostThread>> CreateMany(
+      const std::vector<KernelScheduler>& ksched,
+      std::vector<std::function<void()>> work, int dir_fd = -1);
+
  private:
+  // Used by `CreateMany()`, which starts the thread itself.
+  explicit GhostThread(KernelScheduler ksched) : ksched_(ksched) {}
+
   // The thread's TID (thread identifier).
   int tid_;
 
@@ -594,6 +684,60 @@ class GhostThread {
   std::thread thread_;
 };
 
+// A fixed set of threads that park between pieces of work. Creating a ghOSt
+// thread costs a clone, a move into the enclave and a MSG_TASK_NEW (and, when
+// it exits, a MSG_TASK_DEAD) for the agent to handle. A pool pays that once, up
+// front, so that running work later only wakes up a parked thread.
+//
+// Example:
+// GhostThreadPool pool(GhostThread::KernelScheduler::kGhost,
+//                      /*num_threads=*/8);
+// for (Request& r : requests) {
+//   pool.Submit([&r] { Handle(r); });
+// }
+// pool.Wait();
+class GhostThreadPool {
+ public:
+  // Creates `num_threads` threads in the kernel scheduling class `ksched` with
+  // `GhostThread::CreateMany()`.
+  GhostThreadPool(GhostThread::KernelScheduler ksched, int num_threads,
+                  int dir_fd = -1);
+  GhostThreadPool(const GhostThreadPool&) = delete;
+  GhostThreadPool& operator=(const GhostThreadPool&) = delete;
+
+  // Waits for the work submitted so far to finish and joins the threads.
+  ~GhostThreadPool();
+
+  // Queues `work` to run on the next free thread.
+  void Submit(std::function<void()> work) ABSL_LOCKS_EXCLUDED(mu_);
+
+  // Waits until all the work submitted so far has finished.
+  void Wait() ABSL_LOCKS_EXCLUDED(mu_);
+
+  int num_threads() const { return threads_.size(); }
+
+  const std::vector<std::unique_ptr<GhostThread>>& threads() const {
+    return threads_;
+  }
+
+ private:
+  // Runs work from `queue_` until the pool is destroyed.
+  void ThreadMain() ABSL_LOCKS_EXCLUDED(mu_);
+
+  bool Idle() const ABSL_EXCLUSIVE_LOCKS_REQUIRED(mu_) { return pending_ == 0; }
+  bool HasWorkOrStopping() const ABSL_EXCLUSIVE_LOCKS_REQUIRED(mu_) {
+    return stopping_ || !queue_.empty();
+  }
+
+  absl::Mutex mu_;
+  std::deque<std::function<void()>> queue_ ABSL_GUARDED_BY(mu_);
+  // The number of pieces of work that are queued or running.
+  int pending_ ABSL_GUARDED_BY(mu_) = 0;
+  bool stopping_ ABSL_GUARDED_BY(mu_) = false;
+
+  std::vector<std::unique_ptr<GhostThread>> threads_;
+};
+
 // Test helper class that launches threads and performs operations on them while
 // they do their work.
 //
@@ -0,0 +1,134 @@
+// Copyright 2022 Google LLC
+//
+// Use of this source code is governed by a BSD-style
+// license that can be found in the LICENSE file or at
+// https://developers.google.com/open-source/licenses/bsd
+
+#include "lib/gtid_names.h"
+
+#include <string.h>
+
+#include "absl/numeric/bits.h"
+#include "absl/strings/str_format.h"
+#include "lib/base.h"
+
+namespace ghost {
+
+GtidNameRegistry::GtidNameRegistry(size_t initial_capacity) {
+  CHECK_GE(initial_capacity, 2);
+  tables_.push_back(
+      std::make_unique<Table>(absl::bit_ceil(initial_capacity)));
+  table_.store(tables_.back().get(), std::memory_order_release);
+}
+
+// static
+GtidNameRegistry::Slot* GtidNameRegistry::Probe(const Table& table,
+                                                int64_t gtid) {
+  // The low bits of a gtid are a sequence number, which is 0 or close to it
+  // for most threads, so mix them into the index.
+  size_t i = (static_cast<uint64_t>(gtid) * 0x9e3779b97f4a7c15ULL) >> 32;
+  while (true) {
+    const Slot& slot = table.slots[i & table.mask];
+    const int64_t g = slot.gtid.load(std::memory_order_acquire);
+    if (g == gtid || g == 0) {
+      return const_cast<Slot*>(&slot);
+    }
+    ++i;
+  }
+}
+
+// static
+absl::string_view GtidNameRegistry::Name(const Slot& slot) {
+  const uint32_t version = slot.version.load(std::memory_order_acquire);
+  DCHECK_GT(version, 0);
+  return slot.names[version % 2];
+}
+
+// static
+void GtidNameRegistry::WriteName(Slot* slot, absl::string_view name) {
+  const uint32_t version = slot->version.load(std::memory_order_relaxed) + 1;
+  char* buf = slot->names[version % 2];
+  const size_t len = std::min(name.size(), kMaxNameLength);
+  memcpy(buf, name.data(), len);
+  buf[len] = '\0';
+  slot->version.store(version, std::memory_order_release);
+}
+
+GtidNameRegistry::Slot* GtidNameRegistry::FindOrClaim(int64_t gtid) {
+  Table* table = table_.load(std::memory_order_relaxed);
+  Slot* slot = Probe(*table, gtid);
+  if (slot->gtid.load(std::memory_order_relaxed) == gtid) {
+    return slot;
+  }
+  if (2 * (table->used + 1) > table->slots.size()) {
+    Grow();
+    table = table_.load(std::memory_order_relaxed);
+    slot = Probe(*table, gtid);
+  }
+  table->used++;
+  // Readers don't look at the name until it has a version.
+  slot->gtid.store(gtid, std::memory_order_release);
+  return slot;
+}
+
+void GtidNameRegistry::Grow() {
+  const Table& old = *table_.load(std::memory_order_relaxed);
+  auto table = std::make_unique<Table>(2 * old.slots.size());
+  for (const Slot& from : old.slots) {
+    const int64_t gtid = from.gtid.load(std::memory_order_relaxed);
+    if (gtid == 0) {
+      continue;
+    }
+    Slot* to = Probe(*table, gtid);
+    to->gtid.store(gtid, std::memory_order_relaxed);
+    if (from.version.load(std::memory_order_relaxed) > 0) {
+      WriteName(to, Name(from));
+    }
+    table->used++;
+  }
+  // Publishes the copied names along with the table.
+  table_.store(table.get(), std::memory_order_release);
+  tables_.push_back(std::move(table));
+}
+
+void GtidNameRegistry::Assign(int64_t gtid, absl::string_view name) {
+  CHECK_NE(gtid, 0);
+
+  absl::base_internal::SpinLockHolder lock(&lock_);
+  WriteName(FindOrClaim(gtid), name);
+}
+
+absl::string_view GtidNameRegistry::Lookup(int64_t gtid) {
+  absl::string_view name = Find(gtid);
+  if (!name.empty()) {
+    return name;
+  }
+
+  absl::base_internal::SpinLockHolder lock(&lock_);
+  Slot* slot = FindOrClaim(gtid);
+  // Someone may have named it since we looked.
+  if (slot->version.load(std::memory_order_relaxed) == 0) {
+    const size_t idx = table_.load(std::memory_order_relaxed)->used - 1;
+    WriteName(slot, absl::StrFormat("%c%d/%d/%lld", 'A' + (idx % 26), idx / 26,
+                                    Gtid(gtid).tid(), gtid));
+  }
+  return Name(*slot);
+}
+
+absl::string_view GtidNameRegistry::Find(int64_t gtid) const {
+  DCHECK_NE(gtid, 0);
+
+  const Slot* slot = Probe(*table_.load(std::memory_order_acquire), gtid);
+  if (slot->gtid.load(std::memory_order_acquire) != gtid ||
+      slot->version.load(std::memory_order_acquire) == 0) {
+    return absl::string_view();
+  }
+  return Name(*slot);
+}
+
+size_t GtidNameRegistry::size() const {
+  absl::base_internal::SpinLockHolder lock(&lock_);
+  return table_.load(std::memory_order_relaxed)->used;
+}
+
+}  // namespace ghost
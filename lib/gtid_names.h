@@ -0,0 +1,108 @@
+// Copyright 2022 Google LLC
+//
+// Use of this source code is governed by a BSD-style
+// license that can be found in the LICENSE file or at
+// https://developers.google.com/open-source/licenses/bsd
+
+#ifndef GHOST_LIB_GTID_NAMES_H_
+#define GHOST_LIB_GTID_NAMES_H_
+
+#include <atomic>
+#include <cstdint>
+#include <memory>
+#include <vector>
+
+#include "absl/base/internal/spinlock.h"
+#include "absl/strings/string_view.h"
+
+namespace ghost {
+
+// A read-mostly map from gtids to the names that `Gtid::describe()` prints.
+// Looking up a name takes no locks, so agents printing tasks do not serialize
+// on each other. Assigning names, which happens about once per gtid, takes a
+// lock that only writers share.
+//
+// Names live inline in an open-addressed table. When the table gets half full,
+// writers copy it into one twice its size and publish that. Readers may still
+// be using the old table, so old tables live as long as the registry does, as
+// do entries: gtids are never removed.
+//
+// Each entry has two name buffers, and a rename writes the one that isn't
+// current. So the view that `Lookup()` returns stays valid until the gtid is
+// renamed twice, which is plenty for printing it.
+//
+// Example:
+// GtidNameRegistry names;
+// names.Assign(gtid, "worker");
+// absl::FPrintF(stderr, "%s\n", names.Lookup(gtid));  // Prints "worker".
+class GtidNameRegistry {
+ public:
+  // Longer names are truncated.
+  static constexpr size_t kMaxNameLength = 47;
+
+  explicit GtidNameRegistry(size_t initial_capacity = 1024);
+
+  GtidNameRegistry(const GtidNameRegistry&) = delete;
+  GtidNameRegistry& operator=(const GtidNameRegistry&) = delete;
+
+  // Names `gtid`, which must not be 0, or renames it.
+  void Assign(int64_t gtid, absl::string_view name);
+
+  // Returns the name of `gtid`, which must not be 0. If it has none, assigns it
+  // a unique one first.
+  absl::string_view Lookup(int64_t gtid);
+
+  // Returns the name of `gtid` or an empty view if it has none. This never
+  // takes the writers' lock.
+  absl::string_view Find(int64_t gtid) const;
+
+  // Returns the number of gtids that have names.
+  size_t size() const;
+
+ private:
+  struct Slot {
+    // 0 while the slot is free.
+    std::atomic<int64_t> gtid{0};
+    // Bumped by each (re)name, whose name is in `names[version % 2]`. 0 until
+    // the first name is written.
+    std::atomic<uint32_t> version{0};
+    char names[2][kMaxNameLength + 1];
+  };
+
+  struct Table {
+    explicit Table(size_t capacity) : mask(capacity - 1), slots(capacity) {}
+
+    const size_t mask;
+    // Only modified by writers.
+    size_t used = 0;
+    std::vector<Slot> slots;
+  };
+
+  // Returns the slot for `gtid` in `table`, or the free slot where it would go.
+  static Slot* Probe(const Table& table, int64_t gtid);
+
+  // Returns the current name in `slot`, which must be named.
+  static absl::string_view Name(const Slot& slot);
+
+  // Writes `name` into `slot`. Requires `lock_`.
+  static void WriteName(Slot* slot, absl::string_view name);
+
+  // Returns the slot for `gtid`, claiming one if it has none. Requires
+  // `lock_`.
+  Slot* FindOrClaim(int64_t gtid);
+
+  // Copies the current table into one twice its size. Requires `lock_`.
+  void Grow();
+
+  std::atomic<Table*> table_;
+  // Every table, including the current one, so that they live as long as the
+  // registry does.
+  std::vector<std::unique_ptr<Table>> tables_;
+
+  mutable absl::base_internal::SpinLock lock_{
+      absl::base_internal::SCHEDULE_KERNEL_ONLY};
+};
+
+}  // namespace ghost
+
+#endif  // GHOST_LIB_GTID_NAMES_H_
@@ -0,0 +1,109 @@
+// Copyright 2022 Google LLC
+//
+// Use of this source code is governed by a BSD-style
+// license that can be found in the LICENSE file or at
+// https://developers.google.com/open-source/licenses/bsd
+
+#include "lib/idle_cpu_index.h"
+
+#include <atomic>
+
+namespace ghost {
+
+IdleCpuIndex::IdleCpuIndex(const Topology& topology)
+    : topology_(&topology),
+      idle_(topology),
+      llc_idle_(topology),
+      llc_of_(topology.num_cpus(), -1) {
+  for (const Cpu& cpu : topology.all_cpus()) {
+    if (llc_of_[cpu.id()] >= 0) {
+      continue;
+    }
+    // `level_cpus(kL3)` is the core or the L2 cluster on machines without an
+    // L3 cache, which is as far as the cache is shared there.
+    const CpuList& llc = cpu.level_cpus(TopologyLevel::kL3);
+    for (const Cpu& sibling : llc) {
+      llc_of_[sibling.id()] = llc_cpus_.size();
+    }
+    llc_cpus_.push_back(llc);
+  }
+}
+
+void IdleCpuIndex::SetIdle(const Cpu& cpu) {
+  idle_.Set(cpu);
+  // Pairs with the fence in `SetBusy()`: either this sets the summary bit
+  // after `SetBusy()` clears it, or `SetBusy()` sees `cpu` idle when it checks
+  // again and sets the bit back.
+  std::atomic_thread_fence(std::memory_order_seq_cst);
+  llc_idle_.Set(llc_of_[cpu.id()]);
+}
+
+void IdleCpuIndex::SetBusy(const Cpu& cpu) {
+  idle_.Clear(cpu);
+
+  const int llc = llc_of_[cpu.id()];
+  if (!idle_.Snapshot(llc_cpus_[llc]).Empty()) {
+    return;
+  }
+  llc_idle_.Clear(llc);
+  // A CPU in the LLC may have gone idle since the snapshot above, after its
+  // `SetIdle()` set the summary bit that was just cleared.
+  std::atomic_thread_fence(std::memory_order_seq_cst);
+  if (!idle_.Snapshot(llc_cpus_[llc]).Empty()) {
+    llc_idle_.Set(llc);
+  }
+}
+
+Cpu IdleCpuIndex::FindNearestIdle(const Cpu& cpu, const CpuList& allowed) const {
+  if (idle_.IsSet(cpu) && allowed.IsSet(cpu)) {
+    return cpu;
+  }
+
+  // The CPUs at distances up to `kL3` are the rest of `cpu`'s LLC, so the
+  // summary bit tells whether there is anything to find among them.
+  const CpuList& llc = llc_cpus_[llc_of_[cpu.id()]];
+  if (llc_idle_.IsSet(llc_of_[cpu.id()])) {
+    CpuList candidates = idle_.Snapshot(llc);
+    candidates.Intersection(allowed);
+    if (!candidates.Empty()) {
+      for (TopologyLevel level : kTopologyLevels) {
+        if (level > TopologyLevel::kL3) {
+          break;
+        }
+        CpuList at_level = candidates;
+        at_level.Intersection(cpu.cpus_at_distance(level));
+        if (!at_level.Empty()) {
+          return at_level.Front();
+        }
+      }
+    }
+  }
+
+  // Nothing in the LLC, so look at the rest of the machine.
+  CpuList candidates = idle_.Snapshot(allowed);
+  candidates.Subtract(llc);
+  if (candidates.Empty()) {
+    return Cpu(Cpu::UninitializedType::kUninitialized);
+  }
+  for (TopologyLevel level : kTopologyLevels) {
+    if (level <= TopologyLevel::kL3) {
+      continue;
+    }
+    CpuList at_level = candidates;
+    at_level.Intersection(cpu.cpus_at_distance(level));
+    if (!at_level.Empty()) {
+      return at_level.Front();
+    }
+  }
+  return Cpu(Cpu::UninitializedType::kUninitialized);
+}
+
+Cpu IdleCpuIndex::FindIdle(const CpuList& allowed) const {
+  CpuList candidates = idle_.Snapshot(allowed);
+  if (candidates.Empty()) {
+    return Cpu(Cpu::UninitializedType::kUninitialized);
+  }
+  return candidates.Front();
+}
+
+}  // namespace ghost
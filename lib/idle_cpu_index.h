@@ -0,0 +1,89 @@
+// Copyright 2022 Google LLC
+//
+// Use of this source code is governed by a BSD-style
+// license that can be found in the LICENSE file or at
+// https://developers.google.com/open-source/licenses/bsd
+
+#ifndef GHOST_LIB_IDLE_CPU_INDEX_H_
+#define GHOST_LIB_IDLE_CPU_INDEX_H_
+
+#include <vector>
+
+#include "lib/topology.h"
+
+namespace ghost {
+
+// Tracks which CPUs are idle, so that agents can find an idle CPU near a given
+// CPU without probing each CPU's state. Each agent marks its CPU idle or busy
+// as that changes, with no locks, and any agent can search.
+//
+// The index has two levels: an `AtomicCpuMap` of idle CPUs and, above it, one
+// summary bit per last-level cache (LLC) that is set while any CPU in that LLC
+// is idle. A search loads the summary bit and the few words of the idle map
+// that hold the LLC of the CPU it starts from, and only loads the rest of the
+// map if that LLC has no idle CPU that it can use.
+//
+// The index is a hint: a CPU that it returns may have become busy since, so
+// callers that need to be sure check the CPU's own state afterwards.
+//
+// Example:
+// IdleCpuIndex idle_cpus(*topology);
+// ...
+// Agent on `cpu` with nothing to run: idle_cpus.SetIdle(cpu);
+// Agent on `cpu` that picked a task: idle_cpus.SetBusy(cpu);
+// ...
+// Cpu target = idle_cpus.FindNearestIdle(prev_cpu, allowed_cpus);
+// if (!target.valid()) {
+//   // No CPU in `allowed_cpus` is idle.
+// }
+class IdleCpuIndex {
+ public:
+  // All CPUs start out busy.
+  explicit IdleCpuIndex(const Topology& topology);
+
+  IdleCpuIndex(const IdleCpuIndex&) = delete;
+  IdleCpuIndex& operator=(const IdleCpuIndex&) = delete;
+
+  void SetIdle(const Cpu& cpu);
+  void SetBusy(const Cpu& cpu);
+
+  bool IsIdle(const Cpu& cpu) const { return idle_.IsSet(cpu); }
+
+  // Returns true if any CPU that shares an LLC with `cpu` (including `cpu`) is
+  // idle.
+  bool LlcHasIdle(const Cpu& cpu) const {
+    return llc_idle_.IsSet(llc_of_[cpu.id()]);
+  }
+
+  // Returns the idle CPU in `allowed` that is nearest to `cpu`: `cpu` itself,
+  // then the CPUs at each `TopologyLevel` from `cpu` in turn, and the lowest
+  // numbered CPU among those at the same level. Returns an uninitialized CPU if
+  // no CPU in `allowed` is idle.
+  Cpu FindNearestIdle(const Cpu& cpu, const CpuList& allowed) const;
+
+  // Returns the lowest numbered idle CPU in `allowed`, or an uninitialized CPU
+  // if no CPU in `allowed` is idle.
+  Cpu FindIdle(const CpuList& allowed) const;
+
+  const Topology& topology() const { return *topology_; }
+
+ private:
+  const Topology* topology_;
+
+  // The idle CPUs.
+  AtomicCpuMap idle_;
+
+  // Bit `i` is set while any CPU in `llc_cpus_[i]` is idle. There are never
+  // more LLCs than CPUs, so this can be indexed like a map of CPUs.
+  AtomicCpuMap llc_idle_;
+
+  // The CPUs in each LLC.
+  std::vector<CpuList> llc_cpus_;
+
+  // The index in `llc_cpus_` of each CPU's LLC, indexed by CPU ID.
+  std::vector<int> llc_of_;
+};
+
+}  // namespace ghost
+
+#endif  // GHOST_LIB_IDLE_CPU_INDEX_H_
@@ -0,0 +1,24 @@
+// Copyright 2022 Google LLC
+//
+// Use of this source code is governed by a BSD-style
+// license that can be found in the LICENSE file or at
+// https://developers.google.com/open-source/licenses/bsd
+
+// What agents print to stdout for whoever drives a live update of an enclave
+// (e.g., Orca). This header has no dependencies so that such programs can
+// include it without the agent library.
+
+#ifndef GHOST_LIB_LIVE_UPDATE_H_
+#define GHOST_LIB_LIVE_UPDATE_H_
+
+namespace ghost {
+
+// Printed on a line of its own by `LocalEnclave::WaitForOldAgent()` once every
+// agent task of a new agent is waiting for the old agent: the new agent is
+// ready to take over, and the old agent can be told to exit.
+inline constexpr char kReadyForHandoffMsg[] =
+    "Agent ready for handoff, waiting for the old agent to exit.";
+
+}  // namespace ghost
+
+#endif  // GHOST_LIB_LIVE_UPDATE_H_
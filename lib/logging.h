@@ -12,6 +12,7 @@
 #include "absl/log/check.h"
 #include "absl/log/log.h"
 #include "absl/strings/str_format.h"
+#include "lib/trace_ring.h"
 #include "third_party/util/util.h"
 
 #ifndef GHOST_DEBUG
@@ -31,12 +32,29 @@
 #endif  // !VLOG
 
 // TODO: Consider deprecating GHOST_DPRINT once we migrate to VLOG.
-#define GHOST_DPRINT(level, target, fmt, ...)       \
-  do {                                              \
-    if (verbose() < level) break;                   \
-    absl::FPrintF(target, fmt "\n", ##__VA_ARGS__); \
+//
+// With --dprint_trace set, records into this thread's trace ring rather than
+// printing to `target` (see lib/trace_ring.h), so arguments must be numbers,
+// enums or strings.
+#define GHOST_DPRINT(level, target, fmt, ...)                                 \
+  do {                                                                        \
+    if (verbose() < level) break;                                             \
+    GHOST_DPRINT_TRACE(fmt, ##__VA_ARGS__);                                   \
+    absl::FPrintF(target, fmt "\n", ##__VA_ARGS__);                           \
   } while (0)
 
+// For print macros built like `GHOST_DPRINT`: with --dprint_trace set, records
+// `fmt` and the arguments into this thread's trace ring and breaks out of the
+// enclosing `do { } while (0)`.
+#define GHOST_DPRINT_TRACE(fmt, ...)                                          \
+  if (::ghost::DprintTracer* ghost_dprint_tracer =                            \
+          ::ghost::DprintTracer::Get()) {                                     \
+    static const uint32_t ghost_dprint_format_id =                            \
+        ::ghost::TraceFormats::Register(fmt);                                 \
+    ghost_dprint_tracer->Record(ghost_dprint_format_id, ##__VA_ARGS__);       \
+    break;                                                                    \
+  }
+
 #define GHOST_ERROR(fmt, ...)                          \
   do {                                                 \
     LOG(FATAL) << "(" << ghost::GetTID() << ") "       \
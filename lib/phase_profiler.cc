@@ -0,0 +1,90 @@
+// Copyright 2022 Google LLC
+//
+// Use of this source code is governed by a BSD-style
+// license that can be found in the LICENSE file or at
+// https://developers.google.com/open-source/licenses/bsd
+
+#include "lib/phase_profiler.h"
+
+#include <algorithm>
+
+namespace ghost {
+
+uint64_t PhaseProfile::Histogram::Percentile(double percentile) const {
+  if (!count) {
+    return 0;
+  }
+  const double target = count * std::clamp(percentile, 0.0, 100.0) / 100.0;
+  uint64_t seen = 0;
+  for (int i = 0; i < kNumSlots; ++i) {
+    seen += slots[i];
+    if (seen >= target) {
+      // The last slot is open-ended, and `max` may be tighter in any case.
+      if (i == kNumSlots - 1) {
+        break;
+      }
+      return std::min(ll_hist_slot_upper(i), max);
+    }
+  }
+  return max;
+}
+
+// static
+const char* PhaseProfile::PhaseName(Phase phase) {
+  switch (phase) {
+    case kDispatch:
+      return "dispatch";
+    case kPick:
+      return "pick";
+    case kCommit:
+      return "commit";
+    case kCommitFailure:
+      return "commit_failure";
+    case kNumPhases:
+      break;
+  }
+  return "unknown";
+}
+
+void PhaseProfile::Print(FILE* to) const {
+  auto us = [this](uint64_t cycles) { return cycles / cycles_per_us; };
+
+  fprintf(to, "iterations: %lu (%.0f cycles/us)\n", iterations, cycles_per_us);
+  fprintf(to, "%-16s %10s %10s %10s %10s %10s %10s\n", "phase (us)", "count",
+          "mean", "p50", "p99", "p99.9", "max");
+  for (int i = 0; i < kNumPhases; ++i) {
+    const Histogram& h = phases[i];
+    fprintf(to, "%-16s %10lu %10.2f %10.2f %10.2f %10.2f %10.2f\n",
+            PhaseName(static_cast<Phase>(i)), h.count, us(h.Mean()),
+            us(h.Percentile(50)), us(h.Percentile(99)),
+            us(h.Percentile(99.9)), us(h.max));
+  }
+  fprintf(to, "%-16s %10lu %10.2f %10lu %10lu %10lu %10lu\n", "msgs/iter",
+          msgs.count, msgs.Mean(), msgs.Percentile(50), msgs.Percentile(99),
+          msgs.Percentile(99.9), msgs.max);
+}
+
+PhaseProfiler::PhaseProfiler() : cycles_per_us_(CyclesPerMicrosecond()) {}
+
+// static
+void PhaseProfiler::Copy(const Histogram& from, PhaseProfile::Histogram& to) {
+  to.count = from.count.load(std::memory_order_relaxed);
+  to.sum = from.sum.load(std::memory_order_relaxed);
+  to.max = from.max.load(std::memory_order_relaxed);
+  for (int i = 0; i < PhaseProfile::Histogram::kNumSlots; ++i) {
+    to.slots[i] = from.slots[i].load(std::memory_order_relaxed);
+  }
+}
+
+PhaseProfile PhaseProfiler::Snapshot() const {
+  PhaseProfile profile;
+  profile.cycles_per_us = cycles_per_us_;
+  profile.iterations = iterations_.load(std::memory_order_relaxed);
+  for (int i = 0; i < PhaseProfile::kNumPhases; ++i) {
+    Copy(phases_[i], profile.phases[i]);
+  }
+  Copy(msgs_, profile.msgs);
+  return profile;
+}
+
+}  // namespace ghost
@@ -0,0 +1,150 @@
+// Copyright 2022 Google LLC
+//
+// Use of this source code is governed by a BSD-style
+// license that can be found in the LICENSE file or at
+// https://developers.google.com/open-source/licenses/bsd
+
+// A low-overhead profiler for the global agent's scheduling loop. The agent
+// stamps phase boundaries with the TSC and the profiler files each phase's
+// cycles in a log-linear histogram (see third_party/bpf/ll_hist.h), along with
+// the number of messages dispatched in each iteration. Averages hide the
+// outliers that hurt tail latency; the histograms don't.
+//
+// The agent thread is the only writer. Any other thread (e.g. the RPC handler)
+// may take a `PhaseProfile` snapshot at any time without stopping the agent.
+// The counters are cumulative: diff two snapshots to get an interval.
+
+#ifndef GHOST_LIB_PHASE_PROFILER_H_
+#define GHOST_LIB_PHASE_PROFILER_H_
+
+#include <atomic>
+#include <cstdint>
+#include <cstdio>
+
+#include "lib/base.h"
+#include "lib/tsc_clock.h"
+#include "third_party/bpf/ll_hist.h"
+
+namespace ghost {
+
+struct PhaseProfile {
+  enum Phase {
+    // Draining the channel and handling the messages.
+    kDispatch,
+    // Picking tasks for cpus and opening their transactions.
+    kPick,
+    // Committing the transactions.
+    kCommit,
+    // Putting back the tasks whose transactions failed.
+    kCommitFailure,
+    kNumPhases,
+  };
+
+  struct Histogram {
+    static constexpr int kNumSlots = LL_HIST_NR_SLOTS;
+
+    uint64_t count;
+    uint64_t sum;
+    uint64_t max;
+    uint64_t slots[kNumSlots];
+
+    double Mean() const { return count ? static_cast<double>(sum) / count : 0; }
+    // Returns the upper bound of the slot below which `percentile` (in
+    // [0, 100]) of the values lie, or 0 if there are none.
+    uint64_t Percentile(double percentile) const;
+  };
+
+  // TSC cycles per microsecond, to convert the phase histograms.
+  double cycles_per_us;
+  uint64_t iterations;
+  // In TSC cycles.
+  Histogram phases[kNumPhases];
+  // Messages dispatched per iteration.
+  Histogram msgs;
+
+  static const char* PhaseName(Phase phase);
+
+  // Prints a line per histogram with its count, mean, percentiles and max.
+  void Print(FILE* to) const;
+};
+
+// Trivially copyable so that it fits in an AgentRpcBuffer (16 KiB).
+static_assert(sizeof(PhaseProfile) <= 16384);
+
+class PhaseProfiler {
+ public:
+  PhaseProfiler();
+
+  // Returns the TSC, or the monotonic clock in nsec where it isn't invariant.
+  // See TscClock.
+  static uint64_t Now() { return TscClock::Now(); }
+
+  // Returns what Now() counts per microsecond, measured once per process.
+  static double CyclesPerMicrosecond() {
+    return TscClock::TicksPerMicrosecond();
+  }
+
+  // Files `cycles` under `phase`.
+  void Record(PhaseProfile::Phase phase, uint64_t cycles) {
+    Add(phases_[phase], cycles);
+  }
+
+  // Files the time since `start` under `phase` and returns Now(), so that back
+  // to back phases need one TSC read each:
+  //
+  //   uint64_t t = PhaseProfiler::Now();
+  //   ...
+  //   t = profiler.Lap(PhaseProfile::kPick, t);
+  //   ...
+  //   t = profiler.Lap(PhaseProfile::kCommit, t);
+  uint64_t Lap(PhaseProfile::Phase phase, uint64_t start) {
+    const uint64_t now = Now();
+    Record(phase, now - start);
+    return now;
+  }
+
+  // Ends an iteration of the scheduling loop that dispatched `nr_msgs`.
+  void EndIteration(uint64_t nr_msgs) {
+    Add(msgs_, nr_msgs);
+    Bump(iterations_, 1);
+  }
+
+  // May be called from any thread. Each counter is read atomically, but the
+  // snapshot as a whole may be a few updates apart.
+  PhaseProfile Snapshot() const;
+
+ private:
+  struct Histogram {
+    std::atomic<uint64_t> count{0};
+    std::atomic<uint64_t> sum{0};
+    std::atomic<uint64_t> max{0};
+    std::atomic<uint64_t> slots[PhaseProfile::Histogram::kNumSlots] = {};
+  };
+
+  // There is only one writer, so a relaxed load and store is enough: readers
+  // see either the old or the new value, and we skip the locked instruction.
+  static void Bump(std::atomic<uint64_t>& counter, uint64_t delta) {
+    counter.store(counter.load(std::memory_order_relaxed) + delta,
+                  std::memory_order_relaxed);
+  }
+
+  static void Add(Histogram& h, uint64_t v) {
+    Bump(h.count, 1);
+    Bump(h.sum, v);
+    if (v > h.max.load(std::memory_order_relaxed)) {
+      h.max.store(v, std::memory_order_relaxed);
+    }
+    Bump(h.slots[ll_hist_slot(v)], 1);
+  }
+
+  static void Copy(const Histogram& from, PhaseProfile::Histogram& to);
+
+  const double cycles_per_us_;
+  std::atomic<uint64_t> iterations_{0};
+  Histogram phases_[PhaseProfile::kNumPhases];
+  Histogram msgs_;
+};
+
+}  // namespace ghost
+
+#endif  // GHOST_LIB_PHASE_PROFILER_H_
@@ -0,0 +1,225 @@
+// Copyright 2021 Google LLC
+//
+// Use of this source code is governed by a BSD-style
+// license that can be found in the LICENSE file or at
+// https://developers.google.com/open-source/licenses/bsd
+
+#ifndef GHOST_LIB_RPC_RING_H_
+#define GHOST_LIB_RPC_RING_H_
+
+#include <atomic>
+#include <climits>
+#include <cstdint>
+#include <thread>
+
+#include "lib/base.h"
+
+namespace ghost {
+
+// A fixed-size ring of request/response slots for RPCs between processes that
+// share memory (e.g., `AgentProcess` and its forked agent). Any number of
+// clients may submit requests concurrently; a single server handles them one at
+// a time in submission order.
+//
+// Each request gets a ticket. A client may have several requests in flight
+// (pipelining) and poll or wait for each ticket's completion. Every ticket must
+// eventually be completed with `Complete`, since its slot is only reused after
+// that. Submitting blocks while the ring is full.
+//
+// Waits spin for a while before sleeping on a futex, and wakeups only make a
+// futex call if the other side is asleep, so a busy ring issues no syscalls.
+// Futexes are not private, so the ring works in memory shared across processes.
+//
+// Example:
+//   RpcRing<Req, Resp, 8> ring;  // In shared memory.
+//
+//   // Client:
+//   RpcRing<Req, Resp, 8>::Ticket t = ring.Submit(req);
+//   ...
+//   int64_t code = ring.Complete(t, [](const Resp& r) { return r.code; });
+//
+//   // Server:
+//   for (;;) {
+//     ring.WaitForRequest();
+//     ring.ServeOne([](const Req& req, Resp& resp) { ... });
+//   }
+template <class Request, class Response, uint32_t kSlots>
+class RpcRing {
+  static_assert(kSlots > 0 && (kSlots & (kSlots - 1)) == 0,
+                "kSlots must be a power of two");
+
+ public:
+  using Ticket = uint32_t;
+
+  RpcRing() {
+    for (uint32_t i = 0; i < kSlots; ++i) {
+      slots_[i].turn.store(i, std::memory_order_relaxed);
+    }
+  }
+
+  RpcRing(const RpcRing&) = delete;
+  RpcRing& operator=(const RpcRing&) = delete;
+
+  // Posts `req` and returns its ticket. Blocks while the slot for the ticket is
+  // still in use by the ticket `kSlots` earlier.
+  Ticket Submit(const Request& req) {
+    return SubmitWith([&req](Request& slot_req) { slot_req = req; });
+  }
+
+  // Like `Submit`, but fills in the request in place with `fill(Request&)`,
+  // which saves a copy for large requests.
+  template <class F>
+  Ticket SubmitWith(F fill) {
+    const Ticket t = next_ticket_.fetch_add(1, std::memory_order_relaxed);
+    Slot& slot = slot_for(t);
+    WaitWhileNot(slot.turn, t, slot.waiters);
+    fill(slot.req);
+    Publish(slot.state, kPending, slot.waiters);
+
+    doorbell_.fetch_add(1, std::memory_order_seq_cst);
+    if (server_sleeping_.load(std::memory_order_seq_cst)) {
+      Futex::Wake(&doorbell_, 1);
+    }
+    return t;
+  }
+
+  // Returns true if the request for `t` has been handled, i.e. `Complete(t)`
+  // would not block.
+  bool Poll(Ticket t) const {
+    const Slot& slot = slot_for(t);
+    return slot.turn.load(std::memory_order_acquire) == t &&
+           slot.state.load(std::memory_order_acquire) == kDone;
+  }
+
+  // Waits for the request for `t` to be handled, returns `f(response)` and
+  // releases the slot. `f` should copy out whatever it needs from the response,
+  // which is only valid for the duration of the call.
+  template <class F>
+  auto Complete(Ticket t, F f) {
+    Slot& slot = slot_for(t);
+    WaitWhileNot(slot.state, kDone, slot.waiters);
+    auto ret = f(static_cast<const Response&>(slot.resp));
+
+    // Hand the slot to the ticket that wraps around to it.
+    slot.state.store(kFree, std::memory_order_relaxed);
+    Publish(slot.turn, t + kSlots, slot.waiters);
+    return ret;
+  }
+
+  // Server side. Handles the next request, if it has been submitted, with
+  // `handler(const Request&, Response&)`. The response is value-initialized
+  // beforehand. Returns false if there was no request to handle.
+  template <class F>
+  bool ServeOne(F handler) {
+    Slot& slot = slot_for(served_);
+    if (slot.turn.load(std::memory_order_acquire) != served_ ||
+        slot.state.load(std::memory_order_acquire) != kPending) {
+      return false;
+    }
+    slot.resp = Response();
+    handler(static_cast<const Request&>(slot.req), slot.resp);
+    ++served_;
+    Publish(slot.state, kDone, slot.waiters);
+    return true;
+  }
+
+  // Server side. Returns once there is a request for `ServeOne` to handle.
+  void WaitForRequest() {
+    for (int i = 0; i < SpinIterations(); ++i) {
+      if (HasRequest()) {
+        return;
+      }
+      Pause();
+    }
+    while (true) {
+      const uint32_t bell = doorbell_.load(std::memory_order_seq_cst);
+      server_sleeping_.store(1, std::memory_order_seq_cst);
+      if (HasRequest()) {
+        break;
+      }
+      Futex::Wait(&doorbell_, bell);
+    }
+    server_sleeping_.store(0, std::memory_order_relaxed);
+  }
+
+ private:
+  enum SlotState : uint32_t {
+    kFree,
+    kPending,  // The request has been submitted.
+    kDone,     // The response is ready.
+  };
+
+  // Number of times to check a condition before sleeping on a futex, a few
+  // microseconds' worth, which is about as long as a futex wakeup. There is no
+  // point in spinning on a uniprocessor: the other side cannot run meanwhile.
+  static int SpinIterations() {
+    static const int iterations =
+        std::thread::hardware_concurrency() > 1 ? 256 : 0;
+    return iterations;
+  }
+
+  struct Slot {
+    // The ticket that may use this slot next (only the low 32 bits; `kSlots`
+    // divides 2^32 so the mapping from tickets to slots survives wraparound).
+    std::atomic<uint32_t> turn;
+    std::atomic<SlotState> state = kFree;
+    // Number of threads asleep on `turn` or `state`.
+    std::atomic<uint32_t> waiters = 0;
+    Request req;
+    Response resp;
+  };
+
+  Slot& slot_for(Ticket t) { return slots_[t & (kSlots - 1)]; }
+  const Slot& slot_for(Ticket t) const { return slots_[t & (kSlots - 1)]; }
+
+  // Sequentially consistent, to order it against `server_sleeping_` (see
+  // `WaitForRequest` and `Submit`).
+  bool HasRequest() {
+    const Slot& slot = slot_for(served_);
+    return slot.turn.load(std::memory_order_seq_cst) == served_ &&
+           slot.state.load(std::memory_order_seq_cst) == kPending;
+  }
+
+  // Stores `val` to `word`, waking up anyone sleeping on `word`.
+  template <class T>
+  static void Publish(std::atomic<T>& word, T val,
+                      std::atomic<uint32_t>& waiters) {
+    word.store(val, std::memory_order_seq_cst);
+    if (waiters.load(std::memory_order_seq_cst)) {
+      Futex::Wake(&word, INT_MAX);
+    }
+  }
+
+  // Returns once `word` equals `val`.
+  template <class T>
+  static void WaitWhileNot(std::atomic<T>& word, T val,
+                           std::atomic<uint32_t>& waiters) {
+    for (int i = 0; i < SpinIterations(); ++i) {
+      if (word.load(std::memory_order_acquire) == val) {
+        return;
+      }
+      Pause();
+    }
+    waiters.fetch_add(1, std::memory_order_seq_cst);
+    T cur;
+    while ((cur = word.load(std::memory_order_seq_cst)) != val) {
+      Futex::Wait(&word, cur);
+    }
+    waiters.fetch_sub(1, std::memory_order_relaxed);
+  }
+
+  // Client side.
+  std::atomic<Ticket> next_ticket_ = 0;
+
+  // Server side. The next ticket to handle.
+  Ticket served_ = 0;
+  // Bumped on every submission; the server sleeps on it.
+  std::atomic<uint32_t> doorbell_ = 0;
+  std::atomic<uint32_t> server_sleeping_ = 0;
+
+  Slot slots_[kSlots];
+};
+
+}  // namespace ghost
+
+#endif  // GHOST_LIB_RPC_RING_H_
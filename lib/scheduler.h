@@ -8,11 +8,14 @@
 #ifndef GHOST_LIB_SCHEDULER_H_
 #define GHOST_LIB_SCHEDULER_H_
 
+#include <algorithm>
 #include <atomic>
 #include <memory>
+#include <tuple>
 #include <type_traits>
 #include <unordered_map>
 #include <utility>
+#include <vector>
 
 #include "absl/container/flat_hash_map.h"
 #include "lib/channel.h"
@@ -211,163 +214,31 @@ class BasicDispatchScheduler : public Scheduler {
     // the agent from missing a message.  For instance, switchto involves
     // changing the SW, but there is no corresponding message.  For this reason,
     // we rely on the enclave being "quiescent" (no client tasks).
-    enclave()->ForEachTaskStatusWord([this](ghost_status_word* sw,
-                                            uint32_t region_id, uint32_t idx) {
-      ghost_sw_info swi = {.id = region_id, .index = idx};
-      TaskType* task;
-      uint32_t sw_barrier;
-      uint32_t sw_flags;
-      uint64_t sw_gtid;
-      uint64_t sw_runtime;
-      bool had_estale = false;
-      int assoc_status;
-
-    retry:
-      // Pairs with the smp_store_release() in the kernel.  (READ_ONCE of the
-      // barrier and an smp_rmb()).
-      sw_barrier = READ_ONCE(sw->barrier);
-
-      std::atomic_thread_fence(std::memory_order_acquire);
-
-      sw_flags = READ_ONCE(sw->flags);
-      sw_runtime = READ_ONCE(sw->runtime);
-      sw_gtid = READ_ONCE(sw->gtid);
-
-      // We will "blindly associate" the task with our default queue, where we
-      // don't actually make sure we received all of the messages before
-      // association.  Any previously sent messages were sent to the old agent's
-      // queue, with one exception handled below (EEXIST).
-      //
-      // The seqnum/barrier has two roles: make sure we didn't miss any messages
-      // and make sure we don't *later* handle any messages we shouldn't.
-      // Association is used to hand-off a task between agent tasks: whoever
-      // controls the queue has the right to muck with the Task.  If we
-      // associate to a new queue, the old queue may still have a message, which
-      // could violate that rule.
-      //
-      // In this case, we're OK when it comes to Task ownership.  The only queue
-      // *in this new agent* that this task could have been using is the Default
-      // queue, which is the one we're (re)associating with.  i.e. we're not
-      // swapping queues.
-      if (!GetDefaultChannel().AssociateTask(Gtid(sw_gtid), sw_barrier,
-                                             &assoc_status)) {
-        switch (errno) {
-          case ENOENT:
-            // The task died or departed.  It could have died and the old agent
-            // crashed before it received TASK_DEAD.  It could have departed
-            // concurrently with our scan.  When we free the task, it will tell
-            // the kernel to free the status_word.
-            bool allocated;
-            std::tie(task, allocated) =
-                allocator()->GetTask(Gtid(sw_gtid), swi);
-            // It's a bug if we already created this since we do not allow
-            // concurrent discovery and message handling.
-            if (!allocated) {
-              GHOST_ERROR("Already had task for gtid %lu!", sw_gtid);
-            }
-            allocator()->FreeTask(task);
-            return;
-          case ESTALE:
-            // Task departed and came back into ghost.
-            //
-            // The ESTALE is due to a mismatch between the barrier in the
-            // task's _live_ status_word compared to the barrier we provided
-            // from a status_word associated with an earlier incarnation.
-            //
-            // Reclaim the orphaned status_word (it is not reachable from
-            // the task associated with sw_gtid).
-            //
-            // TODO: harden this further by never resetting the sw->barrier
-            // across incarnations (i.e. msg->seqnum increases monotonically
-            // even if the task departs and comes back into ghost). Without
-            // this it is possible for the association to "succeed" and the
-            // status_word to leak.
-            //
-            // TODO: this is relevant only if a task has the same gtid across
-            // incarnations (this is the case currently). However if we adopt
-            // an approach where each incarnation allocates a new gtid then we
-            // can drop this special case.
-            if (sw_flags & GHOST_SW_F_CANFREE) {
-              CHECK_EQ(GhostHelper()->FreeStatusWordInfo(swi), 0);
-              return;
-            }
-
-            // We shouldn't have *too many* state changes to the task while we
-            // are discovering.  Tasks are not allowed to run while we are in
-            // discovery.  This is the "system must be quiescent" requirement.
-            //
-            // Specifically, we can have a TASK_WAKEUP or TASK_DEPARTED.
-            // TASK_DEPARTED would give us ENOENT, handled above.  There can be
-            // at most one TASK_WAKEUP (since the task won't run until an agent
-            // schedules it), so we can get at most one ESTALE.
-            if (had_estale) {
-              GHOST_ERROR(
-                  "Got repeated ESTALEs from a quiescent reassociation for "
-                  "gtid %lu, flags %lu!",
-                  sw_gtid, sw_flags);
-            }
-            had_estale = true;
-            goto retry;
-          default:
-            GHOST_ERROR(
-                "Failed reassociation for gtid %lu, errno %d, flags %lu",
-                sw_gtid, errno, sw_flags);
-        }
-      }
-
-      if (assoc_status & (GHOST_ASSOC_SF_ALREADY | GHOST_ASSOC_SF_BRAND_NEW)) {
-        // The association succeeded, but we need to handle it specially.  In
-        // both of these cases, we will eventually get all of the messages for
-        // this task and we do not need to discover it.
-        //
-        // 1) The task's queue was already set to our default queue.  This
-        // means that it arrived after we called SetDefaultQueue, and all of
-        // the messages for the task's state (TASK_NEW, etc.) have been
-        // delivered to us.
-        // 2) Regardless of whether or not the task's queue was set, the kernel
-        // has not sent a TASK_NEW yet.  This happens when a third party
-        // setsched's a running task into ghost; the kernel waits until the task
-        // gets off cpu to send the TASK_NEW.
-        //
-        // In either event, we skip the task during discovery, and will call
-        // TaskNew (and potentially TaskDeparted!) when we handle messages
-        // later.
-        return;
-      }
-
-      // Synthesize a message on the stack from the copied SW state.  All ghost
-      // messages must be aligned to the *size* of ghost_msg, not to the
-      // alignment of a ghost_msg.  This means the payloads will be aligned to
-      // that value (8 currently)
-      struct {
-        ghost_msg header;
-        ghost_msg_payload_task_new payload;
-      } synth __attribute__((aligned(sizeof(ghost_msg))));
-      // Make sure there's no magic padding between the structs.
-      static_assert(sizeof(synth) ==
-                    sizeof(ghost_msg) + sizeof(ghost_msg_payload_task_new));
-
-      ghost_msg* gm = &synth.header;
-      ghost_msg_payload_task_new* tn = &synth.payload;
-      gm->type = MSG_TASK_NEW;
-      gm->length = sizeof(synth);
-      gm->seqnum = sw_barrier;
-
-      tn->gtid = sw_gtid;
-      tn->runtime = sw_runtime;
-      tn->runnable = !!(sw_flags & GHOST_SW_TASK_RUNNABLE);
-      tn->sw_info = swi;
-
-      Message msg(gm);
-
-      bool allocated;
-      std::tie(task, allocated) = allocator()->GetTask(Gtid(sw_gtid), swi);
-      if (!allocated) {
-        GHOST_ERROR("Already had task for gtid %lu!", sw_gtid);
+    //
+    // Discovery happens in two phases.  First, the SW table is split into
+    // ranges that are scanned in parallel, and each task found is associated
+    // with our default queue.  Association is a syscall per task and dominates
+    // the discovery time, but it does not touch any scheduler state.  Second,
+    // this thread allocates a Task for each task that needs to be discovered
+    // and delivers the synthesized TASK_NEW, in SW index order, since neither
+    // the allocator nor the scheduler may be thread-safe.
+    StatusWordTable* table = enclave()->GetStatusWordTable();
+    const int num_workers = DiscoveryWorkers(table->capacity());
+    std::vector<std::vector<DiscoveredTask>> discovered(num_workers);
+    table->ForEachTaskStatusWordParallel(
+        num_workers, [this, &discovered](int worker, ghost_status_word* sw,
+                                         uint32_t region_id, uint32_t idx) {
+          DiscoveredTask d;
+          if (AssociateDiscoveredTask(sw, region_id, idx, &d)) {
+            discovered[worker].push_back(d);
+          }
+        });
+
+    for (const std::vector<DiscoveredTask>& tasks : discovered) {
+      for (const DiscoveredTask& d : tasks) {
+        FinishDiscoveredTask(d);
       }
-      TaskNew(task, msg);
-      TaskDiscovered(task);
-    });
+    }
 
     // All tasks that existed before we started to scan the SW region have been
     // discovered, though there may be new tasks, for which the scheduler will
@@ -375,6 +246,14 @@ class BasicDispatchScheduler : public Scheduler {
     DiscoveryComplete();
   }
 
+  // Sets the number of threads that scan the SW table in `DiscoverTasks`. If
+  // `num_workers` is 0 (the default), the number is picked based on the size
+  // of the SW table.
+  void SetDiscoveryWorkers(int num_workers) {
+    CHECK_GE(num_workers, 0);
+    discovery_workers_ = num_workers;
+  }
+
  protected:
   // Callbacks to IPC messages delivered by the kernel against `task`.
   // Implementations typically will advance the task's state machine and adjust
@@ -406,7 +285,207 @@ class BasicDispatchScheduler : public Scheduler {
   TaskAllocator<TaskType>* allocator() const { return allocator_.get(); }
 
  private:
+  // A task found by the first phase of `DiscoverTasks`, along with the state
+  // copied from its SW.
+  struct DiscoveredTask {
+    ghost_sw_info swi;
+    uint64_t gtid;
+    uint32_t barrier;
+    uint32_t flags;
+    uint64_t runtime;
+    // The task died or departed before we could associate it.
+    bool departed;
+  };
+
+  // Status words per discovery worker when the number of workers is picked
+  // automatically, and the maximum number of workers picked.
+  static constexpr uint32_t kDiscoveryWordsPerWorker = 8192;
+  static constexpr int kMaxDiscoveryWorkers = 8;
+
+  int DiscoveryWorkers(uint32_t capacity) const {
+    if (discovery_workers_ > 0) {
+      return discovery_workers_;
+    }
+    return std::clamp<int>(capacity / kDiscoveryWordsPerWorker, 1,
+                           kMaxDiscoveryWorkers);
+  }
+
+  // The first, thread-safe, phase of discovery for the task owning `sw`:
+  // associates the task with our default queue. Returns true and fills in `d`
+  // if the second phase (`FinishDiscoveredTask`) must handle the task.
+  bool AssociateDiscoveredTask(ghost_status_word* sw, uint32_t region_id,
+                               uint32_t idx, DiscoveredTask* d) {
+    ghost_sw_info swi = {.id = region_id, .index = idx};
+    uint32_t sw_barrier;
+    uint32_t sw_flags;
+    uint64_t sw_gtid;
+    uint64_t sw_runtime;
+    bool had_estale = false;
+    int assoc_status;
+
+  retry:
+    // Pairs with the smp_store_release() in the kernel.  (READ_ONCE of the
+    // barrier and an smp_rmb()).
+    sw_barrier = READ_ONCE(sw->barrier);
+
+    std::atomic_thread_fence(std::memory_order_acquire);
+
+    sw_flags = READ_ONCE(sw->flags);
+    sw_runtime = READ_ONCE(sw->runtime);
+    sw_gtid = READ_ONCE(sw->gtid);
+
+    *d = {
+        .swi = swi,
+        .gtid = sw_gtid,
+        .barrier = sw_barrier,
+        .flags = sw_flags,
+        .runtime = sw_runtime,
+        .departed = false,
+    };
+
+    // We will "blindly associate" the task with our default queue, where we
+    // don't actually make sure we received all of the messages before
+    // association.  Any previously sent messages were sent to the old agent's
+    // queue, with one exception handled below (EEXIST).
+    //
+    // The seqnum/barrier has two roles: make sure we didn't miss any messages
+    // and make sure we don't *later* handle any messages we shouldn't.
+    // Association is used to hand-off a task between agent tasks: whoever
+    // controls the queue has the right to muck with the Task.  If we
+    // associate to a new queue, the old queue may still have a message, which
+    // could violate that rule.
+    //
+    // In this case, we're OK when it comes to Task ownership.  The only queue
+    // *in this new agent* that this task could have been using is the Default
+    // queue, which is the one we're (re)associating with.  i.e. we're not
+    // swapping queues.
+    if (!GetDefaultChannel().AssociateTask(Gtid(sw_gtid), sw_barrier,
+                                           &assoc_status)) {
+      switch (errno) {
+        case ENOENT:
+          // The task died or departed.  It could have died and the old agent
+          // crashed before it received TASK_DEAD.  It could have departed
+          // concurrently with our scan.  When we free the task, it will tell
+          // the kernel to free the status_word.
+          d->departed = true;
+          return true;
+        case ESTALE:
+          // Task departed and came back into ghost.
+          //
+          // The ESTALE is due to a mismatch between the barrier in the
+          // task's _live_ status_word compared to the barrier we provided
+          // from a status_word associated with an earlier incarnation.
+          //
+          // Reclaim the orphaned status_word (it is not reachable from
+          // the task associated with sw_gtid).
+          //
+          // TODO: harden this further by never resetting the sw->barrier
+          // across incarnations (i.e. msg->seqnum increases monotonically
+          // even if the task departs and comes back into ghost). Without
+          // this it is possible for the association to "succeed" and the
+          // status_word to leak.
+          //
+          // TODO: this is relevant only if a task has the same gtid across
+          // incarnations (this is the case currently). However if we adopt
+          // an approach where each incarnation allocates a new gtid then we
+          // can drop this special case.
+          if (sw_flags & GHOST_SW_F_CANFREE) {
+            CHECK_EQ(GhostHelper()->FreeStatusWordInfo(swi), 0);
+            return false;
+          }
+
+          // We shouldn't have *too many* state changes to the task while we
+          // are discovering.  Tasks are not allowed to run while we are in
+          // discovery.  This is the "system must be quiescent" requirement.
+          //
+          // Specifically, we can have a TASK_WAKEUP or TASK_DEPARTED.
+          // TASK_DEPARTED would give us ENOENT, handled above.  There can be
+          // at most one TASK_WAKEUP (since the task won't run until an agent
+          // schedules it), so we can get at most one ESTALE.
+          if (had_estale) {
+            GHOST_ERROR(
+                "Got repeated ESTALEs from a quiescent reassociation for "
+                "gtid %lu, flags %lu!",
+                sw_gtid, sw_flags);
+          }
+          had_estale = true;
+          goto retry;
+        default:
+          GHOST_ERROR("Failed reassociation for gtid %lu, errno %d, flags %lu",
+                      sw_gtid, errno, sw_flags);
+      }
+    }
+
+    if (assoc_status & (GHOST_ASSOC_SF_ALREADY | GHOST_ASSOC_SF_BRAND_NEW)) {
+      // The association succeeded, but we need to handle it specially.  In
+      // both of these cases, we will eventually get all of the messages for
+      // this task and we do not need to discover it.
+      //
+      // 1) The task's queue was already set to our default queue.  This
+      // means that it arrived after we called SetDefaultQueue, and all of
+      // the messages for the task's state (TASK_NEW, etc.) have been
+      // delivered to us.
+      // 2) Regardless of whether or not the task's queue was set, the kernel
+      // has not sent a TASK_NEW yet.  This happens when a third party
+      // setsched's a running task into ghost; the kernel waits until the task
+      // gets off cpu to send the TASK_NEW.
+      //
+      // In either event, we skip the task during discovery, and will call
+      // TaskNew (and potentially TaskDeparted!) when we handle messages
+      // later.
+      return false;
+    }
+
+    return true;
+  }
+
+  // The second phase of discovery for `d`. Runs on the thread that called
+  // `DiscoverTasks`.
+  void FinishDiscoveredTask(const DiscoveredTask& d) {
+    TaskType* task;
+    bool allocated;
+    std::tie(task, allocated) = allocator()->GetTask(Gtid(d.gtid), d.swi);
+    // It's a bug if we already created this since we do not allow concurrent
+    // discovery and message handling.
+    if (!allocated) {
+      GHOST_ERROR("Already had task for gtid %lu!", d.gtid);
+    }
+
+    if (d.departed) {
+      allocator()->FreeTask(task);
+      return;
+    }
+
+    // Synthesize a message on the stack from the copied SW state.  All ghost
+    // messages must be aligned to the *size* of ghost_msg, not to the
+    // alignment of a ghost_msg.  This means the payloads will be aligned to
+    // that value (8 currently)
+    struct {
+      ghost_msg header;
+      ghost_msg_payload_task_new payload;
+    } synth __attribute__((aligned(sizeof(ghost_msg))));
+    // Make sure there's no magic padding between the structs.
+    static_assert(sizeof(synth) ==
+                  sizeof(ghost_msg) + sizeof(ghost_msg_payload_task_new));
+
+    ghost_msg* gm = &synth.header;
+    ghost_msg_payload_task_new* tn = &synth.payload;
+    gm->type = MSG_TASK_NEW;
+    gm->length = sizeof(synth);
+    gm->seqnum = d.barrier;
+
+    tn->gtid = d.gtid;
+    tn->runtime = d.runtime;
+    tn->runnable = !!(d.flags & GHOST_SW_TASK_RUNNABLE);
+    tn->sw_info = d.swi;
+
+    Message msg(gm);
+    TaskNew(task, msg);
+    TaskDiscovered(task);
+  }
+
   std::shared_ptr<TaskAllocator<TaskType>> const allocator_;
+  int discovery_workers_ = 0;
 };
 
 // A single-threaded (thread-hostile) Task allocator implementation suitable for
@@ -14,11 +14,35 @@
 #include <string>
 #include <thread>
 
+#ifdef __BMI2__
+#include <immintrin.h>
+#endif
+
 #include "absl/strings/str_format.h"
 #include <numa.h>
 
 namespace ghost {
 
+std::ostream& operator<<(std::ostream& os, TopologyLevel level) {
+  switch (level) {
+    case TopologyLevel::kSmt:
+      return os << "SMT";
+    case TopologyLevel::kCluster:
+      return os << "Cluster";
+    case TopologyLevel::kL3:
+      return os << "L3";
+    case TopologyLevel::kNumaNode:
+      return os << "NUMA node";
+    case TopologyLevel::kDie:
+      return os << "Die";
+    case TopologyLevel::kPackage:
+      return os << "Package";
+    case TopologyLevel::kMachine:
+      return os << "Machine";
+  }
+  return os << "Unknown level " << static_cast<int>(level);
+}
+
 CpuMap::CpuMap(const Topology& topology)
     : topology_(&topology),
       map_size_((topology.num_cpus() + kIntsBits - 1) / kIntsBits) {
@@ -36,17 +60,39 @@ Cpu CpuList::GetNthCpu(uint32_t n) const {
       n -= count;
     } else {
       // The `n`th set bit is in this word.
-
-      // Clears the least significant `n` bits in `word`.
+#ifdef __BMI2__
+      // Deposits the single bit `1 << n` into the `n`th set bit of `word`.
+      word = _pdep_u64(1ULL << n, word);
+      return topology_->cpu(i * kIntsBits + absl::countr_zero(word));
+#else
+      // Skips whole bytes with fewer than `n + 1` set bits, then clears the
+      // least significant `n` bits in the byte that is left.
+      uint32_t offset = 0;
+      for (int byte_count; (byte_count = absl::popcount(word & 0xff)) <= n;) {
+        n -= byte_count;
+        word >>= 8;
+        offset += 8;
+      }
       for (uint32_t j = 0; j < n; j++) {
         word &= word - 1;
       }
-      return topology_->cpu(i * kIntsBits + __builtin_ctzll(word));
+      return topology_->cpu(i * kIntsBits + offset + absl::countr_zero(word));
+#endif
     }
   }
   return Cpu(Cpu::UninitializedType::kUninitialized);
 }
 
+CpuList AtomicCpuMap::Snapshot(const CpuList& mask) const {
+  CpuList result(topology());
+  for (size_t i = 0; i < map_size_; i++) {
+    if (mask.bitmap_[i]) {
+      result.bitmap_[i] = GetNthMap(i) & mask.bitmap_[i];
+    }
+  }
+  return result;
+}
+
 void CpuMap::Iter::FindNextSetBit() {
   uint32_t map_idx = id_ / kIntsBits;
   const size_t bit_offset = id_ & (kIntsBits - 1);
@@ -124,6 +170,74 @@ absl::flat_hash_map<int, CpuList> Topology::GetAllSiblings(
   return siblings;
 }
 
+void Topology::ReadOuterSiblings(const std::filesystem::path& path_prefix) {
+  // Clusters are only reported by newer kernels. Where they aren't, a cluster
+  // is the set of cores that share an L2 cache.
+  absl::flat_hash_map<int, CpuList> cluster_siblings =
+      GetAllSiblings(path_prefix, "topology/cluster_cpus_list");
+  if (cluster_siblings.empty()) {
+    cluster_siblings =
+        GetAllSiblings(path_prefix, "cache/index2/shared_cpu_list");
+  }
+  absl::flat_hash_map<int, CpuList> die_siblings =
+      GetAllSiblings(path_prefix, "topology/die_cpus_list");
+  // `core_siblings_list` is the older name of `package_cpus_list`.
+  absl::flat_hash_map<int, CpuList> package_siblings =
+      GetAllSiblings(path_prefix, "topology/package_cpus_list");
+  if (package_siblings.empty()) {
+    package_siblings =
+        GetAllSiblings(path_prefix, "topology/core_siblings_list");
+  }
+
+  auto fill = [this](const absl::flat_hash_map<int, CpuList>& siblings,
+                     std::unique_ptr<CpuList> Cpu::CpuRep::*field) {
+    if (!siblings.empty()) {
+      CHECK_EQ(siblings.size(), num_cpus_);
+    }
+    for (Cpu::CpuRep& rep : cpus_) {
+      rep.*field = std::make_unique<CpuList>(*this);
+      if (!siblings.empty()) {
+        *(rep.*field) = siblings.find(rep.cpu)->second;
+      }
+    }
+  };
+  fill(cluster_siblings, &Cpu::CpuRep::cluster_siblings);
+  fill(die_siblings, &Cpu::CpuRep::die_siblings);
+  fill(package_siblings, &Cpu::CpuRep::package_siblings);
+}
+
+void Topology::ComputeLevels() {
+  // Each L3 cache is identified by its lowest CPU.
+  absl::flat_hash_set<int> l3_caches;
+
+  for (Cpu::CpuRep& rep : cpus_) {
+    // Indexed by `TopologyLevel`.
+    const CpuList* shared[kNumTopologyLevels] = {
+        rep.siblings.get(),        rep.cluster_siblings.get(),
+        rep.l3_siblings.get(),     &cpus_on_node_[rep.numa_node],
+        rep.die_siblings.get(),    rep.package_siblings.get(),
+        &all_cpus_,
+    };
+
+    CpuList level = EmptyCpuList();
+    level.Set(rep.cpu);
+    CpuList nearer = level;
+    for (int i = 0; i < kNumTopologyLevels; i++) {
+      // Union with the nearer levels so that each level includes them even if
+      // the kernel does not report a level, or reports levels that don't nest.
+      level.Union(*shared[i]);
+      rep.level_cpus[i] = std::make_unique<CpuList>(level);
+      rep.cpus_at_distance[i] = std::make_unique<CpuList>(level - nearer);
+      nearer = level;
+    }
+
+    if (!rep.l3_siblings->Empty()) {
+      l3_caches.insert(rep.l3_siblings->Front().id());
+    }
+  }
+  num_ccxs_ = l3_caches.size();
+}
+
 static std::vector<std::string> split(const std::string& s, std::string regex) {
   std::vector<std::string> result;
   std::regex split_on(regex);
@@ -205,12 +319,14 @@ Topology::Topology(InitHost) : num_cpus_(std::thread::hardware_concurrency()) {
     rep->smt_idx = idx;
     all_cpus_.Set(i);
   }
+  ReadOuterSiblings("/sys/devices/system/cpu");
 
   // Calculate the node with highest idx. This can in turn be used to tell how
   // many nodes are in the system (ignoring hotplug).
   highest_node_idx_ = GetHighestNodeIdx("/sys/devices/system/node/possible");
   CheckSiblings();
   CreateCpuListsForNumaNodes(highest_node_idx_ + 1);
+  ComputeLevels();
 }
 
 void Topology::CreateTestSibling(
@@ -291,6 +407,35 @@ std::filesystem::path Topology::SetUpTestSiblings(
     }
   }
 
+  // Pairs of physical cores share an L2 cluster, e.g., CPUs 0-1 and 56-57.
+  for (int i = 0; i < sibling_offset; i += 2) {
+    std::string cluster_list =
+        absl::StrFormat("%d-%d,%d-%d", i, i + 1, i + sibling_offset,
+                        i + sibling_offset + 1);
+    for (int cpu : {i, i + 1, i + sibling_offset, i + sibling_offset + 1}) {
+      CreateTestSibling(cpu, topology_test_directory, cluster_list,
+                        "topology", "cluster_cpus_list");
+    }
+  }
+
+  // Each NUMA node is a die, and both dies are in one package.
+  for (int i = 0; i < sibling_offset; i += l3_offset) {
+    std::string die_list =
+        absl::StrFormat("%d-%d,%d-%d", i, i + (l3_offset - 1),
+                        i + sibling_offset, i + sibling_offset - 1 + l3_offset);
+    for (int j = i; j < (i + l3_offset); j++) {
+      CreateTestSibling(j, topology_test_directory, die_list, "topology",
+                        "die_cpus_list");
+      CreateTestSibling(j + sibling_offset, topology_test_directory, die_list,
+                        "topology", "die_cpus_list");
+    }
+  }
+  const std::string package_list = absl::StrFormat("0-%d", num_cpus_ - 1);
+  for (int i = 0; i < num_cpus_; i++) {
+    CreateTestSibling(i, topology_test_directory, package_list, "topology",
+                      "package_cpus_list");
+  }
+
   return topology_test_directory;
 }
 
@@ -375,10 +520,12 @@ Topology::Topology(InitTest, const std::filesystem::path& test_directory,
     rep->smt_idx = idx;
     all_cpus_.Set(i);
   }
+  ReadOuterSiblings(siblings_prefix);
 
   highest_node_idx_ = GetHighestNodeIdx(node_possible_path);
   CheckSiblings();
   CreateCpuListsForNumaNodes(highest_node_idx_ + 1);
+  ComputeLevels();
 }
 
 namespace {
@@ -397,9 +544,13 @@ void CheckCustomTopology(const std::vector<Cpu::Raw>& cpus) {
       CHECK_GE(s, 0);
       CHECK_LT(s, cpus.size());
     }
-    for (int s : cpu.l3_siblings) {
-      CHECK_GE(s, 0);
-      CHECK_LT(s, cpus.size());
+    for (const std::vector<int>* siblings :
+         {&cpu.l3_siblings, &cpu.cluster_siblings, &cpu.die_siblings,
+          &cpu.package_siblings}) {
+      for (int s : *siblings) {
+        CHECK_GE(s, 0);
+        CHECK_LT(s, cpus.size());
+      }
     }
   }
 }
@@ -416,6 +567,18 @@ void Topology::CheckSiblings() const {
     for (const Cpu& sibling : cpu.l3_siblings()) {
       CHECK_EQ(cpu.l3_siblings(), sibling.l3_siblings());
     }
+
+    for (const Cpu& sibling : cpu.cluster_siblings()) {
+      CHECK_EQ(cpu.cluster_siblings(), sibling.cluster_siblings());
+    }
+
+    for (const Cpu& sibling : cpu.die_siblings()) {
+      CHECK_EQ(cpu.die_siblings(), sibling.die_siblings());
+    }
+
+    for (const Cpu& sibling : cpu.package_siblings()) {
+      CHECK_EQ(cpu.package_siblings(), sibling.package_siblings());
+    }
   }
 }
 
@@ -449,12 +612,19 @@ Topology::Topology(InitCustom, std::vector<Cpu::Raw> raw_cpus)
     *rep->siblings = ToCpuList(raw_cpu.siblings);
     rep->l3_siblings = std::make_unique<CpuList>(*this);
     *rep->l3_siblings = ToCpuList(raw_cpu.l3_siblings);
+    rep->cluster_siblings = std::make_unique<CpuList>(*this);
+    *rep->cluster_siblings = ToCpuList(raw_cpu.cluster_siblings);
+    rep->die_siblings = std::make_unique<CpuList>(*this);
+    *rep->die_siblings = ToCpuList(raw_cpu.die_siblings);
+    rep->package_siblings = std::make_unique<CpuList>(*this);
+    *rep->package_siblings = ToCpuList(raw_cpu.package_siblings);
 
     all_cpus_.Set(i);
   }
 
   CheckSiblings();
   CreateCpuListsForNumaNodes(highest_node_idx_ + 1);
+  ComputeLevels();
 }
 
 CpuList Topology::ParseCpuStr(const std::string& str) const {
@@ -504,7 +674,12 @@ std::vector<Cpu::Raw> Topology::Export() const {
                          .smt_idx = cpu.smt_idx(),
                          .siblings = cpu.siblings().ToIntVector(),
                          .l3_siblings = cpu.l3_siblings().ToIntVector(),
-                         .numa_node = cpu.numa_node()});
+                         .numa_node = cpu.numa_node(),
+                         .cluster_siblings =
+                             cpu.cluster_siblings().ToIntVector(),
+                         .die_siblings = cpu.die_siblings().ToIntVector(),
+                         .package_siblings =
+                             cpu.package_siblings().ToIntVector()});
   }
   return to_export;
 }
@@ -14,12 +14,18 @@
 
 #include <sched.h>
 
+#ifdef __AVX2__
+#include <immintrin.h>
+#endif
+
+#include <array>
 #include <atomic>
 #include <filesystem>
 #include <vector>
 
 #include "absl/container/flat_hash_map.h"
 #include "absl/container/flat_hash_set.h"
+#include "absl/numeric/bits.h"
 #include "lib/base.h"
 
 // We carry some definitions currently which anchor on this for convenience.
@@ -32,8 +38,49 @@ namespace ghost {
 class CpuList;
 class Topology;
 
+// The levels of the topology that CPUs can share, from the nearest to the
+// furthest. Each level includes the nearer ones: two CPUs that share an L3
+// cache are at `kL3` from each other unless they share an L2 cluster or a core
+// too.
+//
+// Not all machines have every level, e.g. only chiplet CPUs have several L3
+// caches per package and only some kernels report clusters. A missing level is
+// the same as the level below it. The NUMA node comes before the die so that
+// with sub-NUMA clustering, where a die has several nodes, a CPU's own node is
+// nearer than the rest of its die.
+enum class TopologyLevel {
+  // A physical core, i.e., its hardware threads.
+  kSmt,
+  // A cluster of cores that share an L2 cache.
+  kCluster,
+  // An L3 cache, which is a CCX on AMD CPUs.
+  kL3,
+  kNumaNode,
+  kDie,
+  kPackage,
+  // The whole machine.
+  kMachine,
+};
+
+inline constexpr int kNumTopologyLevels =
+    static_cast<int>(TopologyLevel::kMachine) + 1;
+
+// All levels from the nearest to the furthest, for searching outward:
+// for (TopologyLevel level : kTopologyLevels) {
+//   for (const Cpu& cpu : this_cpu.cpus_at_distance(level)) {
+//     ...
+//   }
+// }
+inline constexpr std::array<TopologyLevel, kNumTopologyLevels> kTopologyLevels =
+    {TopologyLevel::kSmt,      TopologyLevel::kCluster, TopologyLevel::kL3,
+     TopologyLevel::kNumaNode, TopologyLevel::kDie,     TopologyLevel::kPackage,
+     TopologyLevel::kMachine};
+
+std::ostream& operator<<(std::ostream& os, TopologyLevel level);
+
 // This is a CPU in the topology. This class holds information about the CPU
-// ID, its physical core, its siblings, and its NUMA node.
+// ID, its physical core, its siblings at each level of the topology, and its
+// NUMA node.
 //
 // CPUs are generally only constructed by the `Topology` class. Example:
 // int cpu_id = 0;
@@ -51,6 +98,11 @@ class Cpu {
     std::vector<int> siblings;
     std::vector<int> l3_siblings;
     int numa_node;
+    // These are empty if the machine does not have (or the kernel does not
+    // report) the level.
+    std::vector<int> cluster_siblings;
+    std::vector<int> die_siblings;
+    std::vector<int> package_siblings;
     // If any additional fields are added to this struct, then update the
     // implementation of the override of the `==` operator below.
 
@@ -60,7 +112,10 @@ class Cpu {
     bool operator==(const Raw& other) const {
       return cpu == other.cpu && core == other.core &&
              smt_idx == other.smt_idx && siblings == other.siblings &&
-             l3_siblings == other.l3_siblings && numa_node == other.numa_node;
+             l3_siblings == other.l3_siblings && numa_node == other.numa_node &&
+             cluster_siblings == other.cluster_siblings &&
+             die_siblings == other.die_siblings &&
+             package_siblings == other.package_siblings;
     }
     bool operator!=(const Raw& other) const { return !(*this == other); }
     bool operator<(const Raw& other) const { return cpu < other.cpu; }
@@ -78,6 +133,25 @@ class Cpu {
   // then the microarchitecture does not have an L3 cache.
   const CpuList& l3_siblings() const { return *rep_->l3_siblings; }
   int numa_node() const { return rep_->numa_node; }
+  // Return the CPUs that share an L2 cluster, a die, and a package with this
+  // CPU, respectively, as reported by the kernel. Each is empty if the kernel
+  // does not report the level.
+  const CpuList& cluster_siblings() const { return *rep_->cluster_siblings; }
+  const CpuList& die_siblings() const { return *rep_->die_siblings; }
+  const CpuList& package_siblings() const { return *rep_->package_siblings; }
+
+  // Returns the CPUs that share `level`, or a nearer level, with this CPU,
+  // including this CPU.
+  const CpuList& level_cpus(TopologyLevel level) const {
+    return *rep_->level_cpus[static_cast<int>(level)];
+  }
+  // Returns the CPUs whose nearest level shared with this CPU is `level`. These
+  // are disjoint across levels and together cover every other CPU, so
+  // searching them level by level visits the nearest CPUs first. This CPU is in
+  // none of them.
+  const CpuList& cpus_at_distance(TopologyLevel level) const {
+    return *rep_->cpus_at_distance[static_cast<int>(level)];
+  }
 
   bool operator==(const Cpu& other) const { return id() == other.id(); }
   bool operator!=(const Cpu& other) const { return !(*this == other); }
@@ -105,6 +179,13 @@ class Cpu {
     std::unique_ptr<CpuList> siblings;
     std::unique_ptr<CpuList> l3_siblings;
     int numa_node;
+    std::unique_ptr<CpuList> cluster_siblings;
+    std::unique_ptr<CpuList> die_siblings;
+    std::unique_ptr<CpuList> package_siblings;
+    // Indexed by `TopologyLevel`. Computed from the fields above once the
+    // whole topology is known.
+    std::unique_ptr<CpuList> level_cpus[kNumTopologyLevels];
+    std::unique_ptr<CpuList> cpus_at_distance[kNumTopologyLevels];
   };
 
   explicit Cpu(const CpuRep* rep) : rep_(rep) { CHECK_NE(rep, nullptr); }
@@ -256,10 +337,120 @@ class CpuMap {
 // bitmap. Common bitwise operations such as Intersection, Set/Clear, FindNext
 // etc. are implemented with room for further extensions and arch specific
 // optimizations as needed.
+//
+// Iteration, `Size()` and `Empty()` work directly on the bitmap rather than
+// through the virtual `CpuMap::GetNthMap()`, since schedulers call them on
+// CpuLists in their hot loops.
 class CpuList : public CpuMap {
  public:
   explicit CpuList(const Topology& topology) : CpuMap(topology) {}
 
+#ifdef __AVX2__
+  // These copy the bitmap with the same 32-byte stores that the set operations
+  // load with. A 32-byte load cannot be forwarded from narrower stores, so a
+  // set operation on a fresh copy would otherwise wait for the copy to reach
+  // the cache.
+  CpuList(const CpuList& other) : CpuMap(other) { CopyBitmap(other); }
+  CpuList& operator=(const CpuList& other) {
+    CpuMap::operator=(other);
+    CopyBitmap(other);
+    return *this;
+  }
+#endif
+
+  // Like `CpuMap::Iter`, but reads the words of `bitmap_` directly. The word
+  // is read again on each step, so bits that are set or cleared during a loop
+  // are seen the same way that `CpuMap::Iter` sees them.
+  class Iter {
+   public:
+    // Iterator traits.
+    using difference_type = CpuMap;
+    using value_type = CpuMap;
+    using pointer = const CpuMap*;
+    using reference = const CpuMap&;
+    using iterator_category = std::input_iterator_tag;
+
+    explicit Iter(const CpuList* list, uint32_t id) : list_(list), id_(id) {
+      DCHECK_NE(list, nullptr);
+      if (id_ < list_->map_size_ * kIntsBits) {
+        const uint32_t map_idx = id_ / kIntsBits;
+        FindSetBit(map_idx,
+                   list_->bitmap_[map_idx] & (~0ULL << (id_ % kIntsBits)));
+      } else {
+        SetEnd();
+      }
+    }
+
+    bool operator==(const Iter& other) const { return id_ == other.id_; }
+    bool operator!=(const Iter& other) const { return !(id_ == other.id_); }
+
+    const Cpu* operator->() const { return &cpu_; }
+    Cpu operator*() const { return cpu_; }
+
+    // Pre-increment op.
+    Cpu operator++() {
+      Next();
+      return cpu_;
+    }
+
+    // Post-increment op.
+    Cpu operator++(int) {
+      Cpu old_cpu = cpu_;
+      Next();
+      return old_cpu;
+    }
+
+   private:
+    // Moves to the first set bit after `id_`.
+    void Next() {
+      const uint32_t map_idx = id_ / kIntsBits;
+      // Clears bit `id_` and every bit below it. `~1ULL` rather than `~0ULL`
+      // keeps the shift below 64 when `id_` is the top bit of the word.
+      FindSetBit(map_idx,
+                 list_->bitmap_[map_idx] & (~1ULL << (id_ % kIntsBits)));
+    }
+
+    // Moves to the lowest set bit in `word`, which holds the bits of slot
+    // `map_idx` that have not been visited yet, or in the slots after it.
+    // Defined below `Topology`.
+    inline void FindSetBit(uint32_t map_idx, uint64_t word);
+
+    // Fast forwards to the `end` Iter to bail out of range based for-loops.
+    inline void SetEnd();
+
+    // The CPU corresponding to the bit that the iterator is currently
+    // pointing at, or an uninitialized CPU at the end of the range.
+    Cpu cpu_{Cpu::UninitializedType::kUninitialized};
+
+    const CpuList* list_;
+
+    // The bit that the iterator is currently pointing at.
+    uint32_t id_;
+  };
+  // These hide the `CpuMap` versions so that range-based for-loops over a
+  // CpuList use `CpuList::Iter`.
+  Iter begin() const { return Iter(this, /*id=*/0); }
+  inline Iter end() const;
+
+  // Returns true if bitmap is all 0s, otherwise returns false.
+  bool Empty() const {
+    for (size_t i = 0; i < map_size_; ++i) {
+      if (bitmap_[i]) {
+        return false;
+      }
+    }
+    return true;
+  }
+
+  // Returns number of set bits in the bitmap.
+  uint32_t Size() const {
+    uint32_t ret = 0;
+    for (size_t i = 0; i < map_size_; ++i) {
+      ret += absl::popcount(bitmap_[i]);
+    }
+    return ret;
+  }
+
   // Returns true if `this` and `other` have identical bitmaps, false
   // otherwise.
   bool operator==(const CpuList& other) const {
@@ -325,8 +516,14 @@ class CpuList : public CpuMap {
   // ...
   // a.Intersection(b);  // Mutates `a`.
   void Intersection(const CpuList& src) {
+#ifdef __AVX2__
+    for (size_t i = 0; i < kMapCapacity; i += kWordsPerVector) {
+      StoreVector(i, _mm256_and_si256(LoadVector(i), src.LoadVector(i)));
+    }
+#else
     std::transform(bitmap_, bitmap_ + map_size_, src.bitmap_, bitmap_,
                    [](uint64_t a, uint64_t b) { return a & b; });
+#endif
   }
 
   // Performs a bitwise OR over two bitmaps and stores the result in the
@@ -338,8 +535,14 @@ class CpuList : public CpuMap {
   // ...
   // a.Union(b);  // Mutates `a`.
   void Union(const CpuList& src) {
+#ifdef __AVX2__
+    for (size_t i = 0; i < kMapCapacity; i += kWordsPerVector) {
+      StoreVector(i, _mm256_or_si256(LoadVector(i), src.LoadVector(i)));
+    }
+#else
     std::transform(bitmap_, bitmap_ + map_size_, src.bitmap_, bitmap_,
                    [](uint64_t a, uint64_t b) { return a | b; });
+#endif
   }
 
   // Performs a bitwise `AND NOT` over two bitmaps, and stores the result in the
@@ -352,8 +555,15 @@ class CpuList : public CpuMap {
   // ...
   // a.Subtract(b);  // Mutates `a`.
   void Subtract(const CpuList& src) {
+#ifdef __AVX2__
+    for (size_t i = 0; i < kMapCapacity; i += kWordsPerVector) {
+      // `_mm256_andnot_si256(b, a)` is `~b & a`.
+      StoreVector(i, _mm256_andnot_si256(src.LoadVector(i), LoadVector(i)));
+    }
+#else
     std::transform(bitmap_, bitmap_ + map_size_, src.bitmap_, bitmap_,
                    [](uint64_t a, uint64_t b) { return a & ~b; });
+#endif
   }
 
   // Sets the bit at index `id`.
@@ -458,7 +668,32 @@ class CpuList : public CpuMap {
     return bitmap_[n];
   }
 
+#ifdef __AVX2__
+  // The set operations work on all `kMapCapacity` words, four at a time,
+  // rather than on the first `map_size_` words. The words past `map_size_` are
+  // 0 in every CpuList and AND, OR and AND NOT keep them 0.
+  static constexpr size_t kWordsPerVector = sizeof(__m256i) / sizeof(uint64_t);
+  static_assert(kMapCapacity % kWordsPerVector == 0);
+
+  __m256i LoadVector(size_t i) const {
+    return _mm256_loadu_si256(reinterpret_cast<const __m256i*>(&bitmap_[i]));
+  }
+
+  void StoreVector(size_t i, __m256i v) {
+    _mm256_storeu_si256(reinterpret_cast<__m256i*>(&bitmap_[i]), v);
+  }
+
+  void CopyBitmap(const CpuList& other) {
+    for (size_t i = 0; i < kMapCapacity; i += kWordsPerVector) {
+      StoreVector(i, other.LoadVector(i));
+    }
+  }
+#endif
+
   uint64_t bitmap_[kMapCapacity] = {0};
+
+  // For `AtomicCpuMap::Snapshot()`.
+  friend class AtomicCpuMap;
 };
 
 // An atomic implementation of a CpuMap. Useful for cases where it would be
@@ -513,6 +748,11 @@ class AtomicCpuMap : public CpuMap {
   }
   bool TestAndClear(const Cpu& cpu) { return TestAndClear(cpu.id()); }
 
+  // Returns the CPUs in `mask` that are set in this map. Only the words that
+  // have CPUs in `mask` are loaded, and each of them once, so the result is
+  // consistent within each group of 64 CPUs but not necessarily across them.
+  CpuList Snapshot(const CpuList& mask) const;
+
  private:
   uint64_t GetNthMap(int n) const override {
     DCHECK_GE(n, 0);
@@ -534,7 +774,6 @@ class AtomicCpuMap : public CpuMap {
 //   int numa_node = cpu.numa_node();
 //   ...
 // }
-// TODO: Needs other sub-NUMA topology information.
 class Topology {
  public:
   // These two functions use the private `Topology` constructor.
@@ -606,9 +845,20 @@ class Topology {
   // Returns the number of CPUs per physical core.
   uint32_t smt_count() const { return cpus_[0].siblings->Size(); }
 
-  // Returns the number of CCXs in this topology.
-  // TODO: compute this
-  uint32_t num_ccxs() const { return 0; }
+  // Returns the number of CCXs (i.e., L3 caches) in this topology. Returns 0 if
+  // the microarchitecture does not have an L3 cache.
+  uint32_t num_ccxs() const { return num_ccxs_; }
+
+  // Returns the nearest level of the topology that `a` and `b` share.
+  // `Distance(a, a)` is `TopologyLevel::kSmt`.
+  TopologyLevel Distance(const Cpu& a, const Cpu& b) const {
+    for (TopologyLevel level : kTopologyLevels) {
+      if (a.level_cpus(level).IsSet(b)) {
+        return level;
+      }
+    }
+    return TopologyLevel::kMachine;
+  }
 
   // Returns the number of numa nodes in this topology.
   uint32_t num_numa_nodes() const { return highest_node_idx_ + 1; }
@@ -706,6 +956,14 @@ class Topology {
   // siblings, then their siblings lists should be identical.
   void CheckSiblings() const;
 
+  // Reads the cluster, die, and package siblings of every CPU from sysfs
+  // under `path_prefix`. Each is left empty if the kernel does not report it.
+  void ReadOuterSiblings(const std::filesystem::path& path_prefix);
+
+  // Computes each CPU's `level_cpus` and `cpus_at_distance` and the number of
+  // CCXs from the siblings and NUMA nodes, which must all be filled in.
+  void ComputeLevels();
+
   // Gets the largest NUMA node index. Note that this is different from the
   // number of NUMA nodes, if indexing skips some offline or unavailable NUMA
   // nodes.
@@ -721,9 +979,9 @@ class Topology {
                          const std::string& dir_path,
                          const std::string& file_name) const;
 
-  // Initializes the test directory to contain `thread_siblings` files in the
-  // same organization and structure as on a normal Linux system in the sysfs
-  // CPU root.
+  // Initializes the test directory to contain `thread_siblings`, cache, cluster,
+  // die, and package files in the same organization and structure as on a
+  // normal Linux system in the sysfs CPU root.
   //
   // If `has_l3_cache` is true, creates an L3 cache. Otherwise, does not create
   // an L3 cache.
@@ -752,8 +1010,31 @@ class Topology {
   int highest_node_idx_ = -1;
 
   std::vector<CpuList> cpus_on_node_;
+
+  uint32_t num_ccxs_ = 0;
 };
 
+inline void CpuList::Iter::FindSetBit(uint32_t map_idx, uint64_t word) {
+  while (!word) {
+    if (++map_idx >= list_->map_size_) {
+      SetEnd();
+      return;
+    }
+    word = list_->bitmap_[map_idx];
+  }
+  id_ = map_idx * kIntsBits + absl::countr_zero(word);
+  cpu_ = list_->topology().cpu(id_);
+}
+
+inline void CpuList::Iter::SetEnd() {
+  id_ = list_->topology().num_cpus();
+  cpu_ = Cpu(Cpu::UninitializedType::kUninitialized);
+}
+
+inline CpuList::Iter CpuList::end() const {
+  return Iter(this, /*id=*/topology_->num_cpus());
+}
+
 // Returns the topology for this machine. The pointer is never null and is
 // owned by the `MachineTopology` function. The pointer lives until the
 // process dies.
@@ -771,6 +1052,9 @@ Topology* MachineTopology();
 // share the same L3 cache. If `has_l3_cache` is false, then the topology is
 // configured as though the microarchitecture does not have an L3 cache.
 //
+// Pairs of physical cores (0-1, 2-3, ...) share an L2 cluster, each NUMA node
+// is its own die, and both dies are in one package.
+//
 // `test_directory` is a path to scratch space in the file system that the
 // topology can use.
 void UpdateTestTopology(const std::filesystem::path& test_directory,
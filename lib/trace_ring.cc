@@ -0,0 +1,524 @@
+// Copyright 2022 Google LLC
+//
+// Use of this source code is governed by a BSD-style
+// license that can be found in the LICENSE file or at
+// https://developers.google.com/open-source/licenses/bsd
+
+#include "lib/trace_ring.h"
+
+#include <fcntl.h>
+#include <linux/futex.h>
+#include <sched.h>
+#include <sys/syscall.h>
+#include <unistd.h>
+
+#include <cerrno>
+#include <cstdlib>
+#include <cstring>
+#include <fstream>
+#include <iterator>
+#include <thread>
+
+#include "absl/base/internal/spinlock.h"
+#include "absl/container/flat_hash_map.h"
+#include "absl/flags/flag.h"
+#include "absl/numeric/bits.h"
+#include "absl/strings/str_cat.h"
+#include "absl/strings/str_format.h"
+#include "absl/strings/str_join.h"
+#include "lib/base.h"
+
+ABSL_FLAG(std::string, dprint_trace, "",
+          "If set, GHOST_DPRINT records into per-thread binary trace rings "
+          "that are written to this file rather than printing. Decode the file "
+          "with trace_decode.");
+ABSL_FLAG(int32_t, dprint_trace_ring_size, 16384,
+          "The number of 64-byte trace records in each thread's ring");
+ABSL_FLAG(absl::Duration, dprint_trace_flush_interval, absl::Milliseconds(100),
+          "How often the trace rings are written out");
+
+namespace ghost {
+
+namespace {
+
+std::atomic<const char*> trace_formats[TraceFormats::kMaxFormats];
+std::atomic<uint32_t> num_trace_formats{0};
+
+// The layout of trace files: a `TraceFileHeader`, then any number of blocks,
+// each a `TraceFileBlock` followed by `length` bytes.
+constexpr char kTraceFileMagic[8] = {'G', 'H', 'T', 'R', 'A', 'C', 'E', '2'};
+
+struct TraceFileHeader {
+  char magic[8];
+  // A `TscClock::Now()` reading and the wall time at that point.
+  uint64_t base_ticks;
+  int64_t base_unix_nanos;
+  double ticks_per_ns;
+};
+
+enum TraceFileBlockType : uint32_t {
+  // `id` is a format ID and the block holds its format string.
+  kTraceFormatBlock = 1,
+  // `id` is a tid and the block holds records from its ring.
+  kTraceRecordsBlock = 2,
+  // `id` is a tid and the block holds a uint64_t, the number of records its
+  // ring has dropped so far.
+  kTraceDroppedBlock = 3,
+};
+
+struct TraceFileBlock {
+  uint32_t type;
+  uint32_t id;
+  uint64_t length;
+};
+
+// Writes all of `bytes` to `fd`. Safe to call from a signal handler.
+bool WriteAll(int fd, const void* bytes, size_t length) {
+  const char* p = static_cast<const char*>(bytes);
+  while (length > 0) {
+    const ssize_t n = write(fd, p, length);
+    if (n < 0) {
+      if (errno == EINTR) {
+        continue;
+      }
+      return false;
+    }
+    p += n;
+    length -= n;
+  }
+  return true;
+}
+
+bool WriteBlock(int fd, TraceFileBlockType type, uint32_t id, const void* bytes,
+                size_t length) {
+  const TraceFileBlock block = {.type = type, .id = id, .length = length};
+  return WriteAll(fd, &block, sizeof(block)) && WriteAll(fd, bytes, length);
+}
+
+int FutexWait(std::atomic<int>* f, int val, const timespec* timeout) {
+  return syscall(__NR_futex, reinterpret_cast<int*>(f), FUTEX_WAIT_PRIVATE,
+                 val, timeout);
+}
+
+int FutexWake(std::atomic<int>* f) {
+  return syscall(__NR_futex, reinterpret_cast<int*>(f), FUTEX_WAKE_PRIVATE,
+                 INT32_MAX, nullptr);
+}
+
+}  // namespace
+
+// static
+uint32_t TraceFormats::Register(const char* format) {
+  const uint32_t id = num_trace_formats.fetch_add(1, std::memory_order_relaxed);
+  CHECK_LT(id, kMaxFormats);
+  trace_formats[id].store(format, std::memory_order_release);
+  return id;
+}
+
+// static
+const char* TraceFormats::Get(uint32_t id) {
+  if (id >= kMaxFormats) {
+    return nullptr;
+  }
+  return trace_formats[id].load(std::memory_order_acquire);
+}
+
+// static
+uint32_t TraceFormats::Count() {
+  return std::min(num_trace_formats.load(std::memory_order_relaxed),
+                  kMaxFormats);
+}
+
+TraceRing::TraceRing(size_t capacity)
+    // The largest record is one slot plus `kMaxTraceArgs` strings.
+    : mask_(absl::bit_ceil(std::max<size_t>(
+                capacity, 1 + (kMaxTraceArgs * kMaxTraceStringLength +
+                               sizeof(TraceRecord) - 1) /
+                                  sizeof(TraceRecord))) -
+            1),
+      records_(new TraceRecord[mask_ + 1]),
+      tid_(GetTID()) {}
+
+bool TraceRing::Write(uint32_t format_id,
+                      const trace_internal::TraceArg* args,
+                      uint32_t num_args) {
+  size_t string_bytes = 0;
+  for (uint32_t i = 0; i < num_args; i++) {
+    if (args[i].type == TraceArgType::kString) {
+      string_bytes += args[i].str.size();
+    }
+  }
+  const uint64_t slots =
+      1 + (string_bytes + sizeof(TraceRecord) - 1) / sizeof(TraceRecord);
+
+  const uint64_t head = head_.load(std::memory_order_relaxed);
+  if (head + slots - tail_.load(std::memory_order_acquire) > mask_ + 1) {
+    dropped_.fetch_add(1, std::memory_order_relaxed);
+    return false;
+  }
+
+  TraceRecord& record = records_[head & mask_];
+  record.ticks = TscClock::Now();
+  record.format_id = format_id;
+  record.cpu = sched_getcpu();
+  record.num_args = num_args;
+  record.arg_types = 0;
+  // Strings are copied slot by slot, since they may wrap around the end.
+  uint64_t pos = head + 1;
+  size_t offset = 0;
+  for (uint32_t i = 0; i < num_args; i++) {
+    record.set_arg_type(i, args[i].type);
+    record.args[i] = args[i].value;
+    absl::string_view str = args[i].str;
+    while (!str.empty()) {
+      char* slot = reinterpret_cast<char*>(&records_[pos & mask_]);
+      const size_t n = std::min(str.size(), sizeof(TraceRecord) - offset);
+      memcpy(slot + offset, str.data(), n);
+      str.remove_prefix(n);
+      offset += n;
+      if (offset == sizeof(TraceRecord)) {
+        pos++;
+        offset = 0;
+      }
+    }
+  }
+
+  head_.store(head + slots, std::memory_order_release);
+  return true;
+}
+
+size_t TraceRing::Drain(
+    const std::function<void(const TraceRecord&, absl::string_view)>& f) {
+  // Copies the records out so that records whose strings wrap around the end
+  // of the ring are contiguous.
+  std::vector<TraceRecord> records;
+  Consume([&records](const TraceRecord* first, size_t n_first,
+                     const TraceRecord* second, size_t n_second) {
+    records.insert(records.end(), first, first + n_first);
+    records.insert(records.end(), second, second + n_second);
+  });
+  size_t drained = 0;
+  ForEachTraceRecord(records.data(), records.size(),
+                     [&f, &drained](const TraceRecord& record,
+                                    absl::string_view strings) {
+                       f(record, strings);
+                       drained++;
+                     });
+  return drained;
+}
+
+void ForEachTraceRecord(
+    const TraceRecord* records, size_t n,
+    const std::function<void(const TraceRecord&, absl::string_view)>& f) {
+  size_t i = 0;
+  while (i < n) {
+    const TraceRecord& record = records[i];
+    const size_t slots = 1 + record.string_slots();
+    if (slots > n - i) {
+      return;
+    }
+    f(record, absl::string_view(reinterpret_cast<const char*>(&records[i + 1]),
+                                record.string_bytes()));
+    i += slots;
+  }
+}
+
+std::string FormatTraceArgs(const TraceRecord& record, const char* format,
+                            absl::string_view strings) {
+  const uint32_t num_args = std::min<uint32_t>(record.num_args, kMaxTraceArgs);
+  // The arguments, which `absl::FormatArg` refers to rather than copies.
+  double doubles[kMaxTraceArgs];
+  absl::string_view strs[kMaxTraceArgs];
+  std::vector<absl::FormatArg> args;
+  std::vector<std::string> raw;
+  for (uint32_t i = 0; i < num_args; i++) {
+    switch (record.arg_type(i)) {
+      case TraceArgType::kDouble:
+        doubles[i] = absl::bit_cast<double>(record.args[i]);
+        args.emplace_back(doubles[i]);
+        raw.push_back(absl::StrCat(doubles[i]));
+        break;
+      case TraceArgType::kString: {
+        const size_t length =
+            std::min<uint64_t>(record.args[i], kMaxTraceStringLength);
+        strs[i] = strings.substr(0, length);
+        strings.remove_prefix(strs[i].size());
+        args.emplace_back(strs[i]);
+        raw.push_back(std::string(strs[i]));
+        break;
+      }
+      default:
+        args.emplace_back(record.args[i]);
+        raw.push_back(absl::StrCat(record.args[i]));
+        break;
+    }
+  }
+
+  std::string text;
+  if (format &&
+      absl::FormatUntyped(&text, absl::UntypedFormatSpec(format), args)) {
+    return text;
+  }
+  return absl::StrFormat("<format %u> %s", record.format_id,
+                         absl::StrJoin(raw, " "));
+}
+
+std::atomic<DprintTracer*> DprintTracer::instance_{nullptr};
+
+// static
+DprintTracer* DprintTracer::StartFromFlags() {
+  // Threads may race to start the tracer from their first `GHOST_DPRINT`.
+  ABSL_CONST_INIT static absl::base_internal::SpinLock lock(
+      absl::kConstInit, absl::base_internal::SCHEDULE_KERNEL_ONLY);
+  absl::base_internal::SpinLockHolder holder(&lock);
+  if (DprintTracer* tracer = instance()) {
+    return tracer;
+  }
+  const std::string path = absl::GetFlag(FLAGS_dprint_trace);
+  if (path.empty()) {
+    return nullptr;
+  }
+  return Start(path, absl::GetFlag(FLAGS_dprint_trace_ring_size),
+               absl::GetFlag(FLAGS_dprint_trace_flush_interval));
+}
+
+// static
+DprintTracer* DprintTracer::Start(const std::string& path,
+                                  size_t ring_capacity,
+                                  absl::Duration flush_interval) {
+  CHECK_EQ(instance(), nullptr);
+  const int fd = open(path.c_str(), O_WRONLY | O_CREAT | O_TRUNC | O_CLOEXEC,
+                      0644);
+  CHECK_GE(fd, 0) << "Cannot open trace file " << path << ": "
+                  << strerror(errno);
+
+  TraceFileHeader header;
+  memcpy(header.magic, kTraceFileMagic, sizeof(header.magic));
+  header.base_ticks = TscClock::Now();
+  header.base_unix_nanos =
+      absl::ToUnixNanos(TscClock::ToTime(header.base_ticks));
+  header.ticks_per_ns = TscClock::TicksPerMicrosecond() / 1000;
+  CHECK(WriteAll(fd, &header, sizeof(header)));
+
+  // Never deleted, since threads may record into it until the process exits.
+  auto tracer = new DprintTracer(fd, path, ring_capacity, flush_interval);
+  instance_.store(tracer, std::memory_order_release);
+  std::thread(&DprintTracer::FlushLoop, tracer).detach();
+  // Writes out what is left when the process exits normally.
+  std::atexit([] { instance()->Dump(); });
+  return tracer;
+}
+
+DprintTracer::DprintTracer(int fd, std::string path, size_t ring_capacity,
+                           absl::Duration flush_interval)
+    : fd_(fd),
+      path_(std::move(path)),
+      ring_capacity_(ring_capacity),
+      flush_interval_(flush_interval) {}
+
+TraceRing* DprintTracer::NewRing() {
+  auto ring = new TraceRing(ring_capacity_);
+  ring->next_ = rings_.load(std::memory_order_relaxed);
+  while (!rings_.compare_exchange_weak(ring->next_, ring,
+                                       std::memory_order_release,
+                                       std::memory_order_relaxed)) {
+  }
+  return ring;
+}
+
+void DprintTracer::WriteOut() {
+  // Formats first, so that every record in the file follows its format.
+  const uint32_t num_formats = TraceFormats::Count();
+  while (formats_written_ < num_formats) {
+    const char* format = TraceFormats::Get(formats_written_);
+    if (!format) {
+      // Registered, but not stored yet. Its records can't be published yet
+      // either.
+      break;
+    }
+    WriteBlock(fd_, kTraceFormatBlock, formats_written_, format,
+               strlen(format));
+    formats_written_++;
+  }
+
+  for (TraceRing* ring = rings_.load(std::memory_order_acquire); ring;
+       ring = ring->next_) {
+    // Consumes up to what is there now, so a busy ring can't keep us here.
+    ring->Consume([this, ring](const TraceRecord* first, size_t n_first,
+                               const TraceRecord* second, size_t n_second) {
+      const TraceFileBlock block = {
+          .type = kTraceRecordsBlock,
+          .id = static_cast<uint32_t>(ring->tid()),
+          .length = (n_first + n_second) * sizeof(TraceRecord)};
+      WriteAll(fd_, &block, sizeof(block)) &&
+          WriteAll(fd_, first, n_first * sizeof(TraceRecord)) &&
+          WriteAll(fd_, second, n_second * sizeof(TraceRecord));
+    });
+
+    const uint64_t dropped = ring->dropped();
+    if (dropped > 0) {
+      WriteBlock(fd_, kTraceDroppedBlock, ring->tid(), &dropped,
+                 sizeof(dropped));
+    }
+  }
+}
+
+void DprintTracer::FlushLoop() {
+  const timespec interval = absl::ToTimespec(flush_interval_);
+  const bool periodic = flush_interval_ != absl::InfiniteDuration();
+  while (true) {
+    const int requests = flush_requests_.load(std::memory_order_acquire);
+    if (requests == flushes_done_.load(std::memory_order_relaxed)) {
+      FutexWait(&flush_requests_, requests, periodic ? &interval : nullptr);
+    }
+    const int handling = flush_requests_.load(std::memory_order_acquire);
+
+    bool expected = false;
+    if (writing_.compare_exchange_strong(expected, true,
+                                         std::memory_order_acquire)) {
+      WriteOut();
+      writing_.store(false, std::memory_order_release);
+    }
+
+    flushes_done_.store(handling, std::memory_order_release);
+    FutexWake(&flushes_done_);
+  }
+}
+
+void DprintTracer::RequestFlush() {
+  flush_requests_.fetch_add(1, std::memory_order_release);
+  FutexWake(&flush_requests_);
+}
+
+void DprintTracer::Flush() {
+  const int request = flush_requests_.fetch_add(1, std::memory_order_release) + 1;
+  FutexWake(&flush_requests_);
+  while (true) {
+    const int done = flushes_done_.load(std::memory_order_acquire);
+    if (done - request >= 0) {
+      return;
+    }
+    FutexWait(&flushes_done_, done, nullptr);
+  }
+}
+
+void DprintTracer::Dump() {
+  // The flusher may be the thread that crashed, so don't wait for it forever.
+  const uint64_t deadline =
+      TscClock::Now() + TscClock::FromDuration(absl::Milliseconds(100));
+  bool expected = false;
+  while (!writing_.compare_exchange_weak(expected, true,
+                                         std::memory_order_acquire) &&
+         TscClock::Now() < deadline) {
+    expected = false;
+    Pause();
+  }
+  WriteOut();
+  writing_.store(false, std::memory_order_release);
+}
+
+uint64_t DprintTracer::dropped() const {
+  uint64_t dropped = 0;
+  for (TraceRing* ring = rings_.load(std::memory_order_acquire); ring;
+       ring = ring->next_) {
+    dropped += ring->dropped();
+  }
+  return dropped;
+}
+
+absl::StatusOr<DecodedTrace> DecodeTraceFile(const std::string& path) {
+  std::ifstream file(path, std::ios::binary);
+  if (!file) {
+    return absl::NotFoundError(absl::StrCat("Cannot open ", path));
+  }
+  const std::string contents((std::istreambuf_iterator<char>(file)),
+                             std::istreambuf_iterator<char>());
+
+  TraceFileHeader header;
+  if (contents.size() < sizeof(header)) {
+    return absl::InvalidArgumentError(absl::StrCat(path, " is too short"));
+  }
+  memcpy(&header, contents.data(), sizeof(header));
+  if (memcmp(header.magic, kTraceFileMagic, sizeof(header.magic)) != 0) {
+    return absl::InvalidArgumentError(
+        absl::StrCat(path, " is not a trace file"));
+  }
+
+  auto to_time = [&header](uint64_t ticks) {
+    const int64_t delta = static_cast<int64_t>(ticks - header.base_ticks);
+    return absl::FromUnixNanos(header.base_unix_nanos) +
+           absl::Nanoseconds(delta / header.ticks_per_ns);
+  };
+
+  absl::flat_hash_map<uint32_t, std::string> formats;
+  absl::flat_hash_map<uint32_t, uint64_t> dropped;
+  std::vector<std::pair<uint64_t, DecodedTraceRecord>> records;
+  size_t offset = sizeof(header);
+  while (offset < contents.size()) {
+    TraceFileBlock block;
+    if (contents.size() - offset < sizeof(block)) {
+      // A partial write, e.g., from a crash.
+      break;
+    }
+    memcpy(&block, contents.data() + offset, sizeof(block));
+    offset += sizeof(block);
+    if (contents.size() - offset < block.length) {
+      break;
+    }
+    const absl::string_view bytes(contents.data() + offset, block.length);
+    offset += block.length;
+
+    switch (block.type) {
+      case kTraceFormatBlock:
+        formats[block.id] = std::string(bytes);
+        break;
+      case kTraceRecordsBlock: {
+        // Copies the records out to align them.
+        std::vector<TraceRecord> run(bytes.size() / sizeof(TraceRecord));
+        memcpy(run.data(), bytes.data(), run.size() * sizeof(TraceRecord));
+        ForEachTraceRecord(
+            run.data(), run.size(),
+            [&](const TraceRecord& record, absl::string_view strings) {
+              auto format = formats.find(record.format_id);
+              records.push_back(
+                  {record.ticks,
+                   {.time = to_time(record.ticks),
+                    .cpu = record.cpu,
+                    .tid = static_cast<pid_t>(block.id),
+                    .text = FormatTraceArgs(record,
+                                            format == formats.end()
+                                                ? nullptr
+                                                : format->second.c_str(),
+                                            strings)}});
+            });
+        break;
+      }
+      case kTraceDroppedBlock:
+        if (bytes.size() == sizeof(uint64_t)) {
+          uint64_t n;
+          memcpy(&n, bytes.data(), sizeof(n));
+          dropped[block.id] = std::max(dropped[block.id], n);
+        }
+        break;
+      default:
+        return absl::InvalidArgumentError(absl::StrFormat(
+            "%s has a block of unknown type %u", path, block.type));
+    }
+  }
+
+  // Each thread's records are in order already, so a stable sort keeps the
+  // order of records from a thread that have the same timestamp.
+  std::stable_sort(records.begin(), records.end(),
+                   [](const auto& a, const auto& b) { return a.first < b.first; });
+  DecodedTrace trace;
+  trace.records.reserve(records.size());
+  for (auto& [ticks, record] : records) {
+    trace.records.push_back(std::move(record));
+  }
+  for (const auto& [tid, n] : dropped) {
+    trace.dropped += n;
+  }
+  return trace;
+}
+
+}  // namespace ghost
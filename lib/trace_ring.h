@@ -0,0 +1,356 @@
+// Copyright 2022 Google LLC
+//
+// Use of this source code is governed by a BSD-style
+// license that can be found in the LICENSE file or at
+// https://developers.google.com/open-source/licenses/bsd
+
+// Per-thread binary trace rings, and the tracer that `GHOST_DPRINT` records
+// into instead of printing when --dprint_trace is set.
+//
+// Printing from an agent formats the message and writes it to stderr right
+// there, which changes the agent's timing enough to hide the bugs one turns
+// verbosity up to find. With --dprint_trace=<file>, each `GHOST_DPRINT` instead
+// records its format ID, the time, the cpu and its arguments into a ring that
+// only its thread writes to, which takes no locks and no system calls. A
+// background thread writes the rings out to <file> every
+// --dprint_trace_flush_interval, and right away on SIGUSR1. What is left is
+// dumped on a fatal signal. Then:
+//
+// $ trace_decode <file>
+//
+// prints the records the way `GHOST_DPRINT` would have, oldest first.
+
+#ifndef GHOST_LIB_TRACE_RING_H_
+#define GHOST_LIB_TRACE_RING_H_
+
+#include <sys/types.h>
+
+#include <algorithm>
+#include <atomic>
+#include <cstdint>
+#include <functional>
+#include <memory>
+#include <string>
+#include <type_traits>
+#include <vector>
+
+#include "absl/base/casts.h"
+#include "absl/status/statusor.h"
+#include "absl/strings/string_view.h"
+#include "absl/time/time.h"
+
+namespace ghost {
+
+inline constexpr int kMaxTraceArgs = 5;
+
+// Longer string arguments are truncated.
+inline constexpr size_t kMaxTraceStringLength = 255;
+
+enum class TraceArgType : uint32_t {
+  kInt = 0,
+  kDouble = 1,
+  kString = 2,
+};
+
+struct TraceRecord {
+  // A `TscClock::Now()` reading.
+  uint64_t ticks;
+  // The ID that `TraceFormats::Register()` returned for the format string.
+  uint32_t format_id;
+  int32_t cpu;
+  uint32_t num_args;
+  // The `TraceArgType` of each argument, 2 bits each, the first one lowest.
+  uint32_t arg_types;
+  // Integers as they are, doubles as their bits and strings as their length.
+  // In a `TraceRing`, the bytes of a record's strings follow the record, back
+  // to back, in the space of `string_slots()` more records.
+  int64_t args[kMaxTraceArgs];
+
+  TraceArgType arg_type(int i) const {
+    return static_cast<TraceArgType>((arg_types >> (2 * i)) & 3);
+  }
+
+  void set_arg_type(int i, TraceArgType type) {
+    arg_types &= ~(3u << (2 * i));
+    arg_types |= static_cast<uint32_t>(type) << (2 * i);
+  }
+
+  // Returns the number of bytes in the record's string arguments.
+  size_t string_bytes() const {
+    size_t bytes = 0;
+    for (uint32_t i = 0; i < std::min<uint32_t>(num_args, kMaxTraceArgs); i++) {
+      if (arg_type(i) == TraceArgType::kString) {
+        bytes += std::min<uint64_t>(args[i], kMaxTraceStringLength);
+      }
+    }
+    return bytes;
+  }
+
+  size_t string_slots() const {
+    return (string_bytes() + sizeof(TraceRecord) - 1) / sizeof(TraceRecord);
+  }
+};
+static_assert(sizeof(TraceRecord) == 64);
+
+// The format strings of all trace points in this process. Each trace point
+// registers its own once, and its records refer to it by ID.
+class TraceFormats {
+ public:
+  static constexpr uint32_t kMaxFormats = 4096;
+
+  // Returns the ID for `format`, which must outlive the process (e.g., a string
+  // literal). Registering the same format twice returns different IDs.
+  static uint32_t Register(const char* format);
+
+  // Returns the format with ID `id`, or nullptr if there is none.
+  static const char* Get(uint32_t id);
+
+  // Returns the number of registered formats. They have IDs 0 to `Count() - 1`.
+  static uint32_t Count();
+};
+
+namespace trace_internal {
+
+struct TraceArg {
+  TraceArgType type = TraceArgType::kInt;
+  int64_t value = 0;
+  absl::string_view str;
+};
+
+template <typename T>
+TraceArg MakeTraceArg(const T& arg) {
+  if constexpr (std::is_integral_v<T> || std::is_enum_v<T>) {
+    return {TraceArgType::kInt, static_cast<int64_t>(arg), {}};
+  } else if constexpr (std::is_floating_point_v<T>) {
+    return {TraceArgType::kDouble,
+            absl::bit_cast<int64_t>(static_cast<double>(arg)),
+            {}};
+  } else {
+    static_assert(std::is_convertible_v<const T&, absl::string_view>,
+                  "Trace arguments must be numbers, enums or strings");
+    const absl::string_view str =
+        absl::string_view(arg).substr(0, kMaxTraceStringLength);
+    return {TraceArgType::kString, static_cast<int64_t>(str.size()), str};
+  }
+}
+
+}  // namespace trace_internal
+
+// A bounded buffer of trace records that one thread writes to and another
+// reads from, without locks. When it is full, new records are dropped and
+// counted rather than making the writer wait.
+//
+// Records may have string arguments, whose bytes take up slots of their own
+// after the record.
+class TraceRing {
+ public:
+  // `capacity`, in records, is rounded up to a power of 2 that fits at least
+  // the largest possible record.
+  explicit TraceRing(size_t capacity);
+
+  TraceRing(const TraceRing&) = delete;
+  TraceRing& operator=(const TraceRing&) = delete;
+
+  // Records `args`, which must be numbers, enums or strings, under
+  // `format_id`. Returns false if the ring is full, in which case the record is
+  // dropped. Only one thread at a time may record.
+  template <typename... Args>
+  bool Record(uint32_t format_id, const Args&... args) {
+    static_assert(sizeof...(Args) <= kMaxTraceArgs, "Too many trace arguments");
+    const trace_internal::TraceArg trace_args[] = {
+        trace_internal::MakeTraceArg(args)..., trace_internal::TraceArg()};
+    return Write(format_id, trace_args, sizeof...(Args));
+  }
+
+  // Calls `f(first, n_first, second, n_second)` on the records written so far,
+  // which are in two runs of whole records (the second possibly empty), and
+  // then frees them. Returns how many slots the records took up. Only one
+  // thread at a time may consume. This makes no system calls of its own.
+  template <class F>
+  size_t Consume(F f) {
+    const uint64_t tail = tail_.load(std::memory_order_relaxed);
+    const uint64_t head = head_.load(std::memory_order_acquire);
+    if (head == tail) {
+      return 0;
+    }
+    const size_t n = head - tail;
+    const size_t begin = tail & mask_;
+    const size_t first = std::min(n, mask_ + 1 - begin);
+    f(&records_[begin], first, &records_[0], n - first);
+    // Hands the slots back to the writer.
+    tail_.store(head, std::memory_order_release);
+    return n;
+  }
+
+  // Consumes the records written so far, oldest first, and calls `f` on each
+  // with the bytes of its string arguments. Returns how many there were.
+  size_t Drain(
+      const std::function<void(const TraceRecord&, absl::string_view)>& f);
+
+  // Returns the tid of the thread that created the ring.
+  pid_t tid() const { return tid_; }
+
+  size_t capacity() const { return mask_ + 1; }
+
+  // Returns the number of records dropped because the ring was full.
+  uint64_t dropped() const { return dropped_.load(std::memory_order_relaxed); }
+
+ private:
+  bool Write(uint32_t format_id, const trace_internal::TraceArg* args,
+             uint32_t num_args);
+
+  const size_t mask_;
+  std::unique_ptr<TraceRecord[]> records_;
+  const pid_t tid_;
+  // The next slot to write, only modified by the writer.
+  alignas(64) std::atomic<uint64_t> head_{0};
+  // The next slot to read, only modified by the reader.
+  alignas(64) std::atomic<uint64_t> tail_{0};
+  std::atomic<uint64_t> dropped_{0};
+
+  // The next ring in the tracer's list.
+  TraceRing* next_ = nullptr;
+  friend class DprintTracer;
+};
+
+// Calls `f(record, strings)` on each record in `records`, `n` slots laid out
+// the way a `TraceRing` holds them, where `strings` are the bytes of the
+// record's string arguments. Stops early at a record whose strings would run
+// past the end.
+void ForEachTraceRecord(
+    const TraceRecord* records, size_t n,
+    const std::function<void(const TraceRecord&, absl::string_view)>& f);
+
+// Returns `format` applied to the arguments of `record`, whose string arguments
+// are in `strings`. If `format` is nullptr or does not apply to them, returns
+// `format_id` and the raw arguments instead.
+std::string FormatTraceArgs(const TraceRecord& record, const char* format,
+                            absl::string_view strings);
+
+// Records `GHOST_DPRINT`s into a ring per thread and writes the rings to a file
+// (see above). There is at most one per process, and it lives as long as the
+// process does.
+class DprintTracer {
+ public:
+  // Returns the tracer, starting it if --dprint_trace is set and no one has
+  // started it yet. Returns nullptr if `GHOST_DPRINT` should print instead.
+  //
+  // A `GHOST_DPRINT` may run before flags are parsed, so until the tracer has
+  // started, this checks the flag again on every call.
+  static DprintTracer* Get() {
+    if (DprintTracer* tracer = instance()) {
+      return tracer;
+    }
+    return StartFromFlags();
+  }
+
+  // Starts the tracer if --dprint_trace is set and it has not started yet.
+  // Returns the tracer, or nullptr if tracing is off. `Ghost::InitCore()` calls
+  // this once flags are parsed, so that tracing covers the agent from the
+  // start.
+  static DprintTracer* StartFromFlags();
+
+  // Returns the tracer if it is running. Unlike `Get()`, this never starts it.
+  static DprintTracer* instance() {
+    return instance_.load(std::memory_order_acquire);
+  }
+
+  // Starts tracing into `path`, with rings of `ring_capacity` records that the
+  // flusher writes out every `flush_interval`. Must be called at most once, and
+  // not at all if --dprint_trace is set.
+  static DprintTracer* Start(const std::string& path, size_t ring_capacity,
+                             absl::Duration flush_interval);
+
+  DprintTracer(const DprintTracer&) = delete;
+  DprintTracer& operator=(const DprintTracer&) = delete;
+
+  // Records `args` under `format_id` into the calling thread's ring.
+  template <typename... Args>
+  void Record(uint32_t format_id, const Args&... args) {
+    ring()->Record(format_id, args...);
+  }
+
+  // Returns the calling thread's ring, creating it on first use.
+  TraceRing* ring() {
+    thread_local TraceRing* ring = nullptr;
+    if (!ring) {
+      ring = NewRing();
+    }
+    return ring;
+  }
+
+  // Has the flusher write out everything recorded so far and returns without
+  // waiting for it. This is safe to call from a signal handler.
+  void RequestFlush();
+
+  // Has the flusher write out everything recorded so far and waits until it
+  // has.
+  void Flush();
+
+  // Writes out everything recorded so far from the calling thread, for fatal
+  // signal handlers and exit: it makes no allocations and takes no locks. If
+  // the flusher is writing at the same time, it waits a little for it to
+  // finish and then writes anyway.
+  void Dump();
+
+  // Returns the number of records dropped because a ring was full.
+  uint64_t dropped() const;
+
+  const std::string& path() const { return path_; }
+
+ private:
+  DprintTracer(int fd, std::string path, size_t ring_capacity,
+               absl::Duration flush_interval);
+
+  TraceRing* NewRing();
+
+  // Writes the formats registered since the last write and everything in the
+  // rings to the file. Requires `writing_`.
+  void WriteOut();
+
+  // Runs the flusher thread.
+  void FlushLoop();
+
+  static std::atomic<DprintTracer*> instance_;
+
+  const int fd_;
+  const std::string path_;
+  const size_t ring_capacity_;
+  const absl::Duration flush_interval_;
+
+  // Every ring ever created, newest first. Rings are never freed, so records
+  // from threads that exited still get written.
+  std::atomic<TraceRing*> rings_{nullptr};
+  // Set while a thread is writing to the file.
+  std::atomic<bool> writing_{false};
+  // The number of formats written to the file so far. Requires `writing_`.
+  uint32_t formats_written_ = 0;
+
+  // Bumped to ask the flusher to write out. Futex words.
+  std::atomic<int> flush_requests_{0};
+  // The value of `flush_requests_` that the flusher last handled.
+  std::atomic<int> flushes_done_{0};
+};
+
+// One record of a decoded trace file.
+struct DecodedTraceRecord {
+  absl::Time time;
+  int32_t cpu;
+  pid_t tid;
+  std::string text;
+};
+
+struct DecodedTrace {
+  // Oldest first.
+  std::vector<DecodedTraceRecord> records;
+  // The number of records that the tracer dropped because a ring was full.
+  uint64_t dropped = 0;
+};
+
+// Reads the trace file that a `DprintTracer` wrote to `path` and formats its
+// records.
+absl::StatusOr<DecodedTrace> DecodeTraceFile(const std::string& path);
+
+}  // namespace ghost
+
+#endif  // GHOST_LIB_TRACE_RING_H_
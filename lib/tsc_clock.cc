@@ -0,0 +1,107 @@
+// Copyright 2022 Google LLC
+//
+// Use of this source code is governed by a BSD-style
+// license that can be found in the LICENSE file or at
+// https://developers.google.com/open-source/licenses/bsd
+
+#include "lib/tsc_clock.h"
+
+#if defined(__x86_64__)
+#include <cpuid.h>
+#endif
+#include <stdio.h>
+
+#include <cmath>
+
+#include "absl/time/clock.h"
+
+namespace ghost {
+
+// static
+uint64_t TscClock::FromDuration(absl::Duration d) {
+  if (d == absl::InfiniteDuration()) {
+    return kInfiniteTicks;
+  }
+  if (d <= absl::ZeroDuration()) {
+    return 0;
+  }
+  const double ticks =
+      absl::ToDoubleNanoseconds(d) * calibration().ticks_per_ns;
+  if (ticks >= static_cast<double>(kInfiniteTicks)) {
+    return kInfiniteTicks;
+  }
+  return static_cast<uint64_t>(ticks);
+}
+
+// static
+absl::Time TscClock::ToTime(uint64_t ticks) {
+  const Calibration& c = calibration();
+  // Ticks from before calibration are negative offsets.
+  const int64_t delta = static_cast<int64_t>(ticks - c.base_ticks);
+  return c.base_time + absl::Nanoseconds(delta * c.ns_per_tick);
+}
+
+// static
+bool TscClock::DetectInvariantTsc() {
+#if defined(__x86_64__)
+  // CPUID.80000007H:EDX[8], which Linux reports as constant_tsc and
+  // nonstop_tsc.
+  unsigned int eax, ebx, ecx, edx;
+  if (!__get_cpuid(0x80000007, &eax, &ebx, &ecx, &edx)) {
+    return false;
+  }
+  return edx & (1u << 8);
+#else
+  return false;
+#endif
+}
+
+// static
+TscClock::Calibration TscClock::Calibrate() {
+  Calibration c;
+  c.invariant = DetectInvariantTsc();
+  if (!c.invariant) {
+#if defined(__x86_64__)
+    fprintf(stderr,
+            "TSC is not invariant, falling back to CLOCK_MONOTONIC ticks\n");
+#endif
+    c.ticks_per_ns = 1.0;
+    c.ns_per_tick = 1.0;
+    c.base_ticks = MonotonicNanos();
+    c.base_time = absl::Now();
+    return c;
+  }
+
+#if defined(__x86_64__)
+  // Pairs a TSC read with a clock read, taking the tightest bracket of a few
+  // tries so that an interrupt in between doesn't skew the pair.
+  auto sample = [](uint64_t* tsc, uint64_t* ns) {
+    uint64_t best = kInfiniteTicks;
+    for (int i = 0; i < 16; ++i) {
+      const uint64_t before = __rdtsc();
+      const uint64_t t = MonotonicNanos();
+      const uint64_t after = __rdtsc();
+      if (after - before < best) {
+        best = after - before;
+        *tsc = before + (after - before) / 2;
+        *ns = t;
+      }
+    }
+  };
+
+  uint64_t start_tsc = 0, start_ns = 0, end_tsc = 0, end_ns = 0;
+  sample(&start_tsc, &start_ns);
+  c.base_ticks = __rdtsc();
+  c.base_time = absl::Now();
+  // Long enough that the error in each sample is a few ppm.
+  absl::SleepFor(absl::Milliseconds(10));
+  sample(&end_tsc, &end_ns);
+
+  c.ticks_per_ns =
+      static_cast<double>(end_tsc - start_tsc) / (end_ns - start_ns);
+  c.ns_per_tick = 1.0 / c.ticks_per_ns;
+#endif
+  return c;
+}
+
+}  // namespace ghost
@@ -0,0 +1,101 @@
+// Copyright 2022 Google LLC
+//
+// Use of this source code is governed by a BSD-style
+// license that can be found in the LICENSE file or at
+// https://developers.google.com/open-source/licenses/bsd
+
+// A monotonic clock for the agents' hot paths that reads the TSC instead of
+// calling clock_gettime() and converting to absl::Time each time. Callers keep
+// and compare raw ticks (e.g. against a time slice converted once with
+// `FromDuration()`) and only convert to absl types at the edges, such as when
+// printing stats.
+//
+// The TSC is only usable if it is invariant: it ticks at a constant rate
+// regardless of frequency scaling and idle states, and stays in sync across
+// cpus. We check for that once per process. Where it isn't (or on other
+// architectures), ticks are CLOCK_MONOTONIC nanoseconds, so callers need not
+// care which one they got.
+
+#ifndef GHOST_LIB_TSC_CLOCK_H_
+#define GHOST_LIB_TSC_CLOCK_H_
+
+#if defined(__x86_64__)
+#include <x86intrin.h>
+#endif
+#include <time.h>
+
+#include <cstdint>
+#include <limits>
+
+#include "absl/base/optimization.h"
+#include "absl/time/time.h"
+
+namespace ghost {
+
+class TscClock {
+ public:
+  // Ticks longer than any duration, e.g. for an infinite time slice.
+  static constexpr uint64_t kInfiniteTicks =
+      std::numeric_limits<uint64_t>::max();
+
+  // Returns the current tick count. Only the difference between two calls is
+  // meaningful.
+  static uint64_t Now() {
+#if defined(__x86_64__)
+    if (ABSL_PREDICT_TRUE(calibration().invariant)) {
+      return __rdtsc();
+    }
+#endif
+    return MonotonicNanos();
+  }
+
+  // Whether Now() reads an invariant TSC.
+  static bool Invariant() { return calibration().invariant; }
+
+  static double TicksPerMicrosecond() {
+    return calibration().ticks_per_ns * 1000.0;
+  }
+
+  // Returns the number of ticks in `d`, rounded down. Negative durations are 0
+  // ticks and infinite ones are kInfiniteTicks.
+  static uint64_t FromDuration(absl::Duration d);
+
+  static absl::Duration ToDuration(uint64_t ticks) {
+    return absl::Nanoseconds(static_cast<double>(ticks) *
+                             calibration().ns_per_tick);
+  }
+
+  // Returns the wall time at which Now() returned `ticks`. It's extrapolated
+  // from a single reference point, so it may drift from absl::Now() by a few
+  // ppm as NTP adjusts the wall clock.
+  static absl::Time ToTime(uint64_t ticks);
+
+ private:
+  struct Calibration {
+    bool invariant;
+    double ticks_per_ns;
+    double ns_per_tick;
+    // A reading of Now() and the wall time at that point.
+    uint64_t base_ticks;
+    absl::Time base_time;
+  };
+
+  static uint64_t MonotonicNanos() {
+    timespec ts;
+    clock_gettime(CLOCK_MONOTONIC, &ts);
+    return static_cast<uint64_t>(ts.tv_sec) * 1'000'000'000 + ts.tv_nsec;
+  }
+
+  // Calibrated on first use, which takes about 10 msec.
+  static const Calibration& calibration() {
+    static const Calibration calibration = Calibrate();
+    return calibration;
+  }
+
+  static Calibration Calibrate();
+  static bool DetectInvariantTsc();
+};
+
+}  // namespace ghost
+
+#endif  // GHOST_LIB_TSC_CLOCK_H_
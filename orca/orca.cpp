@@ -1,18 +1,25 @@
 #include <arpa/inet.h>
+#include <errno.h>
+#include <fcntl.h>
 #include <netinet/tcp.h>
 #include <signal.h>
 #include <stdio.h>
 #include <stdlib.h>
 #include <string.h>
+#include <sys/epoll.h>
 #include <sys/socket.h>
+#include <sys/timerfd.h>
 #include <sys/types.h>
 #include <unistd.h>
 
+#include <algorithm>
 #include <functional>
 #include <iostream>
 #include <memory>
+#include <optional>
 #include <sstream>
 #include <string>
+#include <unordered_map>
 #include <vector>
 
 #include "event_signal.h"
@@ -20,260 +27,738 @@
 #include "orca.h"
 #include "protocol.h"
 
-int main(int argc, char *argv[]) {
-    // TCP socket
-    int tcpfd = socket(AF_INET, SOCK_STREAM, 0);
-    if (tcpfd == -1) {
-        panic("tcp socket");
-    }
+// Datagrams drained per recvmmsg() call.
+constexpr int UDP_BATCH = 64;
 
-    // UDP socket
-    int udpfd = socket(AF_INET, SOCK_DGRAM, 0);
-    if (udpfd == -1) {
-        panic("udp socket");
-    }
+// Longest scheduler output line that we look for messages in.
+constexpr size_t MAX_SCHED_LINE = 4096;
 
-    int yesval = 1;
-    if (setsockopt(tcpfd, SOL_SOCKET, SO_REUSEADDR, &yesval, sizeof(yesval)) ==
-        -1) {
-        panic("setsockopt");
-    }
+// Most unparsed input we keep for a TCP connection between reads. We handle
+// whole frames as soon as they arrive, so all that is left over is part of
+// one frame, and frames are at most MAX_FRAME_SIZE bytes.
+constexpr size_t MAX_CONN_INPUT = orca::MAX_FRAME_SIZE;
 
-    // set up our sockaddr
-    struct sockaddr_in saddr;
-    memset(&saddr, 0, sizeof(saddr));
-    saddr.sin_family = AF_INET;
-    saddr.sin_addr.s_addr = htonl(INADDR_ANY);
-    saddr.sin_port = htons(orca::PORT);
+// Room for the datagrams that arrive while we are busy. The kernel caps it at
+// net.core.rmem_max.
+constexpr int UDP_RCVBUF = 8 << 20;
 
-    // bind TCP
-    if (bind(tcpfd, (struct sockaddr *)&saddr, sizeof(saddr)) == -1) {
-        panic("bind tcp");
-    }
+// put orca_agent ptr in static memory (so SIGINT handler can clean it up)
+static std::unique_ptr<orca::Orca> orca_agent;
+
+// Print every record we receive, not just the totals.
+static bool verbose = false;
+
+// Orca's event loop. Every socket is non-blocking and edge-triggered, so a
+// slow TCP client can't hold up the metrics and hints coming in over UDP.
+class OrcaServer {
+public:
+    OrcaServer() {
+        epfd = epoll_create1(EPOLL_CLOEXEC);
+        if (epfd == -1) {
+            panic("epoll_create1");
+        }
+
+        // TCP socket
+        tcpfd = socket(AF_INET, SOCK_STREAM | SOCK_NONBLOCK, 0);
+        if (tcpfd == -1) {
+            panic("tcp socket");
+        }
+
+        // UDP socket
+        udpfd = socket(AF_INET, SOCK_DGRAM | SOCK_NONBLOCK, 0);
+        if (udpfd == -1) {
+            panic("udp socket");
+        }
+
+        int yesval = 1;
+        if (setsockopt(tcpfd, SOL_SOCKET, SO_REUSEADDR, &yesval,
+                       sizeof(yesval)) == -1) {
+            panic("setsockopt");
+        }
+        // Have the kernel tell us how many datagrams it dropped.
+        if (setsockopt(udpfd, SOL_SOCKET, SO_RXQ_OVFL, &yesval,
+                       sizeof(yesval)) == -1) {
+            panic("setsockopt SO_RXQ_OVFL");
+        }
+        int rcvbuf = UDP_RCVBUF;
+        if (setsockopt(udpfd, SOL_SOCKET, SO_RCVBUF, &rcvbuf,
+                       sizeof(rcvbuf)) == -1) {
+            panic("setsockopt SO_RCVBUF");
+        }
+
+        // set up our sockaddr
+        struct sockaddr_in saddr;
+        memset(&saddr, 0, sizeof(saddr));
+        saddr.sin_family = AF_INET;
+        saddr.sin_addr.s_addr = htonl(INADDR_ANY);
+        saddr.sin_port = htons(orca::PORT);
+
+        // bind TCP
+        if (bind(tcpfd, (struct sockaddr *)&saddr, sizeof(saddr)) == -1) {
+            panic("bind tcp");
+        }
+
+        // bind UDP
+        if (bind(udpfd, (struct sockaddr *)&saddr, sizeof(saddr)) == -1) {
+            panic("bind udp");
+        }
 
-    // bind UDP
-    if (bind(udpfd, (struct sockaddr *)&saddr, sizeof(saddr)) == -1) {
-        panic("bind udp");
+        // listen TCP
+        if (listen(tcpfd, SOMAXCONN) == -1) {
+            panic("listen");
+        }
+
+        // Fires every ANALYSIS_INTERVAL_MS for our periodic report.
+        timerfd = timerfd_create(CLOCK_MONOTONIC, TFD_NONBLOCK | TFD_CLOEXEC);
+        if (timerfd == -1) {
+            panic("timerfd_create");
+        }
+        struct itimerspec interval;
+        interval.it_interval.tv_sec = orca::ANALYSIS_INTERVAL_MS / 1000;
+        interval.it_interval.tv_nsec =
+            (orca::ANALYSIS_INTERVAL_MS % 1000) * 1000000L;
+        interval.it_value = interval.it_interval;
+        if (timerfd_settime(timerfd, 0, &interval, NULL) == -1) {
+            panic("timerfd_settime");
+        }
+
+        // Armed while a handoff is in progress, to check on it every
+        // HANDOFF_POLL_MS in case agent_online changes without waking us.
+        handoff_timerfd =
+            timerfd_create(CLOCK_MONOTONIC, TFD_NONBLOCK | TFD_CLOEXEC);
+        if (handoff_timerfd == -1) {
+            panic("timerfd_create");
+        }
+
+        watch(tcpfd, EPOLLIN | EPOLLET);
+        watch(udpfd, EPOLLIN | EPOLLET);
+        watch(timerfd, EPOLLIN | EPOLLET);
+        watch(handoff_timerfd, EPOLLIN);
+
+        for (int i = 0; i < UDP_BATCH; ++i) {
+            udp_iovs[i].iov_base = udp_bufs[i];
+            udp_iovs[i].iov_len = orca::MAX_FRAME_SIZE;
+        }
     }
 
-    // listen TCP
-    if (listen(tcpfd, 10) == -1) {
-        panic("listen");
+    void run() {
+        // run dFCFS by default
+        set_scheduler(last_config);
+
+        printf("Orca listening on port %d...\n", orca::PORT);
+        struct epoll_event events[64];
+        while (true) {
+            int n = epoll_wait(epfd, events, 64, -1);
+            if (n == -1) {
+                if (errno == EINTR) {
+                    continue;
+                }
+                panic("epoll_wait");
+            }
+
+            for (int i = 0; i < n; ++i) {
+                int fd = events[i].data.fd;
+                if (fd == tcpfd) {
+                    accept_conns();
+                } else if (fd == udpfd) {
+                    drain_udp();
+                } else if (fd == timerfd) {
+                    report();
+                } else if (fd == handoff_timerfd ||
+                           fd == orca_agent->get_agent_online_fd()) {
+                    advance_handoff();
+                } else if (conns.count(fd)) {
+                    handle_conn(fd, events[i].events);
+                } else {
+                    handle_sched_output(fd);
+                }
+            }
+        }
     }
 
-    // put orca_agent ptr in static memory (so SIGINT handler can clean it up)
-    static std::unique_ptr<orca::Orca> orca_agent;
-    orca_agent = std::make_unique<orca::Orca>();
+private:
+    // A client's TCP connection. Requests may arrive in pieces and acks may
+    // wait for the socket to drain, so both directions are buffered.
+    struct Conn {
+        // Tells a connection apart from a later one that reuses its fd, for
+        // acks that wait for the scheduler.
+        uint64_t id;
+        // Read in place, so it has to stay 8-byte aligned: frames are
+        // multiples of 8 bytes and we only drop whole frames from the front.
+        std::vector<char> in;
+        std::string out;
+    };
+
+    // The scheduler's output that we have not yet seen a newline for. We
+    // look for messages from the scheduler line by line, since a line may
+    // arrive across several reads.
+    struct LineBuffer {
+        pid_t pid = 0;
+        std::string partial;
+    };
+
+    int epfd;
+    int tcpfd;
+    int udpfd;
+    int timerfd;
+    int handoff_timerfd;
+
+    std::unordered_map<int, Conn> conns;
+    uint64_t next_conn_id = 0;
 
     orca::SchedulerConfig last_config = orca::SchedulerConfig{
         .type = orca::SchedulerConfig::SchedulerType::dFCFS};
     orca::MetricAnalyzer analyzer;
+    EventSignal<int> sched_ready;
+
+    // Scheduler stdout, by fd.
+    std::unordered_map<int, LineBuffer> sched_lines;
+    // The pending scheduler printed AGENT_ACTIVE_MSG before the handoff was
+    // over.
+    bool pending_active = false;
+    // A switch requested during a handoff, to start once the handoff is over.
+    std::optional<orca::SchedulerConfig> deferred_config;
+
+    // Totals since we started, and as of the last report.
+    orca::StatsRecord stats = {};
+    orca::StatsRecord reported = {};
+
+    alignas(8) char udp_bufs[UDP_BATCH][orca::MAX_FRAME_SIZE];
+    struct iovec udp_iovs[UDP_BATCH];
+    struct mmsghdr udp_msgs[UDP_BATCH];
+    char udp_cmsgs[UDP_BATCH][CMSG_SPACE(sizeof(uint32_t))];
+
+    void watch(int fd, uint32_t events) {
+        struct epoll_event ev;
+        ev.events = events;
+        ev.data.fd = fd;
+        if (epoll_ctl(epfd, EPOLL_CTL_ADD, fd, &ev) == -1) {
+            panic("epoll_ctl");
+        }
+    }
 
-    // run dFCFS by default
-    orca_agent->set_scheduler(last_config);
+    void unwatch(int fd) { epoll_ctl(epfd, EPOLL_CTL_DEL, fd, NULL); }
 
-    signal(SIGINT, [](int signum) {
-        // call Orca destructor
-        orca_agent = nullptr;
+    std::vector<int> sched_fds() {
+        std::vector<int> fds;
+        for (int fd : {orca_agent->get_sched_stdout_fd(),
+                       orca_agent->get_sched_stderr_fd(),
+                       orca_agent->get_pending_stdout_fd(),
+                       orca_agent->get_pending_stderr_fd()}) {
+            if (fd != -1) {
+                fds.push_back(fd);
+            }
+        }
+        return fds;
+    }
 
-        exit(signum);
-    });
+    // Runs `change`, which may close the schedulers' pipes and open new
+    // ones. We stop watching the old ones first: a child may hold a copy of
+    // them, which would keep them in our epoll set after we close them.
+    void change_scheduler(const std::function<void()> &change) {
+        for (int fd : sched_fds()) {
+            unwatch(fd);
+        }
+        change();
+        // Level-triggered: we read a chunk per wakeup. Non-blocking, in case
+        // an event for a pipe we closed turns up for a new one with its fd.
+        for (int fd : sched_fds()) {
+            fcntl(fd, F_SETFL, fcntl(fd, F_GETFL) | O_NONBLOCK);
+            watch(fd, EPOLLIN);
+        }
+    }
 
-    EventSignal<int> sched_ready;
+    void set_scheduler(orca::SchedulerConfig config) {
+        if (orca_agent->handoff_in_progress()) {
+            // The old scheduler is already exiting; the new one has to take
+            // over before we can switch again.
+            deferred_config = config;
+            return;
+        }
+        change_scheduler([&] { orca_agent->set_scheduler(config); });
+    }
+
+    // Arms or disarms the handoff timer.
+    void set_handoff_timer(bool armed) {
+        struct itimerspec interval = {};
+        if (armed) {
+            interval.it_interval.tv_nsec = orca::HANDOFF_POLL_MS * 1000000L;
+            interval.it_value = interval.it_interval;
+        }
+        if (timerfd_settime(handoff_timerfd, 0, &interval, NULL) == -1) {
+            panic("timerfd_settime");
+        }
+    }
 
-    printf("Orca listening on port %d...\n", orca::PORT);
-    while (true) {
-        int sched_stdout = orca_agent->get_sched_stdout_fd();
-        int sched_stderr = orca_agent->get_sched_stderr_fd();
+    // The pending scheduler is ready to take over. We go on serving clients
+    // while the old one exits; advance_handoff() follows the handoff.
+    void start_handoff() {
+        if (orca_agent->handoff_in_progress()) {
+            return;
+        }
+        orca_agent->begin_handoff();
+        pending_active = false;
+        watch(orca_agent->get_agent_online_fd(), EPOLLIN | EPOLLPRI | EPOLLET);
+        set_handoff_timer(true);
+        advance_handoff();
+    }
 
-        // set up fd set for select()
-        fd_set readfds;
-        FD_ZERO(&readfds);
-        FD_SET(tcpfd, &readfds);
-        FD_SET(udpfd, &readfds);
-        if (sched_stdout != -1) {
-            FD_SET(sched_stdout, &readfds);
+    void advance_handoff() {
+        uint64_t expirations;
+        if (read(handoff_timerfd, &expirations, sizeof(expirations)) == -1 &&
+            errno != EAGAIN) {
+            panic("read handoff timer");
         }
-        if (sched_stderr != -1) {
-            FD_SET(sched_stderr, &readfds);
+        if (!orca_agent->handoff_in_progress()) {
+            return;
         }
 
-        // set timeout of 1ms
-        struct timeval timeout;
-        timeout.tv_sec = 0;
-        timeout.tv_usec = 1000;
+        orca::Orca::HandoffResult result = orca_agent->poll_handoff();
+        if (result == orca::Orca::HandoffResult::InProgress) {
+            return;
+        }
+        set_handoff_timer(false);
+        unwatch(orca_agent->get_agent_online_fd());
+        change_scheduler([result] { orca_agent->finish_handoff(result); });
 
-        int ready = select(FD_SETSIZE, &readfds, NULL, NULL, &timeout);
+        if (result == orca::Orca::HandoffResult::Done && pending_active) {
+            sched_ready.fire(0);
+        }
+        pending_active = false;
+        if (deferred_config) {
+            orca::SchedulerConfig config = *deferred_config;
+            deferred_config.reset();
+            set_scheduler(config);
+        }
+    }
 
-        if (ready == -1) {
-            panic("select");
-        } else if (ready == 0) {
-            // timeout occurred, continue loop
-            continue;
-        } else {
-            if (FD_ISSET(tcpfd, &readfds)) {
-                int connfd = accept(tcpfd, NULL, NULL);
-                if (connfd == -1) {
-                    printf("accept returned -1\n");
-                    continue;
+    void accept_conns() {
+        while (true) {
+            int connfd = accept4(tcpfd, NULL, NULL, SOCK_NONBLOCK);
+            if (connfd == -1) {
+                if (errno != EAGAIN && errno != EWOULDBLOCK) {
+                    perror("accept");
                 }
+                return;
+            }
+            conns[connfd].id = next_conn_id++;
+            watch(connfd, EPOLLIN | EPOLLOUT | EPOLLRDHUP | EPOLLET);
+        }
+    }
 
-                char buf[orca::MAX_MESSAGE_SIZE];
-                memset(buf, 0, sizeof(buf));
+    void close_conn(int fd) {
+        // closing the fd also takes it out of our epoll set
+        close(fd);
+        conns.erase(fd);
+    }
 
-                recv_full(connfd, buf, sizeof(orca::OrcaHeader));
-                auto *header = (orca::OrcaHeader *)buf;
+    void handle_conn(int fd, uint32_t events) {
+        Conn &conn = conns[fd];
+        if (events & EPOLLOUT) {
+            flush(fd, conn);
+        }
+        if (!(events & (EPOLLIN | EPOLLRDHUP | EPOLLHUP | EPOLLERR))) {
+            return;
+        }
 
-                switch (header->type) {
-                case orca::MessageType::SetScheduler: {
-                    recv_full(connfd, buf + sizeof(orca::OrcaHeader),
-                              sizeof(orca::OrcaSetScheduler) -
-                                  sizeof(orca::OrcaHeader));
+        // Edge-triggered: read everything there is. Clients may stream
+        // frames that we don't ack, so handle each read's frames before
+        // reading more.
+        while (true) {
+            size_t have = conn.in.size();
+            conn.in.resize(have + orca::MAX_FRAME_SIZE);
+            ssize_t got = recv(fd, conn.in.data() + have,
+                               orca::MAX_FRAME_SIZE, 0);
+            conn.in.resize(have + std::max<ssize_t>(got, 0));
+            if (got > 0) {
+                if (!handle_frames(fd, conn)) {
+                    return;
+                }
+                continue;
+            }
+            if (got == -1 && errno == EINTR) {
+                continue;
+            }
+            if (got == 0 || (errno != EAGAIN && errno != EWOULDBLOCK)) {
+                close_conn(fd);
+            }
+            return;
+        }
+    }
 
-                    auto *msg = (orca::OrcaSetScheduler *)buf;
-                    std::cout
-                        << "Received SetScheduler. type="
-                        << (int)msg->config.type << ", preemption_interval_us="
-                        << msg->config.preemption_interval_us << std::endl;
+    // Handles the whole frames at the front of `conn.in` and keeps the rest.
+    // Returns false if it closed the connection.
+    bool handle_frames(int fd, Conn &conn) {
+        size_t off = 0;
+        while (true) {
+            const char *error;
+            size_t len = orca::frame_length(conn.in.data() + off,
+                                            conn.in.size() - off, &error);
+            if (!error && (len == 0 || conn.in.size() - off < len)) {
+                break;
+            }
+            orca::FrameView frame;
+            if (!error) {
+                error = frame.parse(conn.in.data() + off, len);
+            }
+            if (error) {
+                printf("dropping tcp connection: %s\n", error);
+                ++stats.malformed_frames;
+                close_conn(fd);
+                return false;
+            }
+            handle_request(fd, conn, frame);
+            off += len;
+        }
+        conn.in.erase(conn.in.begin(), conn.in.begin() + off);
 
-                    last_config = msg->config;
-                    orca_agent->set_scheduler(last_config);
+        if (conn.in.size() > MAX_CONN_INPUT) {
+            printf("dropping tcp connection: %zu bytes of a frame unread\n",
+                   conn.in.size());
+            close_conn(fd);
+            return false;
+        }
+        return true;
+    }
 
-                    sched_ready.once([connfd, &sched_ready](int) {
-                        // send ack
-                        orca::OrcaAck ack;
-                        send_full(connfd, (const char *)&ack, sizeof(ack));
+    void handle_request(int fd, Conn &conn, const orca::FrameView &frame) {
+        switch (frame.type()) {
+        case orca::MessageType::SetScheduler: {
+            if (frame.count() != 1) {
+                printf("SetScheduler with %zu records\n", frame.count());
+                break;
+            }
+            const auto &msg = frame.record<orca::SetSchedulerRecord>(0);
+            std::cout << "Received SetScheduler. type=" << (int)msg.config.type
+                      << ", preemption_interval_us="
+                      << msg.config.preemption_interval_us << std::endl;
+
+            last_config = msg.config;
+            set_scheduler(last_config);
+
+            sched_ready.once([this, fd, id = conn.id, seq = frame.seq()](int) {
+                send_ack(fd, id, seq, "");
+            });
+            break;
+        }
+        case orca::MessageType::DetermineScheduler: {
+            auto suggested_config =
+                analyzer.suggest_from_metrics(last_config.type);
+            analyzer.clear();
+
+            std::cout << "Received DetermineScheduler. ";
+            if (suggested_config.type ==
+                orca::SchedulerConfig::SchedulerType::dFCFS) {
+                std::cout << "Selected dFCFS.";
+            } else if (suggested_config.type ==
+                       orca::SchedulerConfig::SchedulerType::cFCFS) {
+                std::cout << "Selected cFCFS.";
+            }
+            std::cout << std::endl;
+
+            last_config = suggested_config;
+            set_scheduler(last_config);
+
+            sched_ready.once([this, fd, id = conn.id, seq = frame.seq(),
+                              type = suggested_config.type](int) {
+                send_ack(fd, id, seq,
+                         type == orca::SchedulerConfig::SchedulerType::dFCFS
+                             ? "dFCFS"
+                             : "cFCFS");
+            });
+            break;
+        }
+        case orca::MessageType::GetStats: {
+            orca::FrameWriter<orca::StatsRecord> reply(frame.seq());
+            *reply.append() = stats;
+            conn.out.append(reply.data(), reply.size());
+            flush(fd, conn);
+            break;
+        }
+        default:
+            if (!ingest(frame)) {
+                printf("Unexpected TCP message type: %d\n", (int)frame.type());
+            }
+        }
+    }
 
-                        close(connfd);
-                    });
+    // Acks request `seq` on connection `id`, if the client is still there.
+    void send_ack(int fd, uint64_t id, uint32_t seq, const char *data) {
+        auto it = conns.find(fd);
+        if (it == conns.end() || it->second.id != id) {
+            return;
+        }
+        orca::FrameWriter<orca::AckRecord> ack(seq);
+        strncpy(ack.append()->data, data, sizeof(orca::AckRecord::data) - 1);
+        it->second.out.append(ack.data(), ack.size());
+        flush(fd, it->second);
+    }
 
-                    break;
+    // Sends what we can of `conn`'s replies. EPOLLOUT brings us back for the
+    // rest.
+    void flush(int fd, Conn &conn) {
+        size_t sent = 0;
+        while (sent < conn.out.size()) {
+            ssize_t n = send(fd, conn.out.data() + sent,
+                             conn.out.size() - sent, MSG_NOSIGNAL);
+            if (n == -1) {
+                if (errno == EINTR) {
+                    continue;
                 }
-                case orca::MessageType::DetermineScheduler: {
-                    auto suggested_config =
-                        analyzer.suggest_from_metrics(last_config.type);
-                    analyzer.clear();
-
-                    std::cout << "Received DetermineScheduler. ";
-                    if (suggested_config.type ==
-                        orca::SchedulerConfig::SchedulerType::dFCFS) {
-                        std::cout << "Selected dFCFS.";
-                    } else if (suggested_config.type ==
-                               orca::SchedulerConfig::SchedulerType::cFCFS) {
-                        std::cout << "Selected cFCFS.";
-                    }
-                    std::cout << std::endl;
-
-                    last_config = suggested_config;
-                    orca_agent->set_scheduler(last_config);
-
-                    sched_ready.once([connfd, type = suggested_config.type,
-                                      &sched_ready](int) {
-                        // send ack
-                        orca::OrcaAck ack;
-                        if (type ==
-                            orca::SchedulerConfig::SchedulerType::dFCFS) {
-                            strcpy(ack.data, "dFCFS");
-                        } else if (type == orca::SchedulerConfig::
-                                               SchedulerType::cFCFS) {
-                            strcpy(ack.data, "cFCFS");
-                        }
-                        send_full(connfd, (const char *)&ack, sizeof(ack));
-
-                        close(connfd);
-                    });
+                if (errno != EAGAIN && errno != EWOULDBLOCK) {
+                    // The client hung up; reading will tell us so.
+                    sent = conn.out.size();
+                }
+                break;
+            }
+            sent += n;
+        }
+        conn.out.erase(0, sent);
+    }
 
-                    break;
+    void drain_udp() {
+        while (true) {
+            for (int i = 0; i < UDP_BATCH; ++i) {
+                struct msghdr &hdr = udp_msgs[i].msg_hdr;
+                memset(&hdr, 0, sizeof(hdr));
+                hdr.msg_iov = &udp_iovs[i];
+                hdr.msg_iovlen = 1;
+                hdr.msg_control = udp_cmsgs[i];
+                hdr.msg_controllen = sizeof(udp_cmsgs[i]);
+            }
+
+            int n = recvmmsg(udpfd, udp_msgs, UDP_BATCH, 0, NULL);
+            if (n == -1) {
+                if (errno == EINTR) {
+                    continue;
                 }
-                default:
-                    panic("unimplemented tcp message type");
+                if (errno != EAGAIN && errno != EWOULDBLOCK) {
+                    panic("recvmmsg");
                 }
+                return;
             }
-            if (FD_ISSET(udpfd, &readfds)) {
-                char buf[orca::MAX_MESSAGE_SIZE];
-                memset(buf, 0, sizeof(buf));
-
-                ssize_t result =
-                    recvfrom(udpfd, buf, orca::MAX_MESSAGE_SIZE, 0, NULL, NULL);
-                if (result <= 0) {
-                    panic("recvfrom");
-                }
-                if (result < sizeof(orca::OrcaHeader)) {
-                    panic("udp datagram: received less than a header");
+
+            for (int i = 0; i < n; ++i) {
+                struct msghdr &hdr = udp_msgs[i].msg_hdr;
+                for (struct cmsghdr *cmsg = CMSG_FIRSTHDR(&hdr); cmsg;
+                     cmsg = CMSG_NXTHDR(&hdr, cmsg)) {
+                    if (cmsg->cmsg_level == SOL_SOCKET &&
+                        cmsg->cmsg_type == SO_RXQ_OVFL) {
+                        // the kernel's running total for the socket
+                        uint32_t dropped;
+                        memcpy(&dropped, CMSG_DATA(cmsg), sizeof(dropped));
+                        stats.dropped_datagrams = dropped;
+                    }
                 }
+                ingest_datagram(udp_bufs[i], udp_msgs[i].msg_len);
+            }
 
-                auto *header = (orca::OrcaHeader *)buf;
-
-                switch (header->type) {
-                case orca::MessageType::Metric: {
-                    auto *msg = (orca::OrcaMetric *)buf;
-                    std::cout << "Received Metric. gtid=" << msg->gtid
-                              << ", created_at_us=" << msg->created_at_us
-                              << ", block_time_us=" << msg->block_time_us
-                              << ", runnable_time_us=" << msg->runnable_time_us
-                              << ", queued_time_us=" << msg->queued_time_us
-                              << ", on_cpu_time_us=" << msg->on_cpu_time_us
-                              << ", yielding_time_us=" << msg->yielding_time_us
-                              << ", died_at_us=" << msg->died_at_us
-                              << ", preempt_count=" << msg->preempt_count
-                              << std::endl;
+            // Edge-triggered epoll wakes us for every datagram that arrives
+            // from here on, so a short batch means we drained the socket.
+            if (n < UDP_BATCH) {
+                return;
+            }
+        }
+    }
 
-                    analyzer.add_metric(*msg);
+    // A datagram holds one or more frames.
+    void ingest_datagram(const char *buf, size_t len) {
+        ++stats.datagrams;
+        for (size_t off = 0; off < len;) {
+            orca::FrameView frame;
+            const char *error = frame.parse(buf + off, len - off);
+            if (error) {
+                printf("dropping udp datagram: %s\n", error);
+                ++stats.malformed_frames;
+                return;
+            }
+            off += frame.size();
+
+            if (!ingest(frame)) {
+                printf("Unexpected UDP message type: %d\n", (int)frame.type());
+            }
+        }
+    }
 
+    // Feeds the analyzer. Returns false if `frame` isn't metrics or hints.
+    bool ingest(const orca::FrameView &frame) {
+        switch (frame.type()) {
+        case orca::MessageType::Metric: {
+            for (size_t i = 0; i < frame.count(); ++i) {
+                const auto &msg = frame.record<orca::MetricRecord>(i);
+                if (verbose) {
+                    std::cout << "Received Metric. gtid=" << msg.gtid
+                              << ", created_at_us=" << msg.created_at_us
+                              << ", block_time_us=" << msg.block_time_us
+                              << ", runnable_time_us=" << msg.runnable_time_us
+                              << ", queued_time_us=" << msg.queued_time_us
+                              << ", on_cpu_time_us=" << msg.on_cpu_time_us
+                              << ", yielding_time_us=" << msg.yielding_time_us
+                              << ", died_at_us=" << msg.died_at_us
+                              << ", preempt_count=" << msg.preempt_count
+                              << std::endl;
+                }
+                analyzer.add_metric(msg);
+            }
+            stats.metrics += frame.count();
+            return true;
+        }
+        case orca::MessageType::IngressHint: {
+            for (size_t i = 0; i < frame.count(); ++i) {
+                switch (frame.record<orca::IngressHintRecord>(i).hint) {
+                case orca::IngressHintRecord::ReqLength::Short: {
+                    analyzer.add_short();
                     break;
                 }
-                case orca::MessageType::IngressHint: {
-                    auto *msg = (orca::OrcaIngressHint *)buf;
-
-                    switch (msg->hint) {
-                    case orca::OrcaIngressHint::ReqLength::Short: {
-                        analyzer.add_short();
-                        break;
-                    }
-                    case orca::OrcaIngressHint::ReqLength::Long: {
-                        analyzer.add_long();
-                        break;
-                    }
-                    }
-
+                case orca::IngressHintRecord::ReqLength::Long: {
+                    analyzer.add_long();
                     break;
                 }
-                default:
-                    printf("Unknown UDP message type: %d\n", (int)header->type);
-                    panic("unimplemented udp message type");
                 }
             }
-            if (sched_stdout != -1 && FD_ISSET(sched_stdout, &readfds)) {
-                char buf[8192];
-                memset(buf, 0, sizeof(buf));
+            stats.ingress_hints += frame.count();
+            return true;
+        }
+        default:
+            return false;
+        }
+    }
 
-                if (read(sched_stdout, buf, sizeof(buf) - 1) == -1) {
-                    panic("read");
-                }
+    // Prints what we received in the last interval, if anything.
+    void report() {
+        uint64_t expirations;
+        if (read(timerfd, &expirations, sizeof(expirations)) == -1) {
+            return;
+        }
+        if (stats.datagrams == reported.datagrams &&
+            stats.metrics == reported.metrics &&
+            stats.ingress_hints == reported.ingress_hints &&
+            stats.dropped_datagrams == reported.dropped_datagrams) {
+            return;
+        }
+        printf("last %d ms: %lu datagrams, %lu metrics, %lu ingress hints, "
+               "%lu malformed frames, %lu datagrams dropped\n",
+               orca::ANALYSIS_INTERVAL_MS,
+               stats.datagrams - reported.datagrams,
+               stats.metrics - reported.metrics,
+               stats.ingress_hints - reported.ingress_hints,
+               stats.malformed_frames - reported.malformed_frames,
+               stats.dropped_datagrams - reported.dropped_datagrams);
+        reported = stats;
+    }
 
-                // forward scheduler's stdout to our stdout
-                std::cout << buf << std::flush;
+    void handle_sched_output(int fd) {
+        std::vector<int> fds = sched_fds();
+        if (std::find(fds.begin(), fds.end(), fd) == fds.end()) {
+            // left over from a switch earlier in this batch of events
+            return;
+        }
 
-                if (strstr(buf, "Initialization complete, ghOSt active.")) {
-                    sched_ready.fire(0);
-                }
+        char buf[8192];
+        ssize_t len = read(fd, buf, sizeof(buf));
+        if (len == -1) {
+            if (errno == EAGAIN || errno == EINTR) {
+                return;
             }
-            if (sched_stderr != -1 && FD_ISSET(sched_stderr, &readfds)) {
-                char buf[8192];
-                memset(buf, 0, sizeof(buf));
+            panic("read");
+        }
 
-                if (read(sched_stderr, buf, sizeof(buf) - 1) == -1) {
-                    panic("read");
-                }
+        bool pending = fd == orca_agent->get_pending_stdout_fd() ||
+                       fd == orca_agent->get_pending_stderr_fd();
+        if (fd == orca_agent->get_sched_stdout_fd() ||
+            fd == orca_agent->get_pending_stdout_fd()) {
+            // forward the scheduler's stdout to our stdout
+            std::cout.write(buf, len) << std::flush;
+            pid_t pid = pending ? orca_agent->get_pending_pid()
+                                : orca_agent->get_sched_pid();
+            for (const std::string &line : take_lines(fd, pid, buf, len)) {
+                handle_sched_line(pending, line);
+            }
+        } else {
+            // forward the scheduler's stderr to our stderr
+            std::cerr.write(buf, len) << std::flush;
+        }
+
+        if (len == 0) {
+            sched_lines.erase(fd);
+            if (pending && fd == orca_agent->get_pending_stdout_fd() &&
+                !orca_agent->handoff_in_progress()) {
+                // the new scheduler exited before it could take over
+                printf("new scheduler exited before the handoff\n");
+                change_scheduler([] { orca_agent->abort_handoff(); });
+                return;
+            }
+            // The scheduler exited. Its pipe stays readable; stop watching it
+            // until the next switch.
+            unwatch(fd);
+        }
+    }
 
-                // forward scheduler's stderr to our stderr
-                std::cerr << buf << std::flush;
+    // Appends what we read from `fd`, the stdout of the scheduler with `pid`,
+    // to what is left of its last line and returns the complete lines. At
+    // EOF (`len` == 0), the rest counts as a line too.
+    std::vector<std::string> take_lines(int fd, pid_t pid, const char *buf,
+                                        size_t len) {
+        LineBuffer &lines = sched_lines[fd];
+        if (lines.pid != pid) {
+            // a new scheduler's pipe with the fd of an old one
+            lines = LineBuffer{.pid = pid};
+        }
+        lines.partial.append(buf, len);
+
+        std::vector<std::string> complete;
+        size_t start = 0;
+        for (size_t nl; (nl = lines.partial.find('\n', start)) !=
+                        std::string::npos;
+             start = nl + 1) {
+            complete.push_back(lines.partial.substr(start, nl - start));
+        }
+        lines.partial.erase(0, start);
+        if (len == 0 && !lines.partial.empty()) {
+            complete.push_back(std::move(lines.partial));
+            lines.partial.clear();
+        }
+        if (lines.partial.size() > MAX_SCHED_LINE) {
+            // Not a line we are looking for.
+            lines.partial.clear();
+        }
+        return complete;
+    }
 
-                /**
-                 *  If we find a substring indicating crash:
-                 *      Call orca_agent->set_scheduler()
-                 */
+    void handle_sched_line(bool pending, const std::string &line) {
+        if (line.find(orca::AGENT_ACTIVE_MSG) != std::string::npos) {
+            if (!pending) {
+                sched_ready.fire(0);
+            } else if (orca_agent->handoff_in_progress()) {
+                pending_active = true;
             }
+        } else if (pending &&
+                   line.find(ghost::kReadyForHandoffMsg) != std::string::npos) {
+            start_handoff();
+        }
+    }
+};
+
+int main(int argc, char *argv[]) {
+    for (int i = 1; i < argc; ++i) {
+        if (!strcmp(argv[i], "-v") || !strcmp(argv[i], "--verbose")) {
+            verbose = true;
+        } else {
+            printf("usage: %s [-v|--verbose]\n", argv[0]);
+            return EXIT_FAILURE;
         }
     }
-}
\ No newline at end of file
+
+    orca_agent = std::make_unique<orca::Orca>();
+
+    signal(SIGINT, [](int signum) {
+        // call Orca destructor
+        orca_agent = nullptr;
+
+        exit(signum);
+    });
+
+    // Too big for the stack, with its receive buffers.
+    static OrcaServer server;
+    server.run();
+}
@@ -1,5 +1,7 @@
 #pragma once
 
+#include <errno.h>
+#include <fcntl.h>
 #include <signal.h>
 #include <stdio.h>
 #include <stdlib.h>
@@ -8,16 +10,38 @@
 #include <sys/wait.h>
 #include <unistd.h>
 
+#include <algorithm>
+#include <chrono>
 #include <functional>
+#include <limits>
 #include <sstream>
 #include <string>
 #include <vector>
 
 #include "helpers.h"
+#include "kernel/ghost_uapi.h"
+#include "lib/live_update.h"
 #include "protocol.h"
 
 namespace orca {
 
+// CPUs managed by the enclave that Orca creates for its scheduling agents.
+constexpr int SCHED_FIRST_CPU = 0;
+constexpr int SCHED_LAST_CPU = 7;
+
+// Printed by a scheduling agent once it is scheduling the enclave.
+constexpr const char *AGENT_ACTIVE_MSG =
+    "Initialization complete, ghOSt active.";
+
+// How long to wait for each step of a live update before giving up.
+constexpr int HANDOFF_TIMEOUT_MS = 10000;
+
+// How often to check on a live update in progress.
+constexpr int HANDOFF_POLL_MS = 1;
+
+// How often Orca reports on what it received.
+constexpr int ANALYSIS_INTERVAL_MS = 1000;
+
 // Helper which suggests a scheduling config based on input data.
 // TODO: this class could form the basis of a more generalized analysis.
 class MetricAnalyzer {
@@ -29,7 +53,14 @@ public:
     void add_long() { ++num_long; }
 
     // Add a metric to the analyzer.
-    void add_metric(orca::OrcaMetric metric) { metrics.push_back(metric); }
+    void add_metric(const orca::MetricRecord &metric) {
+        // Keeps running sums rather than the metrics, which arrive by the
+        // million under load.
+        double queued = (double)metric.queued_time_us;
+        ++num_metrics;
+        queued_sum += queued;
+        queued_sum_sq += queued * queued;
+    }
 
     // Suggest a config based on workload stats
     SchedulerConfig suggest_from_ingress_hints() {
@@ -99,28 +130,29 @@ public:
     void clear() {
         num_short = 0;
         num_long = 0;
-        metrics.clear();
+        num_metrics = 0;
+        queued_sum = 0.0;
+        queued_sum_sq = 0.0;
     }
 
 private:
     int num_short = 0;
     int num_long = 0;
-    std::vector<orca::OrcaMetric> metrics;
+    int64_t num_metrics = 0;
+    double queued_sum = 0.0;
+    double queued_sum_sq = 0.0;
 
     // Compute variance in queued time
     double compute_queued_time_var() {
-        double mean = 0.0;
-        for (const auto &metric : metrics) {
-            mean += (double)metric.queued_time_us;
-        }
-        mean /= (double)metrics.size();
-
-        double var = 0.0;
-        for (const auto &metric : metrics) {
-            double v = (double)metric.queued_time_us - mean;
-            var += v * v;
+        if (num_metrics == 0) {
+            // No metrics: NaN fails both thresholds, which picks dFCFS.
+            printf("no metrics, var=nan\n");
+            return std::numeric_limits<double>::quiet_NaN();
         }
-        var /= (double)metrics.size();
+        double mean = queued_sum / (double)num_metrics;
+        // Rounding can take the difference slightly below 0.
+        double var = std::max(
+            0.0, queued_sum_sq / (double)num_metrics - mean * mean);
 
         printf("mean=%.2f, var=%.2f\n", mean, var);
 
@@ -130,41 +162,285 @@ private:
 
 class Orca {
 public:
-    Orca() {
-        // set pipe fd's to dummy values
-        stdout_pipe_fd[0] = -1;
-        stdout_pipe_fd[1] = -1;
-        stderr_pipe_fd[0] = -1;
-        stderr_pipe_fd[1] = -1;
-    }
+    // Creates the enclave that every scheduling agent attaches to. Orca owns
+    // the enclave for its lifetime, so that switching schedulers hands the
+    // enclave's tasks from the old agent to the new one (a live update)
+    // instead of destroying the enclave and dropping the tasks back to CFS.
+    Orca() { create_enclave(); }
 
     ~Orca() {
         printf("Exiting Orca...\n");
 
-        if (curr_sched_pid != 0) {
-            terminate_child(curr_sched_pid);
+        if (pending.pid != 0) {
+            terminate_child(pending.pid);
         }
+        if (curr.pid != 0) {
+            terminate_child(curr.pid);
+        }
+        destroy_enclave();
     }
 
-    // Helper which runs a new scheduler and kills the old one (if it exists).
+    // Switches to a scheduler for `config`. The first scheduler simply
+    // starts. Later schedulers start alongside the current one and take over
+    // once they are ready; see begin_handoff(). Must not be called while a
+    // handoff is in progress.
     void set_scheduler(orca::SchedulerConfig config) {
-        if (curr_sched_pid != 0) {
-            terminate_child(curr_sched_pid);
+        if (handoff_in_progress()) {
+            panic("set_scheduler during a handoff");
+        }
+        if (curr.pid == 0) {
+            curr = run_scheduler(config, enclave_dir);
+            return;
+        }
+
+        if (pending.pid != 0) {
+            printf("abandoning the switch to pid=%d\n", pending.pid);
+            abort_handoff();
+        }
+        pending = run_scheduler(config, enclave_dir);
+        switch_started = std::chrono::steady_clock::now();
+    }
+
+    // How a handoff stands; see poll_handoff().
+    enum class HandoffResult { InProgress, Done, TimedOut };
+
+    // Called once the pending scheduler printed ghost::kReadyForHandoffMsg.
+    // Tells the current scheduler to exit and returns right away. The caller
+    // then calls poll_handoff() whenever get_agent_online_fd() signals and
+    // every few milliseconds until the handoff is over, and then calls
+    // finish_handoff().
+    void begin_handoff() {
+        if (pending.pid == 0 || handoff_in_progress()) {
+            return;
+        }
+
+        exit_requested = std::chrono::steady_clock::now();
+        if (kill(curr.pid, SIGINT) == -1) {
+            panic("kill");
+        }
+        handoff = HandoffState::WaitOffline;
+        step_deadline =
+            exit_requested + std::chrono::milliseconds(HANDOFF_TIMEOUT_MS);
+    }
+
+    // Checks the enclave's agent_online without blocking. The enclave goes
+    // offline when the old agent closes agent_online, and comes back online
+    // once the new agent has attached to every CPU and discovered the
+    // enclave's tasks. In between, the tasks stay in the enclave, but nothing
+    // schedules them. Each step times out after HANDOFF_TIMEOUT_MS.
+    HandoffResult poll_handoff() {
+        if (!handoff_in_progress()) {
+            return HandoffResult::Done;
+        }
+
+        int online = read_agent_online();
+        auto now = std::chrono::steady_clock::now();
+        if (handoff == HandoffState::WaitOffline && online == 0) {
+            offline_at = now;
+            handoff = HandoffState::WaitOnline;
+            step_deadline = now + std::chrono::milliseconds(HANDOFF_TIMEOUT_MS);
+        }
+        if (handoff == HandoffState::WaitOnline && online == 1) {
+            online_at = now;
+            return HandoffResult::Done;
+        }
+        if (now >= step_deadline) {
+            return HandoffResult::TimedOut;
+        }
+        return HandoffResult::InProgress;
+    }
+
+    // Ends the handoff once poll_handoff() returned Done or TimedOut: reaps
+    // the old scheduler, makes the pending one current, and reports how long
+    // the enclave went unscheduled. May close the schedulers' pipes.
+    void finish_handoff(HandoffResult result) {
+        if (!handoff_in_progress()) {
+            return;
         }
 
-        curr_sched_pid = run_scheduler(config, stdout_pipe_fd, stderr_pipe_fd);
+        bool offline = handoff == HandoffState::WaitOnline;
+        if (!offline) {
+            // The old scheduler ignored SIGINT; don't wait on it forever.
+            kill(curr.pid, SIGKILL);
+        }
+        reap_child(curr.pid);
+        close(curr.stdout_fd);
+        close(curr.stderr_fd);
+        curr = pending;
+        pending = SchedProcess();
+        handoff = HandoffState::Idle;
+
+        if (result != HandoffResult::Done) {
+            printf("live update: timed out waiting for the enclave to go %s\n",
+                   offline ? "online" : "offline");
+            return;
+        }
+        printf("live update: handoff to pid=%d took %.3f ms "
+               "(old agent exit %.3f ms, total switch %.3f ms)\n",
+               curr.pid, ms_between(offline_at, online_at),
+               ms_between(exit_requested, offline_at),
+               ms_between(switch_started, online_at));
     }
 
+    bool handoff_in_progress() const { return handoff != HandoffState::Idle; }
+
+    // Called if the pending scheduler exited before it was ready for handoff.
+    // The current scheduler keeps running. Once a handoff is in progress, the
+    // old scheduler is on its way out, so a pending scheduler that dies then
+    // is left to poll_handoff() to time out on.
+    void abort_handoff() {
+        if (pending.pid == 0 || handoff_in_progress()) {
+            return;
+        }
+        terminate_child(pending.pid);
+        close(pending.stdout_fd);
+        close(pending.stderr_fd);
+        pending = SchedProcess();
+    }
+
+    // Returns a file descriptor for the enclave's agent_online, which signals
+    // when it changes
+    int get_agent_online_fd() { return agent_online_fd; }
+
+    // Returns the pid of the current scheduler process, or 0 if there is none
+    pid_t get_sched_pid() { return curr.pid; }
+
+    // Returns the pid of the scheduler process that is waiting to take over,
+    // or 0 if there is none
+    pid_t get_pending_pid() { return pending.pid; }
+
     // Returns file descriptor which contains stdout of scheduler process
-    int get_sched_stdout_fd() { return stdout_pipe_fd[0]; }
+    int get_sched_stdout_fd() { return curr.stdout_fd; }
 
     // Returns file descriptor which contains stderr of scheduler process
-    int get_sched_stderr_fd() { return stderr_pipe_fd[0]; }
+    int get_sched_stderr_fd() { return curr.stderr_fd; }
+
+    // Returns file descriptor which contains stdout of the scheduler process
+    // that is waiting to take over, or -1 if there is none
+    int get_pending_stdout_fd() { return pending.stdout_fd; }
+
+    // Returns file descriptor which contains stderr of the scheduler process
+    // that is waiting to take over, or -1 if there is none
+    int get_pending_stderr_fd() { return pending.stderr_fd; }
 
 private:
-    int stdout_pipe_fd[2];
-    int stderr_pipe_fd[2];
-    pid_t curr_sched_pid = 0;
+    // A scheduler process along with the read ends of its stdout and stderr.
+    struct SchedProcess {
+        pid_t pid = 0;
+        int stdout_fd = -1;
+        int stderr_fd = -1;
+    };
+
+    SchedProcess curr;
+    SchedProcess pending;
+
+    // A handoff first waits for the enclave to go offline (the old agent
+    // exited), then for it to come back online (the new agent took over).
+    enum class HandoffState { Idle, WaitOffline, WaitOnline };
+    HandoffState handoff = HandoffState::Idle;
+    std::chrono::steady_clock::time_point step_deadline;
+
+    std::chrono::steady_clock::time_point switch_started;
+    std::chrono::steady_clock::time_point exit_requested;
+    std::chrono::steady_clock::time_point offline_at;
+    std::chrono::steady_clock::time_point online_at;
+
+    std::string enclave_dir;
+    int enclave_ctl_fd = -1;
+    int agent_online_fd = -1;
+
+    static double ms_between(std::chrono::steady_clock::time_point from,
+                             std::chrono::steady_clock::time_point to) {
+        return std::chrono::duration<double, std::milli>(to - from).count();
+    }
+
+    // Returns the cpumask string (as accepted by an enclave's cpumask file)
+    // for the CPUs in [first, last].
+    static std::string cpumask_str(int first, int last) {
+        std::vector<uint32_t> words(last / 32 + 1, 0);
+        for (int cpu = first; cpu <= last; ++cpu) {
+            words[cpu / 32] |= 1u << (cpu % 32);
+        }
+        std::string mask;
+        char word[16];
+        for (int i = words.size() - 1; i >= 0; --i) {
+            snprintf(word, sizeof(word), mask.empty() ? "%x" : ",%08x",
+                     words[i]);
+            mask += word;
+        }
+        return mask;
+    }
+
+    // Creates the next free /sys/fs/ghost/enclave_N for our CPUs.
+    void create_enclave() {
+        int top_ctl = open("/sys/fs/ghost/ctl", O_WRONLY);
+        if (top_ctl == -1) {
+            panic("open /sys/fs/ghost/ctl");
+        }
+        int id = 1;
+        while (true) {
+            std::string cmd = "create " + std::to_string(id) + " " +
+                              std::to_string(GHOST_VERSION);
+            if (write(top_ctl, cmd.c_str(), cmd.size()) == (ssize_t)cmd.size()) {
+                break;
+            }
+            if (errno != EEXIST) {
+                panic("create enclave");
+            }
+            ++id;
+        }
+        close(top_ctl);
+
+        enclave_dir = "/sys/fs/ghost/enclave_" + std::to_string(id);
+        enclave_ctl_fd = open((enclave_dir + "/ctl").c_str(), O_RDWR);
+        if (enclave_ctl_fd == -1) {
+            panic("open enclave ctl");
+        }
+
+        int cpumask_fd = open((enclave_dir + "/cpumask").c_str(), O_RDWR);
+        if (cpumask_fd == -1) {
+            panic("open enclave cpumask");
+        }
+        std::string mask = cpumask_str(SCHED_FIRST_CPU, SCHED_LAST_CPU);
+        if (write(cpumask_fd, mask.c_str(), mask.size()) != (ssize_t)mask.size()) {
+            panic("write enclave cpumask");
+        }
+        close(cpumask_fd);
+
+        agent_online_fd = open((enclave_dir + "/agent_online").c_str(),
+                               O_RDONLY | O_CLOEXEC);
+        if (agent_online_fd == -1) {
+            panic("open agent_online");
+        }
+
+        printf("created enclave %s\n", enclave_dir.c_str());
+    }
+
+    void destroy_enclave() {
+        if (agent_online_fd != -1) {
+            close(agent_online_fd);
+            agent_online_fd = -1;
+        }
+        if (enclave_ctl_fd == -1) {
+            return;
+        }
+        const char cmd[] = "destroy";
+        if (write(enclave_ctl_fd, cmd, sizeof(cmd) - 1) == -1) {
+            perror("destroy enclave");
+        }
+        close(enclave_ctl_fd);
+        enclave_ctl_fd = -1;
+    }
+
+    // Returns the current value of the enclave's agent_online.
+    int read_agent_online() {
+        char buf[20];
+        memset(buf, 0, sizeof(buf));
+        if (pread(agent_online_fd, buf, sizeof(buf) - 1, 0) <= 0) {
+            panic("read agent_online");
+        }
+        return atoi(buf);
+    }
 
     static pid_t delegate_to_child(std::function<void()> work,
                                    int *stdout_pipe_fd, int *stderr_pipe_fd) {
@@ -229,6 +505,10 @@ private:
         }
 
         printf("killing child process (pid=%d) ...\n", child_pid);
+        reap_child(child_pid);
+    }
+
+    static void reap_child(pid_t child_pid) {
         int status;
         waitpid(child_pid, &status, 0);
 
@@ -265,13 +545,12 @@ private:
         return stat(filepath, &buf) == 0;
     }
 
-    // Run a scheduling agent.
-    // Returns the PID of the scheduler.
-    static pid_t run_scheduler(orca::SchedulerConfig config,
-                               int *stdout_pipe_fd, int *stderr_pipe_fd) {
+    // Run a scheduling agent attached to the enclave at `enclave_dir`.
+    static SchedProcess run_scheduler(orca::SchedulerConfig config,
+                                      const std::string &enclave_dir) {
         // statically allocate memory for execv args
-        // this is kinda sketchy but it should work, since only one scheduling
-        // agent runs at a time
+        // this is kinda sketchy but it should work, since the child that
+        // uses them is forked right after they are filled in
         static char argbuf[20][100];
 
         std::vector<std::string> arglist = {"/usr/bin/sudo"};
@@ -284,22 +563,9 @@ private:
             panic("unrecognized scheduler type");
         }
 
-        arglist.push_back("--ghost_cpus");
-        arglist.push_back("0-7");
-
-        // Check if there is an enclave to attach to
-        /*
-        if (file_exists("/sys/fs/ghost/enclave_1")) {
-            if (file_exists("/sys/fs/ghost/enclave_2")) {
-                // We expect to make one enclave at most, and to keep reusing it
-                // for each scheduler agent
-                // If there is more than one enclave, something went wrong
-                panic("more enclaves than expected");
-            }
-            arglist.push_back("--enclave");
-            arglist.push_back("/sys/fs/ghost/enclave_1");
-        }
-        */
+        // The agent takes its CPUs from the enclave.
+        arglist.push_back("--enclave");
+        arglist.push_back(enclave_dir);
 
         if (config.type != orca::SchedulerConfig::SchedulerType::dFCFS &&
             config.preemption_interval_us >= 0) {
@@ -323,12 +589,18 @@ private:
         }
         printf("\n");
 
-        return delegate_to_child(
+        int stdout_pipe_fd[2];
+        int stderr_pipe_fd[2];
+        SchedProcess proc;
+        proc.pid = delegate_to_child(
             [] {
                 execv(args[0], args);
                 panic("execv");
             },
             stdout_pipe_fd, stderr_pipe_fd);
+        proc.stdout_fd = stdout_pipe_fd[0];
+        proc.stderr_fd = stderr_pipe_fd[0];
+        return proc;
     }
 };
 
@@ -13,39 +13,16 @@
 #include "helpers.h"
 #include "protocol.h"
 
-void send_message(int port, const char *buf, size_t len) {
-    const char *hostname = "localhost";
+// One connection for all the commands of a session.
+orca::OrcaTCPClient client;
 
-    int sockfd = socket(AF_INET, SOCK_STREAM, IPPROTO_IP);
-
-    struct sockaddr_in addr;
-    addr.sin_family = AF_INET;
-
-    // resolve host
-    struct hostent *host = gethostbyname(hostname);
-    if (host == NULL) {
-        panic("gethostbyname");
-    }
-    memcpy(&addr.sin_addr, host->h_addr_list[0], host->h_length);
-    addr.sin_port = htons(port);
-
-    if (connect(sockfd, (struct sockaddr *)&addr, sizeof(addr)) == -1) {
-        panic("connect");
-    }
-
-    // send message
-    send_full(sockfd, buf, len);
-
-    // wait for ack
+void send_message(char *buf, size_t len) {
     printf("awaiting ack...\n");
-    orca::OrcaAck ack;
-    recv_full(sockfd, (char *)&ack, sizeof(ack));
-    if (ack.type != orca::MessageType::Ack) {
+    orca::AckRecord ack;
+    if (!client.request(buf, len, &ack)) {
         panic("expected ack");
     }
     printf("got ack. %s\n", ack.data);
-
-    close(sockfd);
 }
 
 void print_usage() {
@@ -56,7 +33,7 @@ void print_usage() {
     std::cout << std::flush;
 }
 
-void handle_input(int port, const std::string &input) {
+void handle_input(const std::string &input) {
     printf("Running command: %s\n", input.c_str());
 
     std::istringstream iss(input);
@@ -86,13 +63,14 @@ void handle_input(int port, const std::string &input) {
             config.preemption_interval_us = preemption_interval_us;
         }
 
-        orca::OrcaSetScheduler msg;
-        msg.config = config;
+        orca::FrameWriter<orca::SetSchedulerRecord> msg;
+        msg.append()->config = config;
 
-        send_message(port, (const char *)&msg, sizeof(msg));
+        send_message(msg.data(), msg.size());
     } else if (cmd == "detsched") {
-        orca::OrcaDetermineScheduler msg;
-        send_message(port, (const char *)&msg, sizeof(msg));
+        orca::FrameHeader msg =
+            orca::empty_frame(orca::MessageType::DetermineScheduler);
+        send_message((char *)&msg, sizeof(msg));
     } else {
         printf("Invalid command: %s\n", input.c_str());
         print_usage();
@@ -105,7 +83,7 @@ int main(int argc, char *argv[]) {
         for (int i = 1; i < argc; ++i) {
             oss << argv[i] << " ";
         }
-        handle_input(orca::PORT, oss.str());
+        handle_input(oss.str());
         return 0;
     }
 
@@ -113,6 +91,6 @@ int main(int argc, char *argv[]) {
 
     std::string input;
     while (std::getline(std::cin, input)) {
-        handle_input(orca::PORT, input);
+        handle_input(input);
     }
 }
@@ -0,0 +1,175 @@
+// Floods Orca with ingress hints and metrics over UDP, the way busy workloads
+// and agents do, then asks Orca how many it received and reports the drop
+// rate.
+//
+// Orca's totals include anything else sent to it meanwhile, e.g. metrics from
+// a running agent, so run this against an otherwise idle Orca.
+
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <unistd.h>
+
+#include <algorithm>
+#include <chrono>
+#include <string>
+#include <thread>
+#include <vector>
+
+#include "helpers.h"
+#include "protocol.h"
+
+using std::chrono::steady_clock;
+
+struct Options {
+    int threads = 4;
+    double seconds = 5.0;
+    // Records per second per thread, or 0 for as fast as we can.
+    double rate = 0.0;
+    // Every Nth record is a metric, the rest are ingress hints.
+    int metric_every = 10;
+    int max_delay_us = 1000;
+};
+
+void print_usage(const char *argv0) {
+    printf("usage: %s [--threads N] [--seconds S] [--rate RECORDS_PER_SEC] "
+           "[--metric_every N] [--max_delay_us US]\n",
+           argv0);
+}
+
+Options parse_options(int argc, char *argv[]) {
+    Options opts;
+    for (int i = 1; i < argc; ++i) {
+        std::string flag = argv[i];
+        if (i + 1 == argc) {
+            print_usage(argv[0]);
+            exit(EXIT_FAILURE);
+        }
+        const char *value = argv[++i];
+        if (flag == "--threads") {
+            opts.threads = atoi(value);
+        } else if (flag == "--seconds") {
+            opts.seconds = atof(value);
+        } else if (flag == "--rate") {
+            opts.rate = atof(value);
+        } else if (flag == "--metric_every") {
+            opts.metric_every = atoi(value);
+        } else if (flag == "--max_delay_us") {
+            opts.max_delay_us = atoi(value);
+        } else {
+            print_usage(argv[0]);
+            exit(EXIT_FAILURE);
+        }
+    }
+    if (opts.threads <= 0 || opts.seconds <= 0 || opts.rate < 0 ||
+        opts.metric_every <= 0 || opts.max_delay_us < 0) {
+        print_usage(argv[0]);
+        exit(EXIT_FAILURE);
+    }
+    return opts;
+}
+
+orca::StatsRecord get_stats(orca::OrcaTCPClient &client) {
+    orca::FrameHeader msg = orca::empty_frame(orca::MessageType::GetStats);
+    orca::StatsRecord stats;
+    if (!client.request((char *)&msg, sizeof(msg), &stats)) {
+        panic("GetStats");
+    }
+    return stats;
+}
+
+// Sends records until `deadline`, `opts.rate` per second if set, and counts
+// the hints and metrics it sent.
+void flood(const Options &opts, steady_clock::time_point deadline,
+           uint64_t *hints_sent, uint64_t *metrics_sent) {
+    std::chrono::microseconds max_delay(opts.max_delay_us);
+    orca::OrcaUDPBatcher<orca::IngressHintRecord> hints(max_delay);
+    orca::OrcaUDPBatcher<orca::MetricRecord> metrics(max_delay);
+
+    auto start = steady_clock::now();
+    uint64_t sent = 0;
+    while (true) {
+        // Pacing and the deadline only need checking now and then.
+        if (opts.rate > 0 || sent % 64 == 0) {
+            auto now = steady_clock::now();
+            if (now >= deadline) {
+                break;
+            }
+            if (opts.rate > 0) {
+                auto due = start + std::chrono::duration_cast<
+                                       steady_clock::duration>(
+                                       std::chrono::duration<double>(
+                                           sent / opts.rate));
+                if (now < due) {
+                    std::this_thread::sleep_until(due);
+                }
+            }
+        }
+
+        if (sent % opts.metric_every == 0) {
+            orca::MetricRecord *m = metrics.append();
+            m->gtid = (int64_t)sent;
+            m->queued_time_us = (int64_t)(sent % 1000);
+            ++*metrics_sent;
+        } else {
+            hints.append()->hint =
+                sent % 2 ? orca::IngressHintRecord::ReqLength::Short
+                         : orca::IngressHintRecord::ReqLength::Long;
+            ++*hints_sent;
+        }
+        ++sent;
+    }
+    // the batchers flush the rest as they go out of scope
+}
+
+int main(int argc, char *argv[]) {
+    Options opts = parse_options(argc, argv);
+
+    orca::OrcaTCPClient client;
+    orca::StatsRecord before = get_stats(client);
+
+    printf("flooding Orca from %d threads for %.1f s...\n", opts.threads,
+           opts.seconds);
+    std::vector<uint64_t> hints_sent(opts.threads, 0);
+    std::vector<uint64_t> metrics_sent(opts.threads, 0);
+    auto start = steady_clock::now();
+    auto deadline = start + std::chrono::duration_cast<steady_clock::duration>(
+                                std::chrono::duration<double>(opts.seconds));
+    std::vector<std::thread> threads;
+    for (int i = 0; i < opts.threads; ++i) {
+        threads.emplace_back(flood, std::cref(opts), deadline, &hints_sent[i],
+                             &metrics_sent[i]);
+    }
+    for (auto &t : threads) {
+        t.join();
+    }
+    double elapsed =
+        std::chrono::duration<double>(steady_clock::now() - start).count();
+
+    // Let Orca drain its socket.
+    usleep(500 * 1000);
+    orca::StatsRecord after = get_stats(client);
+
+    uint64_t hints = 0, metrics = 0;
+    for (int i = 0; i < opts.threads; ++i) {
+        hints += hints_sent[i];
+        metrics += metrics_sent[i];
+    }
+    uint64_t sent = hints + metrics;
+    uint64_t received = (after.ingress_hints - before.ingress_hints) +
+                        (after.metrics - before.metrics);
+    double drop_rate =
+        sent ? 1.0 - (double)std::min(received, sent) / (double)sent : 0.0;
+
+    printf("sent:     %lu records (%lu hints, %lu metrics) in %.2f s, "
+           "%.0f records/s\n",
+           sent, hints, metrics, elapsed, sent / elapsed);
+    printf("received: %lu records (%lu hints, %lu metrics) in %lu datagrams\n",
+           received, after.ingress_hints - before.ingress_hints,
+           after.metrics - before.metrics, after.datagrams - before.datagrams);
+    printf("dropped:  %.4f%% of records; the kernel dropped %lu datagrams, "
+           "%lu frames were malformed\n",
+           100.0 * drop_rate,
+           after.dropped_datagrams - before.dropped_datagrams,
+           after.malformed_frames - before.malformed_frames);
+}
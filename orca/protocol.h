@@ -10,57 +10,89 @@
 #include <sys/socket.h>
 #include <unistd.h>
 
+#include <chrono>
+
 #include "helpers.h"
 
 namespace orca {
 
 constexpr int PORT = 8000;
-constexpr size_t MAX_MESSAGE_SIZE = 1024;
+
+// Wire format
+//
+// Everything sent to and from Orca, over TCP or UDP, is a frame: a FrameHeader
+// followed by `count` fixed-size records of the frame's type, back to back. A
+// datagram may carry several frames, and a TCP connection carries any number
+// of them, so clients batch records and keep their connection open.
+//
+// Frames are in host byte order: Orca and its clients share a machine.
+// Records are plain structs that the receiver reads in place, without copying.
+// Records may only grow at the end. `record_size` tells the receiver how far
+// apart they are, so a receiver skips the fields it doesn't know about.
+// Anything else is a new PROTOCOL_VERSION.
+
+constexpr uint16_t PROTOCOL_MAGIC = 0x4f52; // "OR"
+constexpr uint8_t PROTOCOL_VERSION = 1;
+
+// Fits in a single datagram on a 1500 byte MTU, so that nothing fragments.
+constexpr size_t MAX_FRAME_SIZE = 1472;
 
 struct SchedulerConfig {
-    enum class SchedulerType { dFCFS, cFCFS };
+    enum class SchedulerType : uint32_t { dFCFS, cFCFS };
 
     SchedulerType type;
-    int preemption_interval_us = -1; // ignored for dFCFS
+    int32_t preemption_interval_us = -1; // ignored for dFCFS
 };
 
-enum class MessageType {
+enum class MessageType : uint8_t {
     Ack,
     SetScheduler,
     DetermineScheduler,
     Metric,
-    IngressHint
+    IngressHint,
+    GetStats,
+    Stats
 };
 
-// Header for all TCP messages to the Orca server.
-struct OrcaHeader {
+struct FrameHeader {
+    uint16_t magic;
+    uint8_t version;
     MessageType type;
-
-    OrcaHeader() {}
-    OrcaHeader(MessageType type) : type(type) {}
+    // Size of the frame in bytes, including this header.
+    uint32_t length;
+    uint16_t count;
+    uint16_t record_size;
+    // Chosen by the sender of a request and echoed in its ack, so that a
+    // client with a persistent connection can tell its acks apart.
+    uint32_t seq;
 };
+static_assert(sizeof(FrameHeader) == 16);
 
-struct OrcaAck : OrcaHeader {
-    // include optional data with ack (debug)
-    char data[100];
+// Records. Each is a multiple of 8 bytes, so that they stay aligned in a
+// frame.
 
-    OrcaAck() : OrcaHeader(MessageType::Ack) { memset(data, 0, sizeof(data)); }
+// Reply to SetScheduler and DetermineScheduler, once the scheduler runs.
+struct AckRecord {
+    static constexpr MessageType TYPE = MessageType::Ack;
+
+    // include optional data with ack (debug)
+    char data[32];
 };
 
-// Message which results in the scheduler being restarted.
-struct OrcaSetScheduler : OrcaHeader {
-    SchedulerConfig config;
+// Restarts the scheduler with `config`.
+struct SetSchedulerRecord {
+    static constexpr MessageType TYPE = MessageType::SetScheduler;
 
-    OrcaSetScheduler() : OrcaHeader(MessageType::SetScheduler) {}
+    SchedulerConfig config;
 };
 
-// Triggers a scheduler update based on Orca's best guess.
-struct OrcaDetermineScheduler : OrcaHeader {
-    OrcaDetermineScheduler() : OrcaHeader(MessageType::DetermineScheduler) {}
-};
+// A DetermineScheduler frame has no records: it triggers a scheduler update
+// based on Orca's best guess.
 
 // Payload from a Metrics object
-struct OrcaMetric : OrcaHeader {
+struct MetricRecord {
+    static constexpr MessageType TYPE = MessageType::Metric;
+
     // Gtid (raw int64 value)
     int64_t gtid;
 
@@ -75,50 +107,380 @@ struct OrcaMetric : OrcaHeader {
 
     // Number of preemptions
     int64_t preempt_count;
-
-    OrcaMetric() : OrcaHeader(MessageType::Metric) {}
 };
 
 // Hints about runtime for ingress requests
-struct OrcaIngressHint : OrcaHeader {
-    enum class ReqLength {
+struct IngressHintRecord {
+    static constexpr MessageType TYPE = MessageType::IngressHint;
+
+    enum class ReqLength : uint32_t {
         Short, // ex. RocksDB Get
         Long,  // ex. RocksDB Range
     };
 
     // A hint which tells Orca about an incoming request type.
     ReqLength hint;
+    uint32_t reserved = 0;
+};
 
-    OrcaIngressHint() : OrcaHeader(MessageType::IngressHint) {}
+// Reply to GetStats (a frame with no records): what Orca has received since
+// it started. Clients diff two of them to measure an interval.
+struct StatsRecord {
+    static constexpr MessageType TYPE = MessageType::Stats;
+
+    uint64_t datagrams;
+    // Records by type, from UDP and TCP.
+    uint64_t metrics;
+    uint64_t ingress_hints;
+    // Frames that failed to parse.
+    uint64_t malformed_frames;
+    // Datagrams the kernel dropped because Orca's receive buffer was full.
+    uint64_t dropped_datagrams;
 };
 
-// class which allows convenient sending of UDP messages to Orca
-class OrcaUDPClient {
+static_assert(sizeof(AckRecord) % 8 == 0);
+static_assert(sizeof(SetSchedulerRecord) % 8 == 0);
+static_assert(sizeof(MetricRecord) % 8 == 0);
+static_assert(sizeof(IngressHintRecord) % 8 == 0);
+static_assert(sizeof(StatsRecord) % 8 == 0);
+
+// Returns the size of the records of `type` in this version, or -1 if we don't
+// know `type`.
+inline int record_size_of(MessageType type) {
+    switch (type) {
+    case MessageType::Ack:
+        return sizeof(AckRecord);
+    case MessageType::SetScheduler:
+        return sizeof(SetSchedulerRecord);
+    case MessageType::DetermineScheduler:
+        return 0;
+    case MessageType::Metric:
+        return sizeof(MetricRecord);
+    case MessageType::IngressHint:
+        return sizeof(IngressHintRecord);
+    case MessageType::GetStats:
+        return 0;
+    case MessageType::Stats:
+        return sizeof(StatsRecord);
+    }
+    return -1;
+}
+
+// A received frame, read in place from the receive buffer, which must be
+// 8-byte aligned and outlive the view.
+class FrameView {
 public:
-    OrcaUDPClient() {
-        sockfd = socket(AF_INET, SOCK_DGRAM, 0);
-        if (sockfd == -1) {
-            panic("error with socket");
+    // Parses the frame at the start of `buf`. Returns nullptr on success, or
+    // what is wrong with the frame. `len` may include more frames after this
+    // one; see size().
+    const char *parse(const char *buf, size_t len) {
+        if (len < sizeof(FrameHeader)) {
+            return "short frame header";
+        }
+        header = reinterpret_cast<const FrameHeader *>(buf);
+        if (header->magic != PROTOCOL_MAGIC) {
+            return "bad magic";
+        }
+        if (header->version != PROTOCOL_VERSION) {
+            return "unsupported protocol version";
+        }
+        if (header->length > len || header->length > MAX_FRAME_SIZE) {
+            return "truncated frame";
         }
+        int min_size = record_size_of(header->type);
+        if (min_size < 0) {
+            return "unknown message type";
+        }
+        if (header->record_size < min_size || header->record_size % 8) {
+            return "bad record size";
+        }
+        if (header->length !=
+            sizeof(FrameHeader) + header->count * header->record_size) {
+            return "bad frame length";
+        }
+        records = buf + sizeof(FrameHeader);
+        return nullptr;
+    }
+
+    MessageType type() const { return header->type; }
+    uint32_t seq() const { return header->seq; }
+    size_t count() const { return header->count; }
+    // Bytes in the frame, i.e. where the next one starts.
+    size_t size() const { return header->length; }
+
+    // Returns the i-th record. `Record` must be the frame's type.
+    template <typename Record> const Record &record(size_t i) const {
+        return *reinterpret_cast<const Record *>(records +
+                                                 i * header->record_size);
+    }
+
+private:
+    const FrameHeader *header = nullptr;
+    const char *records = nullptr;
+};
+
+// Builds a frame of `Record`s in place.
+template <typename Record> class FrameWriter {
+public:
+    static constexpr size_t MAX_RECORDS =
+        (MAX_FRAME_SIZE - sizeof(FrameHeader)) / sizeof(Record);
+
+    explicit FrameWriter(uint32_t seq = 0) { reset(seq); }
+
+    // Starts over with an empty frame.
+    void reset(uint32_t seq = 0) {
+        FrameHeader *h = header();
+        h->magic = PROTOCOL_MAGIC;
+        h->version = PROTOCOL_VERSION;
+        h->type = Record::TYPE;
+        h->length = sizeof(FrameHeader);
+        h->count = 0;
+        h->record_size = sizeof(Record);
+        h->seq = seq;
+    }
+
+    // Returns a slot for the next record, to be filled in by the caller, or
+    // nullptr if the frame is full.
+    Record *append() {
+        FrameHeader *h = header();
+        if (h->count == MAX_RECORDS) {
+            return nullptr;
+        }
+        auto *r = reinterpret_cast<Record *>(buf + h->length);
+        *r = Record();
+        h->count++;
+        h->length += sizeof(Record);
+        return r;
+    }
+
+    size_t count() const { return header()->count; }
+    bool empty() const { return count() == 0; }
+    bool full() const { return count() == MAX_RECORDS; }
+
+    char *data() { return buf; }
+    const char *data() const { return buf; }
+    size_t size() const { return header()->length; }
+
+private:
+    alignas(8) char buf[MAX_FRAME_SIZE];
+
+    FrameHeader *header() { return reinterpret_cast<FrameHeader *>(buf); }
+    const FrameHeader *header() const {
+        return reinterpret_cast<const FrameHeader *>(buf);
+    }
+};
+
+// Returns a frame with no records, e.g. DetermineScheduler.
+inline FrameHeader empty_frame(MessageType type, uint32_t seq = 0) {
+    FrameHeader h;
+    h.magic = PROTOCOL_MAGIC;
+    h.version = PROTOCOL_VERSION;
+    h.type = type;
+    h.length = sizeof(FrameHeader);
+    h.count = 0;
+    h.record_size = 0;
+    h.seq = seq;
+    return h;
+}
+
+// For a stream of frames: returns the length of the frame at the start of
+// `buf`, or 0 if the `len` bytes we have don't cover its header yet. Sets
+// `error` if the header's length can't be right, after which the stream is
+// lost.
+inline size_t frame_length(const char *buf, size_t len, const char **error) {
+    *error = nullptr;
+    if (len < sizeof(FrameHeader)) {
+        return 0;
+    }
+    auto *h = reinterpret_cast<const FrameHeader *>(buf);
+    if (h->length < sizeof(FrameHeader) || h->length > MAX_FRAME_SIZE) {
+        *error = "bad frame length";
+        return 0;
+    }
+    return h->length;
+}
 
-        memset(&serverAddr, 0, sizeof(serverAddr));
-        serverAddr.sin_family = AF_INET;
-        serverAddr.sin_port = htons(orca::PORT);
-        struct hostent *sp = gethostbyname("localhost");
-        memcpy(&serverAddr.sin_addr, sp->h_addr_list[0], sp->h_length);
+// Receives one frame from a TCP connection into `buf`, which must be
+// MAX_FRAME_SIZE bytes. Returns false if the peer closed the connection or
+// sent something that isn't a frame; `error` says which.
+inline bool recv_frame(int fd, char *buf, FrameView *frame,
+                       const char **error) {
+    ssize_t got = recv(fd, buf, sizeof(FrameHeader), MSG_WAITALL);
+    if (got != sizeof(FrameHeader)) {
+        *error = got == 0 ? "connection closed" : "short frame header";
+        return false;
+    }
+    size_t length = frame_length(buf, got, error);
+    if (*error) {
+        return false;
+    }
+    size_t rest = length - sizeof(FrameHeader);
+    if (rest && recv(fd, buf + sizeof(FrameHeader), rest, MSG_WAITALL) !=
+                    (ssize_t)rest) {
+        *error = "truncated frame";
+        return false;
+    }
+    *error = frame->parse(buf, length);
+    return *error == nullptr;
+}
+
+// Opens a UDP socket to Orca on localhost and fills in `addr`.
+inline int udp_socket_to_orca(struct sockaddr_in *addr) {
+    int sockfd = socket(AF_INET, SOCK_DGRAM, 0);
+    if (sockfd == -1) {
+        panic("error with socket");
     }
 
-    ~OrcaUDPClient() { close(sockfd); }
+    memset(addr, 0, sizeof(*addr));
+    addr->sin_family = AF_INET;
+    addr->sin_port = htons(orca::PORT);
+    struct hostent *sp = gethostbyname("localhost");
+    memcpy(&addr->sin_addr, sp->h_addr_list[0], sp->h_length);
+    return sockfd;
+}
 
-    // Send bytes to Orca.
-    void send_bytes(const char *buf, size_t len) {
-        sendto(sockfd, buf, len, 0, (sockaddr *)&serverAddr,
-               sizeof(serverAddr));
+// Batches records of one type into datagrams to Orca. A datagram goes out
+// once it is full, or on the first append() after it has waited for
+// `max_delay`, or on flush(). Not thread-safe: give each thread its own.
+template <typename Record> class OrcaUDPBatcher {
+public:
+    explicit OrcaUDPBatcher(
+        std::chrono::microseconds max_delay = std::chrono::milliseconds(1))
+        : max_delay(max_delay) {
+        sockfd = udp_socket_to_orca(&serverAddr);
+    }
+
+    ~OrcaUDPBatcher() {
+        flush();
+        close(sockfd);
+    }
+
+    // Returns a slot for the next record, to be filled in before the next
+    // call.
+    Record *append() {
+        auto now = std::chrono::steady_clock::now();
+        if (frame.full() || (!frame.empty() && now - oldest >= max_delay)) {
+            flush();
+        }
+        if (frame.empty()) {
+            oldest = now;
+        }
+        return frame.append();
+    }
+
+    // Sends the records we have.
+    void flush() {
+        if (frame.empty()) {
+            return;
+        }
+        sendto(sockfd, frame.data(), frame.size(), 0,
+               (sockaddr *)&serverAddr, sizeof(serverAddr));
+        frame.reset();
     }
 
 private:
     int sockfd;
     struct sockaddr_in serverAddr;
+    const std::chrono::microseconds max_delay;
+    std::chrono::steady_clock::time_point oldest;
+    FrameWriter<Record> frame;
+};
+
+// A persistent TCP connection to Orca for requests that Orca acks.
+class OrcaTCPClient {
+public:
+    explicit OrcaTCPClient(int port = PORT) : port(port) {}
+
+    ~OrcaTCPClient() { disconnect(); }
+
+    // Sends a frame of `len` bytes at `buf`, whose seq we overwrite, and waits
+    // for its single-record reply, an AckRecord for most requests. Connects on
+    // first use. Returns false if there is no reply.
+    //
+    // If Orca closed the connection in the meantime, we reconnect and try
+    // once more, but only when that cannot apply a request twice: either the
+    // send failed before any of the frame went out, or the request is
+    // idempotent. Once SetScheduler or DetermineScheduler has gone out,
+    // Orca may have acted on it even if the ack never came back.
+    template <typename Reply = AckRecord>
+    bool request(char *buf, size_t len, Reply *reply) {
+        auto *header = reinterpret_cast<FrameHeader *>(buf);
+        for (int attempt = 0; attempt < 2; ++attempt) {
+            if (sockfd == -1) {
+                connect_to_orca();
+            }
+            header->seq = ++seq;
+            ssize_t sent = send(sockfd, buf, len, MSG_NOSIGNAL);
+            if (sent == (ssize_t)len && wait_for_reply(reply)) {
+                return true;
+            }
+            disconnect();
+            if (sent > 0 && !idempotent(header->type)) {
+                return false;
+            }
+        }
+        return false;
+    }
+
+private:
+    int port;
+    int sockfd = -1;
+    uint32_t seq = 0;
+
+    void connect_to_orca() {
+        sockfd = socket(AF_INET, SOCK_STREAM, IPPROTO_IP);
+        if (sockfd == -1) {
+            panic("tcp socket");
+        }
+
+        struct sockaddr_in addr;
+        memset(&addr, 0, sizeof(addr));
+        addr.sin_family = AF_INET;
+
+        // resolve host
+        struct hostent *host = gethostbyname("localhost");
+        if (host == NULL) {
+            panic("gethostbyname");
+        }
+        memcpy(&addr.sin_addr, host->h_addr_list[0], host->h_length);
+        addr.sin_port = htons(port);
+
+        if (connect(sockfd, (struct sockaddr *)&addr, sizeof(addr)) == -1) {
+            panic("connect");
+        }
+    }
+
+    void disconnect() {
+        if (sockfd != -1) {
+            close(sockfd);
+            sockfd = -1;
+        }
+    }
+
+    // Requests that Orca may safely handle twice.
+    static bool idempotent(MessageType type) {
+        return type == MessageType::GetStats;
+    }
+
+    // Skips replies to earlier requests, e.g. ones we gave up on.
+    template <typename Reply> bool wait_for_reply(Reply *reply) {
+        alignas(8) char buf[MAX_FRAME_SIZE];
+        FrameView frame;
+        const char *error;
+        while (recv_frame(sockfd, buf, &frame, &error)) {
+            if (frame.seq() != seq) {
+                continue;
+            }
+            if (frame.type() != Reply::TYPE || frame.count() != 1) {
+                printf("unexpected reply type %d\n", (int)frame.type());
+                return false;
+            }
+            *reply = frame.record<Reply>(0);
+            return true;
+        }
+        printf("no reply: %s\n", error);
+        return false;
+    }
 };
 
-} // namespace orca
\ No newline at end of file
+} // namespace orca
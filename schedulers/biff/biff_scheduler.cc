@@ -6,12 +6,42 @@
 
 #include "schedulers/biff/biff_scheduler.h"
 
+#include <algorithm>
+#include <atomic>
+
+#include "absl/container/flat_hash_map.h"
 #include "absl/strings/str_format.h"
 #include "third_party/bpf/topology.bpf.h"
 #include "bpf/user/agent.h"
 
 namespace ghost {
 
+namespace {
+
+// Numbers the last-level cache domains of `cpus` densely from 0. CPUs without
+// an L3 cache use their NUMA node as their domain.
+//
+// Sets `rodata->cpu_to_llc` to 1 + the domain of each cpu in `cpus` (and 0 for
+// the others) and `rodata->nr_llcs`, the way biff.bpf.c expects them. Folds
+// domains beyond BIFF_MAX_LLCS onto the earlier ones.
+//
+// `rodata` is the rodata of the BPF skeleton, before loading.
+template <typename Rodata>
+void SetBpfLlcVars(Rodata* rodata, const CpuList& cpus) {
+  // Keyed by the first cpu of the L3, or by -1 - node if there is no L3.
+  absl::flat_hash_map<int, uint32_t> llcs;
+  for (const Cpu& cpu : cpus) {
+    int key = cpu.l3_siblings().Empty() ? -1 - cpu.numa_node()
+                                        : cpu.l3_siblings().Front().id();
+    auto it = llcs.try_emplace(key, llcs.size()).first;
+    CHECK_LT(cpu.id(), BIFF_MAX_CPUS);
+    rodata->cpu_to_llc[cpu.id()] = 1 + it->second % BIFF_MAX_LLCS;
+  }
+  rodata->nr_llcs = std::clamp<uint32_t>(llcs.size(), 1, BIFF_MAX_LLCS);
+}
+
+}  // namespace
+
 BiffScheduler::BiffScheduler(Enclave* enclave, CpuList cpulist,
                              const AgentConfig& config)
     : Scheduler(enclave, std::move(cpulist)),
@@ -29,6 +59,7 @@ BiffScheduler::BiffScheduler(Enclave* enclave, CpuList cpulist,
 
   bpf_obj_->rodata->enable_bpf_printd = CapHas(CAP_PERFMON);
   SetBpfTopologyVars(bpf_obj_->rodata, MachineTopology());
+  SetBpfLlcVars(bpf_obj_->rodata, cpus());
 
   CHECK_EQ(biff_bpf__load(bpf_obj_), 0);
 
@@ -49,6 +80,9 @@ BiffScheduler::BiffScheduler(Enclave* enclave, CpuList cpulist,
 }
 
 BiffScheduler::~BiffScheduler() {
+  // Stop reinjecting and sampling before the maps go away.
+  rescue_channel_.reset();
+  telemetry_.reset();
   bpf_map__munmap(bpf_obj_->maps.cpu_data, bpf_cpu_data_);
   bpf_map__munmap(bpf_obj_->maps.sw_data, bpf_sw_data_);
   biff_bpf__destroy(bpf_obj_);
@@ -58,6 +92,52 @@ void BiffScheduler::EnclaveReady() {
   enclave()->SetDeliverTicks(true);
   enclave()->SetDeliverCpuAvailability(true);
   WRITE_ONCE(bpf_obj_->bss->initialized, true);
+
+  rescue_channel_ = std::make_unique<BpfRescueChannel>(
+      bpf_map__fd(bpf_obj_->maps.rescue_ring), BPF_RESCUE_RING_SIZE,
+      [this](const bpf_rescue_msg& msg) { return ReinjectTask(msg); });
+  telemetry_ = std::make_unique<BpfTelemetry>(
+      BIFF_MAX_GTIDS,
+      [this](BpfTelemetrySampler& sampler) { SampleTelemetry(sampler); });
+}
+
+bool BiffScheduler::ReinjectTask(const bpf_rescue_msg& msg) {
+  // Count the task before bpf can pop it; see rescue_pop().
+  std::atomic_ref<uint64_t> nr_queued(bpf_obj_->bss->rescue_stats.nr_queued);
+  nr_queued.fetch_add(1);
+  // Fails with E2BIG if the queue is full, in which case we retry later.
+  if (bpf_map_update_elem(bpf_map__fd(bpf_obj_->maps.rescue_rq), nullptr,
+                          &msg, BPF_ANY)) {
+    nr_queued.fetch_sub(1);
+    return false;
+  }
+  return true;
+}
+
+void BiffScheduler::SampleTelemetry(BpfTelemetrySampler& sampler) const {
+  for (const Cpu& cpu : cpus()) {
+    sampler.SampleCpu(cpu.id(),
+                      READ_ONCE(bpf_cpu_data_[cpu.id()].current) != 0);
+  }
+  // sw_data is indexed like the status words, so only the slots of live tasks
+  // are worth reading.
+  enclave()->GetStatusWordTable()->ForEachTaskStatusWord(
+      [this, &sampler](ghost_status_word* sw, uint32_t region_id,
+                       uint32_t idx) {
+        if (idx >= BIFF_MAX_GTIDS) return;
+        const struct biff_bpf_sw_data& swd = bpf_sw_data_[idx];
+        sampler.SampleTask(idx, READ_ONCE(swd.ran_at),
+                           READ_ONCE(swd.runnable_at));
+      });
+}
+
+BpfRescueReport BiffScheduler::GetRescueReport() const {
+  BpfRescueReport report;
+  report.bpf = bpf_obj_->bss->rescue_stats;
+  if (rescue_channel_) {
+    report.agent = rescue_channel_->stats();
+  }
+  return report;
 }
 
 void BiffScheduler::DiscoverTasks() {
@@ -12,11 +12,19 @@
 
 #include "third_party/bpf/biff_bpf.h"
 #include "lib/agent.h"
+#include "lib/bpf_rescue.h"
+#include "lib/bpf_telemetry.h"
 #include "lib/scheduler.h"
 #include "schedulers/biff/biff_bpf.skel.h"
 
 namespace ghost {
 
+// RPC request numbers for `FullBiffAgent::RpcHandler`.
+enum BiffRpc : int64_t {
+  // Returns a `BpfRescueReport` in the response buffer.
+  kBiffRpcRescueStats = 1,
+};
+
 class BiffScheduler : public Scheduler {
  public:
   explicit BiffScheduler(Enclave* enclave, CpuList cpulist,
@@ -27,11 +35,20 @@ class BiffScheduler : public Scheduler {
   void DiscoverTasks() final;
   Channel& GetDefaultChannel() final { return unused_channel_; };
 
+  BpfRescueReport GetRescueReport() const;
+
  private:
+  // Pushes a task that bpf gave up on to the rescue_rq, for bpf-pnt to run.
+  bool ReinjectTask(const bpf_rescue_msg& msg);
+  // Reads the cpu_data map and the sw_data of live tasks for BpfTelemetry.
+  void SampleTelemetry(BpfTelemetrySampler& sampler) const;
+
   LocalChannel unused_channel_;
   struct biff_bpf* bpf_obj_;
   struct biff_bpf_cpu_data* bpf_cpu_data_;
   struct biff_bpf_sw_data* bpf_sw_data_;
+  std::unique_ptr<BpfRescueChannel> rescue_channel_;
+  std::unique_ptr<BpfTelemetry> telemetry_;
 };
 
 class BiffAgentTask : public LocalAgent {
@@ -70,6 +87,12 @@ class FullBiffAgent : public FullAgent<EnclaveType> {
   void RpcHandler(int64_t req, const AgentRpcArgs& args,
                   AgentRpcResponse& response) override {
     switch (req) {
+      case kBiffRpcRescueStats:
+        response.response_code =
+            response.buffer.Serialize(biff_sched_->GetRescueReport()).ok()
+                ? 0
+                : -EINVAL;
+        return;
       default:
         response.response_code = -1;
         return;
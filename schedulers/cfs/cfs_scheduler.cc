@@ -31,12 +31,15 @@
 #include "lib/logging.h"
 #include "lib/topology.h"
 
-#define DPRINT_CFS(level, message)                               \
-  do {                                                           \
-    if (ABSL_PREDICT_TRUE(verbose() < level)) break;             \
-    absl::FPrintF(stderr, "DCFS: [%.6f] cpu %d: %s\n",           \
-                  absl::ToDoubleSeconds(MonotonicNow() - start), \
-                  sched_getcpu(), message);                      \
+// Trace records carry their own time and cpu, so only the printed messages get
+// them added.
+#define DPRINT_CFS(level, fmt, ...)                                  \
+  do {                                                               \
+    if (ABSL_PREDICT_TRUE(verbose() < level)) break;                 \
+    GHOST_DPRINT_TRACE("DCFS: " fmt, ##__VA_ARGS__);                 \
+    absl::FPrintF(stderr, "DCFS: [%.6f] cpu %d: " fmt "\n",          \
+                  absl::ToDoubleSeconds(MonotonicNow() - start),     \
+                  sched_getcpu(), ##__VA_ARGS__);                    \
   } while (0)
 
 // TODO: Remove this flag after we test idle load balancing
@@ -48,11 +51,11 @@ namespace ghost {
 
 void PrintDebugTaskMessage(std::string message_name, CpuState* cs,
                            CfsTask* task) {
-  DPRINT_CFS(2, absl::StrFormat(
-                    "[%s]: %s with state %s, %scurrent", message_name,
-                    task->gtid.describe(),
-                    absl::FormatStreamed(task->task_state),
-                    (cs && cs->current == task) ? "" : "!"));
+  DPRINT_CFS(2, "[%s]: %s with state (%s, %s), %scurrent", message_name,
+             task->gtid.describe(),
+             CfsTaskState::StateToString(task->task_state.GetState()),
+             CfsTaskState::OnRqToString(task->task_state.GetOnRq()),
+             (cs && cs->current == task) ? "" : "!");
 }
 
 CfsScheduler::CfsScheduler(Enclave* enclave, CpuList cpulist,
@@ -60,6 +63,7 @@ CfsScheduler::CfsScheduler(Enclave* enclave, CpuList cpulist,
                            absl::Duration min_granularity,
                            absl::Duration latency)
     : BasicDispatchScheduler(enclave, std::move(cpulist), std::move(allocator)),
+      idle_cpus_(*topology()),
       min_granularity_(min_granularity),
       latency_(latency),
       idle_load_balancing_(
@@ -74,6 +78,7 @@ CfsScheduler::CfsScheduler(Enclave* enclave, CpuList cpulist,
       absl::MutexLock l(&cs->run_queue.mu_);
       cs->run_queue.SetMinGranularity(min_granularity_);
       cs->run_queue.SetLatency(latency_);
+      cs->run_queue.TrackIdle(&idle_cpus_, cpu);
     }
 
     cs->channel = enclave->MakeChannel(GHOST_MAX_QUEUE_ELEMS, cpu.numa_node(),
@@ -156,6 +161,9 @@ void CfsScheduler::EnclaveReady() {
 // - Otherwise, check if our prev_cpu is idle.
 // - Otherwise, try to find an idle CPU in the L3 sibiling list of our prev_cpu
 // - Otherwise, just use the least utilized CPU
+// Idle CPUs are found through `idle_cpus_`, which rqs keep up to date as they
+// become empty and non-empty, so finding one does not take every rq's lock.
+// Only when there is no idle CPU do we scan the rqs for the least utilized.
 // In general, there are many, many, many heuristic in kernel CFS, so I tried to
 // just grab the general idea and translate it to ghost code. In the future, we
 // will probably end up tweaking this code.
@@ -180,8 +188,8 @@ Cpu CfsScheduler::SelectTaskRq(CfsTask* task) {
   CpuList eligible_cpus = cpus();
   eligible_cpus.Intersection(task->cpu_affinity);
   if (eligible_cpus.Empty()) {
-    DPRINT_CFS(3, absl::StrFormat("[%s]: No CPUs eligible for this task.",
-                                  task->gtid.describe()));
+    DPRINT_CFS(3, "[%s]: No CPUs eligible for this task.",
+               task->gtid.describe());
   }
 
   // Updates the min cpu load variables and returns true if empty.
@@ -197,6 +205,14 @@ Cpu CfsScheduler::SelectTaskRq(CfsTask* task) {
     return false;
   };
 
+  // Returns true if `cpu`, which `idle_cpus_` reported idle, still is. The
+  // index is only a hint, since its rq may have changed since.
+  auto still_idle = [this, &update_min](const Cpu& cpu) {
+    CpuState* cs = cpu_state(cpu);
+    absl::MutexLock l(&cs->run_queue.mu_);
+    return update_min(cs->run_queue.Size(), cpu);
+  };
+
   // Check if this cpu is empty.
   // NOTE: placing on this cpu is safe as it is in cpus() by virtue of
   // us recieving a message on its queue
@@ -223,21 +239,40 @@ Cpu CfsScheduler::SelectTaskRq(CfsTask* task) {
       }
     }
 
-    // Check if we can find an idle l3 sibling.
-    for (const Cpu& cpu : prev_cpu.l3_siblings()) {
-      // We can't schedule on this cpu.
-      if (!cpus().IsSet(cpu)) continue;
-      cs = cpu_state(cpu);
-      {
-        absl::MutexLock l(&cs->run_queue.mu_);
-        if (update_min(cs->run_queue.Size(), cpu)) {
-          return cpu;
+    // Find the idle cpu nearest to prev cpu, so that the task keeps as much of
+    // its cache footprint as it can.
+    if (const Cpu idle_cpu =
+            idle_cpus_.FindNearestIdle(prev_cpu, eligible_cpus);
+        idle_cpu.valid() && still_idle(idle_cpu)) {
+      return idle_cpu;
+    }
+
+    // Otherwise, search outward from prev cpu for an idle cpu that the index
+    // missed, nearest cpus first, noting the least loaded cpu as we go. This
+    // visits every other cpu, so there is nothing left to check afterwards.
+    for (TopologyLevel level : kTopologyLevels) {
+      for (const Cpu& cpu : prev_cpu.cpus_at_distance(level)) {
+        // We can't schedule on this cpu.
+        if (!cpus().IsSet(cpu)) continue;
+        cs = cpu_state(cpu);
+        {
+          absl::MutexLock l(&cs->run_queue.mu_);
+          if (update_min(cs->run_queue.Size(), cpu)) {
+            return cpu;
+          }
         }
       }
     }
+
+    // We couldn't find an idle cpu, so just use the least loaded one.
+    return min_load_cpu;
   }
 
   // Check if we can find any idle cpu.
+  if (const Cpu idle_cpu = idle_cpus_.FindIdle(eligible_cpus);
+      idle_cpu.valid() && still_idle(idle_cpu)) {
+    return idle_cpu;
+  }
   for (const Cpu& cpu : cpus()) {
     cs = cpu_state(cpu);
     {
@@ -369,9 +404,8 @@ void CfsScheduler::TaskNew(CfsTask* task, const Message& msg) {
     // (ii) another task moves the task out of ghOSt via `sched_setscheduler`,
     // (iii) the task dies and then (iv) this agent handles the TASK_NEW
     // message.
-    DPRINT_CFS(3, absl::StrFormat(
-                      "[%s]: Cannot retrieve the CPU mask. Returned errno: %d.",
-                      task->gtid.describe(), errno));
+    DPRINT_CFS(3, "[%s]: Cannot retrieve the CPU mask. Returned errno: %d.",
+               task->gtid.describe(), errno);
     // Fall back to having all the CPUs eligible.
     cpu_affinity = cpus();
   }
@@ -451,10 +485,8 @@ void CfsScheduler::HandleTaskDone(CfsTask* task, bool from_switchto)
   } else {
     // Our assertion in ->task_state.Set(), should keep this from every
     // happening.
-    DPRINT_CFS(1,
-               absl::StrFormat(
-                   "TaskDeparted/Dead cases were not exhaustive, got %s",
-                   absl::FormatStreamed(CfsTaskState::State(prev_state))));
+    DPRINT_CFS(1, "TaskDeparted/Dead cases were not exhaustive, got %s",
+               CfsTaskState::StateToString(CfsTaskState::State(prev_state)));
   }
 }
 
@@ -778,8 +810,7 @@ void CfsScheduler::CfsSchedule(const Cpu& cpu, BarrierToken agent_barrier,
   cs->current = next;
 
   if (next) {
-    DPRINT_CFS(2, absl::StrFormat("[%s]: Picked via PickNextTask",
-                                  next->gtid.describe()));
+    DPRINT_CFS(2, "[%s]: Picked via PickNextTask", next->gtid.describe());
 
     req->Open({
         .target = next->gtid,
@@ -877,8 +908,8 @@ void CfsScheduler::TaskAffinityChanged(CfsTask* task, const Message& msg)
 
   CpuList cpu_affinity = MachineTopology()->EmptyCpuList();
   if (GhostHelper()->SchedGetAffinity(task->gtid, cpu_affinity) != 0) {
-    DPRINT_CFS(3, absl::StrFormat("[%s]: Cannot retrieve the CPU mask.",
-      task->gtid.describe()));
+    DPRINT_CFS(3, "[%s]: Cannot retrieve the CPU mask.",
+               task->gtid.describe());
     cpu_affinity = cpus();
   }
 
@@ -926,28 +957,23 @@ void CfsTaskState::AssertValidTransition(State next) {
 
   // Check if next is actually a valid state to come from.
   if ((valid_states & (1 << static_cast<uint32_t>(curr))) == 0) {
-    DPRINT_CFS(1, absl::StrFormat("[%s]: Cannot go from %s -> %s",
-                                  absl::FormatStreamed(task_name_),
-                                  absl::FormatStreamed(curr),
-                                  absl::FormatStreamed(next)));
-    DPRINT_CFS(1, absl::StrFormat("[%s]: Valid transitions -> %s are:",
-                                  absl::FormatStreamed(task_name_),
-                                  absl::FormatStreamed(next)));
+    DPRINT_CFS(1, "[%s]: Cannot go from %s -> %s", task_name_,
+               StateToString(curr), StateToString(next));
+    DPRINT_CFS(1, "[%s]: Valid transitions -> %s are:", task_name_,
+               StateToString(next));
 
     // Extract all the valid from states.
     for (uint32_t i = 0;
          i < static_cast<uint32_t>(CfsTaskState::State::kNumStates); ++i) {
       if ((valid_states & (1 << static_cast<uint32_t>(i))) != 0) {
-        DPRINT_CFS(1, absl::StrFormat("%s", absl::FormatStreamed(
-            CfsTaskState::State(i))));
+        DPRINT_CFS(1, "%s", StateToString(CfsTaskState::State(i)));
       }
     }
 
-    DPRINT_CFS(1, absl::StrFormat("[%s]: State trace:", task_name_));
+    DPRINT_CFS(1, "[%s]: State trace:", task_name_);
     state_trace_.ForEach([this] (const FullState& s) {
-      DPRINT_CFS(1, absl::StrFormat("[%s]: (%s, %s)", task_name_,
-                                    absl::FormatStreamed(s.state),
-                                    absl::FormatStreamed(s.on_rq)));
+      DPRINT_CFS(1, "[%s]: (%s, %s)", task_name_, StateToString(s.state),
+                 OnRqToString(s.on_rq));
     });
 
     // We want to crash since we tranisitioned to an invalid state.
@@ -961,30 +987,24 @@ void CfsTaskState::AssertValidTransition(OnRq next) {
 
   // Check if next is actually a valid state to come from.
   if ((valid_states & (1 << static_cast<uint32_t>(curr))) == 0) {
-    DPRINT_CFS(1, absl::StrFormat("[%s]: Cannot go from %s -> %s",
-                                  absl::FormatStreamed(task_name_),
-                                  absl::FormatStreamed(curr),
-                                  absl::FormatStreamed(next)));
-    DPRINT_CFS(1, absl::StrFormat("[%s]: Valid transitions -> %s are:",
-                                  absl::FormatStreamed(task_name_),
-                                  absl::FormatStreamed(next)));
+    DPRINT_CFS(1, "[%s]: Cannot go from %s -> %s", task_name_,
+               OnRqToString(curr), OnRqToString(next));
+    DPRINT_CFS(1, "[%s]: Valid transitions -> %s are:", task_name_,
+               OnRqToString(next));
 
     // Extract all the valid from states.
     for (uint32_t i = 0;
          i < static_cast<uint32_t>(CfsTaskState::OnRq::kNumStates);
          ++i) {
       if ((valid_states & (1 << static_cast<uint32_t>(i))) != 0) {
-        DPRINT_CFS(
-            1, absl::StrFormat(
-                "%s", absl::FormatStreamed(CfsTaskState::OnRq(i))));
+        DPRINT_CFS(1, "%s", OnRqToString(CfsTaskState::OnRq(i)));
       }
     }
 
-    DPRINT_CFS(1, absl::StrFormat("[%s]: State trace:", task_name_));
+    DPRINT_CFS(1, "[%s]: State trace:", task_name_);
     state_trace_.ForEach([this] (const FullState& s) {
-      DPRINT_CFS(1, absl::StrFormat("[%s]: (%s, %s)", task_name_,
-                                    absl::FormatStreamed(s.state),
-                                    absl::FormatStreamed(s.on_rq)));
+      DPRINT_CFS(1, "[%s]: (%s, %s)", task_name_, StateToString(s.state),
+                 OnRqToString(s.on_rq));
     });
 
     // We want to crash since we tranisitioned to an invalid state.
@@ -999,7 +1019,7 @@ CfsRq::CfsRq() : min_vruntime_(absl::ZeroDuration()), rq_(&CfsTask::Less) {}
 void CfsRq::EnqueueTask(CfsTask* task) {
   CHECK_GE(task->cpu, 0);
 
-  DPRINT_CFS(2, absl::StrFormat("[%s]: Enqueing task", task->gtid.describe()));
+  DPRINT_CFS(2, "[%s]: Enqueing task", task->gtid.describe());
 
   // We never want to enqueue a new task with a smaller vruntime that we have
   // currently. We also never want to have a task's vruntime go backwards,
@@ -1015,8 +1035,7 @@ void CfsRq::EnqueueTask(CfsTask* task) {
 void CfsRq::PutPrevTask(CfsTask* task) ABSL_EXCLUSIVE_LOCKS_REQUIRED(mu_) {
   CHECK_GE(task->cpu, 0);
 
-  DPRINT_CFS(2,
-             absl::StrFormat("[%s]: Putting prev task", task->gtid.describe()));
+  DPRINT_CFS(2, "[%s]: Putting prev task", task->gtid.describe());
 
   InsertTaskIntoRq(task);
 }
@@ -1080,10 +1099,10 @@ CfsTask* CfsRq::PickNextTask(CfsTask* prev, TaskAllocator<CfsTask>* allocator,
 }
 
 void CfsRq::DequeueTask(CfsTask* task) ABSL_EXCLUSIVE_LOCKS_REQUIRED(mu_) {
-  DPRINT_CFS(2, absl::StrFormat("[%s]: Erasing task", task->gtid.describe()));
+  DPRINT_CFS(2, "[%s]: Erasing task", task->gtid.describe());
   if (rq_.erase(task)) {
     task->task_state.SetOnRq(CfsTaskState::OnRq::kDequeued);
-    rq_size_.store(rq_.size(), std::memory_order_relaxed);
+    UpdateSize(rq_.size() + 1);
     return;
   }
 
@@ -1092,9 +1111,8 @@ void CfsRq::DequeueTask(CfsTask* task) ABSL_EXCLUSIVE_LOCKS_REQUIRED(mu_) {
   // TaskDeparted message. In reality, this is harmless as adding a check for
   // is my task in the rq currently would be equivalent.
   // DPRINT_CFS(
-  //     1, absl::StrFormat(
-  //            "[%s] Attempted to remove task with state %d while not in rq",
-  //            task->gtid.describe(), task->task_state.Get()));
+  //     1, "[%s] Attempted to remove task with state %d while not in rq",
+  //     task->gtid.describe(), task->task_state.Get());
   // CHECK(false);
 }
 
@@ -1158,11 +1176,34 @@ absl::Duration CfsRq::MinPreemptionGranularity() {
 
 void CfsRq::InsertTaskIntoRq(CfsTask* task) ABSL_EXCLUSIVE_LOCKS_REQUIRED(mu_) {
   task->task_state.SetOnRq(CfsTaskState::OnRq::kQueued);
+  const size_t old_size = rq_.size();
   rq_.insert(task);
-  rq_size_.store(rq_.size(), std::memory_order_relaxed);
+  UpdateSize(old_size);
   min_vruntime_ = (*rq_.begin())->vruntime;
-  DPRINT_CFS(2, absl::StrFormat("[%s]: Inserted into run queue",
-                                task->gtid.describe()));
+  DPRINT_CFS(2, "[%s]: Inserted into run queue", task->gtid.describe());
+}
+
+void CfsRq::UpdateSize(size_t old_size) ABSL_EXCLUSIVE_LOCKS_REQUIRED(mu_) {
+  const size_t size = rq_.size();
+  rq_size_.store(size, std::memory_order_relaxed);
+  if (idle_cpus_ && (old_size == 0) != (size == 0)) {
+    if (size == 0) {
+      idle_cpus_->SetIdle(cpu_);
+    } else {
+      idle_cpus_->SetBusy(cpu_);
+    }
+  }
+}
+
+void CfsRq::TrackIdle(IdleCpuIndex* idle_cpus, const Cpu& cpu)
+    ABSL_EXCLUSIVE_LOCKS_REQUIRED(mu_) {
+  idle_cpus_ = idle_cpus;
+  cpu_ = cpu;
+  if (rq_.empty()) {
+    idle_cpus_->SetIdle(cpu_);
+  } else {
+    idle_cpus_->SetBusy(cpu_);
+  }
 }
 
 void CfsRq::AttachTasks(const std::vector<CfsTask*>& tasks)
@@ -1190,7 +1231,7 @@ int CfsRq::DetachTasks(const CpuState* dst_cs, int n,
       task->cpu = dst_cs->id;
       task->task_state.SetOnRq(CfsTaskState::OnRq::kDequeued);
       it = rq_.erase(it);
-      rq_size_.store(rq_.size(), std::memory_order_relaxed);
+      UpdateSize(rq_.size() + 1);
     } else {
       it++;
     }
@@ -1252,32 +1293,44 @@ void CfsAgent::AgentThread() {
   }
 }
 
-std::ostream& operator<<(std::ostream& os, CfsTaskState::State state) {
+// static
+absl::string_view CfsTaskState::StateToString(State state) {
   switch (state) {
-    case CfsTaskState::State::kBlocked:
-      return os << "kBlocked";
-    case CfsTaskState::State::kDone:
-      return os << "kDone";
-    case CfsTaskState::State::kRunning:
-      return os << "kRunning";
-    case CfsTaskState::State::kRunnable:
-      return os << "kRunnable";
-    case CfsTaskState::State::kNumStates:
-      return os << "SENTINEL";
+    case State::kBlocked:
+      return "kBlocked";
+    case State::kDone:
+      return "kDone";
+    case State::kRunning:
+      return "kRunning";
+    case State::kRunnable:
+      return "kRunnable";
+    case State::kNumStates:
+      return "SENTINEL";
   }
+  return "UNKNOWN";
 }
 
-std::ostream& operator<<(std::ostream& os, CfsTaskState::OnRq state) {
-  switch (state) {
-    case CfsTaskState::OnRq::kDequeued:
-      return os << "kDequeued";
-    case CfsTaskState::OnRq::kQueued:
-      return os << "kQueued";
-    case CfsTaskState::OnRq::kMigrating:
-      return os << "kMigrating";
-    case CfsTaskState::OnRq::kNumStates:
-      return os << "SENTINEL";
+// static
+absl::string_view CfsTaskState::OnRqToString(OnRq on_rq) {
+  switch (on_rq) {
+    case OnRq::kDequeued:
+      return "kDequeued";
+    case OnRq::kQueued:
+      return "kQueued";
+    case OnRq::kMigrating:
+      return "kMigrating";
+    case OnRq::kNumStates:
+      return "SENTINEL";
   }
+  return "UNKNOWN";
+}
+
+std::ostream& operator<<(std::ostream& os, CfsTaskState::State state) {
+  return os << CfsTaskState::StateToString(state);
+}
+
+std::ostream& operator<<(std::ostream& os, CfsTaskState::OnRq state) {
+  return os << CfsTaskState::OnRqToString(state);
 }
 
 std::ostream& operator<<(std::ostream& os, const CfsTaskState& state) {
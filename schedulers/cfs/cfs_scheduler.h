@@ -17,11 +17,13 @@
 #include "absl/container/flat_hash_map.h"
 #include "absl/functional/any_invocable.h"
 #include "absl/strings/str_format.h"
+#include "absl/strings/string_view.h"
 #include "absl/synchronization/mutex.h"
 #include "absl/time/clock.h"
 #include "absl/time/time.h"
 #include "lib/agent.h"
 #include "lib/base.h"
+#include "lib/idle_cpu_index.h"
 #include "lib/scheduler.h"
 
 static const absl::Time start = absl::Now();
@@ -59,6 +61,10 @@ class CfsTaskState {
   static_assert(static_cast<uint32_t>(OnRq::kNumStates) <=
                 sizeof(uint64_t) * CHAR_BIT);
 
+  // Names for DPRINT_CFS, which takes strings rather than streamed values.
+  static absl::string_view StateToString(State state);
+  static absl::string_view OnRqToString(OnRq on_rq);
+
   explicit CfsTaskState(State state)
       : CfsTaskState(state, OnRq::kMigrating, "") {}
   explicit CfsTaskState(State state, absl::string_view task_name)
@@ -329,6 +335,11 @@ class CfsRq {
 
   bool IsEmpty() const ABSL_EXCLUSIVE_LOCKS_REQUIRED(mu_) { return rq_.empty(); }
 
+  // Marks `cpu` idle in `idle_cpus` whenever this run queue is empty and busy
+  // otherwise, starting now.
+  void TrackIdle(IdleCpuIndex* idle_cpus, const Cpu& cpu)
+      ABSL_EXCLUSIVE_LOCKS_REQUIRED(mu_);
+
   // Needs to be called everytime we touch the rq or update a current task's
   // vruntime.
   void UpdateMinVruntime(CpuState* cs) ABSL_EXCLUSIVE_LOCKS_REQUIRED(mu_);
@@ -341,6 +352,11 @@ class CfsRq {
   // Preconditons: task->vruntime has been set to a logical value.
   void InsertTaskIntoRq(CfsTask* task) ABSL_EXCLUSIVE_LOCKS_REQUIRED(mu_);
 
+  // Needs to be called everytime a task is added to or removed from `rq_`.
+  // Updates `rq_size_` and, when the rq becomes empty or stops being empty,
+  // `idle_cpus_`.
+  void UpdateSize(size_t old_size) ABSL_EXCLUSIVE_LOCKS_REQUIRED(mu_);
+
   absl::Duration min_vruntime_ ABSL_GUARDED_BY(mu_);
 
   // Unlike in-kernel CFS, we want to have this properties per run-queue instead
@@ -356,6 +372,11 @@ class CfsRq {
   std::set<CfsTask*, decltype(&CfsTask::Less)> rq_ ABSL_GUARDED_BY(mu_);
   // Used for lockless reads of rq size.
   std::atomic<size_t> rq_size_{0};
+
+  // Where this rq's CPU is marked idle while the rq is empty. See
+  // `TrackIdle()`.
+  IdleCpuIndex* idle_cpus_ ABSL_GUARDED_BY(mu_) = nullptr;
+  Cpu cpu_ ABSL_GUARDED_BY(mu_){Cpu::UninitializedType::kUninitialized};
 };
 
 // Migration queue. Neither copyable nor movable.
@@ -636,6 +657,9 @@ class CfsScheduler : public BasicDispatchScheduler<CfsTask> {
   CpuState cpu_states_[MAX_CPUS];
   Channel* default_channel_ = nullptr;
 
+  // The CPUs whose run queues are empty, for `SelectTaskRq`.
+  IdleCpuIndex idle_cpus_;
+
   absl::Duration min_granularity_;
   absl::Duration latency_;
 
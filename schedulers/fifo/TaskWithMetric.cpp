@@ -11,8 +11,10 @@ namespace ghost
     {
         TaskState newState = getStateFromString(_newState);
 
-        absl::Time currentTime = absl::Now();
-        absl::Duration d = currentTime - m.stateStarted;
+        // absl::Now() can take a lock; TscClock ticks are converted only
+        // where they are added up.
+        uint64_t currentTime = TscClock::Now();
+        absl::Duration d = TscClock::ToDuration(currentTime - m.stateStarted);
         switch (m.currentState)
         {
         case TaskState::kBlocked:
@@ -39,7 +41,7 @@ namespace ghost
         m.stateStarted = currentTime;
         if (newState == TaskState::kDied)
         {
-            m.diedAt = currentTime;
+            m.diedAt = TscClock::ToTime(currentTime);
         }
     }
 
@@ -4,6 +4,7 @@
 #include "absl/time/time.h"
 #include "absl/strings/str_format.h"
 #include "lib/scheduler.h"
+#include "lib/tsc_clock.h"
 
 #include <inttypes.h>
 
@@ -50,16 +51,20 @@ namespace ghost
             int64_t preemptCount; // if it's preempted
 
             TaskState currentState;
-            absl::Time stateStarted;
+            // TscClock ticks, since this is updated on every state change.
+            uint64_t stateStarted;
 
             Metric() : blockTime(absl::ZeroDuration()), runnableTime(absl::ZeroDuration()),
                        queuedTime(absl::ZeroDuration()), onCpuTime(absl::ZeroDuration()), yieldingTime(absl::ZeroDuration()),
-                       runtime(absl::ZeroDuration()), elapsedRuntime(absl::ZeroDuration()), preemptCount(0) {}
+                       runtime(absl::ZeroDuration()), elapsedRuntime(absl::ZeroDuration()), preemptCount(0), stateStarted(0) {}
 
-            Metric(Gtid _gtid) : gtid(_gtid), createdAt(absl::Now()), blockTime(absl::ZeroDuration()), runnableTime(absl::ZeroDuration()),
+            Metric(Gtid _gtid) : gtid(_gtid), blockTime(absl::ZeroDuration()), runnableTime(absl::ZeroDuration()),
                                  queuedTime(absl::ZeroDuration()), onCpuTime(absl::ZeroDuration()), yieldingTime(absl::ZeroDuration()),
                                  runtime(absl::ZeroDuration()), elapsedRuntime(absl::ZeroDuration()), diedAt(absl::FromUnixNanos(0)), preemptCount(0),
-                                 currentState(TaskState::kCreated), stateStarted(createdAt) {}
+                                 currentState(TaskState::kCreated), stateStarted(TscClock::Now())
+            {
+                createdAt = TscClock::ToTime(stateStarted);
+            }
 
             void printResult(FILE *to);
             static double stddev(const std::vector<Metric> &v);
@@ -109,6 +109,15 @@ int main(int argc, char* argv[]) {
   // TODO: this is racy - uap could be deleted already
   ghost::GhostSignals::AddHandler(SIGUSR1, [uap](int) {
     uap->Rpc(ghost::FifoScheduler::kDebugRunqueue);
+    ghost::AgentRpcResponse response =
+        uap->RpcWithResponse(ghost::FifoScheduler::kGetPhaseProfile);
+    if (response.response_code == 0) {
+      response.buffer.Deserialize<ghost::PhaseProfile>()->Print(stderr);
+    }
+    response = uap->RpcWithResponse(ghost::FifoScheduler::kGetCommitStats);
+    if (response.response_code == 0) {
+      response.buffer.Deserialize<ghost::FifoCommitStats>()->Print(stderr);
+    }
     return false;
   });
 
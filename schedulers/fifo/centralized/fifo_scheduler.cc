@@ -23,7 +23,8 @@ FifoScheduler::FifoScheduler(Enclave* enclave, CpuList cpulist,
     : BasicDispatchScheduler(enclave, std::move(cpulist), std::move(allocator)),
       global_cpu_(global_cpu),
       global_channel_(GHOST_MAX_QUEUE_ELEMS, /*node=*/0),
-      preemption_time_slice_(preemption_time_slice) {
+      preemption_time_slice_(preemption_time_slice),
+      preemption_ticks_(TscClock::FromDuration(preemption_time_slice)) {
   if (!cpus().IsSet(global_cpu_)) {
     Cpu c = cpus().Front();
     CHECK(c.valid());
@@ -271,11 +272,60 @@ void FifoScheduler::TaskOnCpu(FifoTask* task, const Cpu& cpu) {
   task->prio_boost = false;
 }
 
+void FifoScheduler::OpenRunRequest(FifoTask* task, const Cpu& cpu) {
+  CpuState* cs = cpu_state(cpu);
+
+  if (cs->current) {
+    cs->current->run_state = FifoTask::RunState::kRunnable;
+    cs->current->updateState(FifoTask::RunStateToString(cs->current->run_state));
+    Enqueue(cs->current);
+  }
+  cs->current = task;
+
+  RunRequest* req = enclave()->GetRunRequest(cpu);
+  req->Open({.target = task->gtid,
+             .target_barrier = task->seqnum,
+             // No need to set `agent_barrier` because the agent barrier is
+             // not checked when a global agent is scheduling a CPU other than
+             // the one that the global agent is currently running on.
+             .commit_flags = COMMIT_AT_TXN_COMMIT});
+}
+
+// static
+bool FifoScheduler::RetryCommit(ghost_txn_state state) {
+  switch (state) {
+    // The CPU went to a higher priority sched class (e.g., CFS) after we
+    // picked it. Nothing is wrong with the task.
+    case GHOST_TXN_CPU_UNAVAIL:
+      return true;
+
+    // Failures caused by the task, such as GHOST_TXN_TARGET_STALE, wait for
+    // the next iteration: a stale barrier means the task has messages that we
+    // have not dispatched yet.
+    default:
+      return false;
+  }
+}
+
+void FifoCommitStats::Print(FILE* to) const {
+  fprintf(to, "commit retries: %lu\n", retries);
+  for (int i = 0; i < kNumStates; ++i) {
+    if (states[i]) {
+      fprintf(to, "%-32s %lu\n",
+              RunRequest::StateToString(
+                  static_cast<ghost_txn_state>(GHOST_TXN_COMPLETE + i))
+                  .c_str(),
+              states[i]);
+    }
+  }
+}
+
 void FifoScheduler::GlobalSchedule(const StatusWord& agent_sw,
                                    BarrierToken agent_sw_last) {
   const int global_cpu_id = GetGlobalCPUId();
   CpuList available = topology()->EmptyCpuList();
   CpuList assigned = topology()->EmptyCpuList();
+  uint64_t t = PhaseProfiler::Now();
 
   for (const Cpu& cpu : cpus()) {
     CpuState* cs = cpu_state(cpu);
@@ -289,8 +339,8 @@ void FifoScheduler::GlobalSchedule(const StatusWord& agent_sw,
       // This CPU is running a higher priority sched class, such as CFS.
       continue;
     }
-    if (cs->current &&
-        (MonotonicNow() - cs->last_commit) < preemption_time_slice_) {
+    // `t` is recent enough for a time slice, and saves a clock read per cpu.
+    if (cs->current && (t - cs->last_commit) < preemption_ticks_) {
       // This CPU is currently running a task, so do not schedule a different
       // task on it.
       continue;
@@ -320,51 +370,71 @@ void FifoScheduler::GlobalSchedule(const StatusWord& agent_sw,
     }
 
     // Assign `next` to run on the CPU at the front of `available`.
-    const Cpu& next_cpu = available.Front();
-    CpuState* cs = cpu_state(next_cpu);
-
-    if (cs->current) {
-      cs->current->run_state = FifoTask::RunState::kRunnable;
-      cs->current->updateState(FifoTask::RunStateToString(cs->current->run_state));
-      Enqueue(cs->current);
-    }
-    cs->current = next;
-
+    const Cpu next_cpu = available.Front();
     available.Clear(next_cpu);
     assigned.Set(next_cpu);
-
-    RunRequest* req = enclave()->GetRunRequest(next_cpu);
-    req->Open({.target = next->gtid,
-               .target_barrier = next->seqnum,
-               // No need to set `agent_barrier` because the agent barrier is
-               // not checked when a global agent is scheduling a CPU other than
-               // the one that the global agent is currently running on.
-               .commit_flags = COMMIT_AT_TXN_COMMIT});
+    OpenRunRequest(next, next_cpu);
   }
 
-  // Commit on all CPUs with open transactions.
-  if (!assigned.Empty()) {
+  t = phase_profiler_.Lap(PhaseProfile::kPick, t);
+  // Commit on all CPUs with open transactions. A transaction that fails
+  // because of the CPU rather than the task is retried right away on another
+  // available CPU, instead of an iteration later after we have drained the
+  // channel and scanned all the CPUs again.
+  for (int attempt = 0; !assigned.Empty(); ++attempt) {
     enclave()->CommitRunRequests(assigned);
-    absl::Time now = MonotonicNow();
+    t = phase_profiler_.Lap(PhaseProfile::kCommit, t);
     for (const Cpu& cpu : assigned) {
-      cpu_state(cpu)->last_commit = now;
+      cpu_state(cpu)->last_commit = t;
     }
-  }
-  for (const Cpu& next_cpu : assigned) {
-    CpuState* cs = cpu_state(next_cpu);
-    RunRequest* req = enclave()->GetRunRequest(next_cpu);
-    if (req->succeeded()) {
-      // The transaction succeeded and `next` is running on `next_cpu`.
-      TaskOnCpu(cs->current, next_cpu);
-    } else {
-      GHOST_DPRINT(3, stderr, "FifoSchedule: commit failed (state=%d)",
-                   req->state());
 
-      // The transaction commit failed so push `next` to the front of runqueue.
-      cs->current->prio_boost = true;
-      Enqueue(cs->current);
+    bool failed = false;
+    for (const Cpu& next_cpu : assigned) {
+      CpuState* cs = cpu_state(next_cpu);
+      RunRequest* req = enclave()->GetRunRequest(next_cpu);
+      const ghost_txn_state state = req->state();
+      commit_counters_.Count(state);
+      if (RunRequest::is_succeeded(state)) {
+        // The transaction succeeded and `next` is running on `next_cpu`.
+        TaskOnCpu(cs->current, next_cpu);
+        continue;
+      }
+
+      GHOST_DPRINT(3, stderr, "FifoSchedule: commit failed (state=%s)",
+                   RunRequest::StateToString(state).c_str());
+      failed = true;
+      FifoTask* next = cs->current;
       // The task failed to run on `next_cpu`, so clear out `cs->current`.
       cs->current = nullptr;
+      if (attempt < kMaxCommitRetries && !available.Empty() &&
+          RetryCommit(state)) {
+        retry_tasks_.push_back(next);
+      } else {
+        // Push `next` to the front of runqueue for the next iteration.
+        next->prio_boost = true;
+        Enqueue(next);
+      }
+    }
+
+    assigned = topology()->EmptyCpuList();
+    for (FifoTask* next : retry_tasks_) {
+      if (available.Empty()) {
+        next->prio_boost = true;
+        Enqueue(next);
+        continue;
+      }
+      const Cpu next_cpu = available.Front();
+      available.Clear(next_cpu);
+      assigned.Set(next_cpu);
+      OpenRunRequest(next, next_cpu);
+      commit_counters_.CountRetry();
+    }
+    retry_tasks_.clear();
+
+    if (failed) {
+      // The whole pass over the committed cpus, which is what a failure costs
+      // us.
+      t = phase_profiler_.Lap(PhaseProfile::kCommitFailure, t);
     }
   }
 
@@ -385,48 +455,23 @@ bool FifoScheduler::PickNextGlobalCPU(BarrierToken agent_barrier,
                                       const Cpu& this_cpu) {
   Cpu target(Cpu::UninitializedType::kUninitialized);
   Cpu global_cpu = topology()->cpu(GetGlobalCPUId());
-  int numa_node = global_cpu.numa_node();
 
   // Let's make sure we do some useful work before moving to another CPU.
   if (iterations_ & 0xff) {
     return false;
   }
 
-  for (const Cpu& cpu : global_cpu.siblings()) {
-    if (cpu.id() == global_cpu.id()) continue;
-
-    if (Available(cpu)) {
-      target = cpu;
-      goto found;
-    }
-  }
-
-  for (const Cpu& cpu : global_cpu.l3_siblings()) {
-    if (cpu.id() == global_cpu.id()) continue;
-
-    if (Available(cpu)) {
-      target = cpu;
-      goto found;
-    }
-  }
-
-again:
-  for (const Cpu& cpu : cpus()) {
-    if (cpu.id() == global_cpu.id()) continue;
-
-    if (numa_node >= 0 && cpu.numa_node() != numa_node) continue;
-
-    if (Available(cpu)) {
-      target = cpu;
-      goto found;
+  // Search outward from the global cpu, nearest cpus first, to keep the global
+  // agent close to the caches it has warmed up.
+  for (TopologyLevel level : kTopologyLevels) {
+    for (const Cpu& cpu : global_cpu.cpus_at_distance(level)) {
+      if (Available(cpu)) {
+        target = cpu;
+        goto found;
+      }
     }
   }
 
-  if (numa_node >= 0) {
-    numa_node = -1;
-    goto again;
-  }
-
 found:
   if (!target.valid()) return false;
 
@@ -494,13 +539,19 @@ void FifoAgent::AgentThread() {
         continue;
       }
 
+      PhaseProfiler& profiler = global_scheduler_->phase_profiler();
+      const uint64_t dispatch_start = PhaseProfiler::Now();
       Message msg;
+      uint64_t nr_msgs = 0;
       while (!(msg = global_channel.Peek()).empty()) {
         global_scheduler_->DispatchMessage(msg);
         global_channel.Consume(msg);
+        nr_msgs++;
       }
+      profiler.Lap(PhaseProfile::kDispatch, dispatch_start);
 
       global_scheduler_->GlobalSchedule(status_word(), agent_barrier);
+      profiler.EndIteration(nr_msgs);
 
       if(profile_peroid.Edge()){
         auto res = global_scheduler_->CollectMetric();
@@ -514,6 +565,7 @@ void FifoAgent::AgentThread() {
             if (verbose()) m.printResult(stderr);
             this->orcaMessenger->sendMessageToOrca(m);
           }
+          this->orcaMessenger->flush();
           global_scheduler_->deadTasks.clear();
           global_scheduler_->ClearMetric();
         }
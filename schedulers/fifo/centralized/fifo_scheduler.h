@@ -7,13 +7,16 @@
 #ifndef GHOST_SCHEDULERS_FIFO_CENTRALIZED_FIFO_SCHEDULER_H
 #define GHOST_SCHEDULERS_FIFO_CENTRALIZED_FIFO_SCHEDULER_H
 
+#include <atomic>
 #include <cstdint>
 #include <map>
 #include <memory>
 
 #include "absl/time/time.h"
 #include "lib/agent.h"
+#include "lib/phase_profiler.h"
 #include "lib/scheduler.h"
+#include "lib/tsc_clock.h"
 #include "schedulers/fifo/TaskWithMetric.h"
 #include "schedulers/fifo/orca_messenger.h"
 
@@ -67,6 +70,71 @@ struct FifoTask : public TaskWithMetric {
   bool prio_boost = false;
 };
 
+// How the global agent's transactions turned out, for tuning. Trivially
+// copyable, so that it fits in an RPC response buffer.
+struct FifoCommitStats {
+  // Committed transactions end up in [GHOST_TXN_COMPLETE, GHOST_TXN_POISONED].
+  static constexpr int kNumStates = GHOST_TXN_POISONED - GHOST_TXN_COMPLETE + 1;
+
+  // Transactions reopened on another CPU in the same iteration.
+  uint64_t retries;
+  // Transactions by final state, indexed by `state - GHOST_TXN_COMPLETE`.
+  uint64_t states[kNumStates];
+
+  // Returns the index of `state` in `states`, or -1 for states that a commit
+  // does not end in.
+  static int Index(ghost_txn_state state) {
+    // GHOST_TXN_COMPLETE is INT_MIN, so check the range before subtracting.
+    if (state < GHOST_TXN_COMPLETE || state > GHOST_TXN_POISONED) {
+      return -1;
+    }
+    return state - GHOST_TXN_COMPLETE;
+  }
+
+  // Returns 0 for states that a commit does not end in.
+  uint64_t count(ghost_txn_state state) const {
+    const int i = Index(state);
+    return i < 0 ? 0 : states[i];
+  }
+
+  // Prints the states that occurred, one per line.
+  void Print(FILE* to) const;
+};
+
+// Collects `FifoCommitStats`. Only the global agent counts, so the counters
+// skip the locked adds; any thread may take a snapshot.
+class FifoCommitCounters {
+ public:
+  // Counts a transaction that ended in `state`. Ignores states that a commit
+  // does not end in.
+  void Count(ghost_txn_state state) {
+    const int i = FifoCommitStats::Index(state);
+    if (i >= 0) {
+      Increment(states_[i]);
+    }
+  }
+  // Counts a transaction reopened on another CPU.
+  void CountRetry() { Increment(retries_); }
+
+  FifoCommitStats Snapshot() const {
+    FifoCommitStats stats;
+    stats.retries = retries_.load(std::memory_order_relaxed);
+    for (int i = 0; i < FifoCommitStats::kNumStates; ++i) {
+      stats.states[i] = states_[i].load(std::memory_order_relaxed);
+    }
+    return stats;
+  }
+
+ private:
+  static void Increment(std::atomic<uint64_t>& counter) {
+    counter.store(counter.load(std::memory_order_relaxed) + 1,
+                  std::memory_order_relaxed);
+  }
+
+  std::atomic<uint64_t> retries_ = 0;
+  std::atomic<uint64_t> states_[FifoCommitStats::kNumStates] = {};
+};
+
 class FifoScheduler : public BasicDispatchScheduler<FifoTask> {
  public:
   FifoScheduler(Enclave* enclave, CpuList cpulist,
@@ -120,7 +188,23 @@ class FifoScheduler : public BasicDispatchScheduler<FifoTask> {
   void DumpState(const Cpu& cpu, int flags);
   std::atomic<bool> debug_runqueue_ = false;
 
+  // Per-phase histograms of the global agent's loop. The agent thread records
+  // into it; any thread may take a snapshot.
+  PhaseProfiler& phase_profiler() { return phase_profiler_; }
+  PhaseProfile GetPhaseProfile() const { return phase_profiler_.Snapshot(); }
+
+  // May be called from any thread.
+  FifoCommitStats GetCommitStats() const { return commit_counters_.Snapshot(); }
+
+  // Returns true if a transaction that failed with `state` is worth retrying
+  // on another CPU before the next iteration.
+  static bool RetryCommit(ghost_txn_state state);
+
   static const int kDebugRunqueue = 1;
+  // Returns a PhaseProfile in the response buffer.
+  static const int kGetPhaseProfile = 2;
+  // Returns a FifoCommitStats in the response buffer.
+  static const int kGetCommitStats = 3;
 
   std::vector<TaskWithMetric::Metric> CollectMetric(){
     std::vector<TaskWithMetric::Metric> tmp; 
@@ -147,7 +231,8 @@ class FifoScheduler : public BasicDispatchScheduler<FifoTask> {
   struct CpuState {
     FifoTask* current = nullptr;
     const Agent* agent = nullptr;
-    absl::Time last_commit;
+    // TscClock ticks.
+    uint64_t last_commit = 0;
   } ABSL_CACHELINE_ALIGNED;
 
   // Updates the state of `task` to reflect that it is now running on `cpu`.
@@ -155,6 +240,10 @@ class FifoScheduler : public BasicDispatchScheduler<FifoTask> {
   // `cpu` succeeds.
   void TaskOnCpu(FifoTask* task, const Cpu& cpu);
 
+  // Makes `task` the current task on `cpu` and opens a transaction to run it
+  // there. Whatever ran on `cpu` goes back to the runqueue.
+  void OpenRunRequest(FifoTask* task, const Cpu& cpu);
+
   // Marks a task as yielded.
   void Yield(FifoTask* task);
   // Takes the task out of the yielding_tasks_ runqueue and puts it back into
@@ -192,6 +281,8 @@ class FifoScheduler : public BasicDispatchScheduler<FifoTask> {
   int num_tasks_ = 0;
 
   const absl::Duration preemption_time_slice_;
+  // preemption_time_slice_ in TscClock ticks, for the per-cpu check.
+  const uint64_t preemption_ticks_;
 
   std::deque<FifoTask*> run_queue_;
   std::vector<FifoTask*> yielding_tasks_;
@@ -199,6 +290,13 @@ class FifoScheduler : public BasicDispatchScheduler<FifoTask> {
   absl::Time schedule_timer_start_;
   absl::Duration schedule_durations_;
   uint64_t iterations_ = 0;
+
+  PhaseProfiler phase_profiler_;
+
+  // Retry a failed transaction at most this many times per iteration.
+  static constexpr int kMaxCommitRetries = 2;
+  std::vector<FifoTask*> retry_tasks_;
+  FifoCommitCounters commit_counters_;
 };
 
 // Initializes the task allocator and the FIFO scheduler.
@@ -282,6 +380,20 @@ class FullFifoAgent : public FullAgent<EnclaveType> {
         global_scheduler_->debug_runqueue_ = true;
         response.response_code = 0;
         return;
+      case FifoScheduler::kGetPhaseProfile:
+        response.response_code =
+            response.buffer.Serialize(global_scheduler_->GetPhaseProfile())
+                    .ok()
+                ? 0
+                : -EINVAL;
+        return;
+      case FifoScheduler::kGetCommitStats:
+        response.response_code =
+            response.buffer.Serialize(global_scheduler_->GetCommitStats())
+                    .ok()
+                ? 0
+                : -EINVAL;
+        return;
       default:
         response.response_code = -1;
         return;
@@ -13,38 +13,20 @@
 #include "orca/helpers.h"
 #include "schedulers/fifo/TaskWithMetric.h"
 
-// An abstraction for a UDP socket which allows sending messages to Orca
+// An abstraction for a UDP socket which allows sending messages to Orca.
+// Metrics are batched into datagrams; call flush() once a batch of them is
+// queued so that none wait for the next one.
 class OrcaMessenger
 {
 public:
-    OrcaMessenger()
-    {
-        sockfd = socket(AF_INET, SOCK_DGRAM, 0);
-        if (sockfd == -1)
-        {
-            panic("error with socket");
-        }
-
-        memset(&serverAddr, 0, sizeof(serverAddr));
-        serverAddr.sin_family = AF_INET;
-        serverAddr.sin_port = htons(orca::PORT);
-        struct hostent *sp = gethostbyname("localhost");
-        memcpy(&serverAddr.sin_addr, sp->h_addr_list[0], sp->h_length);
-    }
-
-    ~OrcaMessenger()
-    {
-        close(sockfd);
-    }
+    void sendMessageToOrca(const ghost::TaskWithMetric::Metric &m);
 
-    // Send bytes to Orca.
-    void sendBytes(const char *buf, size_t len)
+    // Send the metrics we have queued.
+    void flush()
     {
-        sendto(sockfd, buf, len, 0, (sockaddr *)&serverAddr, sizeof(serverAddr));
+        batcher.flush();
     }
-    void sendMessageToOrca(const ghost::TaskWithMetric::Metric &m);
 
 private:
-    int sockfd;
-    struct sockaddr_in serverAddr;
-};
\ No newline at end of file
+    orca::OrcaUDPBatcher<orca::MetricRecord> batcher;
+};
@@ -433,6 +433,7 @@ void FifoAgent::AgentThread() {
           this->orcaMessenger->sendMessageToOrca(m);
           // m.sendMessageToOrca();
         }
+        this->orcaMessenger->flush();
         scheduler_->deadTasks.clear();
         scheduler_->ClearMetric();
       }
@@ -17,13 +17,24 @@
 #include "schedulers/flux/flux_scheduler.h"
 
 ABSL_FLAG(std::string, enclave, "", "Connect to preexisting enclave directory");
+ABSL_FLAG(std::string, hierarchy, ghost::FluxHierarchy::kDefaultSpec,
+          "Flux schedulers, as a comma-separated list of type[:parent_id], "
+          "with ids counting from 1");
 
 int main(int argc, char* argv[]) {
   absl::InitializeSymbolizer(argv[0]);
   absl::ParseCommandLine(argc, argv);
 
   ghost::Topology* t = ghost::MachineTopology();
-  ghost::AgentConfig config(t, t->all_cpus());
+  ghost::FluxConfig config(t, t->all_cpus());
+  absl::StatusOr<ghost::FluxHierarchy> hierarchy =
+      ghost::FluxHierarchy::Parse(absl::GetFlag(FLAGS_hierarchy));
+  if (!hierarchy.ok()) {
+    fprintf(stderr, "bad --hierarchy: %s\n",
+            std::string(hierarchy.status().message()).c_str());
+    return 1;
+  }
+  config.hierarchy_ = *hierarchy;
   std::string enclave = absl::GetFlag(FLAGS_enclave);
   if (!enclave.empty()) {
     int fd = open(enclave.c_str(), O_PATH);
@@ -32,7 +43,7 @@ int main(int argc, char* argv[]) {
   }
 
   auto uap = new ghost::AgentProcess<ghost::FullFluxAgent<ghost::LocalEnclave>,
-                                     ghost::AgentConfig>(config);
+                                     ghost::FluxConfig>(config);
 
   ghost::GhostHelper()->InitCore();
 
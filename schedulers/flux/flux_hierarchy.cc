@@ -0,0 +1,183 @@
+// Copyright 2022 Google LLC
+//
+// Use of this source code is governed by a BSD-style
+// license that can be found in the LICENSE file or at
+// https://developers.google.com/open-source/licenses/bsd
+
+#include "schedulers/flux/flux_hierarchy.h"
+
+#include <algorithm>
+
+#include "absl/strings/numbers.h"
+#include "absl/strings/str_format.h"
+#include "absl/strings/str_split.h"
+#include "lib/logging.h"
+
+namespace ghost {
+
+namespace {
+
+struct TypeInfo {
+  const char* name;
+  int type;
+};
+
+#define FLUX_TYPE_INFO(name, NAME, ...) {#name, FLUX_SCHED_TYPE_##NAME},
+constexpr TypeInfo kTypes[] = {FLUX_FOR_EACH_SCHED_TYPE(FLUX_TYPE_INFO)};
+#undef FLUX_TYPE_INFO
+
+#define FLUX_THREAD_TYPE(name, NAME, ...) FLUX_SCHED_TYPE_##NAME,
+constexpr int kThreadTypes[] = {
+    FLUX_FOR_EACH_THREAD_SCHED_TYPE(FLUX_THREAD_TYPE)};
+#undef FLUX_THREAD_TYPE
+
+int TypeFromName(absl::string_view name) {
+  for (const TypeInfo& t : kTypes) {
+    if (name == t.name) {
+      return t.type;
+    }
+  }
+  return FLUX_SCHED_TYPE_NONE;
+}
+
+}  // namespace
+
+int FluxHierarchy::Parent(int sched_id) const {
+  return Valid(sched_id) ? parent[sched_id] : FLUX_SCHED_NONE;
+}
+
+int FluxHierarchy::Tier(int sched_id) const {
+  return Valid(sched_id) ? tier[sched_id] : 0;
+}
+
+std::vector<int> FluxHierarchy::Children(int sched_id) const {
+  std::vector<int> children;
+  for (int i = FLUX_SCHED_NONE + 1; i < nr_scheds; ++i) {
+    if (parent[i] == sched_id) {
+      children.push_back(i);
+    }
+  }
+  return children;
+}
+
+absl::StatusOr<FluxHierarchy> FluxHierarchy::Parse(absl::string_view spec) {
+  FluxHierarchy h;
+  h.nr_scheds = 1;
+  h.nr_tiers = 1;
+  h.type[FLUX_SCHED_NONE] = FLUX_SCHED_TYPE_NONE;
+  h.parent[FLUX_SCHED_NONE] = FLUX_SCHED_NONE;
+  h.tier[FLUX_SCHED_NONE] = 0;
+
+  for (absl::string_view entry : absl::StrSplit(spec, ',')) {
+    const int id = h.nr_scheds;
+    if (id >= FLUX_MAX_NR_SCHEDS) {
+      return absl::InvalidArgumentError(absl::StrFormat(
+          "more than %d schedulers", FLUX_MAX_NR_SCHEDS - 1));
+    }
+    std::vector<absl::string_view> fields = absl::StrSplit(entry, ':');
+    if (fields.size() > 2) {
+      return absl::InvalidArgumentError(
+          absl::StrFormat("bad scheduler \"%s\"", entry));
+    }
+    const int type = TypeFromName(fields[0]);
+    if (type == FLUX_SCHED_TYPE_NONE) {
+      return absl::InvalidArgumentError(
+          absl::StrFormat("unknown scheduler type \"%s\"", fields[0]));
+    }
+    int parent = FLUX_SCHED_NONE;
+    if (fields.size() == 2) {
+      if (!absl::SimpleAtoi(fields[1], &parent) || parent <= FLUX_SCHED_NONE ||
+          parent >= id) {
+        return absl::InvalidArgumentError(absl::StrFormat(
+            "scheduler %d: parent \"%s\" is not an earlier scheduler", id,
+            fields[1]));
+      }
+    } else if (h.top != FLUX_SCHED_NONE) {
+      return absl::InvalidArgumentError(absl::StrFormat(
+          "scheduler %d: only %d can be at the top", id, h.top));
+    } else {
+      h.top = id;
+    }
+    // A cpu has one struct per type, which a scheduler and its ancestor can't
+    // share.  See flux_header_bpf.h.
+    for (int a = parent; a != FLUX_SCHED_NONE; a = h.parent[a]) {
+      if (h.type[a] == type) {
+        return absl::InvalidArgumentError(absl::StrFormat(
+            "scheduler %d: ancestor %d is also %s", id, a, fields[0]));
+      }
+    }
+    const int tier = h.tier[parent] + 1;
+    if (tier >= FLUX_MAX_NR_TIERS) {
+      return absl::InvalidArgumentError(absl::StrFormat(
+          "scheduler %d: more than %d tiers", id, FLUX_MAX_NR_TIERS - 1));
+    }
+
+    h.type[id] = type;
+    h.parent[id] = parent;
+    h.tier[id] = tier;
+    h.nr_tiers = std::max(h.nr_tiers, tier + 1);
+    if (h.new_thread == FLUX_SCHED_NONE && SchedulesThreads(type)) {
+      h.new_thread = id;
+    }
+    h.nr_scheds++;
+  }
+
+  if (h.top == FLUX_SCHED_NONE) {
+    return absl::InvalidArgumentError("no top scheduler");
+  }
+  if (h.new_thread == FLUX_SCHED_NONE) {
+    return absl::InvalidArgumentError("no scheduler for threads");
+  }
+
+  // Only Roci hands cpus down, and FluxScheduler::InitSchedulers() needs to
+  // know which of its children gets them.
+  for (int id = FLUX_SCHED_NONE + 1; id < h.nr_scheds; ++id) {
+    const std::vector<int> children = h.Children(id);
+    switch (h.type[id]) {
+      case FLUX_SCHED_TYPE_ROCI: {
+        const int nr_idle = std::count_if(
+            children.begin(), children.end(),
+            [&h](int c) { return h.type[c] == FLUX_SCHED_TYPE_IDLE; });
+        if (children.size() != 2 || nr_idle != 1) {
+          return absl::InvalidArgumentError(absl::StrFormat(
+              "scheduler %d: roci needs one idle and one primary child", id));
+        }
+        break;
+      }
+      default:
+        if (!children.empty()) {
+          return absl::InvalidArgumentError(
+              absl::StrFormat("scheduler %d: %s can't have children", id,
+                              TypeName(h.type[id])));
+        }
+        break;
+    }
+  }
+  return h;
+}
+
+FluxHierarchy FluxHierarchy::Default() {
+  absl::StatusOr<FluxHierarchy> h = Parse(kDefaultSpec);
+  CHECK(h.ok()) << h.status();
+  return *h;
+}
+
+const char* FluxHierarchy::TypeName(int type) {
+  for (const TypeInfo& t : kTypes) {
+    if (type == t.type) {
+      return t.name;
+    }
+  }
+  return "none";
+}
+
+bool FluxHierarchy::SchedulesThreads(int type) {
+  for (int t : kThreadTypes) {
+    if (type == t) {
+      return true;
+    }
+  }
+  return false;
+}
+
+}  // namespace ghost
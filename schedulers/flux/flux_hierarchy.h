@@ -0,0 +1,68 @@
+// Copyright 2022 Google LLC
+//
+// Use of this source code is governed by a BSD-style
+// license that can be found in the LICENSE file or at
+// https://developers.google.com/open-source/licenses/bsd
+
+#ifndef GHOST_SCHEDULERS_FLUX_FLUX_HIERARCHY_H_
+#define GHOST_SCHEDULERS_FLUX_FLUX_HIERARCHY_H_
+
+#include <vector>
+
+#include "absl/status/statusor.h"
+#include "absl/strings/string_view.h"
+#include "third_party/bpf/flux_bpf.h"
+
+namespace ghost {
+
+// The shape of a Flux hierarchy: each scheduler's type, parent and tier.  Sched
+// ids index the arrays.  Id FLUX_SCHED_NONE is the kernel, which owns the cpus
+// we don't have, at tier 0.
+//
+// FluxScheduler writes this into the BPF program's schedulers map, and
+// FluxTierModel replays it offline.  Trivially copyable, so that it can be part
+// of an AgentConfig.
+struct FluxHierarchy {
+  int nr_scheds = 0;  // Including FLUX_SCHED_NONE.
+  int nr_tiers = 0;   // Including tier 0.
+  // The scheduler that PNT grants newly available cpus to.
+  int top = FLUX_SCHED_NONE;
+  // The scheduler that new threads join.
+  int new_thread = FLUX_SCHED_NONE;
+  int type[FLUX_MAX_NR_SCHEDS] = {};
+  int parent[FLUX_MAX_NR_SCHEDS] = {};
+  int tier[FLUX_MAX_NR_SCHEDS] = {};
+
+  int Parent(int sched_id) const;
+  // Returns 0 for unknown ids, like sched_id_to_tier() in flux_dispatch.bpf.c.
+  int Tier(int sched_id) const;
+  bool Valid(int sched_id) const {
+    return sched_id >= 0 && sched_id < nr_scheds;
+  }
+  // Returns the ids of `sched_id`'s children, in order.
+  std::vector<int> Children(int sched_id) const;
+
+  // Parses a comma-separated list of scheduler types, each with the id of its
+  // parent, e.g. "roci,biff:1,idle:1".  Ids count from 1 in list order, and
+  // parents come before their children.  The one scheduler without a parent is
+  // the top.  New threads join the first scheduler whose type schedules
+  // threads.
+  //
+  // Roci needs exactly two children, an idle one and the primary one that gets
+  // its cpus.  The other types don't hand out cpus, so they have no children.
+  // No scheduler can be below one of its own type, since a cpu has one struct
+  // per type, so roci can't be below roci either.  That keeps hierarchies to
+  // two levels; stacking more tiers takes another type that hands out cpus.
+  static absl::StatusOr<FluxHierarchy> Parse(absl::string_view spec);
+  // agent_flux's hierarchy: Roci at the top, Biff and Idle below.
+  static constexpr const char* kDefaultSpec = "roci,biff:1,idle:1";
+  static FluxHierarchy Default();
+
+  // Returns e.g. "roci" for FLUX_SCHED_TYPE_ROCI, or "none".
+  static const char* TypeName(int type);
+  static bool SchedulesThreads(int type);
+};
+
+}  // namespace ghost
+
+#endif  // GHOST_SCHEDULERS_FLUX_FLUX_HIERARCHY_H_
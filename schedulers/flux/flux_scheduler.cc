@@ -13,26 +13,10 @@
 
 namespace ghost {
 
-// We only have one scheduler of each type, so id-to-type is pretty basic.
-int IdToType(int id)
-{
-  switch (id) {
-  case FLUX_SCHED_NONE:
-    return FLUX_SCHED_TYPE_NONE;
-  case FLUX_SCHED_ROCI:
-    return FLUX_SCHED_TYPE_ROCI;
-  case FLUX_SCHED_BIFF:
-    return FLUX_SCHED_TYPE_BIFF;
-  case FLUX_SCHED_IDLE:
-    return FLUX_SCHED_TYPE_IDLE;
-  default:
-    return FLUX_SCHED_TYPE_NONE;
-  }
-}
-
 FluxScheduler::FluxScheduler(Enclave* enclave, CpuList cpulist,
-                             const AgentConfig& config)
+                             const FluxConfig& config)
     : Scheduler(enclave, std::move(cpulist)),
+      hierarchy_(config.hierarchy_),
       unused_channel_(1, /*node=*/0) {
 
   bpf_obj_ = flux_bpf__open();
@@ -46,6 +30,8 @@ FluxScheduler::FluxScheduler(Enclave* enclave, CpuList cpulist,
                          BPF_PROG_TYPE_GHOST_SELECT_RQ, BPF_GHOST_SELECT_RQ);
 
   bpf_obj_->rodata->enable_bpf_printd = CapHas(CAP_PERFMON);
+  bpf_obj_->rodata->flux_top_sched_id = hierarchy_.top;
+  bpf_obj_->rodata->flux_new_thread_sched_id = hierarchy_.new_thread;
 
   CHECK_EQ(flux_bpf__load(bpf_obj_), 0);
 
@@ -63,23 +49,59 @@ FluxScheduler::FluxScheduler(Enclave* enclave, CpuList cpulist,
     cpu_data_[i].f.id = i;
   }
 
-  struct flux_sched s;
-  memset(&s, 0, sizeof(struct flux_sched));
-  for (int i = 0; i < FLUX_NR_SCHEDS; i++) {
-    s.f.id = i;
-    s.f.type = IdToType(i);
-    CHECK_EQ(bpf_map_update_elem(bpf_map__fd(bpf_obj_->maps.schedulers),
-                                 &i, &s, BPF_ANY), 0);
-  }
+  InitSchedulers();
 
   thread_data_ = static_cast<flux_thread*>(
       bpf_map__mmap(bpf_obj_->maps.thread_data));
   CHECK_NE(thread_data_, MAP_FAILED);
+
+  cpu_stats_ = static_cast<flux_cpu_stats*>(
+      bpf_map__mmap(bpf_obj_->maps.cpu_stats));
+  CHECK_NE(cpu_stats_, MAP_FAILED);
+}
+
+void FluxScheduler::InitSchedulers() {
+  for (int i = 0; i < hierarchy_.nr_scheds; i++) {
+    struct flux_sched s;
+    memset(&s, 0, sizeof(struct flux_sched));
+    s.f.id = i;
+    s.f.type = hierarchy_.type[i];
+    s.f.parent = hierarchy_.parent[i];
+    s.f.tier = hierarchy_.tier[i];
+
+    // Per-type setup, for types that need to know their children.
+    std::vector<int> children = hierarchy_.Children(i);
+    switch (s.f.type) {
+      case FLUX_SCHED_TYPE_ROCI:
+        // Roci gives cpus to its primary and the rest to idle.
+        CHECK_EQ(children.size(), 2) << "roci " << i << " needs two children";
+        for (int c : children) {
+          if (hierarchy_.type[c] == FLUX_SCHED_TYPE_IDLE) {
+            s.roci.idle = c;
+          } else {
+            s.roci.primary = c;
+          }
+        }
+        CHECK_NE(s.roci.idle, FLUX_SCHED_NONE)
+            << "roci " << i << " needs an idle child";
+        CHECK_NE(s.roci.primary, FLUX_SCHED_NONE)
+            << "roci " << i << " needs a primary child";
+        break;
+      default:
+        break;
+    }
+
+    CHECK_EQ(bpf_map_update_elem(bpf_map__fd(bpf_obj_->maps.schedulers),
+                                 &i, &s, BPF_ANY), 0);
+  }
 }
 
 FluxScheduler::~FluxScheduler() {
+  rescue_channel_.reset();
+  telemetry_.reset();
   bpf_map__munmap(bpf_obj_->maps.cpu_data, cpu_data_);
   bpf_map__munmap(bpf_obj_->maps.thread_data, thread_data_);
+  bpf_map__munmap(bpf_obj_->maps.cpu_stats, cpu_stats_);
   flux_bpf__destroy(bpf_obj_);
 }
 
@@ -105,6 +127,60 @@ void FluxScheduler::EnclaveReady() {
   thread.join();
 
   WRITE_ONCE(bpf_obj_->bss->user_initialized, true);
+
+  rescue_channel_ = std::make_unique<BpfRescueChannel>(
+      bpf_map__fd(bpf_obj_->maps.rescue_ring), BPF_RESCUE_RING_SIZE,
+      [this](const bpf_rescue_msg& msg) { return ReinjectTask(msg); },
+      /*retry_period=*/kRediscoverPeriod);
+  telemetry_ = std::make_unique<BpfTelemetry>(
+      FLUX_MAX_GTIDS,
+      [this](BpfTelemetrySampler& sampler) { SampleTelemetry(sampler); });
+}
+
+bool FluxScheduler::ReinjectTask(const bpf_rescue_msg& msg) {
+  // A discovery that started after bpf gave up on the task covers it.
+  if (absl::FromUnixNanos(msg.rescued_at) < last_rediscover_) {
+    return true;
+  }
+  absl::Time now = MonotonicNow();
+  if (now - last_rediscover_ < kRediscoverPeriod) {
+    return false;
+  }
+  last_rediscover_ = now;
+  enclave()->DiscoverTasks();
+  return true;
+}
+
+void FluxScheduler::SampleTelemetry(BpfTelemetrySampler& sampler) const {
+  for (const Cpu& cpu : cpus()) {
+    sampler.SampleCpu(cpu.id(), READ_ONCE(cpu_data_[cpu.id()].f.current) != 0);
+  }
+  // thread_data is indexed like the status words; see BiffScheduler.
+  enclave()->GetStatusWordTable()->ForEachTaskStatusWord(
+      [this, &sampler](ghost_status_word* sw, uint32_t region_id,
+                       uint32_t idx) {
+        if (idx >= FLUX_MAX_GTIDS) return;
+        const flux_thread& t = thread_data_[idx];
+        sampler.SampleTask(idx, READ_ONCE(t.f.ran_at),
+                           READ_ONCE(t.f.runnable_at));
+      });
+}
+
+BpfRescueReport FluxScheduler::GetRescueReport() const {
+  BpfRescueReport report;
+  report.bpf = bpf_obj_->bss->rescue_stats;
+  if (rescue_channel_) {
+    report.agent = rescue_channel_->stats();
+  }
+  return report;
+}
+
+FluxTierReport FluxScheduler::GetTierReport() const {
+  FluxTierReport report;
+  for (const Cpu& cpu : cpus()) {
+    report.Add(hierarchy_, cpu_stats_[cpu.id()]);
+  }
+  return report;
 }
 
 void FluxScheduler::DiscoverTasks() {
@@ -10,28 +10,73 @@
 #include <cstdint>
 #include <memory>
 
+#include "absl/time/time.h"
 #include "third_party/bpf/flux_bpf.h"
 #include "lib/agent.h"
+#include "lib/bpf_rescue.h"
+#include "lib/bpf_telemetry.h"
 #include "lib/scheduler.h"
 #include "schedulers/flux/flux_bpf.skel.h"
+#include "schedulers/flux/flux_hierarchy.h"
+#include "schedulers/flux/flux_tier_model.h"
 
 namespace ghost {
 
+// RPC request numbers for `FullFluxAgent::RpcHandler`.
+enum FluxRpc : int64_t {
+  // Returns a `BpfRescueReport` in the response buffer.
+  kFluxRpcRescueStats = 1,
+  // Returns a `FluxTierReport` in the response buffer.
+  kFluxRpcTierStats = 2,
+};
+
+class FluxConfig : public AgentConfig {
+ public:
+  FluxConfig() {}
+  FluxConfig(Topology* topology, CpuList cpulist)
+      : AgentConfig(topology, std::move(cpulist)) {}
+
+  FluxHierarchy hierarchy_ = FluxHierarchy::Default();
+};
+
 class FluxScheduler : public Scheduler {
  public:
   explicit FluxScheduler(Enclave* enclave, CpuList cpulist,
-                         const AgentConfig& config);
+                         const FluxConfig& config);
   ~FluxScheduler() final;
 
   void EnclaveReady() final;
   void DiscoverTasks() final;
   Channel& GetDefaultChannel() final { return unused_channel_; };
 
+  BpfRescueReport GetRescueReport() const;
+  // Sums the cpu_stats map over our cpus.  The counters are read while bpf
+  // updates them, so they are only roughly consistent with each other.
+  FluxTierReport GetTierReport() const;
+
  private:
+  // Flux can't run a task it doesn't track, so we get bpf another task_new
+  // for a task it gave up on by rediscovering the enclave's tasks. That's
+  // expensive, so we do it at most once per kRediscoverPeriod.
+  static constexpr absl::Duration kRediscoverPeriod = absl::Milliseconds(100);
+
+  bool ReinjectTask(const bpf_rescue_msg& msg);
+  // Reads the cpu_data map and the thread_data of live tasks for BpfTelemetry.
+  void SampleTelemetry(BpfTelemetrySampler& sampler) const;
+
+  // Writes hierarchy_ into the schedulers map.
+  void InitSchedulers();
+
+  const FluxHierarchy hierarchy_;
   LocalChannel unused_channel_;
   flux_bpf* bpf_obj_;
   flux_cpu* cpu_data_;
   flux_thread* thread_data_;
+  flux_cpu_stats* cpu_stats_;
+  // Only used by the rescue channel's thread.
+  absl::Time last_rediscover_ = absl::InfinitePast();
+  std::unique_ptr<BpfRescueChannel> rescue_channel_;
+  std::unique_ptr<BpfTelemetry> telemetry_;
 };
 
 class FluxAgentTask : public LocalAgent {
@@ -49,7 +94,7 @@ class FluxAgentTask : public LocalAgent {
 template <class EnclaveType>
 class FullFluxAgent : public FullAgent<EnclaveType> {
  public:
-  explicit FullFluxAgent(AgentConfig config)
+  explicit FullFluxAgent(FluxConfig config)
       : FullAgent<EnclaveType>(config) {
     flux_sched_ = std::make_unique<FluxScheduler>(
         &this->enclave_, *this->enclave_.cpus(), config);
@@ -74,6 +119,18 @@ class FullFluxAgent : public FullAgent<EnclaveType> {
   void RpcHandler(int64_t req, const AgentRpcArgs& args,
                   AgentRpcResponse& response) override {
     switch (req) {
+      case kFluxRpcRescueStats:
+        response.response_code =
+            response.buffer.Serialize(flux_sched_->GetRescueReport()).ok()
+                ? 0
+                : -EINVAL;
+        return;
+      case kFluxRpcTierStats:
+        response.response_code =
+            response.buffer.Serialize(flux_sched_->GetTierReport()).ok()
+                ? 0
+                : -EINVAL;
+        return;
       default:
         response.response_code = -1;
         return;
@@ -0,0 +1,187 @@
+// Copyright 2022 Google LLC
+//
+// Use of this source code is governed by a BSD-style
+// license that can be found in the LICENSE file or at
+// https://developers.google.com/open-source/licenses/bsd
+
+#include "schedulers/flux/flux_tier_model.h"
+
+#include "absl/strings/str_format.h"
+#include "lib/logging.h"
+
+namespace ghost {
+
+void FluxTierReport::Add(const FluxHierarchy& h, const flux_cpu_stats& st) {
+  nr_cpus++;
+  nr_scheds = h.nr_scheds;
+  nr_tiers = h.nr_tiers;
+  for (int i = 0; i < h.nr_scheds; ++i) {
+    const __flux_sched_cpu_stats& from = st.sched[i];
+    __flux_sched_cpu_stats& to = sched[i];
+
+    tier[i] = h.Tier(i);
+    to.grants += from.grants;
+    to.yields += from.yields;
+    to.preempted += from.preempted;
+    to.preempt_requests += from.preempt_requests;
+    to.residency_ns += from.residency_ns;
+    for (int s = 0; s < FLUX_STATS_RESIDENCY_SLOTS; ++s) {
+      to.residency[s] += from.residency[s];
+    }
+    if (tier[i] < FLUX_MAX_NR_TIERS) {
+      tier_residency_ns[tier[i]] += from.residency_ns;
+    }
+  }
+  for (int t = 0; t < FLUX_MAX_NR_TIERS; ++t) {
+    preemptions[t] += st.preemptions[t];
+  }
+}
+
+FluxTierModel::FluxTierModel(const FluxHierarchy& hierarchy, int nr_cpus)
+    : h_(hierarchy), cpus_(nr_cpus) {
+  CHECK_LE(h_.nr_scheds, FLUX_MAX_NR_SCHEDS);
+  CHECK_LE(h_.nr_tiers, FLUX_MAX_NR_TIERS);
+  // cpu_data starts zeroed, i.e. with a pending preemption to tier 0, until
+  // the cpu's first MSG_CPU_AVAILABLE.
+  for (CpuState& cpu : cpus_) {
+    cpu.preempt_to = 0;
+  }
+}
+
+void FluxTierModel::SetCurrentSched(CpuState& cpu, int sched_id,
+                                    uint64_t now) {
+  flux_stats_switch(&cpu.stats, cpu.current_sched, now);
+  cpu.current_sched = sched_id;
+}
+
+void FluxTierModel::Grant(CpuState& cpu, int child_id, uint64_t now) {
+  SetCurrentSched(cpu, child_id, now);
+  if (__flux_sched_cpu_stats* ss = flux_stats_sched(&cpu.stats, child_id)) {
+    ss->grants++;
+  }
+}
+
+void FluxTierModel::PreemptUpTo(CpuState& cpu, int tier, uint64_t now) {
+  for (int i = 0; i < h_.nr_tiers; ++i) {
+    if (h_.Tier(cpu.current_sched) <= tier) {
+      break;
+    }
+    if (__flux_sched_cpu_stats* ss =
+            flux_stats_sched(&cpu.stats, cpu.current_sched)) {
+      ss->preempted++;
+    }
+    SetCurrentSched(cpu, h_.Parent(cpu.current_sched), now);
+  }
+  flux_stats_preempted_to(&cpu.stats, tier);
+}
+
+absl::Status FluxTierModel::Apply(const Event& event) {
+  if (event.cpu < 0 || event.cpu >= cpus_.size()) {
+    return absl::InvalidArgumentError(
+        absl::StrFormat("no cpu %d", event.cpu));
+  }
+  CpuState& cpu = cpus_[event.cpu];
+  if (event.time_ns < cpu.last_event_ns) {
+    return absl::InvalidArgumentError(absl::StrFormat(
+        "cpu %d: time went backwards, %lu < %lu", event.cpu, event.time_ns,
+        cpu.last_event_ns));
+  }
+  const bool needs_sched = event.type == Event::kGrant ||
+                           event.type == Event::kYield ||
+                           event.type == Event::kPreemptCpu;
+  if (needs_sched &&
+      (!h_.Valid(event.sched) || event.sched == FLUX_SCHED_NONE)) {
+    return absl::InvalidArgumentError(
+        absl::StrFormat("no sched %d", event.sched));
+  }
+
+  switch (event.type) {
+    case Event::kCpuAvailable:
+      cpu.available = true;
+      cpu.preempt_to = NoPreempt();
+      break;
+
+    case Event::kCpuBusy:
+      cpu.available = false;
+      cpu.preempt_to = 0;
+      PreemptUpTo(cpu, 0, event.time_ns);
+      break;
+
+    case Event::kPnt:
+      if (!cpu.available) {
+        break;
+      }
+      if (cpu.preempt_to != NoPreempt()) {
+        int tier = cpu.preempt_to;
+        cpu.preempt_to = NoPreempt();
+        PreemptUpTo(cpu, tier, event.time_ns);
+      }
+      if (cpu.current_sched == FLUX_SCHED_NONE) {
+        Grant(cpu, h_.top, event.time_ns);
+      }
+      break;
+
+    case Event::kGrant:
+      if (!cpu.available) {
+        return absl::InvalidArgumentError(
+            absl::StrFormat("cpu %d: grant while unavailable", event.cpu));
+      }
+      if (cpu.current_sched != h_.Parent(event.sched)) {
+        return absl::InvalidArgumentError(absl::StrFormat(
+            "cpu %d: grant to %d, but the cpu is %d's", event.cpu,
+            event.sched, cpu.current_sched));
+      }
+      Grant(cpu, event.sched, event.time_ns);
+      break;
+
+    case Event::kYield:
+      if (cpu.current_sched != event.sched) {
+        return absl::InvalidArgumentError(absl::StrFormat(
+            "cpu %d: yield by %d, but the cpu is %d's", event.cpu,
+            event.sched, cpu.current_sched));
+      }
+      if (__flux_sched_cpu_stats* ss =
+              flux_stats_sched(&cpu.stats, event.sched)) {
+        ss->yields++;
+      }
+      SetCurrentSched(cpu, h_.Parent(event.sched), event.time_ns);
+      break;
+
+    case Event::kPreemptCpu: {
+      // Only ever moves preempt_to up the hierarchy: a pending preemption to
+      // a higher tier covers ours.
+      int my_tier = h_.Tier(event.sched);
+      if (cpu.preempt_to <= my_tier) {
+        break;
+      }
+      cpu.preempt_to = my_tier;
+      if (__flux_sched_cpu_stats* ss =
+              flux_stats_sched(&cpu.stats, event.sched)) {
+        ss->preempt_requests++;
+      }
+      break;
+    }
+  }
+  cpu.last_event_ns = event.time_ns;
+  return absl::OkStatus();
+}
+
+absl::Status FluxTierModel::Replay(const std::vector<Event>& events) {
+  for (const Event& event : events) {
+    absl::Status status = Apply(event);
+    if (!status.ok()) {
+      return status;
+    }
+  }
+  return absl::OkStatus();
+}
+
+FluxTierReport FluxTierModel::Report() const {
+  FluxTierReport report;
+  for (const CpuState& cpu : cpus_) {
+    report.Add(h_, cpu.stats);
+  }
+  return report;
+}
+
+}  // namespace ghost
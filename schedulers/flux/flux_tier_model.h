@@ -0,0 +1,105 @@
+// Copyright 2022 Google LLC
+//
+// Use of this source code is governed by a BSD-style
+// license that can be found in the LICENSE file or at
+// https://developers.google.com/open-source/licenses/bsd
+
+// An offline model of the state machine that flux_api.bpf.c runs for each cpu:
+// which scheduler holds the cpu (current_sched), who asked to preempt it
+// (preempt_to), and the per-tier stats that go with every transition.
+//
+// The model keeps its stats with the same helpers (flux_header_bpf.h) as the
+// BPF program, so replaying a trace of events yields the flux_cpu_stats that
+// the cpu_stats map should hold.  Tests use it to pin down the accounting, and
+// you can replay a recorded trace to tell a policy bug from a Flux bug.
+
+#ifndef GHOST_SCHEDULERS_FLUX_FLUX_TIER_MODEL_H_
+#define GHOST_SCHEDULERS_FLUX_FLUX_TIER_MODEL_H_
+
+#include <cstdint>
+#include <vector>
+
+#include "absl/status/status.h"
+#include "schedulers/flux/flux_hierarchy.h"
+#include "third_party/bpf/flux_bpf.h"
+
+namespace ghost {
+
+// Stats summed over cpus, per scheduler and per tier.  Trivially copyable, so
+// that it fits in an RPC response buffer.
+struct FluxTierReport {
+  uint32_t nr_cpus = 0;
+  uint32_t nr_scheds = 0;
+  uint32_t nr_tiers = 0;
+  int32_t tier[FLUX_MAX_NR_SCHEDS] = {};
+  __flux_sched_cpu_stats sched[FLUX_MAX_NR_SCHEDS] = {};
+  // Preemptions up to each tier, e.g. [0] is from cpu_busy.
+  uint64_t preemptions[FLUX_MAX_NR_TIERS] = {};
+  // Time the cpus spent in each tier's schedulers.
+  uint64_t tier_residency_ns[FLUX_MAX_NR_TIERS] = {};
+
+  void Add(const FluxHierarchy& h, const flux_cpu_stats& st);
+};
+
+class FluxTierModel {
+ public:
+  struct Event {
+    enum Type {
+      // Messages, which the kernel delivers for the cpu.
+      kCpuAvailable,
+      kCpuBusy,
+      // PNT on the cpu: runs pending preemptions and grants the cpu to the top
+      // scheduler if we just got it.
+      kPnt,
+      // `sched` gets the cpu from its parent.
+      kGrant,
+      // `sched` gives the cpu back to its parent.
+      kYield,
+      // `sched`, on any cpu, asks to preempt the cpu up to its tier.
+      kPreemptCpu,
+    };
+
+    Type type;
+    uint64_t time_ns;
+    int cpu;
+    int sched = FLUX_SCHED_NONE;
+  };
+
+  FluxTierModel(const FluxHierarchy& hierarchy, int nr_cpus);
+
+  // Returns InvalidArgument for events that the BPF program can't generate,
+  // e.g. a grant from a scheduler that doesn't hold the cpu, and leaves the
+  // model unchanged.
+  absl::Status Apply(const Event& event);
+  // Stops at the first event that fails.
+  absl::Status Replay(const std::vector<Event>& events);
+
+  int current_sched(int cpu) const { return cpus_[cpu].current_sched; }
+  int preempt_to(int cpu) const { return cpus_[cpu].preempt_to; }
+  bool available(int cpu) const { return cpus_[cpu].available; }
+  const flux_cpu_stats& stats(int cpu) const { return cpus_[cpu].stats; }
+
+  FluxTierReport Report() const;
+
+ private:
+  struct CpuState {
+    bool available = false;
+    int current_sched = FLUX_SCHED_NONE;
+    int preempt_to;
+    uint64_t last_event_ns = 0;
+    flux_cpu_stats stats = {};
+  };
+
+  // FLUX_TIER_NO_PREEMPT
+  static constexpr int NoPreempt() { return FLUX_MAX_NR_TIERS; }
+  void SetCurrentSched(CpuState& cpu, int sched_id, uint64_t now);
+  void Grant(CpuState& cpu, int child_id, uint64_t now);
+  void PreemptUpTo(CpuState& cpu, int tier, uint64_t now);
+
+  const FluxHierarchy h_;
+  std::vector<CpuState> cpus_;
+};
+
+}  // namespace ghost
+
+#endif  // GHOST_SCHEDULERS_FLUX_FLUX_TIER_MODEL_H_
@@ -4,8 +4,13 @@
 // license that can be found in the LICENSE file or at
 // https://developers.google.com/open-source/licenses/bsd
 
+#include <arpa/inet.h>
+#include <netinet/in.h>
+#include <sys/socket.h>
+
 #include <cstdint>
 #include <string>
+#include <thread>
 #include <vector>
 
 #include "absl/debugging/symbolize.h"
@@ -23,6 +28,9 @@ ABSL_FLAG(int32_t, ncpus, 5, "Schedule on <ncpus> starting from <firstcpu>");
 ABSL_FLAG(std::string, enclave, "", "Connect to preexisting enclave directory");
 ABSL_FLAG(absl::Duration, preemption_time_slice, absl::Microseconds(50),
           "Shinjuku preemption time slice");
+ABSL_FLAG(int32_t, control_port, 0,
+          "If nonzero, accept runtime control requests (e.g., from "
+          "shinjuku_client) on this localhost TCP port");
 
 namespace ghost {
 
@@ -64,6 +72,87 @@ void ParseShinjukuConfig(ShinjukuConfig* config) {
   }
 }
 
+using ShinjukuAgentProcess =
+    AgentProcess<FullShinjukuAgent<LocalEnclave>, ShinjukuConfig>;
+
+// Forwards `request` to the agent and returns the agent's response.
+ShinjukuControlResponse HandleControlRequest(
+    ShinjukuAgentProcess* uap, const ShinjukuControlRequest& request) {
+  ShinjukuControlResponse response;
+  AgentRpcArgs args;
+  args.arg0 = request.arg0;
+  args.arg1 = request.arg1;
+  switch (request.req) {
+    case kShinjukuRpcDebugRunqueue:
+    case kShinjukuRpcSetTimeSlice:
+    case kShinjukuRpcGetTimeSlices:
+      break;
+    case kShinjukuRpcSetTimeSlices:
+      CHECK(args.buffer.Serialize(request.slices).ok());
+      break;
+    case kShinjukuRpcSetSliceController:
+      CHECK(args.buffer.Serialize(request.slices.controller_params).ok());
+      break;
+    default:
+      return response;
+  }
+
+  AgentRpcResponse rpc_response = uap->RpcWithResponse(request.req, args);
+  response.response_code = rpc_response.response_code;
+  if (request.req == kShinjukuRpcGetTimeSlices &&
+      response.response_code == 0) {
+    absl::StatusOr<ShinjukuTimeSlices> slices =
+        rpc_response.buffer.Deserialize<ShinjukuTimeSlices>();
+    CHECK(slices.ok());
+    response.slices = slices.value();
+  }
+  return response;
+}
+
+// Serves `ShinjukuControlRequest`s on `listen_fd` until the socket is shut
+// down. Each connection may carry any number of requests.
+void ServeControlRequests(int listen_fd, ShinjukuAgentProcess* uap) {
+  while (true) {
+    int fd = accept(listen_fd, nullptr, nullptr);
+    if (fd < 0) {
+      if (errno == EINTR) {
+        continue;
+      }
+      // `listen_fd` was shut down.
+      return;
+    }
+
+    ShinjukuControlRequest request;
+    while (recv(fd, &request, sizeof(request), MSG_WAITALL) ==
+           sizeof(request)) {
+      const ShinjukuControlResponse response =
+          HandleControlRequest(uap, request);
+      if (send(fd, &response, sizeof(response), MSG_NOSIGNAL) !=
+          sizeof(response)) {
+        break;
+      }
+    }
+    close(fd);
+  }
+}
+
+// Returns a socket listening on localhost at `port`.
+int ListenOnControlPort(int port) {
+  int fd = socket(AF_INET, SOCK_STREAM, 0);
+  CHECK_GE(fd, 0);
+  int one = 1;
+  CHECK_EQ(setsockopt(fd, SOL_SOCKET, SO_REUSEADDR, &one, sizeof(one)), 0);
+
+  sockaddr_in addr = {};
+  addr.sin_family = AF_INET;
+  addr.sin_port = htons(port);
+  addr.sin_addr.s_addr = htonl(INADDR_LOOPBACK);
+  CHECK_EQ(bind(fd, reinterpret_cast<sockaddr*>(&addr), sizeof(addr)), 0)
+      << "cannot bind control port " << port;
+  CHECK_EQ(listen(fd, /*backlog=*/4), 0);
+  return fd;
+}
+
 }  // namespace ghost
 
 int main(int argc, char* argv[]) {
@@ -86,11 +175,18 @@ int main(int argc, char* argv[]) {
   printf("Initializing...\n");
 
   // Using new so we can destruct the object before printing Done
-  auto uap =
-      new ghost::AgentProcess<ghost::FullShinjukuAgent<ghost::LocalEnclave>,
-                              ghost::ShinjukuConfig>(config);
+  auto uap = new ghost::ShinjukuAgentProcess(config);
 
   ghost::GhostHelper()->InitCore();
+
+  const int control_port = absl::GetFlag(FLAGS_control_port);
+  int control_fd = -1;
+  std::thread control_thread;
+  if (control_port > 0) {
+    control_fd = ghost::ListenOnControlPort(control_port);
+    control_thread = std::thread(ghost::ServeControlRequests, control_fd, uap);
+  }
+
   printf("Initialization complete, ghOSt active.\n");
 
   // When `stdout` is directed to a terminal, it is newline-buffered. When
@@ -115,11 +211,23 @@ int main(int argc, char* argv[]) {
   // TODO: this is racy - uap could be deleted already
   ghost::GhostSignals::AddHandler(SIGUSR1, [uap](int) {
     uap->Rpc(ghost::ShinjukuScheduler::kDebugRunqueue);
+    ghost::AgentRpcResponse response =
+        uap->RpcWithResponse(ghost::kShinjukuRpcGetPhaseProfile);
+    if (response.response_code == 0) {
+      response.buffer.Deserialize<ghost::PhaseProfile>()->Print(stderr);
+    }
     return false;
   });
 
   exit.WaitForNotification();
 
+  if (control_thread.joinable()) {
+    // Wakes up the control thread's `accept`.
+    shutdown(control_fd, SHUT_RDWR);
+    control_thread.join();
+    close(control_fd);
+  }
+
   delete uap;
 
   printf("Done!\n");
@@ -0,0 +1,209 @@
+// Copyright 2021 Google LLC
+//
+// Use of this source code is governed by a BSD-style
+// license that can be found in the LICENSE file or at
+// https://developers.google.com/open-source/licenses/bsd
+
+// Changes the preemption time slice of a running Shinjuku agent without
+// restarting it. The agent must have been started with `--control_port`.
+//
+// Usage:
+//   shinjuku_client [--port=N] show
+//   shinjuku_client [--port=N] slice <duration|inf>
+//   shinjuku_client [--port=N] qos_slice <qos> <duration|inf|default>
+//   shinjuku_client [--port=N] controller off
+//   shinjuku_client [--port=N] controller on [<target_wait> <min_slice>
+//                                             <max_slice> <period>]
+//   shinjuku_client [--port=N] debug_runqueue
+//
+// Durations use the absl syntax, e.g. "30us" or "1ms".
+
+#include <arpa/inet.h>
+#include <netinet/in.h>
+#include <sys/socket.h>
+#include <unistd.h>
+
+#include <cstdint>
+#include <cstdio>
+#include <string>
+#include <vector>
+
+#include "absl/flags/flag.h"
+#include "absl/flags/parse.h"
+#include "absl/strings/numbers.h"
+#include "absl/time/time.h"
+#include "schedulers/shinjuku/shinjuku_control.h"
+
+ABSL_FLAG(int32_t, port, ghost::kShinjukuControlPort,
+          "The agent's control port (its --control_port flag)");
+
+namespace ghost {
+namespace {
+
+bool ParseSlice(const std::string& s, int64_t* ns) {
+  if (s == "inf") {
+    *ns = kShinjukuInfiniteSlice;
+    return true;
+  }
+  absl::Duration d;
+  if (!absl::ParseDuration(s, &d) || d < absl::ZeroDuration()) {
+    return false;
+  }
+  *ns = ShinjukuSliceToNanos(d);
+  return true;
+}
+
+std::string SliceToString(int64_t ns) {
+  if (ns == kShinjukuUseDefaultSlice) {
+    return "default";
+  }
+  return absl::FormatDuration(ShinjukuSliceFromNanos(ns));
+}
+
+// Sends `request` to the agent listening on localhost at `port`. Returns false
+// if the agent cannot be reached.
+bool SendRequest(int port, const ShinjukuControlRequest& request,
+                 ShinjukuControlResponse* response) {
+  int fd = socket(AF_INET, SOCK_STREAM, 0);
+  if (fd < 0) {
+    perror("socket");
+    return false;
+  }
+
+  sockaddr_in addr = {};
+  addr.sin_family = AF_INET;
+  addr.sin_port = htons(port);
+  addr.sin_addr.s_addr = htonl(INADDR_LOOPBACK);
+  bool ok = connect(fd, reinterpret_cast<sockaddr*>(&addr), sizeof(addr)) == 0;
+  if (!ok) {
+    perror("connect");
+  } else {
+    ok = send(fd, &request, sizeof(request), 0) == sizeof(request) &&
+         recv(fd, response, sizeof(*response), MSG_WAITALL) ==
+             sizeof(*response);
+    if (!ok) {
+      fprintf(stderr, "Lost the connection to the agent\n");
+    }
+  }
+  close(fd);
+  return ok;
+}
+
+void PrintSlices(const ShinjukuTimeSlices& slices) {
+  printf("default: %s\n", SliceToString(slices.default_ns).c_str());
+  for (uint32_t qos = 0; qos < kShinjukuNumQoSLevels; qos++) {
+    if (slices.qos_ns[qos] != kShinjukuUseDefaultSlice) {
+      printf("qos %u: %s\n", qos, SliceToString(slices.qos_ns[qos]).c_str());
+    }
+  }
+  if (slices.controller_enabled) {
+    const ShinjukuSliceController::Params& p = slices.controller_params;
+    printf("controller: on (target wait %s, slice [%s, %s], period %s)\n",
+           absl::FormatDuration(absl::Nanoseconds(p.target_wait_ns)).c_str(),
+           absl::FormatDuration(absl::Nanoseconds(p.min_slice_ns)).c_str(),
+           absl::FormatDuration(absl::Nanoseconds(p.max_slice_ns)).c_str(),
+           absl::FormatDuration(absl::Nanoseconds(p.period_ns)).c_str());
+  } else {
+    printf("controller: off\n");
+  }
+}
+
+// Builds the request for the command in `args`. Returns false if the command
+// is malformed.
+bool ParseCommand(const std::vector<std::string>& args,
+                  ShinjukuControlRequest* request) {
+  if (args.empty()) {
+    return false;
+  }
+  const std::string& cmd = args[0];
+  if (cmd == "show" && args.size() == 1) {
+    request->req = kShinjukuRpcGetTimeSlices;
+    return true;
+  }
+  if (cmd == "debug_runqueue" && args.size() == 1) {
+    request->req = kShinjukuRpcDebugRunqueue;
+    return true;
+  }
+  if (cmd == "slice" && args.size() == 2) {
+    request->req = kShinjukuRpcSetTimeSlice;
+    request->arg1 = -1;
+    return ParseSlice(args[1], &request->arg0);
+  }
+  if (cmd == "qos_slice" && args.size() == 3) {
+    request->req = kShinjukuRpcSetTimeSlice;
+    uint32_t qos;
+    if (!absl::SimpleAtoi(args[1], &qos) || qos >= kShinjukuNumQoSLevels) {
+      return false;
+    }
+    request->arg1 = qos;
+    if (args[2] == "default") {
+      request->arg0 = kShinjukuUseDefaultSlice;
+      return true;
+    }
+    return ParseSlice(args[2], &request->arg0);
+  }
+  if (cmd == "controller" && args.size() == 2 && args[1] == "off") {
+    request->req = kShinjukuRpcSetSliceController;
+    request->arg0 = 0;
+    return true;
+  }
+  if (cmd == "controller" && args.size() >= 2 && args[1] == "on") {
+    request->req = kShinjukuRpcSetSliceController;
+    request->arg0 = 1;
+    ShinjukuSliceController::Params& p = request->slices.controller_params;
+    if (args.size() == 2) {
+      return true;
+    }
+    if (args.size() != 6) {
+      return false;
+    }
+    absl::Duration target, min_slice, max_slice, period;
+    if (!absl::ParseDuration(args[2], &target) ||
+        !absl::ParseDuration(args[3], &min_slice) ||
+        !absl::ParseDuration(args[4], &max_slice) ||
+        !absl::ParseDuration(args[5], &period) || min_slice > max_slice ||
+        min_slice <= absl::ZeroDuration() || period <= absl::ZeroDuration()) {
+      return false;
+    }
+    p.target_wait_ns = absl::ToInt64Nanoseconds(target);
+    p.min_slice_ns = absl::ToInt64Nanoseconds(min_slice);
+    p.max_slice_ns = absl::ToInt64Nanoseconds(max_slice);
+    p.period_ns = absl::ToInt64Nanoseconds(period);
+    return true;
+  }
+  return false;
+}
+
+}  // namespace
+}  // namespace ghost
+
+int main(int argc, char* argv[]) {
+  std::vector<char*> positional = absl::ParseCommandLine(argc, argv);
+  // Skip the program name.
+  std::vector<std::string> args(positional.begin() + 1, positional.end());
+
+  ghost::ShinjukuControlRequest request;
+  if (!ghost::ParseCommand(args, &request)) {
+    fprintf(stderr,
+            "Usage: %s [--port=N] show | slice <duration|inf> | "
+            "qos_slice <qos> <duration|inf|default> | controller off | "
+            "controller on [<target_wait> <min_slice> <max_slice> <period>] | "
+            "debug_runqueue\n",
+            argv[0]);
+    return 1;
+  }
+
+  ghost::ShinjukuControlResponse response;
+  if (!ghost::SendRequest(absl::GetFlag(FLAGS_port), request, &response)) {
+    return 1;
+  }
+  if (response.response_code != 0) {
+    fprintf(stderr, "The agent rejected the request (%ld)\n",
+            response.response_code);
+    return 1;
+  }
+  if (request.req == ghost::kShinjukuRpcGetTimeSlices) {
+    ghost::PrintSlices(response.slices);
+  }
+  return 0;
+}
@@ -0,0 +1,178 @@
+// Copyright 2021 Google LLC
+//
+// Use of this source code is governed by a BSD-style
+// license that can be found in the LICENSE file or at
+// https://developers.google.com/open-source/licenses/bsd
+
+// Runtime control of the Shinjuku agent: the RPCs understood by
+// `FullShinjukuAgent::RpcHandler`, the wire format used by `shinjuku_client` to
+// reach them through the agent's control port, and the optional controller that
+// adapts the preemption time slice to the observed runqueue wait times.
+//
+// This header has no dependencies on the agent library so that clients can
+// include it.
+
+#ifndef GHOST_SCHEDULERS_SHINJUKU_SHINJUKU_CONTROL_H
+#define GHOST_SCHEDULERS_SHINJUKU_SHINJUKU_CONTROL_H
+
+#include <algorithm>
+#include <cstdint>
+#include <limits>
+#include <optional>
+
+#include "absl/time/time.h"
+#include "lib/logging.h"
+#include "schedulers/shinjuku/shinjuku_runqueue.h"
+
+namespace ghost {
+
+// RPC request numbers for `FullShinjukuAgent::RpcHandler`.
+enum ShinjukuRpc : int64_t {
+  // Dumps the runqueue and all tasks on the next debug print.
+  kShinjukuRpcDebugRunqueue = 1,
+  // Sets a single time slice. `arg0` is the slice in nanoseconds (negative to
+  // clear a per-QoS override). `arg1` is the QoS level or -1 for the default
+  // slice.
+  kShinjukuRpcSetTimeSlice = 2,
+  // Replaces the default slice (if `default_ns` >= 0) and the whole per-QoS
+  // table with the `ShinjukuTimeSlices` serialized in the argument buffer.
+  kShinjukuRpcSetTimeSlices = 3,
+  // Returns the current `ShinjukuTimeSlices` in the response buffer.
+  kShinjukuRpcGetTimeSlices = 4,
+  // Turns the slice controller on (`arg0` != 0) or off. When turning it on,
+  // the argument buffer holds a `ShinjukuSliceController::Params`.
+  kShinjukuRpcSetSliceController = 5,
+  // Returns the global agent's `PhaseProfile` (lib/phase_profiler.h) in the
+  // response buffer.
+  kShinjukuRpcGetPhaseProfile = 6,
+};
+
+constexpr uint32_t kShinjukuNumQoSLevels = kNumQoSRunqueueLevels;
+
+// Time slices are exchanged as nanoseconds. `kShinjukuInfiniteSlice` stands for
+// `absl::InfiniteDuration()` (i.e., centralized queuing with no preemption) and
+// `kShinjukuUseDefaultSlice` marks a QoS level without an override.
+constexpr int64_t kShinjukuInfiniteSlice = std::numeric_limits<int64_t>::max();
+constexpr int64_t kShinjukuUseDefaultSlice = -1;
+
+inline int64_t ShinjukuSliceToNanos(absl::Duration slice) {
+  if (slice == absl::InfiniteDuration()) {
+    return kShinjukuInfiniteSlice;
+  }
+  return absl::ToInt64Nanoseconds(slice);
+}
+
+inline absl::Duration ShinjukuSliceFromNanos(int64_t ns) {
+  if (ns == kShinjukuInfiniteSlice) {
+    return absl::InfiniteDuration();
+  }
+  return absl::Nanoseconds(ns);
+}
+
+// Adapts the default preemption time slice so that the mean time that tasks
+// wait in the runqueue stays near `target_wait`. Waits above the target shrink
+// the slice (preempting long requests sooner so queued short requests can
+// run); waits well below the target grow it (fewer preemptions, less agent
+// overhead). The slice is kept within [`min_slice`, `max_slice`].
+//
+// Not thread-safe; owned by the global agent.
+class ShinjukuSliceController {
+ public:
+  struct Params {
+    int64_t target_wait_ns = 20'000;
+    int64_t min_slice_ns = 5'000;
+    int64_t max_slice_ns = 1'000'000;
+    int64_t period_ns = 10'000'000;
+
+    // Returns true if the controller can run with these params: all of them
+    // positive and `min_slice_ns` no larger than `max_slice_ns`.
+    bool Valid() const {
+      return target_wait_ns > 0 && min_slice_ns > 0 && period_ns > 0 &&
+             min_slice_ns <= max_slice_ns;
+    }
+  };
+
+  ShinjukuSliceController() : ShinjukuSliceController(Params()) {}
+  explicit ShinjukuSliceController(const Params& params) : params_(params) {
+    CHECK(params_.Valid());
+  }
+
+  const Params& params() const { return params_; }
+
+  void AddWait(absl::Duration wait) {
+    wait_sum_ += wait;
+    num_waits_++;
+  }
+
+  // Returns a new slice if a period has elapsed since the last adjustment and
+  // the observed waits call for a change. Otherwise returns `std::nullopt`.
+  std::optional<absl::Duration> MaybeAdjust(absl::Time now,
+                                            absl::Duration current) {
+    if (now - last_adjust_ < absl::Nanoseconds(params_.period_ns)) {
+      return std::nullopt;
+    }
+    last_adjust_ = now;
+    if (num_waits_ == 0) {
+      return std::nullopt;
+    }
+
+    const absl::Duration mean_wait = wait_sum_ / num_waits_;
+    wait_sum_ = absl::ZeroDuration();
+    num_waits_ = 0;
+
+    const absl::Duration min_slice = absl::Nanoseconds(params_.min_slice_ns);
+    const absl::Duration max_slice = absl::Nanoseconds(params_.max_slice_ns);
+    const absl::Duration target = absl::Nanoseconds(params_.target_wait_ns);
+    absl::Duration slice = std::clamp(current, min_slice, max_slice);
+    if (mean_wait > target) {
+      slice = slice * 3 / 4;
+    } else if (mean_wait < target / 2) {
+      slice = slice * 5 / 4;
+    }
+    slice = std::clamp(slice, min_slice, max_slice);
+    if (slice == current) {
+      return std::nullopt;
+    }
+    return slice;
+  }
+
+ private:
+  const Params params_;
+  absl::Duration wait_sum_ = absl::ZeroDuration();
+  int64_t num_waits_ = 0;
+  absl::Time last_adjust_ = absl::InfinitePast();
+};
+
+// The time slices in effect. Serialized in the RPC buffers.
+struct ShinjukuTimeSlices {
+  int64_t default_ns = kShinjukuUseDefaultSlice;
+  int64_t qos_ns[kShinjukuNumQoSLevels];
+  bool controller_enabled = false;
+  ShinjukuSliceController::Params controller_params;
+
+  ShinjukuTimeSlices() {
+    std::fill_n(qos_ns, kShinjukuNumQoSLevels, kShinjukuUseDefaultSlice);
+  }
+};
+
+// The Shinjuku agent binary accepts TCP connections on localhost at
+// `--control_port` and forwards each `ShinjukuControlRequest` to the agent as
+// an RPC, replying with a `ShinjukuControlResponse`. Both structs are sent raw;
+// the client and agent must run on the same machine and build.
+constexpr int kShinjukuControlPort = 8100;
+
+struct ShinjukuControlRequest {
+  int64_t req = 0;
+  int64_t arg0 = 0;
+  int64_t arg1 = 0;
+  ShinjukuTimeSlices slices;
+};
+
+struct ShinjukuControlResponse {
+  int64_t response_code = -1;
+  ShinjukuTimeSlices slices;
+};
+
+}  // namespace ghost
+
+#endif  // GHOST_SCHEDULERS_SHINJUKU_SHINJUKU_CONTROL_H
@@ -41,28 +41,19 @@ void ShinjukuOrchestrator::RefreshAllSchedParams(
 
 void ShinjukuOrchestrator::RefreshSchedParams(
     const SchedCallbackFunc& SchedCallback) {
-  int updatedIndex;
-
-  // Limit the number of iterations that we do before exiting this function. If
-  // we were to replace this for loop with a while true loop, a malicious or
-  // malfunctioning application could repeatedly overflow the stream and cause
-  // the agent to get stuck in an infinite loop. The for loop we have right now
-  // iterates up to 'table_.hdr()->st_cap' times, which is enough times to drain
-  // a full stream. Additionally, if there are multiple overflows, the first
-  // overflow will be picked up here and subsequent overflows will be handled in
-  // future calls to this function.
-  for (uint32_t i = 0; i < table_.hdr()->st_cap; i++) {
-    updatedIndex = table_.NextUpdatedIndex();
-    if (updatedIndex >= 0 && updatedIndex < num_sched_items_) {
-      RefreshSchedParam(updatedIndex, SchedCallback);
-    } else if (updatedIndex == PrioTable::kStreamOverflow) {
-      RefreshAllSchedParams(SchedCallback);
-      break;
-    } else if (updatedIndex == PrioTable::kStreamNoEntries) {
-      break;
+  // Drain the stream and the batch bitmap in one pass. Each entry is visited
+  // at most once, so a malicious or malfunctioning application that keeps
+  // marking sched items as updated cannot keep the agent here. Updates that
+  // race with the pass are picked up in future calls to this function.
+  const bool drained = table_.DrainUpdatedIndices([&](int idx) {
+    if (idx >= 0 && idx < num_sched_items_) {
+      RefreshSchedParam(idx, SchedCallback);
     } else {
       GHOST_ERROR("Dequeued unknown value from the stream");
     }
+  });
+  if (!drained) {
+    RefreshAllSchedParams(SchedCallback);
   }
 }
 
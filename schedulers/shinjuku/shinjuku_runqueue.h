@@ -0,0 +1,226 @@
+// Copyright 2021 Google LLC
+//
+// Use of this source code is governed by a BSD-style
+// license that can be found in the LICENSE file or at
+// https://developers.google.com/open-source/licenses/bsd
+
+#ifndef GHOST_SCHEDULERS_SHINJUKU_SHINJUKU_RUNQUEUE_H
+#define GHOST_SCHEDULERS_SHINJUKU_SHINJUKU_RUNQUEUE_H
+
+#include <algorithm>
+#include <cstddef>
+#include <cstdint>
+
+#include "lib/logging.h"
+
+namespace ghost {
+
+// A hook embedded in an element so that the element can be linked into an
+// `IntrusiveFifo`. An element needs one hook per list that it can be on at the
+// same time. `tag` is opaque to the list and may be used by the owner of the
+// list (e.g., `QosRunqueue` records the QoS level the element was queued at).
+template <class T>
+struct IntrusiveFifoHook {
+  T* prev = nullptr;
+  T* next = nullptr;
+  bool linked = false;
+  uint32_t tag = 0;
+};
+
+// A doubly-linked FIFO whose links live inside the elements themselves, so that
+// insertion and removal (from any position) are O(1) and never allocate.
+//
+// Example:
+// struct Elem {
+//   IntrusiveFifoHook<Elem> hook;
+// };
+// IntrusiveFifo<Elem, &Elem::hook> fifo;
+// Elem e;
+// fifo.PushBack(&e);
+// CHECK_EQ(fifo.Front(), &e);
+// fifo.Remove(&e);
+// CHECK(fifo.Empty());
+template <class T, IntrusiveFifoHook<T> T::*Hook>
+class IntrusiveFifo {
+ public:
+  IntrusiveFifo() = default;
+  IntrusiveFifo(const IntrusiveFifo&) = delete;
+  IntrusiveFifo& operator=(const IntrusiveFifo&) = delete;
+
+  bool Empty() const { return head_ == nullptr; }
+  size_t Size() const { return size_; }
+  T* Front() const { return head_; }
+
+  // Returns true if `elem` is currently linked via this list's hook. Note that
+  // this does not distinguish between different lists sharing the same hook.
+  static bool Linked(const T* elem) { return (elem->*Hook).linked; }
+
+  void PushBack(T* elem) {
+    IntrusiveFifoHook<T>& h = elem->*Hook;
+    DCHECK(!h.linked);
+    h.prev = tail_;
+    h.next = nullptr;
+    h.linked = true;
+    if (tail_) {
+      (tail_->*Hook).next = elem;
+    } else {
+      head_ = elem;
+    }
+    tail_ = elem;
+    size_++;
+  }
+
+  void PushFront(T* elem) {
+    IntrusiveFifoHook<T>& h = elem->*Hook;
+    DCHECK(!h.linked);
+    h.prev = nullptr;
+    h.next = head_;
+    h.linked = true;
+    if (head_) {
+      (head_->*Hook).prev = elem;
+    } else {
+      tail_ = elem;
+    }
+    head_ = elem;
+    size_++;
+  }
+
+  // Removes and returns the element at the front of the list, or nullptr if the
+  // list is empty.
+  T* PopFront() {
+    T* elem = head_;
+    if (elem) {
+      Remove(elem);
+    }
+    return elem;
+  }
+
+  // Unlinks `elem`, which must be on this list.
+  void Remove(T* elem) {
+    IntrusiveFifoHook<T>& h = elem->*Hook;
+    DCHECK(h.linked);
+    DCHECK_GT(size_, 0);
+    if (h.prev) {
+      (h.prev->*Hook).next = h.next;
+    } else {
+      head_ = h.next;
+    }
+    if (h.next) {
+      (h.next->*Hook).prev = h.prev;
+    } else {
+      tail_ = h.prev;
+    }
+    h.prev = nullptr;
+    h.next = nullptr;
+    h.linked = false;
+    size_--;
+  }
+
+  // Calls `f(elem)` on each element from front to back. `f` may remove the
+  // element it is passed (but no other element) from the list.
+  template <class F>
+  void ForEach(F f) {
+    for (T* elem = head_; elem;) {
+      T* next = (elem->*Hook).next;
+      f(elem);
+      elem = next;
+    }
+  }
+
+ private:
+  T* head_ = nullptr;
+  T* tail_ = nullptr;
+  size_t size_ = 0;
+};
+
+// The number of QoS levels that a `QosRunqueue` distinguishes.
+constexpr uint32_t kNumQoSRunqueueLevels = 64;
+
+// A runqueue made of one FIFO per QoS level along with a bitmap of the levels
+// that have at least one element queued. Finding the highest non-empty QoS
+// level is a single count-leading-zeros instruction and every operation is
+// O(1), independent of the number of QoS levels in use or the number of queued
+// elements.
+//
+// QoS values at or above `kNumQoSLevels` are clamped to the highest level.
+template <class T, IntrusiveFifoHook<T> T::*Hook>
+class QosRunqueue {
+ public:
+  static constexpr uint32_t kNumQoSLevels = kNumQoSRunqueueLevels;
+
+  static constexpr uint32_t Level(uint32_t qos) {
+    return std::min(qos, kNumQoSLevels - 1);
+  }
+
+  bool Empty() const { return nonempty_ == 0; }
+  size_t Size() const { return size_; }
+
+  // Returns the QoS level the element was enqueued at.
+  static uint32_t QueuedLevel(const T* elem) { return (elem->*Hook).tag; }
+
+  // Adds `elem` to the FIFO for `qos`, either at the back (`back` == true) or
+  // at the front.
+  void Enqueue(T* elem, uint32_t qos, bool back = true) {
+    const uint32_t level = Level(qos);
+    if (back) {
+      fifos_[level].PushBack(elem);
+    } else {
+      fifos_[level].PushFront(elem);
+    }
+    (elem->*Hook).tag = level;
+    nonempty_ |= uint64_t{1} << level;
+    size_++;
+  }
+
+  // Returns (but does not remove) the front element of the highest non-empty
+  // QoS level, or nullptr if the runqueue is empty.
+  T* Peek() const {
+    if (Empty()) {
+      return nullptr;
+    }
+    return fifos_[HighestLevel()].Front();
+  }
+
+  // Removes and returns the front element of the highest non-empty QoS level,
+  // or nullptr if the runqueue is empty.
+  T* Dequeue() {
+    if (Empty()) {
+      return nullptr;
+    }
+    const uint32_t level = HighestLevel();
+    T* elem = fifos_[level].PopFront();
+    if (fifos_[level].Empty()) {
+      nonempty_ &= ~(uint64_t{1} << level);
+    }
+    size_--;
+    return elem;
+  }
+
+  // Unlinks `elem`, which must be queued on this runqueue.
+  void Remove(T* elem) {
+    const uint32_t level = QueuedLevel(elem);
+    DCHECK_LT(level, kNumQoSLevels);
+    fifos_[level].Remove(elem);
+    if (fifos_[level].Empty()) {
+      nonempty_ &= ~(uint64_t{1} << level);
+    }
+    size_--;
+  }
+
+ private:
+  static_assert(kNumQoSLevels == 64, "`nonempty_` is a single 64-bit word");
+
+  // Requires a non-empty runqueue.
+  uint32_t HighestLevel() const {
+    DCHECK_NE(nonempty_, 0);
+    return 63 - __builtin_clzll(nonempty_);
+  }
+
+  IntrusiveFifo<T, Hook> fifos_[kNumQoSLevels];
+  uint64_t nonempty_ = 0;
+  size_t size_ = 0;
+};
+
+}  // namespace ghost
+
+#endif  // GHOST_SCHEDULERS_SHINJUKU_SHINJUKU_RUNQUEUE_H
@@ -41,7 +41,10 @@ ShinjukuScheduler::ShinjukuScheduler(
     : BasicDispatchScheduler(enclave, std::move(cpulist), std::move(allocator)),
       global_cpu_(global_cpu),
       global_channel_(GHOST_MAX_QUEUE_ELEMS, /*node=*/0),
-      preemption_time_slice_(preemption_time_slice) {
+      default_slice_ns_(ShinjukuSliceToNanos(preemption_time_slice)) {
+  for (std::atomic<int64_t>& qos_ns : qos_slice_ns_) {
+    qos_ns.store(kShinjukuUseDefaultSlice, std::memory_order_relaxed);
+  }
   if (!cpus().IsSet(global_cpu_)) {
     Cpu c = cpus().Front();
     CHECK(c.valid());
@@ -207,6 +210,7 @@ void ShinjukuScheduler::TaskDeparted(ShinjukuTask* task, const Message& msg) {
   } else {
     CHECK(task->blocked() || task->paused());
   }
+  RemoveFromPausedRepeatables(task);
 
   allocator()->FreeTask(task);
   num_tasks_--;
@@ -214,6 +218,7 @@ void ShinjukuScheduler::TaskDeparted(ShinjukuTask* task, const Message& msg) {
 
 void ShinjukuScheduler::TaskDead(ShinjukuTask* task, const Message& msg) {
   CHECK_EQ(task->run_state, ShinjukuTask::RunState::kBlocked);
+  RemoveFromPausedRepeatables(task);
   allocator()->FreeTask(task);
 
   num_tasks_--;
@@ -317,19 +322,23 @@ void ShinjukuScheduler::Yield(ShinjukuTask* task) {
   // GlobalSchedule()).
   CHECK(task->oncpu() || task->queued());
   task->run_state = ShinjukuTask::RunState::kYielding;
-  yielding_tasks_.emplace_back(task);
+  yielding_tasks_.PushBack(task);
 }
 
 void ShinjukuScheduler::Unyield(ShinjukuTask* task) {
   CHECK(task->yielding());
 
-  auto it = std::find(yielding_tasks_.begin(), yielding_tasks_.end(), task);
-  CHECK(it != yielding_tasks_.end());
-  yielding_tasks_.erase(it);
+  yielding_tasks_.Remove(task);
 
   Enqueue(task);
 }
 
+void ShinjukuScheduler::RemoveFromPausedRepeatables(ShinjukuTask* task) {
+  if (paused_repeatables_.Linked(task)) {
+    paused_repeatables_.Remove(task);
+  }
+}
+
 void ShinjukuScheduler::Enqueue(ShinjukuTask* task, bool back) {
   CHECK_EQ(task->unschedule_level,
            ShinjukuTask::UnscheduleLevel::kNoUnschedule);
@@ -340,36 +349,35 @@ void ShinjukuScheduler::Enqueue(ShinjukuTask* task, bool back) {
     return;
   }
 
+  // A repeatable that is made runnable by any path is no longer paused.
+  RemoveFromPausedRepeatables(task);
+
   task->run_state = ShinjukuTask::RunState::kQueued;
-  if (back && !task->prio_boost) {
-    run_queue_[task->sp->GetQoS()].emplace_back(task);
-  } else {
-    run_queue_[task->sp->GetQoS()].emplace_front(task);
+  if (controller_ && task->queued_since == absl::InfinitePast()) {
+    task->queued_since = absl::Now();
   }
+  run_queue_.Enqueue(task, task->sp->GetQoS(), back && !task->prio_boost);
 }
 
 ShinjukuTask* ShinjukuScheduler::Dequeue() {
-  if (RunqueueEmpty()) {
+  ShinjukuTask* task = run_queue_.Dequeue();
+  if (!task) {
     return nullptr;
   }
 
-  std::deque<ShinjukuTask*>& rq = run_queue_[FirstFilledRunqueue()];
-  struct ShinjukuTask* task = rq.front();
-  CHECK_NE(task, nullptr);
   CHECK(task->has_work);
   CHECK_EQ(task->unschedule_level,
            ShinjukuTask::UnscheduleLevel::kNoUnschedule);
-  rq.pop_front();
 
   return task;
 }
 
 ShinjukuTask* ShinjukuScheduler::Peek() {
-  if (RunqueueEmpty()) {
+  ShinjukuTask* task = run_queue_.Peek();
+  if (!task) {
     return nullptr;
   }
 
-  ShinjukuTask* task = run_queue_[FirstFilledRunqueue()].front();
   CHECK(task->has_work);
   CHECK_EQ(task->unschedule_level,
            ShinjukuTask::UnscheduleLevel::kNoUnschedule);
@@ -380,18 +388,9 @@ ShinjukuTask* ShinjukuScheduler::Peek() {
 void ShinjukuScheduler::RemoveFromRunqueue(ShinjukuTask* task) {
   CHECK(task->queued());
 
-  for (auto& [qos, rq] : run_queue_) {
-    for (int pos = rq.size() - 1; pos >= 0; pos--) {
-      // The [] operator for 'std::deque' is constant time
-      if (rq[pos] == task) {
-        task->run_state = ShinjukuTask::RunState::kPaused;
-        rq.erase(rq.cbegin() + pos);
-        return;
-      }
-    }
-  }
-  // This state is unreachable because the task is queued
-  CHECK(false);
+  run_queue_.Remove(task);
+  task->run_state = ShinjukuTask::RunState::kPaused;
+  task->queued_since = absl::InfinitePast();
 }
 
 void ShinjukuScheduler::UnscheduleTask(ShinjukuTask* task) {
@@ -571,8 +570,8 @@ void ShinjukuScheduler::SchedParamsCallback(ShinjukuOrchestrator& orch,
             (task->oncpu() &&
              task->unschedule_level ==
                  ShinjukuTask::UnscheduleLevel::kMustUnschedule));
-      if (orch.Repeating(task->sp)) {
-        paused_repeatables_.push_back(task);
+      if (orch.Repeating(task->sp) && !paused_repeatables_.Linked(task)) {
+        paused_repeatables_.PushBack(task);
       }
     }
   }
@@ -615,6 +614,7 @@ void ShinjukuScheduler::GlobalSchedule(const StatusWord& agent_sw,
   // List of CPUs with open transactions.
   CpuList open_cpus = MachineTopology()->EmptyCpuList();
   const absl::Time now = absl::Now();
+  uint64_t t = PhaseProfiler::Now();
   // TODO: Refactor this loop
   for (int i = 0; i < 2; i++) {
     CpuList updated_cpus = MachineTopology()->EmptyCpuList();
@@ -649,7 +649,7 @@ void ShinjukuScheduler::GlobalSchedule(const StatusWord& agent_sw,
           if (current_qos < peek_qos) {
             should_preempt = true;
           } else if (current_qos == peek_qos) {
-            if (elapsed_runtime >= preemption_time_slice_ &&
+            if (elapsed_runtime >= TimeSliceFor(cs->current) &&
                 cs->current->orch &&
                 !cs->current->orch->Repeating(cs->current->sp)) {
               should_preempt = true;
@@ -754,10 +754,13 @@ void ShinjukuScheduler::GlobalSchedule(const StatusWord& agent_sw,
       open_cpus.Set(cpu.id());
     }
   }
+  t = phase_profiler_.Lap(PhaseProfile::kPick, t);
   if (!open_cpus.Empty()) {
     enclave()->CommitRunRequests(open_cpus);
+    t = phase_profiler_.Lap(PhaseProfile::kCommit, t);
   }
 
+  bool failed = false;
   for (const Cpu& cpu : open_cpus) {
     CpuState* cs = cpu_state(cpu);
     ShinjukuTask* next = cs->next;
@@ -793,7 +796,12 @@ void ShinjukuScheduler::GlobalSchedule(const StatusWord& agent_sw,
       // this task
       next->elapsed_runtime = absl::ZeroDuration();
       next->last_ran = absl::Now();
+      if (controller_ && next->queued_since != absl::InfinitePast()) {
+        controller_->AddWait(next->last_ran - next->queued_since);
+      }
+      next->queued_since = absl::InfinitePast();
     } else {
+      failed = true;
       // Need to requeue in the stale case.
       Enqueue(next, /* back = */ false);
       if (cs->current && cs->current->unschedule_level >=
@@ -807,33 +815,110 @@ void ShinjukuScheduler::GlobalSchedule(const StatusWord& agent_sw,
       }
     }
   }
+  if (failed) {
+    // The whole pass over the committed cpus, which is what a failure costs us.
+    phase_profiler_.Lap(PhaseProfile::kCommitFailure, t);
+  }
 
   // Yielding tasks are moved back to the runqueue having skipped one round
   // of scheduling decisions.
-  if (!yielding_tasks_.empty()) {
-    for (ShinjukuTask* t : yielding_tasks_) {
-      CHECK_EQ(t->run_state, ShinjukuTask::RunState::kYielding);
-      Enqueue(t);
-    }
-    yielding_tasks_.clear();
+  while (ShinjukuTask* t = yielding_tasks_.PopFront()) {
+    CHECK_EQ(t->run_state, ShinjukuTask::RunState::kYielding);
+    Enqueue(t);
   }
   // Check to see if any repeatables are eligible to run
-  for (auto it = paused_repeatables_.begin();
-       it != paused_repeatables_.end();) {
-    ShinjukuTask* task = *it;
+  paused_repeatables_.ForEach([this](ShinjukuTask* task) {
     CHECK_NE(task->orch, nullptr);
     absl::Duration wait = absl::Now() - task->last_ran;
     if (wait >= task->orch->GetWorkClassPeriod(task->sp->GetWorkClass())) {
-      // The repeatable should run again
+      // The repeatable should run again. `Enqueue` takes it off the list of
+      // paused repeatables.
       task->orch->MakeEngineRunnable(task->sp);
       task->has_work = true;
       Enqueue(task);
-      // 'erase' returns an iterator to the next element in the vector
-      it = paused_repeatables_.erase(it);
+    }
+  });
+
+  RunSliceController(now);
+}
+
+bool ShinjukuScheduler::SetTimeSlice(int64_t ns, int64_t qos) {
+  if (qos < 0) {
+    if (ns < 0) {
+      return false;
+    }
+    default_slice_ns_.store(ns, std::memory_order_relaxed);
+    return true;
+  }
+  if (qos >= kShinjukuNumQoSLevels) {
+    return false;
+  }
+  qos_slice_ns_[qos].store(ns < 0 ? kShinjukuUseDefaultSlice : ns,
+                           std::memory_order_relaxed);
+  return true;
+}
+
+void ShinjukuScheduler::SetTimeSlices(const ShinjukuTimeSlices& slices) {
+  if (slices.default_ns >= 0) {
+    default_slice_ns_.store(slices.default_ns, std::memory_order_relaxed);
+  }
+  for (uint32_t qos = 0; qos < kShinjukuNumQoSLevels; qos++) {
+    const int64_t ns = slices.qos_ns[qos];
+    qos_slice_ns_[qos].store(ns < 0 ? kShinjukuUseDefaultSlice : ns,
+                             std::memory_order_relaxed);
+  }
+}
+
+ShinjukuTimeSlices ShinjukuScheduler::GetTimeSlices() {
+  ShinjukuTimeSlices slices;
+  slices.default_ns = default_slice_ns_.load(std::memory_order_relaxed);
+  for (uint32_t qos = 0; qos < kShinjukuNumQoSLevels; qos++) {
+    slices.qos_ns[qos] = qos_slice_ns_[qos].load(std::memory_order_relaxed);
+  }
+  // Report the most recent request. The global agent applies it on its next
+  // scheduling round.
+  absl::MutexLock lock(&controller_mu_);
+  slices.controller_enabled = pending_controller_enabled_;
+  slices.controller_params = pending_controller_params_;
+  return slices;
+}
+
+bool ShinjukuScheduler::SetSliceController(
+    bool enable, const ShinjukuSliceController::Params& params) {
+  // Reject bad params here, on the RPC thread, rather than let them reach the
+  // global agent.
+  if (enable && !params.Valid()) {
+    return false;
+  }
+  absl::MutexLock lock(&controller_mu_);
+  pending_controller_enabled_ = enable;
+  pending_controller_params_ = params;
+  controller_changed_.store(true, std::memory_order_release);
+  return true;
+}
+
+void ShinjukuScheduler::RunSliceController(absl::Time now) {
+  if (ABSL_PREDICT_FALSE(controller_changed_.load(std::memory_order_acquire))) {
+    absl::MutexLock lock(&controller_mu_);
+    controller_changed_.store(false, std::memory_order_relaxed);
+    if (pending_controller_enabled_) {
+      controller_ =
+          std::make_unique<ShinjukuSliceController>(pending_controller_params_);
     } else {
-      it++;
+      controller_.reset();
     }
   }
+  if (!controller_) {
+    return;
+  }
+
+  const absl::Duration current =
+      ShinjukuSliceFromNanos(default_slice_ns_.load(std::memory_order_relaxed));
+  if (std::optional<absl::Duration> slice =
+          controller_->MaybeAdjust(now, current)) {
+    default_slice_ns_.store(ShinjukuSliceToNanos(*slice),
+                            std::memory_order_relaxed);
+  }
 }
 
 void ShinjukuScheduler::PickNextGlobalCPU(BarrierToken agent_barrier) {
@@ -904,11 +989,16 @@ void ShinjukuAgent::AgentThread() {
         continue;
       }
 
+      PhaseProfiler& profiler = global_scheduler_->phase_profiler();
+      const uint64_t dispatch_start = PhaseProfiler::Now();
       Message msg;
+      uint64_t nr_msgs = 0;
       while (!(msg = global_channel.Peek()).empty()) {
         global_scheduler_->DispatchMessage(msg);
         global_channel.Consume(msg);
+        nr_msgs++;
       }
+      profiler.Lap(PhaseProfile::kDispatch, dispatch_start);
 
       // Order matters here: when a worker is PAUSED we defer the
       // preemption until GlobalSchedule() hoping to combine the
@@ -919,6 +1009,7 @@ void ShinjukuAgent::AgentThread() {
       global_scheduler_->UpdateSchedParams();
 
       global_scheduler_->GlobalSchedule(status_word(), agent_barrier);
+      profiler.EndIteration(nr_msgs);
 
       if (verbose() && debug_out.Edge()) {
         static const int flags =
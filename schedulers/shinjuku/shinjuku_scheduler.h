@@ -7,16 +7,20 @@
 #ifndef GHOST_SCHEDULERS_SHINJUKU_SHINJUKU_SCHEDULER_H
 #define GHOST_SCHEDULERS_SHINJUKU_SHINJUKU_SCHEDULER_H
 
+#include <atomic>
 #include <cstdint>
-#include <map>
 #include <memory>
 
 #include "absl/container/flat_hash_map.h"
 #include "absl/functional/bind_front.h"
+#include "absl/synchronization/mutex.h"
 #include "absl/time/time.h"
 #include "lib/agent.h"
+#include "lib/phase_profiler.h"
 #include "lib/scheduler.h"
+#include "schedulers/shinjuku/shinjuku_control.h"
 #include "schedulers/shinjuku/shinjuku_orchestrator.h"
+#include "schedulers/shinjuku/shinjuku_runqueue.h"
 #include "shared/prio_table.h"
 
 namespace ghost {
@@ -116,6 +120,9 @@ struct ShinjukuTask : public Task<> {
   absl::Duration elapsed_runtime;
   // The time that the task was last scheduled.
   absl::Time last_ran = absl::UnixEpoch();
+  // The time that the task entered the runqueue. Only tracked while the slice
+  // controller is enabled; `absl::InfinitePast()` otherwise.
+  absl::Time queued_since = absl::InfinitePast();
 
   // Whether the last execution was preempted or not.
   bool preempted = false;
@@ -128,6 +135,12 @@ struct ShinjukuTask : public Task<> {
   // Indicates whether there is a pending deferred unschedule for this task, and
   // if so, whether the unschedule could optionally happen or must happen.
   UnscheduleLevel unschedule_level = UnscheduleLevel::kNoUnschedule;
+
+  // Links the task into the runqueue (when kQueued) or into the list of
+  // yielding tasks (when kYielding). A task is never in both at once.
+  IntrusiveFifoHook<ShinjukuTask> rq_hook;
+  // Links the task into the list of paused repeatables.
+  IntrusiveFifoHook<ShinjukuTask> repeatable_hook;
 };
 
 // Implements the global agent policy layer and the Shinjuku scheduling
@@ -196,7 +209,32 @@ class ShinjukuScheduler : public BasicDispatchScheduler<ShinjukuTask> {
   void DumpState(const Cpu& cpu, int flags) final;
   std::atomic<bool> debug_runqueue_ = false;
 
-  static constexpr int kDebugRunqueue = 1;
+  static constexpr int kDebugRunqueue = kShinjukuRpcDebugRunqueue;
+
+  // Sets the preemption time slice to `ns` nanoseconds, either the default
+  // (`qos` < 0) or the one for tasks at QoS level `qos`. A negative `ns`
+  // removes the override for `qos`. Returns false if the arguments are invalid.
+  // May be called from any thread; takes effect on the next scheduling round.
+  bool SetTimeSlice(int64_t ns, int64_t qos);
+
+  // Sets the default time slice (unless `slices.default_ns` is negative) and
+  // replaces the per-QoS time slices. May be called from any thread.
+  void SetTimeSlices(const ShinjukuTimeSlices& slices);
+
+  // Returns the time slices currently in effect and the controller state.
+  ShinjukuTimeSlices GetTimeSlices();
+
+  // Turns the slice controller on with `params` or off. While on, the
+  // controller periodically adjusts the default time slice. Returns false,
+  // changing nothing, if `enable` is true and `params` are not valid. May be
+  // called from any thread.
+  bool SetSliceController(bool enable,
+                          const ShinjukuSliceController::Params& params);
+
+  // Per-phase histograms of the global agent's loop. The agent thread records
+  // into it; any thread may take a snapshot.
+  PhaseProfiler& phase_profiler() { return phase_profiler_; }
+  PhaseProfile GetPhaseProfile() const { return phase_profiler_.Snapshot(); }
 
  private:
   struct CpuState {
@@ -254,32 +292,30 @@ class ShinjukuScheduler : public BasicDispatchScheduler<ShinjukuTask> {
 
   CpuState* cpu_state(const Cpu& cpu) { return &cpu_states_[cpu.id()]; }
 
-  size_t RunqueueSize() const {
-    size_t size = 0;
-    for (const auto& [qos, rq] : run_queue_) {
-      size += rq.size();
-    }
-    return size;
-  }
+  size_t RunqueueSize() const { return run_queue_.Size(); }
 
-  bool RunqueueEmpty() const { return RunqueueSize() == 0; }
+  bool RunqueueEmpty() const { return run_queue_.Empty(); }
 
-  // Returns the highest-QoS runqueue that has at least one task enqueued.
-  // Must call this on a non-empty runqueue.
-  uint32_t FirstFilledRunqueue() const {
-    for (auto it = run_queue_.rbegin(); it != run_queue_.rend(); it++) {
-      if (!it->second.empty()) {
-        return it->first;
-      }
+  // Removes 'task' from the list of paused repeatables if it is on it.
+  void RemoveFromPausedRepeatables(ShinjukuTask* task);
+
+  // Returns the preemption time slice that applies to 'task'.
+  absl::Duration TimeSliceFor(const ShinjukuTask* task) const {
+    const int64_t qos_ns =
+        qos_slice_ns_[QosRunqueue<ShinjukuTask, &ShinjukuTask::rq_hook>::Level(
+                          task->sp->GetQoS())]
+            .load(std::memory_order_relaxed);
+    if (qos_ns >= 0) {
+      return ShinjukuSliceFromNanos(qos_ns);
     }
-    // A precondition for this method is that the runqueue must be non-empty, so
-    // if we get down here, that precondition was not upheld.
-    CHECK(false);
-    // Return something so that the compiler doesn't complain, but we will never
-    // execute this return statement due to the 'CHECK(false)' above.
-    return std::numeric_limits<uint32_t>::max();
+    return ShinjukuSliceFromNanos(
+        default_slice_ns_.load(std::memory_order_relaxed));
   }
 
+  // Applies any pending controller change from 'SetSliceController' and lets
+  // the controller adjust the default time slice.
+  void RunSliceController(absl::Time now);
+
   CpuState cpu_states_[MAX_CPUS];
 
   std::atomic<int32_t> global_cpu_;
@@ -287,16 +323,32 @@ class ShinjukuScheduler : public BasicDispatchScheduler<ShinjukuTask> {
   int num_tasks_ = 0;
   bool in_discovery_ = false;
 
-  // Map from QoS level to runqueue
-  // We use an 'std::map' rather than 'absl::flat_hash_map' because we need to
-  // iterate on the map in order of QoS level.
-  std::map<uint32_t, std::deque<ShinjukuTask*>> run_queue_;
-  std::vector<ShinjukuTask*> paused_repeatables_;
-  std::vector<ShinjukuTask*> yielding_tasks_;
+  // One FIFO per QoS level. Picking the next task is a bitmap lookup and
+  // removing an arbitrary task is O(1) since the links live in the task.
+  QosRunqueue<ShinjukuTask, &ShinjukuTask::rq_hook> run_queue_;
+  IntrusiveFifo<ShinjukuTask, &ShinjukuTask::repeatable_hook>
+      paused_repeatables_;
+  IntrusiveFifo<ShinjukuTask, &ShinjukuTask::rq_hook> yielding_tasks_;
   absl::flat_hash_map<pid_t, std::shared_ptr<ShinjukuOrchestrator>> orchs_;
   const ShinjukuOrchestrator::SchedCallbackFunc kSchedCallbackFunc =
       absl::bind_front(&ShinjukuScheduler::SchedParamsCallback, this);
-  const absl::Duration preemption_time_slice_;
+
+  // Time slices in nanoseconds (see `ShinjukuSliceToNanos`). These are written
+  // by the RPC thread and the slice controller and read by the global agent.
+  std::atomic<int64_t> default_slice_ns_;
+  std::atomic<int64_t> qos_slice_ns_[kShinjukuNumQoSLevels];
+
+  // The slice controller is owned by the global agent. RPCs post a change in
+  // `pending_controller_` and set `controller_changed_`; the global agent picks
+  // it up in 'RunSliceController'.
+  std::unique_ptr<ShinjukuSliceController> controller_;
+  std::atomic<bool> controller_changed_ = false;
+  absl::Mutex controller_mu_;
+  bool pending_controller_enabled_ ABSL_GUARDED_BY(controller_mu_) = false;
+  ShinjukuSliceController::Params pending_controller_params_
+      ABSL_GUARDED_BY(controller_mu_);
+
+  PhaseProfiler phase_profiler_;
 };
 
 // Initializes the task allocator and the Shinjuku scheduler.
@@ -376,6 +428,51 @@ class FullShinjukuAgent : public FullAgent<EnclaveType> {
         global_scheduler_->debug_runqueue_ = true;
         response.response_code = 0;
         return;
+      case kShinjukuRpcSetTimeSlice:
+        response.response_code =
+            global_scheduler_->SetTimeSlice(args.arg0, args.arg1) ? 0 : -EINVAL;
+        return;
+      case kShinjukuRpcSetTimeSlices: {
+        absl::StatusOr<ShinjukuTimeSlices> slices =
+            args.buffer.Deserialize<ShinjukuTimeSlices>();
+        if (!slices.ok()) {
+          response.response_code = -EINVAL;
+          return;
+        }
+        global_scheduler_->SetTimeSlices(slices.value());
+        response.response_code = 0;
+        return;
+      }
+      case kShinjukuRpcGetTimeSlices:
+        response.response_code =
+            response.buffer.Serialize(global_scheduler_->GetTimeSlices()).ok()
+                ? 0
+                : -EINVAL;
+        return;
+      case kShinjukuRpcGetPhaseProfile:
+        response.response_code =
+            response.buffer.Serialize(global_scheduler_->GetPhaseProfile())
+                    .ok()
+                ? 0
+                : -EINVAL;
+        return;
+      case kShinjukuRpcSetSliceController: {
+        ShinjukuSliceController::Params params;
+        if (args.arg0) {
+          absl::StatusOr<ShinjukuSliceController::Params> p =
+              args.buffer.Deserialize<ShinjukuSliceController::Params>();
+          if (!p.ok()) {
+            response.response_code = -EINVAL;
+            return;
+          }
+          params = p.value();
+        }
+        response.response_code =
+            global_scheduler_->SetSliceController(args.arg0 != 0, params)
+                ? 0
+                : -EINVAL;
+        return;
+      }
       default:
         response.response_code = -1;
         return;
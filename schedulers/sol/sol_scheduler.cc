@@ -24,7 +24,8 @@ SolScheduler::SolScheduler(Enclave* enclave, CpuList cpulist,
     : BasicDispatchScheduler(enclave, std::move(cpulist), std::move(allocator)),
       global_cpu_(global_cpu),
       global_channel_(GHOST_MAX_QUEUE_ELEMS, numa_node),
-      preemption_time_slice_(preemption_time_slice) {
+      preemption_time_slice_(preemption_time_slice),
+      preemption_ticks_(TscClock::FromDuration(preemption_time_slice)) {
   if (!cpus().IsSet(global_cpu_)) {
     Cpu c = cpus().Front();
     CHECK(c.valid());
@@ -53,9 +54,11 @@ bool SolScheduler::Available(const Cpu& cpu) {
 void SolScheduler::DumpStats() {
   fprintf(stderr, "\n------------------------------------------------\n");
 
-  float t_d = absl::ToDoubleMicroseconds(dispatch_durations_total_) /
+  float t_d = absl::ToDoubleMicroseconds(
+                  TscClock::ToDuration(dispatch_ticks_total_)) /
                 iterations_;
-  float t_t = absl::ToDoubleMicroseconds(schedule_durations_total_) /
+  float t_t = absl::ToDoubleMicroseconds(
+                  TscClock::ToDuration(schedule_ticks_total_)) /
                 iterations_;
   float t_a = t_t - t_d;
   float msg_per_iter = 1.0 * nr_msgs_ / iterations_;
@@ -69,6 +72,8 @@ void SolScheduler::DumpStats() {
           "A/S = T_d/T_t: %.2f, Computed S: %.2f, L: %.2f\n",
           t_d / t_t, A * t_t / t_d, t_a * A);
 
+  GetPhaseProfile().Print(stderr);
+
   fprintf(stderr, "------------------------------------------------\n");
 }
 
@@ -384,6 +389,7 @@ void SolScheduler::GlobalSchedule(const StatusWord& agent_sw,
   const int global_cpu_id = GetGlobalCPUId();
   CpuList available = topology()->EmptyCpuList();
   CpuList assigned = topology()->EmptyCpuList();
+  uint64_t t = PhaseProfiler::Now();
 
   for (const Cpu& cpu : cpus()) {
     CpuState* cs = cpu_state(cpu);
@@ -399,16 +405,22 @@ void SolScheduler::GlobalSchedule(const StatusWord& agent_sw,
     if (cs->next) {
       if (req->committed()) {
         // Note that txn could have failed to commit in which case the
-        // 'cs->next' will go back into the run queue.
-        SyncCpuState(cpu);
+        // 'cs->next' will go back into the run queue.  We submit
+        // asynchronously, so this is where we handle the failures, as part
+        // of the pick phase.
+        const uint64_t sync_start = PhaseProfiler::Now();
+        if (!SyncCpuState(cpu)) {
+          phase_profiler_.Record(PhaseProfile::kCommitFailure,
+                                 PhaseProfiler::Now() - sync_start);
+        }
       } else {
         // This CPU has a pending txn that we have not reaped yet.
         continue;
       }
     }
 
-    if (cs->current &&
-        (MonotonicNow() - cs->last_commit) < preemption_time_slice_) {
+    // `t` is recent enough for a time slice, and saves a clock read per cpu.
+    if (cs->current && (t - cs->last_commit) < preemption_ticks_) {
       // A task is currently running on this CPU and it has not exceeded its
       // preemption time slice, so do not schedule this CPU.
       continue;
@@ -474,11 +486,12 @@ void SolScheduler::GlobalSchedule(const StatusWord& agent_sw,
   // tasks if their time slice has expired. The ghOSt kernel will deliver a
   // TASK_PREEMPT message for those preempted tasks, so we do not need to put
   // those tasks back onto the runqueue here.
+  t = phase_profiler_.Lap(PhaseProfile::kPick, t);
   if (!assigned.Empty()) {
     enclave()->SubmitRunRequests(assigned);
-    absl::Time now = MonotonicNow();
+    t = phase_profiler_.Lap(PhaseProfile::kCommit, t);
     for (const Cpu& cpu : assigned) {
-      cpu_state(cpu)->last_commit = now;
+      cpu_state(cpu)->last_commit = t;
     }
   }
 
@@ -498,46 +511,21 @@ bool SolScheduler::PickNextGlobalCPU(BarrierToken agent_barrier,
                                      const Cpu& this_cpu) {
   Cpu target(Cpu::UninitializedType::kUninitialized);
   Cpu global_cpu = topology()->cpu(GetGlobalCPUId());
-  int numa_node = global_cpu.numa_node();
 
   // Let's make sure we do some useful work before moving to another cpu.
   if (iterations_ & 0xff) return false;
 
-  for (const Cpu& cpu : global_cpu.siblings()) {
-    if (cpu.id() == global_cpu.id()) continue;
-
-    if (Available(cpu)) {
-      target = cpu;
-      goto found;
-    }
-  }
-
-  for (const Cpu& cpu : global_cpu.l3_siblings()) {
-    if (cpu.id() == global_cpu.id()) continue;
-
-    if (Available(cpu)) {
-      target = cpu;
-      goto found;
-    }
-  }
-
-again:
-  for (const Cpu& cpu : cpus()) {
-    if (cpu.id() == global_cpu.id()) continue;
-
-    if (numa_node >= 0 && cpu.numa_node() != numa_node) continue;
-
-    if (Available(cpu)) {
-      target = cpu;
-      goto found;
+  // Search outward from the global cpu, nearest cpus first, to keep the global
+  // agent close to the caches it has warmed up.
+  for (TopologyLevel level : kTopologyLevels) {
+    for (const Cpu& cpu : global_cpu.cpus_at_distance(level)) {
+      if (Available(cpu)) {
+        target = cpu;
+        goto found;
+      }
     }
   }
 
-  if (numa_node >= 0) {
-    numa_node = -1;
-    goto again;
-  }
-
 found:
   if (!target.valid()) return false;
 
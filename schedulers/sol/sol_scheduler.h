@@ -13,7 +13,9 @@
 
 #include "absl/time/time.h"
 #include "lib/agent.h"
+#include "lib/phase_profiler.h"
 #include "lib/scheduler.h"
+#include "lib/tsc_clock.h"
 
 namespace ghost {
 
@@ -122,36 +124,42 @@ class SolScheduler : public BasicDispatchScheduler<SolTask> {
     global_cpu_.store(cpu.id(), std::memory_order_release);
   }
 
+  // The timers count TscClock ticks, which are converted when the stats are
+  // printed.
   void EnterSchedule() {
-    CHECK_EQ(schedule_timer_start_, absl::UnixEpoch());
-    schedule_timer_start_ = MonotonicNow();
+    CHECK_EQ(schedule_timer_start_, 0);
+    schedule_timer_start_ = TscClock::Now();
   }
 
   void ExitSchedule() {
-    CHECK_NE(schedule_timer_start_, absl::UnixEpoch());
-    absl::Duration iter_time = MonotonicNow() - schedule_timer_start_;
-    schedule_durations_ += iter_time;
-    schedule_durations_total_ += iter_time;
-    schedule_timer_start_ = absl::UnixEpoch();
+    CHECK_NE(schedule_timer_start_, 0);
+    uint64_t iter_ticks = TscClock::Now() - schedule_timer_start_;
+    schedule_ticks_ += iter_ticks;
+    schedule_ticks_total_ += iter_ticks;
+    schedule_timer_start_ = 0;
     ++iterations_;
+    phase_profiler_.EndIteration(iteration_msgs_);
   }
 
   // Dispatch is a subset of Schedule.  See AgentThread for details.
   void EnterDispatch() {
-    CHECK_EQ(dispatch_timer_start_, absl::UnixEpoch());
-    dispatch_timer_start_ = MonotonicNow();
+    CHECK_EQ(dispatch_timer_start_, 0);
+    dispatch_timer_start_ = TscClock::Now();
   }
 
   void ExitDispatch(uint64_t nr_msgs) {
-    CHECK_NE(dispatch_timer_start_, absl::UnixEpoch());
-    dispatch_durations_total_ += MonotonicNow() - dispatch_timer_start_;
-    dispatch_timer_start_ = absl::UnixEpoch();
+    CHECK_NE(dispatch_timer_start_, 0);
+    uint64_t dispatch_ticks = TscClock::Now() - dispatch_timer_start_;
+    dispatch_ticks_total_ += dispatch_ticks;
+    dispatch_timer_start_ = 0;
     nr_msgs_ += nr_msgs;
+    phase_profiler_.Record(PhaseProfile::kDispatch, dispatch_ticks);
+    iteration_msgs_ = nr_msgs;
   }
 
   absl::Duration SchedulingOverhead() {
-    absl::Duration ret = schedule_durations_ / iterations_;
-    schedule_durations_ = absl::ZeroDuration();
+    absl::Duration ret = TscClock::ToDuration(schedule_ticks_) / iterations_;
+    schedule_ticks_ = 0;
     return ret;
   }
 
@@ -170,16 +178,23 @@ class SolScheduler : public BasicDispatchScheduler<SolTask> {
   void DumpStats();
   std::atomic<bool> dump_stats_ = false;
 
+  // Per-phase histograms of the global agent's loop. Safe to read from any
+  // thread while the agent runs.
+  PhaseProfile GetPhaseProfile() const { return phase_profiler_.Snapshot(); }
+
   static constexpr int kDebugRunqueue = 1;
   static constexpr int kGetSchedOverhead = 2;
   static constexpr int kDumpStats = 3;
+  // Returns a PhaseProfile in the response buffer.
+  static constexpr int kGetPhaseProfile = 4;
 
  private:
   struct CpuState {
     SolTask* current = nullptr;
     SolTask* next = nullptr;
     const Agent* agent = nullptr;
-    absl::Time last_commit;
+    // TscClock ticks.
+    uint64_t last_commit = 0;
   } ABSL_CACHELINE_ALIGNED;
 
   bool SyncCpuState(const Cpu& cpu);
@@ -224,17 +239,22 @@ class SolScheduler : public BasicDispatchScheduler<SolTask> {
   int num_tasks_ = 0;
 
   const absl::Duration preemption_time_slice_;
+  // preemption_time_slice_ in TscClock ticks, for the per-cpu check.
+  const uint64_t preemption_ticks_;
 
   std::deque<SolTask*> run_queue_;
   std::vector<SolTask*> yielding_tasks_;
 
-  absl::Time schedule_timer_start_;
-  absl::Duration schedule_durations_;
-  absl::Duration schedule_durations_total_;
+  uint64_t schedule_timer_start_ = 0;
+  uint64_t schedule_ticks_ = 0;
+  uint64_t schedule_ticks_total_ = 0;
   uint64_t iterations_ = 0;
-  absl::Time dispatch_timer_start_;
-  absl::Duration dispatch_durations_total_;
+  uint64_t dispatch_timer_start_ = 0;
+  uint64_t dispatch_ticks_total_ = 0;
   uint64_t nr_msgs_ = 0;
+
+  PhaseProfiler phase_profiler_;
+  uint64_t iteration_msgs_ = 0;
 };
 
 // Initializes the task allocator and the Sol scheduler.
@@ -324,6 +344,13 @@ class FullSolAgent : public FullAgent<EnclaveType> {
         global_scheduler_->dump_stats_ = true;
         response.response_code = 0;
         return;
+      case SolScheduler::kGetPhaseProfile:
+        response.response_code =
+            response.buffer.Serialize(global_scheduler_->GetPhaseProfile())
+                    .ok()
+                ? 0
+                : -EINVAL;
+        return;
       default:
         response.response_code = -1;
         return;
@@ -8,11 +8,25 @@
 
 #include <cstdint>
 
+#include "absl/numeric/bits.h"
+
 namespace ghost {
 
 // Warning insanity requires "constexpr const" here.
 static constexpr const char* kPrioTableShmemName = "priotable";
-static constexpr int64_t kPrioTableVersion = 0;
+static constexpr int64_t kPrioTableVersion = 1;
+
+static uint32_t bitmap_words(uint32_t sched_items) {
+  return (sched_items + 63) / 64;
+}
+
+static size_t stream_size(uint32_t stream_capacity) {
+  size_t sz = sizeof(struct PrioTable::stream) +
+              sizeof(std::atomic<int>) * stream_capacity;
+  // Start the update bitmap on a new cacheline.
+  return (sz + ABSL_CACHELINE_SIZE - 1) / ABSL_CACHELINE_SIZE *
+         ABSL_CACHELINE_SIZE;
+}
 
 static size_t shmem_size(uint32_t sched_items, uint32_t work_classes,
                          uint32_t stream_capacity) {
@@ -26,8 +40,9 @@ static size_t shmem_size(uint32_t sched_items, uint32_t work_classes,
   // The three structs above are each aligned to a cacheline, so this check
   // should succeed
   CHECK_EQ(sz % ABSL_CACHELINE_SIZE, 0);
-  sz += sizeof(struct PrioTable::stream) +
-        sizeof(std::atomic<int>) * stream_capacity;
+  sz += stream_size(stream_capacity);
+  sz += sizeof(struct PrioTable::update_bitmap) +
+        sizeof(std::atomic<uint64_t>) * bitmap_words(sched_items);
 
   return sz;
 }
@@ -54,11 +69,18 @@ PrioTable::PrioTable(uint32_t num_items, uint32_t num_classes,
   // The header, sched items, and work classes are each aligned to a cacheline,
   // so this check should succeed
   CHECK_EQ(hdr()->st_off % ABSL_CACHELINE_SIZE, 0);
+  hdr()->bm_num = bitmap_words(num_items);
+  hdr()->bm_off = hdr()->st_off + stream_size(st_cap);
 
   std::atomic<int>* entries = stream()->entries;
   for (uint32_t i = 0; i < hdr()->st_cap; i++) {
     entries[i].store(kStreamFreeEntry, std::memory_order_relaxed);
   }
+  struct update_bitmap* bm = update_bitmap();
+  bm->summary.store(0, std::memory_order_relaxed);
+  for (uint32_t i = 0; i < hdr()->bm_num; i++) {
+    bm->words[i].store(0, std::memory_order_relaxed);
+  }
 
   shmem_->MarkReady();  // Ready for ghOSt agent to connect/start polling.
 }
@@ -82,6 +104,12 @@ struct PrioTable::stream* PrioTable::stream() {
   return reinterpret_cast<struct PrioTable::stream*>(bytes + hdr()->st_off);
 }
 
+struct PrioTable::update_bitmap* PrioTable::update_bitmap() {
+  char* bytes = reinterpret_cast<char*>(hdr_);
+  return reinterpret_cast<struct PrioTable::update_bitmap*>(bytes +
+                                                           hdr()->bm_off);
+}
+
 void PrioTable::MarkUpdatedIndex(int idx, int num_retries) {
   struct stream* s = stream();
   std::atomic<int>* scrape_all = &s->scrape_all;
@@ -136,7 +164,127 @@ int PrioTable::NextUpdatedIndex() {
     }
   }
 
-  return full_scan ? kStreamOverflow : kStreamNoEntries;
+  if (full_scan) {
+    // Batched indices are covered by the full scan too.
+    DrainUpdatedBitmap([](int) {});
+    return kStreamOverflow;
+  }
+  return NextBatchedIndex();
+}
+
+// Takes one index out of the update bitmap, or returns kStreamNoEntries.
+int PrioTable::NextBatchedIndex() {
+  struct update_bitmap* bm = update_bitmap();
+  uint64_t summary = bm->summary.load(std::memory_order_relaxed);
+
+  while (summary) {
+    const int b = absl::countr_zero(summary);
+    const uint64_t group = uint64_t{1} << b;
+    summary &= ~group;
+    // Clear the summary bit before looking at the words, so that a batch that
+    // sets a word after we look at it also sets the summary bit again.
+    bm->summary.fetch_and(~group, std::memory_order_acquire);
+    for (uint32_t w = b; w < hdr()->bm_num; w += 64) {
+      uint64_t word = bm->words[w].load(std::memory_order_acquire);
+      if (word) {
+        const uint64_t bit = word & -word;
+        bm->words[w].fetch_and(~bit, std::memory_order_acquire);
+        // The group may have more set bits, so leave them for the next call.
+        bm->summary.fetch_or(group, std::memory_order_relaxed);
+        return w * 64 + absl::countr_zero(bit);
+      }
+    }
+  }
+  return kStreamNoEntries;
+}
+
+void PrioTable::DrainUpdatedBitmap(absl::FunctionRef<void(int)> f) {
+  struct update_bitmap* bm = update_bitmap();
+
+  if (bm->summary.load(std::memory_order_relaxed) == 0) {
+    return;
+  }
+  // Pairs with the release in 'UpdateBatch::Publish()'. A batch sets its words
+  // before the summary, so every word covered by a summary bit taken here is
+  // visible to the exchanges below.
+  uint64_t summary = bm->summary.exchange(0, std::memory_order_acquire);
+  while (summary) {
+    const int b = absl::countr_zero(summary);
+    summary &= summary - 1;
+    for (uint32_t w = b; w < hdr()->bm_num; w += 64) {
+      if (bm->words[w].load(std::memory_order_relaxed) == 0) {
+        continue;
+      }
+      uint64_t word = bm->words[w].exchange(0, std::memory_order_acquire);
+      while (word) {
+        f(w * 64 + absl::countr_zero(word));
+        word &= word - 1;
+      }
+    }
+  }
+}
+
+bool PrioTable::DrainUpdatedIndices(absl::FunctionRef<void(int)> f) {
+  struct stream* s = stream();
+  std::atomic<int>* scrape_all = &s->scrape_all;
+  std::atomic<int>* entries = s->entries;
+  bool full_scan = false;
+
+  if (scrape_all->load(std::memory_order_relaxed) > 0) {
+    scrape_all->exchange(0, std::memory_order_acquire);
+    full_scan = true;
+  }
+
+  // Unlike 'NextUpdatedIndex()', which starts over at the beginning of the
+  // stream for each index, this visits each entry once. See the comments
+  // there for why the non-atomic clear is safe.
+  for (uint32_t i = 0; i < hdr()->st_cap; i++) {
+    int idx = entries[i].load(std::memory_order_acquire);
+    if (idx != kStreamFreeEntry) {
+      entries[i].store(kStreamFreeEntry, std::memory_order_relaxed);
+      if (!full_scan) f(idx);
+    }
+  }
+
+  if (full_scan) {
+    DrainUpdatedBitmap([](int) {});
+    return false;
+  }
+  DrainUpdatedBitmap(f);
+  return true;
+}
+
+void PrioTable::UpdateBatch::Add(int idx) {
+  DCHECK_GE(idx, 0);
+  CHECK_LT(idx, table_.hdr()->si_num);
+
+  const int word = idx / 64;
+  if (word != word_) {
+    FlushWord();
+    word_ = word;
+  }
+  pending_ |= uint64_t{1} << (idx % 64);
+}
+
+void PrioTable::UpdateBatch::FlushWord() {
+  if (!pending_) {
+    return;
+  }
+  // Pairs with the acquire in 'DrainUpdatedBitmap()' and orders the sched
+  // item writes before the bit.
+  table_.update_bitmap()->words[word_].fetch_or(pending_,
+                                                std::memory_order_release);
+  summary_ |= uint64_t{1} << (word_ % 64);
+  pending_ = 0;
+}
+
+void PrioTable::UpdateBatch::Publish() {
+  FlushWord();
+  if (!summary_) {
+    return;
+  }
+  table_.update_bitmap()->summary.fetch_or(summary_, std::memory_order_release);
+  summary_ = 0;
 }
 
 }  // namespace ghost
@@ -11,6 +11,7 @@
 
 #include <atomic>
 
+#include "absl/functional/function_ref.h"
 #include "shared/shmem.h"
 
 namespace ghost {
@@ -41,6 +42,8 @@ struct ghost_shmem_hdr {
   uint32_t wc_off; /* offset of 'work_class[0]' from start of hdr */
   uint32_t st_cap; /* capacity of the stream */
   uint32_t st_off; /* offset of stream from start of hdr */
+  uint32_t bm_num; /* number of words in 'update_bitmap.words[]' */
+  uint32_t bm_off; /* offset of update bitmap from start of hdr */
 } ABSL_CACHELINE_ALIGNED;
 
 struct sched_item {
@@ -113,6 +116,56 @@ class PrioTable {
   void MarkUpdatedIndex(int idx, int num_retries);
   int NextUpdatedIndex();
 
+  // Updated indices that are published in batches (see 'UpdateBatch') are set
+  // in a bitmap with one bit per sched item rather than in the stream, so a
+  // batch never overflows the stream. Bit 'b' of 'summary' is set once any of
+  // words 'b', 'b + 64', 'b + 128', ... has a bit set, so the agent only looks
+  // at the words that batches touched.
+  struct update_bitmap {
+    std::atomic<uint64_t> summary;
+    std::atomic<uint64_t> words[];
+  };
+
+  // Marks many indices as updated and publishes them to the agent together.
+  // Each 'Add' of an index in a different bitmap word than the previous one
+  // does one atomic OR on the bitmap, and 'Publish' does one more on the
+  // summary, so adding indices in ascending order is cheapest. Compared with
+  // 'MarkUpdatedIndex' per index, this skips the stream's compare-and-swap
+  // probing and leaves the stream to single updates.
+  //
+  // Example:
+  // PrioTable::UpdateBatch batch(table);
+  // for (...) {
+  //   (Update sched item 'sid' under its seqcount.)
+  //   batch.Add(sid);
+  // }
+  // batch.Publish();
+  class UpdateBatch {
+   public:
+    explicit UpdateBatch(PrioTable& table) : table_(table) {}
+    // Indices that were added but never published would be lost.
+    ~UpdateBatch() { DCHECK(pending_ == 0 && summary_ == 0); }
+
+    void Add(int idx);
+    // Makes all indices added since the last 'Publish' visible to the agent.
+    void Publish();
+
+   private:
+    void FlushWord();
+
+    PrioTable& table_;
+    int word_ = 0;
+    uint64_t pending_ = 0;
+    uint64_t summary_ = 0;
+  };
+
+  // Calls 'f' with each index marked as updated since the last call, whether
+  // through the stream or through an 'UpdateBatch', and clears them, all in
+  // one pass. An index may be passed more than once. Returns false without
+  // calling 'f' if the stream overflowed, in which case every index may have
+  // been updated.
+  bool DrainUpdatedIndices(absl::FunctionRef<void(int)> f);
+
   pid_t Owner() const { return shmem_ ? shmem_->Owner() : 0; }
 
   PrioTable(const PrioTable&) = delete;
@@ -124,6 +177,9 @@ class PrioTable {
 
   static constexpr int kStreamFreeEntry = std::numeric_limits<uint32_t>::max();
   struct stream* stream();
+  struct update_bitmap* update_bitmap();
+  int NextBatchedIndex();
+  void DrainUpdatedBitmap(absl::FunctionRef<void(int)> f);
 };
 
 //------------------------------------------------------------------------------
@@ -131,6 +131,7 @@ void GhostShmem::CreateShmem(int64_t client_version, const char* suffix,
   hdr_->client_size = map_size_ - kHeaderReservedBytes;
   hdr_->header_size = kHeaderReservedBytes;
   hdr_->owning_pid = getpid();  // Should probably be process.
+  hdr_->client_version = client_version;
 }
 
 bool GhostShmem::ConnectShmem(int64_t client_version, const char* suffix,
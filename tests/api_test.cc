@@ -1967,6 +1967,95 @@ TEST(ApiTest, SchedEnterGhostGtid) {
   GhostHelper()->CloseGlobalEnclaveFds();
 }
 
+// Creates ghOSt and CFS threads in bulk.
+TEST(ApiTest, CreateManyGhostThreads) {
+  constexpr int kNumThreads = 64;
+  Topology* topology = MachineTopology();
+
+  auto ap = AgentProcess<FullFifoAgent<LocalEnclave>, ghost::ProfilingAgentConfig>(
+      ghost::ProfilingAgentConfig(topology, topology->ToCpuList(std::vector<int>{0})));
+
+  std::vector<GhostThread::KernelScheduler> ksched;
+  std::vector<std::function<void()>> work;
+  std::atomic<int> num_ghost = 0;
+  std::atomic<int> num_cfs = 0;
+  for (int i = 0; i < kNumThreads; i++) {
+    // Every fourth thread is a CFS thread.
+    if (i % 4 == 3) {
+      ksched.push_back(GhostThread::KernelScheduler::kCfs);
+      work.push_back([&num_cfs] {
+        EXPECT_THAT(sched_getscheduler(/*pid=*/0), Eq(0));
+        num_cfs.fetch_add(1, std::memory_order_relaxed);
+      });
+    } else {
+      ksched.push_back(GhostThread::KernelScheduler::kGhost);
+      work.push_back([&num_ghost] {
+        EXPECT_THAT(sched_getscheduler(/*pid=*/0), Eq(SCHED_GHOST));
+        num_ghost.fetch_add(1, std::memory_order_relaxed);
+      });
+    }
+  }
+
+  std::vector<std::unique_ptr<GhostThread>> threads =
+      GhostThread::CreateMany(ksched, std::move(work));
+  ASSERT_THAT(threads.size(), Eq(kNumThreads));
+  for (auto& t : threads) {
+    EXPECT_THAT(t->tid(), Gt(0));
+    t->Join();
+  }
+  EXPECT_THAT(num_ghost.load(), Eq(kNumThreads - kNumThreads / 4));
+  EXPECT_THAT(num_cfs.load(), Eq(kNumThreads / 4));
+
+  // Wait for all the tasks to die. See the comment in GhostCloneGhost for more
+  // information.
+  int num_tasks;
+  do {
+    num_tasks = ap.Rpc(FifoScheduler::kCountAllTasks);
+    EXPECT_THAT(num_tasks, Ge(0));
+  } while (num_tasks > 0);
+
+  GhostHelper()->CloseGlobalEnclaveFds();
+}
+
+// Runs work on a pool of ghOSt threads that outlives the work.
+TEST(ApiTest, GhostThreadPool) {
+  constexpr int kNumThreads = 4;
+  constexpr int kNumWork = 1000;
+  Topology* topology = MachineTopology();
+
+  auto ap = AgentProcess<FullFifoAgent<LocalEnclave>, ghost::ProfilingAgentConfig>(
+      ghost::ProfilingAgentConfig(topology, topology->ToCpuList(std::vector<int>{0})));
+
+  std::atomic<int> done = 0;
+  {
+    GhostThreadPool pool(GhostThread::KernelScheduler::kGhost, kNumThreads);
+    EXPECT_THAT(pool.num_threads(), Eq(kNumThreads));
+
+    for (int i = 0; i < kNumWork; i++) {
+      pool.Submit([&done] {
+        EXPECT_THAT(sched_getscheduler(/*pid=*/0), Eq(SCHED_GHOST));
+        done.fetch_add(1, std::memory_order_relaxed);
+      });
+    }
+    pool.Wait();
+    EXPECT_THAT(done.load(), Eq(kNumWork));
+    // The work ran on the pool's threads rather than on new ones.
+    EXPECT_THAT(ap.Rpc(FifoScheduler::kCountAllTasks), Le(kNumThreads));
+
+    // The destructor finishes what is queued.
+    pool.Submit([&done] { done.fetch_add(1, std::memory_order_relaxed); });
+  }
+  EXPECT_THAT(done.load(), Eq(kNumWork + 1));
+
+  int num_tasks;
+  do {
+    num_tasks = ap.Rpc(FifoScheduler::kCountAllTasks);
+    EXPECT_THAT(num_tasks, Ge(0));
+  } while (num_tasks > 0);
+
+  GhostHelper()->CloseGlobalEnclaveFds();
+}
+
 TEST(ApiTest, EnteringGhostViaSetSchedulerReturnsBadFdError) {
   // Sets sched_priority to be less than -1 to simulate a regular task trying
   // to enter ghost via sched_setscheduler call, which should fail.
@@ -10,15 +10,17 @@
 #include "gtest/gtest.h"
 #include "absl/synchronization/notification.h"
 
-// Tests `Notification`, `Futex`, and `Gtid`.
+// Tests `Notification`, `AdaptiveSpin`, `Futex`, and `Gtid`.
 
 namespace ghost {
 namespace {
 
 using ::testing::Eq;
 using ::testing::Ge;
+using ::testing::Gt;
 using ::testing::IsEmpty;
 using ::testing::IsTrue;
+using ::testing::Le;
 
 // Tests that `Notification` is constructed to be "unnotified" and that it
 // successfully notifies after a call to `Notify`. This test is single-threaded.
@@ -50,6 +52,134 @@ TEST(NotificationTest, NotifyAfterWait) {
   thread.join();
 }
 
+// Tests that a notification can be reset and notified again, and that it keeps
+// counting waits across resets.
+TEST(NotificationTest, Reuse) {
+  Notification n;
+
+  for (int i = 0; i < 3; i++) {
+    EXPECT_FALSE(n.HasBeenNotified());
+    n.Notify();
+    n.WaitForNotification();
+    EXPECT_TRUE(n.HasBeenNotified());
+    n.Reset();
+  }
+  EXPECT_FALSE(n.HasBeenNotified());
+  EXPECT_THAT(n.spin_stats().waits, Eq(3));
+  // Each wait found the notification already notified.
+  EXPECT_THAT(n.spin_stats().parks, Eq(0));
+}
+
+// Tests that a waiter gives up spinning and sleeps when the notification takes
+// far longer than it is willing to spin.
+TEST(NotificationTest, LongWaitParks) {
+  Notification n(/*max_spin=*/absl::Microseconds(10));
+
+  std::thread thread([&n]() {
+    std::this_thread::sleep_for(std::chrono::milliseconds(50));
+    n.Notify();
+  });
+  n.WaitForNotification();
+  thread.join();
+
+  EXPECT_THAT(n.spin_stats().waits, Eq(1));
+  EXPECT_THAT(n.spin_stats().parks, Eq(1));
+}
+
+// Tests that a notification sleeps right away by default.
+TEST(NotificationTest, NoSpin) {
+  Notification n1;
+  Notification n2;
+
+  std::thread thread([&n1, &n2]() {
+    n2.WaitForNotification();
+    n1.Notify();
+  });
+  n2.Notify();
+  n1.WaitForNotification();
+  thread.join();
+
+  EXPECT_THAT(n1.spin_stats().budget, Eq(absl::ZeroDuration()));
+  // `n1` may have been notified before we waited, in which case we didn't
+  // sleep, but we never spun.
+  EXPECT_THAT(n1.spin_stats().waits, Eq(1));
+}
+
+// Tests that a `SpinningNotification` has a spin budget to start with.
+TEST(NotificationTest, Spinning) {
+  SpinningNotification n;
+
+  EXPECT_THAT(n.spin_stats().budget, Gt(absl::ZeroDuration()));
+  EXPECT_THAT(n.spin_stats().budget, Le(AdaptiveSpin::kDefaultMaxSpin));
+  n.Notify();
+  n.WaitForNotification();
+  EXPECT_THAT(n.spin_stats().waits, Eq(1));
+  EXPECT_THAT(n.spin_stats().parks, Eq(0));
+}
+
+// Tests that the spin budget grows after waits that spinning would have
+// covered, up to the maximum, and shrinks after waits that it would not have.
+TEST(AdaptiveSpinTest, Adjust) {
+  const absl::Duration max_spin = absl::Microseconds(100);
+  const uint64_t max_ticks = TscClock::FromDuration(max_spin);
+  AdaptiveSpin spin(max_spin);
+
+  const absl::Duration initial = spin.stats().budget;
+  EXPECT_GT(initial, absl::ZeroDuration());
+  EXPECT_LE(initial, max_spin);
+
+  spin.Adjust(/*wait_ticks=*/max_ticks / 2);
+  EXPECT_GT(spin.stats().budget, initial);
+  for (int i = 0; i < 10; i++) {
+    spin.Adjust(/*wait_ticks=*/max_ticks / 2);
+  }
+  EXPECT_THAT(spin.stats().budget, Eq(TscClock::ToDuration(max_ticks)));
+
+  spin.Adjust(/*wait_ticks=*/max_ticks * 10);
+  EXPECT_THAT(spin.stats().budget, Eq(TscClock::ToDuration(max_ticks / 2)));
+  for (int i = 0; i < 64; i++) {
+    spin.Adjust(/*wait_ticks=*/max_ticks * 10);
+  }
+  EXPECT_THAT(spin.stats().budget, Eq(absl::ZeroDuration()));
+
+  // A budget of zero can still recover.
+  spin.Adjust(/*wait_ticks=*/0);
+  EXPECT_GT(spin.stats().budget, absl::ZeroDuration());
+}
+
+// Tests that `Spin()` returns as soon as it is done and otherwise gives up
+// once its budget runs out.
+TEST(AdaptiveSpinTest, Spin) {
+  AdaptiveSpin spin(absl::Microseconds(100));
+
+  EXPECT_TRUE(spin.Spin(TscClock::Now(), [] { return true; }));
+  int calls = 0;
+  EXPECT_FALSE(spin.Spin(TscClock::Now(), [&calls] { return ++calls > 1e9; }));
+  EXPECT_THAT(calls, Ge(1));
+
+  AdaptiveSpin::Stats stats = spin.stats();
+  EXPECT_THAT(stats.waits, Eq(2));
+  EXPECT_THAT(stats.parks, Eq(0));
+}
+
+// Tests that a zero budget never spins and that its waits are still counted.
+TEST(AdaptiveSpinTest, Disabled) {
+  AdaptiveSpin spin(absl::ZeroDuration());
+  EXPECT_FALSE(spin.enabled());
+
+  const uint64_t start = spin.Start();
+  EXPECT_THAT(start, Eq(0));
+  int calls = 0;
+  EXPECT_FALSE(spin.Spin(start, [&calls] { return ++calls > 1; }));
+  EXPECT_THAT(calls, Eq(1));
+  spin.Parked(start);
+
+  AdaptiveSpin::Stats stats = spin.stats();
+  EXPECT_THAT(stats.waits, Eq(1));
+  EXPECT_THAT(stats.parks, Eq(1));
+  EXPECT_THAT(stats.budget, Eq(absl::ZeroDuration()));
+}
+
 // Tests that `num_threads` threads can wait on a futex with `Futex::Wait` for a
 // type `T` and an initial value of `initial_val`. Then tests that all threads
 // are woken up when a different thread writes `final_val` to the memory
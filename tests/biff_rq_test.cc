@@ -0,0 +1,205 @@
+// Copyright 2022 Google LLC
+//
+// Use of this source code is governed by a BSD-style
+// license that can be found in the LICENSE file or at
+// https://developers.google.com/open-source/licenses/bsd
+
+#include <algorithm>
+#include <set>
+#include <vector>
+
+#include "gmock/gmock.h"
+#include "gtest/gtest.h"
+#include "third_party/bpf/biff_rq.bpf.h"
+
+// Tests Biff's per-LLC runqueues and their policy helpers, outside of bpf.
+
+namespace ghost {
+namespace {
+
+using ::testing::ElementsAre;
+using ::testing::ElementsAreArray;
+
+class BiffRqTest : public testing::Test {
+ protected:
+  static constexpr unsigned int kNrLlcs = 4;
+
+  // Like the sw_data map, which the arr_list indexes with BIFF_MAX_GTIDS.
+  std::vector<biff_bpf_sw_data> sw_data_ =
+      std::vector<biff_bpf_sw_data>(BIFF_MAX_GTIDS);
+  biff_rq rqs_[kNrLlcs] = {};
+
+  biff_bpf_sw_data* task(int i) {
+    biff_bpf_sw_data* swd = &sw_data_[i];
+    swd->gtid = i;
+    return swd;
+  }
+
+  bool push(unsigned int llc, int i, uint32_t barrier = 0) {
+    return biff_rq_push(&rqs_[llc], sw_data_.data(), task(i), llc, barrier);
+  }
+
+  // Returns the gtid of the popped task, or -1.
+  int pop(unsigned int llc) {
+    biff_bpf_sw_data* swd = biff_rq_pop(&rqs_[llc], sw_data_.data());
+    return swd ? swd->gtid : -1;
+  }
+
+  bool remove(unsigned int llc, int i) {
+    return biff_rq_remove(&rqs_[llc], sw_data_.data(), &sw_data_[i], llc);
+  }
+
+  std::vector<int> drain(unsigned int llc) {
+    std::vector<int> gtids;
+    for (int gtid = pop(llc); gtid != -1; gtid = pop(llc)) {
+      gtids.push_back(gtid);
+    }
+    return gtids;
+  }
+
+  // What biff-pnt does: pops from our LLC, then steals from the others.
+  int pick(unsigned int local) {
+    for (unsigned int i = 0; i < kNrLlcs; ++i) {
+      int gtid = pop(biff_llc_probe(local, i, kNrLlcs));
+      if (gtid != -1) {
+        return gtid;
+      }
+    }
+    return -1;
+  }
+};
+
+TEST_F(BiffRqTest, Fifo) {
+  for (int i = 1; i <= 5; ++i) {
+    EXPECT_TRUE(push(0, i));
+  }
+  EXPECT_EQ(rqs_[0].nr_queued, 5);
+  EXPECT_THAT(drain(0), ElementsAre(1, 2, 3, 4, 5));
+  EXPECT_EQ(rqs_[0].nr_queued, 0);
+  EXPECT_TRUE(arr_list_empty(&rqs_[0].list));
+  EXPECT_EQ(sw_data_[3].rq_llc, 0);
+}
+
+// Tests that the rqs of different LLCs are independent.
+TEST_F(BiffRqTest, PerLlc) {
+  push(0, 1);
+  push(1, 2);
+  push(0, 3);
+  push(2, 4);
+  EXPECT_EQ(sw_data_[2].rq_llc, 2);
+  EXPECT_EQ(sw_data_[4].rq_llc, 3);
+
+  EXPECT_THAT(drain(1), ElementsAre(2));
+  EXPECT_THAT(drain(0), ElementsAre(1, 3));
+  EXPECT_THAT(drain(3), ElementsAre());
+  EXPECT_THAT(drain(2), ElementsAre(4));
+}
+
+// Tests that requeueing a queued task keeps its place but takes the new
+// barrier, even from another LLC.
+TEST_F(BiffRqTest, PushQueued) {
+  push(0, 1, /*barrier=*/10);
+  push(0, 2, /*barrier=*/20);
+  EXPECT_FALSE(push(0, 1, /*barrier=*/11));
+  EXPECT_FALSE(push(1, 1, /*barrier=*/12));
+  EXPECT_EQ(rqs_[0].nr_queued, 2);
+  EXPECT_EQ(rqs_[1].nr_queued, 0);
+  EXPECT_EQ(sw_data_[1].task_barrier, 12);
+  EXPECT_THAT(drain(0), ElementsAre(1, 2));
+
+  // Once popped, it can be queued again.
+  EXPECT_TRUE(push(1, 1, /*barrier=*/13));
+  EXPECT_THAT(drain(1), ElementsAre(1));
+}
+
+TEST_F(BiffRqTest, Remove) {
+  for (int i = 1; i <= 4; ++i) {
+    push(0, i);
+  }
+  // Not on llc 1's rq.
+  EXPECT_FALSE(remove(1, 2));
+  EXPECT_TRUE(remove(0, 2));
+  EXPECT_FALSE(remove(0, 2));
+  EXPECT_TRUE(remove(0, 4));
+  EXPECT_EQ(rqs_[0].nr_queued, 2);
+  EXPECT_THAT(drain(0), ElementsAre(1, 3));
+
+  // Tasks that are not queued at all.
+  EXPECT_FALSE(remove(0, 1));
+  EXPECT_FALSE(remove(0, 100));
+}
+
+// Tests that every LLC probes its own rq first and then each other rq once.
+TEST_F(BiffRqTest, ProbeOrder) {
+  for (unsigned int nr_llcs : {1u, 2u, 3u, 8u, static_cast<unsigned int>(BIFF_MAX_LLCS)}) {
+    for (unsigned int local = 0; local < nr_llcs; ++local) {
+      std::vector<unsigned int> order;
+      for (unsigned int i = 0; i < nr_llcs; ++i) {
+        order.push_back(biff_llc_probe(local, i, nr_llcs));
+      }
+      EXPECT_EQ(order[0], local);
+      std::set<unsigned int> seen(order.begin(), order.end());
+      EXPECT_EQ(seen.size(), nr_llcs);
+      EXPECT_LT(*seen.rbegin(), nr_llcs);
+    }
+  }
+}
+
+// Tests that cpus prefer their own LLC's tasks and steal only when their LLC is
+// empty.
+TEST_F(BiffRqTest, Steal) {
+  push(0, 1);
+  push(0, 2);
+  push(0, 3);
+  push(2, 4);
+
+  EXPECT_EQ(pick(2), 4);
+  // LLC 2 is empty: steal from LLC 3 (empty), then 0.
+  EXPECT_EQ(pick(2), 1);
+  EXPECT_EQ(pick(1), 2);
+  EXPECT_EQ(pick(0), 3);
+  EXPECT_EQ(pick(0), -1);
+}
+
+// Tests that no task is lost or run twice when all LLCs share the work.
+TEST_F(BiffRqTest, StealEverything) {
+  constexpr int kTasks = 1000;
+  for (int i = 1; i <= kTasks; ++i) {
+    push(i % 3 == 0 ? 1 : 0, i);
+  }
+
+  std::vector<int> picked;
+  for (int round = 0; picked.size() < kTasks && round < kTasks; ++round) {
+    for (unsigned int llc = 0; llc < kNrLlcs; ++llc) {
+      int gtid = pick(llc);
+      if (gtid != -1) {
+        picked.push_back(gtid);
+      }
+    }
+  }
+  std::sort(picked.begin(), picked.end());
+  std::vector<int> expected;
+  for (int i = 1; i <= kTasks; ++i) {
+    expected.push_back(i);
+  }
+  EXPECT_THAT(picked, ElementsAreArray(expected));
+  for (unsigned int llc = 0; llc < kNrLlcs; ++llc) {
+    EXPECT_EQ(rqs_[llc].nr_queued, 0);
+  }
+}
+
+TEST_F(BiffRqTest, WakePolicy) {
+  EXPECT_FALSE(biff_wake_on_waker_llc(0, 0));
+  EXPECT_FALSE(biff_wake_on_waker_llc(BIFF_LLC_IMBALANCE, 0));
+  EXPECT_TRUE(biff_wake_on_waker_llc(BIFF_LLC_IMBALANCE + 1, 0));
+  EXPECT_FALSE(biff_wake_on_waker_llc(BIFF_LLC_IMBALANCE + 10, 10));
+  EXPECT_FALSE(biff_wake_on_waker_llc(0, 100));
+}
+
+}  // namespace
+}  // namespace ghost
+
+int main(int argc, char** argv) {
+  testing::InitGoogleTest(&argc, argv);
+  return RUN_ALL_TESTS();
+}
@@ -0,0 +1,258 @@
+// Copyright 2022 Google LLC
+//
+// Use of this source code is governed by a BSD-style
+// license that can be found in the LICENSE file or at
+// https://developers.google.com/open-source/licenses/bsd
+
+#include "lib/bpf_rescue.h"
+
+#include <cstring>
+#include <vector>
+
+#include "gmock/gmock.h"
+#include "gtest/gtest.h"
+
+// Tests the userspace side of the BPF rescue channel against a fake ring.
+
+namespace ghost {
+namespace {
+
+using ::testing::ElementsAre;
+using ::testing::IsEmpty;
+
+// Lays out memory like the kernel's BPF ring buffer and produces records the
+// way bpf_ringbuf_reserve()/submit() do.
+class FakeRing {
+ public:
+  static constexpr size_t kSize = 256;
+
+  FakeRing() : data_(2 * kSize) {}
+
+  BpfRingConsumer MakeConsumer() {
+    return BpfRingConsumer(&consumer_pos_, &producer_pos_, data_.data(),
+                           kSize);
+  }
+
+  // Reserves a record for `msg` and returns its offset. The record is busy
+  // until `Commit`.
+  uint64_t Reserve(const bpf_rescue_msg& msg) {
+    uint64_t pos = Reserve(sizeof(msg));
+    Write(pos + BpfRingConsumer::kHeaderSize, &msg, sizeof(msg));
+    return pos;
+  }
+
+  // Reserves a record with `len` bytes of payload.
+  uint64_t Reserve(uint32_t len) {
+    uint64_t pos = producer_pos_.load();
+    uint64_t size = BpfRingConsumer::RecordSize(len);
+    EXPECT_LE(pos + size - consumer_pos_.load(), kSize);
+    WriteHeader(pos, len | BpfRingConsumer::kBusyBit);
+    producer_pos_.store(pos + size);
+    return pos;
+  }
+
+  void Commit(uint64_t pos, bool discard = false) {
+    uint32_t len = ReadHeader(pos) & ~BpfRingConsumer::kBusyBit;
+    WriteHeader(pos, len | (discard ? BpfRingConsumer::kDiscardBit : 0));
+  }
+
+  void Output(const bpf_rescue_msg& msg) { Commit(Reserve(msg)); }
+
+  uint64_t consumer_pos() const { return consumer_pos_.load(); }
+  uint64_t producer_pos() const { return producer_pos_.load(); }
+
+ private:
+  // The kernel maps the data area twice, so writes past the end show up at
+  // the start and vice versa.
+  void Write(uint64_t pos, const void* src, size_t len) {
+    for (size_t i = 0; i < len; ++i) {
+      char c = static_cast<const char*>(src)[i];
+      uint64_t off = (pos + i) & (kSize - 1);
+      data_[off] = c;
+      data_[off + kSize] = c;
+    }
+  }
+
+  void WriteHeader(uint64_t pos, uint32_t len) {
+    uint64_t hdr = len;
+    Write(pos, &hdr, sizeof(hdr));
+  }
+
+  uint32_t ReadHeader(uint64_t pos) {
+    uint32_t len;
+    memcpy(&len, &data_[pos & (kSize - 1)], sizeof(len));
+    return len;
+  }
+
+  std::atomic<uint64_t> consumer_pos_{0};
+  std::atomic<uint64_t> producer_pos_{0};
+  std::vector<char> data_;
+};
+
+bpf_rescue_msg Msg(uint64_t gtid, uint32_t barrier = 0) {
+  bpf_rescue_msg msg = {};
+  msg.gtid = gtid;
+  msg.task_barrier = barrier;
+  msg.reason = BPF_RESCUE_NO_SLOT;
+  return msg;
+}
+
+// Returns the gtids of the records `consumer` consumes.
+std::vector<uint64_t> Drain(BpfRingConsumer& consumer) {
+  std::vector<uint64_t> gtids;
+  consumer.Consume([&gtids](const void* record, uint32_t len) {
+    EXPECT_EQ(len, sizeof(bpf_rescue_msg));
+    bpf_rescue_msg msg;
+    memcpy(&msg, record, sizeof(msg));
+    gtids.push_back(msg.gtid);
+  });
+  return gtids;
+}
+
+TEST(BpfRingConsumerTest, Consume) {
+  FakeRing ring;
+  BpfRingConsumer consumer = ring.MakeConsumer();
+
+  EXPECT_THAT(Drain(consumer), IsEmpty());
+  ring.Output(Msg(1));
+  ring.Output(Msg(2));
+  ring.Output(Msg(3));
+  EXPECT_THAT(Drain(consumer), ElementsAre(1, 2, 3));
+  EXPECT_EQ(ring.consumer_pos(), ring.producer_pos());
+  EXPECT_THAT(Drain(consumer), IsEmpty());
+}
+
+TEST(BpfRingConsumerTest, Discard) {
+  FakeRing ring;
+  BpfRingConsumer consumer = ring.MakeConsumer();
+
+  ring.Output(Msg(1));
+  ring.Commit(ring.Reserve(Msg(2)), /*discard=*/true);
+  ring.Output(Msg(3));
+  EXPECT_THAT(Drain(consumer), ElementsAre(1, 3));
+  EXPECT_EQ(ring.consumer_pos(), ring.producer_pos());
+}
+
+// Tests that we stop at a record that is still being written, even if later
+// records are ready, and pick up from there once it is committed.
+TEST(BpfRingConsumerTest, Busy) {
+  FakeRing ring;
+  BpfRingConsumer consumer = ring.MakeConsumer();
+
+  ring.Output(Msg(1));
+  uint64_t busy = ring.Reserve(Msg(2));
+  ring.Output(Msg(3));
+  EXPECT_THAT(Drain(consumer), ElementsAre(1));
+  EXPECT_EQ(ring.consumer_pos(), busy);
+
+  ring.Commit(busy);
+  EXPECT_THAT(Drain(consumer), ElementsAre(2, 3));
+}
+
+// Tests records that wrap around the end of the data area.
+TEST(BpfRingConsumerTest, Wraparound) {
+  FakeRing ring;
+  BpfRingConsumer consumer = ring.MakeConsumer();
+
+  // Shift the records by a discarded one, so that they straddle the end.
+  const uint64_t record_size =
+      BpfRingConsumer::RecordSize(sizeof(bpf_rescue_msg));
+  ring.Commit(ring.Reserve(record_size / 2), /*discard=*/true);
+  ASSERT_NE(ring.producer_pos() % record_size, 0);
+
+  uint64_t next = 0;
+  for (int round = 0; round < 20; ++round) {
+    std::vector<uint64_t> expected;
+    for (int i = 0; i < 3; ++i) {
+      ring.Output(Msg(++next));
+      expected.push_back(next);
+    }
+    EXPECT_EQ(Drain(consumer), expected);
+  }
+  EXPECT_GT(ring.consumer_pos(), 4 * FakeRing::kSize);
+}
+
+TEST(BpfTaskRescuerTest, Reinject) {
+  std::vector<uint64_t> reinjected;
+  BpfTaskRescuer rescuer([&reinjected](const bpf_rescue_msg& msg) {
+    reinjected.push_back(msg.gtid);
+    return true;
+  });
+
+  rescuer.Receive(Msg(1));
+  rescuer.Receive(Msg(2));
+  EXPECT_EQ(rescuer.Reinject(), 0);
+  EXPECT_THAT(reinjected, ElementsAre(1, 2));
+  EXPECT_EQ(rescuer.stats().received, 2);
+  EXPECT_EQ(rescuer.stats().reinjected, 2);
+  EXPECT_EQ(rescuer.stats().backlog, 0);
+}
+
+// Tests that tasks bpf did not take stay in order until it takes them.
+TEST(BpfTaskRescuerTest, Retry) {
+  int room = 1;
+  std::vector<uint64_t> reinjected;
+  BpfTaskRescuer rescuer([&](const bpf_rescue_msg& msg) {
+    if (room == 0) {
+      return false;
+    }
+    room--;
+    reinjected.push_back(msg.gtid);
+    return true;
+  });
+
+  for (uint64_t gtid = 1; gtid <= 4; ++gtid) {
+    rescuer.Receive(Msg(gtid));
+  }
+  EXPECT_EQ(rescuer.Reinject(), 3);
+  EXPECT_EQ(rescuer.Reinject(), 3);
+  EXPECT_EQ(rescuer.stats().retries, 2);
+  EXPECT_EQ(rescuer.stats().max_backlog, 4);
+
+  room = 2;
+  EXPECT_EQ(rescuer.Reinject(), 1);
+  room = 10;
+  EXPECT_EQ(rescuer.Reinject(), 0);
+  EXPECT_THAT(reinjected, ElementsAre(1, 2, 3, 4));
+  EXPECT_EQ(rescuer.stats().reinjected, 4);
+}
+
+// Tests that a task rescued again while in the backlog is reinjected once,
+// with its latest barrier, in its original place.
+TEST(BpfTaskRescuerTest, Merge) {
+  bool accept = false;
+  std::vector<bpf_rescue_msg> reinjected;
+  BpfTaskRescuer rescuer([&](const bpf_rescue_msg& msg) {
+    if (accept) {
+      reinjected.push_back(msg);
+    }
+    return accept;
+  });
+
+  rescuer.Receive(Msg(1, /*barrier=*/10));
+  rescuer.Receive(Msg(2, /*barrier=*/20));
+  rescuer.Receive(Msg(1, /*barrier=*/11));
+  EXPECT_EQ(rescuer.stats().merged, 1);
+  EXPECT_EQ(rescuer.stats().backlog, 2);
+
+  accept = true;
+  EXPECT_EQ(rescuer.Reinject(), 0);
+  ASSERT_EQ(reinjected.size(), 2);
+  EXPECT_EQ(reinjected[0].gtid, 1);
+  EXPECT_EQ(reinjected[0].task_barrier, 11);
+  EXPECT_EQ(reinjected[1].gtid, 2);
+
+  // Once reinjected, the task can be rescued again.
+  rescuer.Receive(Msg(1, /*barrier=*/12));
+  EXPECT_EQ(rescuer.Reinject(), 0);
+  EXPECT_EQ(reinjected.size(), 3);
+  EXPECT_EQ(rescuer.stats().merged, 1);
+}
+
+}  // namespace
+}  // namespace ghost
+
+int main(int argc, char** argv) {
+  testing::InitGoogleTest(&argc, argv);
+  return RUN_ALL_TESTS();
+}
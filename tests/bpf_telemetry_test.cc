@@ -0,0 +1,142 @@
+// Copyright 2022 Google LLC
+//
+// Use of this source code is governed by a BSD-style
+// license that can be found in the LICENSE file or at
+// https://developers.google.com/open-source/licenses/bsd
+
+#include "lib/bpf_telemetry.h"
+
+#include <thread>
+
+#include "gmock/gmock.h"
+#include "gtest/gtest.h"
+
+namespace ghost {
+namespace {
+
+using Stats = BpfTelemetryStats;
+
+TEST(BpfTelemetryStatsTest, LatencyBucket) {
+  EXPECT_EQ(Stats::LatencyBucket(0), 0);
+  EXPECT_EQ(Stats::LatencyBucket(1), 1);
+  EXPECT_EQ(Stats::LatencyBucket(2), 2);
+  EXPECT_EQ(Stats::LatencyBucket(3), 2);
+  EXPECT_EQ(Stats::LatencyBucket(4), 3);
+  EXPECT_EQ(Stats::LatencyBucket(1000), 10);
+  EXPECT_EQ(Stats::LatencyBucket(1024), 11);
+  EXPECT_EQ(Stats::LatencyBucket(~0ull), Stats::kLatencyBuckets - 1);
+}
+
+TEST(BpfTelemetryStatsTest, LatencyPercentile) {
+  Stats::LatencyStats lat = {};
+  EXPECT_EQ(Stats::LatencyPercentile(lat, 50), 0);
+
+  // 90 latencies under 4us, 9 around 100us, and 1 very long one.
+  lat.count = 100;
+  lat.buckets[Stats::LatencyBucket(3)] = 90;
+  lat.buckets[Stats::LatencyBucket(100)] = 9;
+  lat.buckets[Stats::kLatencyBuckets - 1] = 1;
+  lat.max_us = uint64_t{1} << 40;
+  EXPECT_EQ(Stats::LatencyPercentile(lat, 50), 4);
+  EXPECT_EQ(Stats::LatencyPercentile(lat, 90), 4);
+  EXPECT_EQ(Stats::LatencyPercentile(lat, 99), 128);
+  EXPECT_EQ(Stats::LatencyPercentile(lat, 100), lat.max_us);
+}
+
+TEST(BpfTelemetrySamplerTest, Utilization) {
+  BpfTelemetrySampler sampler(/*nr_slots=*/1);
+  for (int round = 0; round < 4; ++round) {
+    sampler.SampleCpu(0, /*busy=*/true);
+    sampler.SampleCpu(3, /*busy=*/round % 2);
+    sampler.EndRound(absl::UnixEpoch() + absl::Milliseconds(round));
+  }
+
+  const Stats& stats = sampler.stats();
+  EXPECT_EQ(stats.nr_samples, 4);
+  EXPECT_EQ(stats.nr_cpus, 4);
+  EXPECT_EQ(stats.cpus[0].samples, 4);
+  EXPECT_EQ(stats.cpus[0].busy_samples, 4);
+  EXPECT_EQ(stats.cpus[1].samples, 0);
+  EXPECT_EQ(stats.cpus[3].samples, 4);
+  EXPECT_EQ(stats.cpus[3].busy_samples, 2);
+  EXPECT_EQ(stats.updated_at_ns, absl::ToUnixNanos(absl::UnixEpoch() +
+                                                   absl::Milliseconds(3)));
+}
+
+TEST(BpfTelemetrySamplerTest, Latency) {
+  BpfTelemetrySampler sampler(/*nr_slots=*/4);
+
+  // The first round only sets the baseline, since we don't know when these
+  // runs happened.
+  sampler.SampleTask(0, /*ran_at=*/100, /*runnable_at=*/50);
+  sampler.SampleTask(1, /*ran_at=*/0, /*runnable_at=*/0);
+  sampler.EndRound(absl::UnixEpoch());
+  EXPECT_EQ(sampler.stats().latency.count, 0);
+
+  // Task 0 didn't run again. Task 1 ran, 10us after it became runnable.
+  sampler.SampleTask(0, /*ran_at=*/100, /*runnable_at=*/50);
+  sampler.SampleTask(1, /*ran_at=*/210, /*runnable_at=*/200);
+  sampler.EndRound(absl::UnixEpoch());
+  EXPECT_EQ(sampler.stats().latency.count, 1);
+  EXPECT_EQ(sampler.stats().latency.sum_us, 10);
+
+  // Task 0 ran after waiting 1000us. Task 1 ran and became runnable again in
+  // the same round: we lost its latency. Task 2 is runnable but hasn't run.
+  sampler.SampleTask(0, /*ran_at=*/2000, /*runnable_at=*/1000);
+  sampler.SampleTask(1, /*ran_at=*/300, /*runnable_at=*/350);
+  sampler.SampleTask(2, /*ran_at=*/0, /*runnable_at=*/400);
+  sampler.EndRound(absl::UnixEpoch());
+
+  const Stats::LatencyStats& lat = sampler.stats().latency;
+  EXPECT_EQ(lat.count, 2);
+  EXPECT_EQ(lat.sum_us, 1010);
+  EXPECT_EQ(lat.max_us, 1000);
+  EXPECT_EQ(lat.buckets[Stats::LatencyBucket(10)], 1);
+  EXPECT_EQ(lat.buckets[Stats::LatencyBucket(1000)], 1);
+
+  // Task 1 ran again.
+  sampler.SampleTask(1, /*ran_at=*/360, /*runnable_at=*/350);
+  sampler.EndRound(absl::UnixEpoch());
+  EXPECT_EQ(sampler.stats().latency.count, 3);
+}
+
+// Tests that readers never see a partially written page.
+TEST(BpfTelemetryPageTest, Seqlock) {
+  auto page = std::make_unique<BpfTelemetryPage>();
+  auto in = std::make_unique<Stats>();
+  page->Write(*in);
+
+  std::atomic<bool> stop = false;
+  std::thread writer([&] {
+    for (uint64_t i = 1; !stop.load(std::memory_order_relaxed); ++i) {
+      in->nr_samples = i;
+      for (int cpu = 0; cpu < Stats::kMaxCpus; ++cpu) {
+        in->cpus[cpu].samples = i;
+      }
+      in->latency.count = i;
+      page->Write(*in);
+    }
+  });
+
+  auto out = std::make_unique<Stats>();
+  int nr_reads = 0;
+  while (nr_reads < 1000) {
+    if (!page->Read(out.get())) {
+      continue;
+    }
+    ++nr_reads;
+    ASSERT_EQ(out->cpus[0].samples, out->nr_samples);
+    ASSERT_EQ(out->cpus[Stats::kMaxCpus - 1].samples, out->nr_samples);
+    ASSERT_EQ(out->latency.count, out->nr_samples);
+  }
+  stop = true;
+  writer.join();
+}
+
+}  // namespace
+}  // namespace ghost
+
+int main(int argc, char** argv) {
+  testing::InitGoogleTest(&argc, argv);
+  return RUN_ALL_TESTS();
+}
@@ -14,6 +14,7 @@
 #include <utility>
 #include <vector>
 
+#include "experiments/shared/synthetic_work.h"
 #include "lib/base.h"
 #include "lib/ghost.h"
 #include "orca/protocol.h"
@@ -48,6 +49,8 @@ struct Job {
     JobType type;
     steady_clock::time_point submitted;
     steady_clock::time_point finished;
+    // CPU time the worker spent running the job.
+    absl::Duration cpu_time;
 };
 
 std::vector<Job> run_experiment(GhostThread::KernelScheduler ks_mode,
@@ -63,65 +66,59 @@ std::vector<Job> run_experiment(GhostThread::KernelScheduler ks_mode,
     std::queue<Job *> work_q;
     std::mutex work_q_m;
 
-    // hack: send ingress hints to Orca
-    orca::OrcaUDPClient orca_client;
+    // Jobs do a calibrated amount of work rather than spin on the clock, so
+    // a job's service time does not depend on what reading the clock costs.
+    const ghost_test::SyntheticWork work(ghost_test::SyntheticWork::Mix::kAlu);
 
     // Spawn worker threads
-    std::vector<std::unique_ptr<GhostThread>> worker_threads;
-    worker_threads.reserve(num_workers);
-    for (int i = 0; i < num_workers; ++i) {
-        auto thread = std::make_unique<GhostThread>(ks_mode, [&] {
-            while (!isdead) {
-                Job *job;
-                {
-                    std::lock_guard lg(work_q_m);
-                    if (work_q.empty()) {
-                        continue;
-                    }
-                    job = work_q.front();
-                    work_q.pop();
+    auto worker = [&] {
+        // hack: send ingress hints to Orca, batched per worker
+        orca::OrcaUDPBatcher<orca::IngressHintRecord> orca_hints;
 
-                    ++num_jobs_done;
-                    if (num_jobs_done % 50000 == 0) {
-                        std::cerr << num_jobs_done << std::endl;
-                    }
+        while (!isdead) {
+            Job *job;
+            {
+                std::lock_guard lg(work_q_m);
+                if (work_q.empty()) {
+                    continue;
                 }
+                job = work_q.front();
+                work_q.pop();
 
-                // Send hint to Orca
-                orca::OrcaIngressHint hint;
-                switch (job->type) {
-                case JobType::Short: {
-                    hint.hint = orca::OrcaIngressHint::ReqLength::Short;
-                    break;
-                }
-                case JobType::Long: {
-                    hint.hint = orca::OrcaIngressHint::ReqLength::Long;
-                    break;
-                }
-                }
-                orca_client.send_bytes((const char *)&hint, sizeof(hint));
-
-                // Run job
-                auto start = steady_clock::now();
-                if (job->type == JobType::Short) {
-                    while (std::chrono::duration<double>(steady_clock::now() -
-                                                         start)
-                               .count() < 1e-6) {
-                    }
-                } else if (job->type == JobType::Long) {
-                    while (std::chrono::duration<double>(steady_clock::now() -
-                                                         start)
-                               .count() < 1e-3) {
-                    }
+                ++num_jobs_done;
+                if (num_jobs_done % 50000 == 0) {
+                    std::cerr << num_jobs_done << std::endl;
                 }
+            }
 
-                // Mark finished timestamp
-                job->finished = steady_clock::now();
+            // Send hint to Orca
+            orca::IngressHintRecord *hint = orca_hints.append();
+            switch (job->type) {
+            case JobType::Short: {
+                hint->hint = orca::IngressHintRecord::ReqLength::Short;
+                break;
+            }
+            case JobType::Long: {
+                hint->hint = orca::IngressHintRecord::ReqLength::Long;
+                break;
+            }
             }
-        });
 
-        worker_threads.push_back(std::move(thread));
-    }
+            // Run job
+            if (job->type == JobType::Short) {
+                job->cpu_time = work.RunFor(absl::Microseconds(1));
+            } else if (job->type == JobType::Long) {
+                job->cpu_time = work.RunFor(absl::Milliseconds(1));
+            }
+
+            // Mark finished timestamp
+            job->finished = steady_clock::now();
+        }
+    };
+    std::vector<std::unique_ptr<GhostThread>> worker_threads =
+        GhostThread::CreateMany(
+            std::vector<GhostThread::KernelScheduler>(num_workers, ks_mode),
+            std::vector<std::function<void()>>(num_workers, worker));
 
     // Send requests into work queue
     steady_clock::time_point t1 = steady_clock::now();
@@ -210,6 +207,8 @@ int main(int argc, char *argv[]) {
 
     std::vector<double> short_runtimes;
     std::vector<double> long_runtimes;
+    std::vector<double> short_cpu_times;
+    std::vector<double> long_cpu_times;
 
     for (const auto &job : jobs) {
         if (job.type == JobType::Short) {
@@ -217,11 +216,14 @@ int main(int argc, char *argv[]) {
                 std::chrono::duration<double>(job.finished - job.submitted)
                     .count() *
                 1e6);
+            short_cpu_times.push_back(
+                absl::ToDoubleMicroseconds(job.cpu_time));
         } else if (job.type == JobType::Long) {
             long_runtimes.push_back(
                 std::chrono::duration<double>(job.finished - job.submitted)
                     .count() *
                 1e6);
+            long_cpu_times.push_back(absl::ToDoubleMicroseconds(job.cpu_time));
         }
     }
 
@@ -240,6 +242,11 @@ int main(int argc, char *argv[]) {
         printf("%s percentile: %.3f\n", p.c_str(),
                percentile(long_runtimes, stod(p) / 100.0));
     }
+    // Service times that jobs actually got, so that runs on different hosts
+    // can be compared.
+    printf("== CPU time per task ==\n");
+    printf("short median: %.3f\n", percentile(short_cpu_times, 0.5));
+    printf("long median: %.3f\n", percentile(long_cpu_times, 0.5));
 
     std::vector<std::pair<std::string, std::string>> stats;
     stats.push_back({"num_short", std::to_string(short_runtimes.size())});
@@ -256,6 +263,10 @@ int main(int argc, char *argv[]) {
         stats.push_back({oss.str(), std::to_string(percentile(
                                         long_runtimes, stod(p) / 100.0))});
     }
+    stats.push_back({"short_cpu_50_pct",
+                     std::to_string(percentile(short_cpu_times, 0.5))});
+    stats.push_back({"long_cpu_50_pct",
+                     std::to_string(percentile(long_cpu_times, 0.5))});
 
     printf("<csv>\n");
 
@@ -0,0 +1,425 @@
+// Copyright 2022 Google LLC
+//
+// Use of this source code is governed by a BSD-style
+// license that can be found in the LICENSE file or at
+// https://developers.google.com/open-source/licenses/bsd
+
+#include <sys/mman.h>
+#include <unistd.h>
+
+#include <functional>
+#include <memory>
+#include <utility>
+#include <vector>
+
+#include "gmock/gmock.h"
+#include "gtest/gtest.h"
+#include "schedulers/fifo/centralized/fifo_scheduler.h"
+#include "tests/synthetic_status_word_table.h"
+
+namespace ghost {
+namespace {
+
+using ::testing::ElementsAre;
+using ::testing::Pair;
+
+// Tests that only failures caused by the CPU are retried in the same
+// iteration.
+TEST(FifoCommitTest, RetryCommit) {
+  EXPECT_TRUE(FifoScheduler::RetryCommit(GHOST_TXN_CPU_UNAVAIL));
+
+  for (ghost_txn_state state : {
+           GHOST_TXN_COMPLETE,
+           GHOST_TXN_ABORTED,
+           GHOST_TXN_TARGET_ONCPU,
+           GHOST_TXN_TARGET_STALE,
+           GHOST_TXN_TARGET_NOT_FOUND,
+           GHOST_TXN_TARGET_NOT_RUNNABLE,
+           GHOST_TXN_AGENT_STALE,
+           GHOST_TXN_CPU_OFFLINE,
+           GHOST_TXN_NOT_PERMITTED,
+           GHOST_TXN_INVALID_FLAGS,
+           GHOST_TXN_INVALID_TARGET,
+           GHOST_TXN_INVALID_CPU,
+           GHOST_TXN_NO_AGENT,
+           GHOST_TXN_UNSUPPORTED_VERSION,
+           GHOST_TXN_POISONED,
+       }) {
+    EXPECT_FALSE(FifoScheduler::RetryCommit(state)) << state;
+  }
+}
+
+TEST(FifoCommitTest, Counters) {
+  FifoCommitCounters counters;
+  FifoCommitStats stats = counters.Snapshot();
+  EXPECT_EQ(stats.retries, 0);
+  for (int i = 0; i < FifoCommitStats::kNumStates; ++i) {
+    EXPECT_EQ(stats.states[i], 0);
+  }
+
+  counters.Count(GHOST_TXN_COMPLETE);
+  counters.Count(GHOST_TXN_COMPLETE);
+  counters.Count(GHOST_TXN_CPU_UNAVAIL);
+  counters.Count(GHOST_TXN_POISONED);
+  counters.CountRetry();
+
+  stats = counters.Snapshot();
+  EXPECT_EQ(stats.retries, 1);
+  EXPECT_EQ(stats.count(GHOST_TXN_COMPLETE), 2);
+  EXPECT_EQ(stats.count(GHOST_TXN_CPU_UNAVAIL), 1);
+  EXPECT_EQ(stats.count(GHOST_TXN_POISONED), 1);
+  EXPECT_EQ(stats.count(GHOST_TXN_TARGET_STALE), 0);
+}
+
+// Tests that states a commit does not end in are neither counted nor read out
+// of bounds.
+TEST(FifoCommitTest, OutOfRangeStates) {
+  EXPECT_EQ(FifoCommitStats::Index(GHOST_TXN_COMPLETE), 0);
+  EXPECT_EQ(FifoCommitStats::Index(GHOST_TXN_POISONED),
+            FifoCommitStats::kNumStates - 1);
+
+  FifoCommitCounters counters;
+  for (ghost_txn_state state : {GHOST_TXN_READY,
+                                static_cast<ghost_txn_state>(
+                                    GHOST_TXN_POISONED + 1)}) {
+    EXPECT_EQ(FifoCommitStats::Index(state), -1) << state;
+    counters.Count(state);
+  }
+
+  FifoCommitStats stats = counters.Snapshot();
+  EXPECT_EQ(stats.count(GHOST_TXN_READY), 0);
+  EXPECT_EQ(stats.count(static_cast<ghost_txn_state>(GHOST_TXN_POISONED + 1)),
+            0);
+  for (int i = 0; i < FifoCommitStats::kNumStates; ++i) {
+    EXPECT_EQ(stats.states[i], 0);
+  }
+}
+
+// The cpus that the scheduling tests use. Cpu 0 is the global agent's.
+constexpr int kNumCpus = 5;
+constexpr int kGlobalCpu = 0;
+// Status words 0 to kNumCpus - 1 are the agents', and tasks get the rest.
+constexpr uint32_t kNumStatusWords = 64;
+
+// Backs the few kernel calls that the scheduler makes outside of the enclave:
+// status words come from a `SyntheticStatusWordTable` and the global channel is
+// ordinary memory that nothing ever posts to.
+class FakeGhost : public Ghost {
+ public:
+  explicit FakeGhost(StatusWordTable* table) {
+    SetGlobalStatusWordTable(table);
+  }
+
+  int CreateQueue(int elems, int node, int flags, uint64_t& mapsize) override {
+    int fd = memfd_create("fifo_commit_test_queue", MFD_CLOEXEC);
+    CHECK_GE(fd, 0);
+    mapsize = getpagesize();
+    CHECK_EQ(ftruncate(fd, mapsize), 0);
+    ghost_queue_header header = {
+        .version = GHOST_QUEUE_VERSION,
+        .start = sizeof(header),
+        .nelems = static_cast<uint32_t>(elems),
+    };
+    CHECK_EQ(pwrite(fd, &header, sizeof(header), 0), sizeof(header));
+    return fd;
+  }
+
+  int FreeStatusWordInfo(ghost_sw_info& info) override { return 0; }
+};
+
+// A transaction that the `FakeEnclave` completes with a state of the test's
+// choosing.
+class FakeRunRequest : public RunRequest {
+ public:
+  void Open(const RunRequestOptions& options) override {
+    target_ = options.target;
+    target_barrier_ = options.target_barrier;
+    commit_flags_ = options.commit_flags;
+    state_ = GHOST_TXN_READY;
+  }
+  void OpenUnschedule() override { Open({}); }
+  bool Abort() override { return false; }
+
+  ghost_txn_state state() const override { return state_; }
+  void set_state(ghost_txn_state state) { state_ = state; }
+  absl::Time commit_time() const override { return absl::UnixEpoch(); }
+
+  int32_t sync_group_owner_get() const override { return -1; }
+  void sync_group_owner_set(int32_t owner) override {}
+  bool sync_group_owned() const override { return false; }
+  BarrierToken agent_barrier() const override {
+    return StatusWord::NullBarrierToken();
+  }
+  Gtid target() const override { return target_; }
+  BarrierToken target_barrier() const override { return target_barrier_; }
+  int commit_flags() const override { return commit_flags_; }
+  int run_flags() const override { return 0; }
+  bool allow_txn_target_on_cpu() const override { return false; }
+  uint64_t cpu_seqnum() const override { return 0; }
+
+ private:
+  ghost_txn_state state_ = GHOST_TXN_COMPLETE;
+  Gtid target_;
+  BarrierToken target_barrier_ = StatusWord::NullBarrierToken();
+  int commit_flags_ = 0;
+};
+
+// An agent that never runs, only there for the scheduler to read whether its
+// cpu is available.
+class FakeAgent : public Agent {
+ public:
+  FakeAgent(Enclave* enclave, const Cpu& cpu, ghost_sw_info sw_info)
+      : Agent(enclave, cpu), status_word_(Gtid(0), sw_info) {}
+  ~FakeAgent() override { status_word_.Free(); }
+
+  const StatusWord& status_word() const override { return status_word_; }
+
+ protected:
+  void AgentThread() override {}
+  void ThreadBody() override {}
+
+ private:
+  LocalStatusWord status_word_;
+};
+
+// Commits transactions without a kernel: each one ends in the state that
+// `result()` returns for its cpu, and is logged.
+class FakeEnclave : public Enclave {
+ public:
+  FakeEnclave(Topology* topology, SyntheticStatusWordTable* table)
+      : Enclave(AgentConfig(topology, topology->all_cpus())) {
+    for (const Cpu& cpu : topology->all_cpus()) {
+      ghost_status_word& sw = table->word(cpu.id());
+      sw.flags = GHOST_SW_F_INUSE | GHOST_SW_F_CANFREE | GHOST_SW_CPU_AVAIL;
+      agents_[cpu.id()] = std::make_unique<FakeAgent>(
+          this, cpu,
+          ghost_sw_info{.id = static_cast<uint32_t>(table->id()),
+                        .index = static_cast<uint32_t>(cpu.id())});
+    }
+  }
+
+  // Returns the state that a transaction committed on `cpu` ends in.
+  std::function<ghost_txn_state(const Cpu& cpu)> result = [](const Cpu&) {
+    return GHOST_TXN_COMPLETE;
+  };
+  // The cpu and target of each committed transaction, in commit order.
+  std::vector<std::pair<int, int64_t>> commits;
+
+  RunRequest* GetRunRequest(const Cpu& cpu) override {
+    return &requests_[cpu.id()];
+  }
+  bool CommitRunRequest(RunRequest* req) override {
+    SubmitRunRequest(req);
+    return CompleteRunRequest(req);
+  }
+  void SubmitRunRequest(RunRequest* req) override {
+    const int cpu = static_cast<FakeRunRequest*>(req) - requests_;
+    commits.emplace_back(cpu, req->target().id());
+    requests_[cpu].set_state(result(topology()->cpu(cpu)));
+  }
+  bool CompleteRunRequest(RunRequest* req) override {
+    return req->succeeded();
+  }
+  void LocalYieldRunRequest(const RunRequest* req, BarrierToken agent_barrier,
+                            int flags) override {}
+  bool PingRunRequest(const RunRequest* req) override { return false; }
+  bool CommitSyncRequests(const CpuList& cpu_list) override { return false; }
+  bool SubmitSyncRequests(const CpuList& cpu_list) override { return false; }
+  Agent* GetAgent(const Cpu& cpu) override { return agents_[cpu.id()].get(); }
+  StatusWordTable* GetStatusWordTable() override {
+    return GhostHelper()->GetGlobalStatusWordTable();
+  }
+  void ForEachTaskStatusWord(
+      std::function<void(ghost_status_word* sw, uint32_t region_id,
+                         uint32_t idx)>
+          l) override {}
+  void WaitForOldAgent() override {}
+  std::unique_ptr<Channel> MakeChannel(int elems, int node,
+                                       const CpuList& cpulist) override {
+    return nullptr;
+  }
+
+ private:
+  FakeRunRequest requests_[kNumCpus];
+  std::unique_ptr<FakeAgent> agents_[kNumCpus];
+};
+
+// Drives `FifoScheduler::GlobalSchedule()` against a `FakeEnclave`, with tasks
+// made runnable through `TaskNew()` messages.
+class FifoGlobalScheduleTest : public testing::Test {
+ protected:
+  static void SetUpTestSuite() {
+    std::vector<Cpu::Raw> cpus;
+    for (int i = 0; i < kNumCpus; i++) {
+      cpus.push_back({.cpu = i, .core = i, .smt_idx = 0, .siblings = {i}});
+    }
+    UpdateCustomTopology(cpus);
+  }
+
+  FifoGlobalScheduleTest()
+      : table_(kNumStatusWords),
+        ghost_(InstallFakeGhost(&table_)),
+        enclave_(CustomTopology(), &table_),
+        allocator_(
+            std::make_shared<SingleThreadMallocTaskAllocator<FifoTask>>()),
+        scheduler_(std::make_unique<FifoScheduler>(
+            &enclave_, CustomTopology()->all_cpus(), allocator_, kGlobalCpu,
+            /*preemption_time_slice=*/absl::Milliseconds(10))) {
+    scheduler_->EnclaveReady();
+  }
+
+  ~FifoGlobalScheduleTest() override {
+    std::vector<FifoTask*> tasks;
+    allocator_->ForEachTask([&tasks](Gtid gtid, FifoTask* task) {
+      tasks.push_back(task);
+      return true;
+    });
+    for (FifoTask* task : tasks) {
+      allocator_->FreeTask(task);
+    }
+    scheduler_.reset();
+  }
+
+  // Makes a `FakeGhost` the helper, which must happen before anything maps a
+  // status word or creates a queue.
+  static FakeGhost* InstallFakeGhost(StatusWordTable* table) {
+    auto* ghost = new FakeGhost(table);
+    UpdateGhostHelper(ghost);
+    return ghost;
+  }
+
+  // Hands the scheduler a new runnable task.
+  FifoTask* NewRunnableTask() {
+    const uint32_t idx = kNumCpus + next_task_++;
+    const int64_t gtid = 1000 + idx;
+    const uint32_t barrier = 1;
+    ghost_status_word& sw = table_.word(idx);
+    sw.barrier = barrier;
+    sw.flags = GHOST_SW_F_INUSE | GHOST_SW_F_CANFREE | GHOST_SW_TASK_RUNNABLE;
+    const ghost_sw_info sw_info = {.id = static_cast<uint32_t>(table_.id()),
+                                   .index = idx};
+
+    auto [task, allocated] = allocator_->GetTask(Gtid(gtid), sw_info);
+    CHECK(allocated);
+
+    alignas(ghost_msg) char buf[sizeof(ghost_msg) +
+                                sizeof(ghost_msg_payload_task_new)] = {};
+    ghost_msg* msg = reinterpret_cast<ghost_msg*>(buf);
+    msg->type = MSG_TASK_NEW;
+    msg->length = sizeof(buf);
+    msg->seqnum = barrier;
+    auto* payload = reinterpret_cast<ghost_msg_payload_task_new*>(msg->payload);
+    payload->gtid = gtid;
+    payload->runnable = 1;
+    payload->sw_info = sw_info;
+    scheduler_->TaskNew(task, Message(msg));
+    return task;
+  }
+
+  void GlobalSchedule() {
+    const Agent* agent = enclave_.GetAgent(CustomTopology()->cpu(kGlobalCpu));
+    scheduler_->GlobalSchedule(agent->status_word(),
+                               StatusWord::NullBarrierToken());
+  }
+
+  SyntheticStatusWordTable table_;
+  // Owned by `GhostHelper()` from here on.
+  FakeGhost* ghost_;
+  FakeEnclave enclave_;
+  std::shared_ptr<SingleThreadMallocTaskAllocator<FifoTask>> allocator_;
+  std::unique_ptr<FifoScheduler> scheduler_;
+
+ private:
+  int next_task_ = 0;
+};
+
+// Tests that a task whose commit fails because its cpu went away runs on
+// another available cpu in the same pass.
+TEST_F(FifoGlobalScheduleTest, CpuUnavailRetriedOnAnotherCpu) {
+  FifoTask* task = NewRunnableTask();
+  enclave_.result = [](const Cpu& cpu) {
+    return cpu.id() == 1 ? GHOST_TXN_CPU_UNAVAIL : GHOST_TXN_COMPLETE;
+  };
+
+  GlobalSchedule();
+
+  EXPECT_THAT(enclave_.commits,
+              ElementsAre(Pair(1, task->gtid.id()), Pair(2, task->gtid.id())));
+  EXPECT_TRUE(task->oncpu());
+  EXPECT_EQ(task->cpu.id(), 2);
+  EXPECT_FALSE(task->prio_boost);
+
+  const FifoCommitStats stats = scheduler_->GetCommitStats();
+  EXPECT_EQ(stats.retries, 1);
+  EXPECT_EQ(stats.count(GHOST_TXN_CPU_UNAVAIL), 1);
+  EXPECT_EQ(stats.count(GHOST_TXN_COMPLETE), 1);
+}
+
+// Tests that a task is boosted and requeued, once, when its commits keep
+// failing until the retries run out.
+TEST_F(FifoGlobalScheduleTest, RequeuedOnceWhenRetriesRunOut) {
+  FifoTask* task = NewRunnableTask();
+  enclave_.result = [](const Cpu&) { return GHOST_TXN_CPU_UNAVAIL; };
+
+  GlobalSchedule();
+
+  // The first attempt and two retries, with cpu 4 left over.
+  EXPECT_THAT(enclave_.commits,
+              ElementsAre(Pair(1, task->gtid.id()), Pair(2, task->gtid.id()),
+                          Pair(3, task->gtid.id())));
+  EXPECT_TRUE(task->queued());
+  EXPECT_TRUE(task->prio_boost);
+  EXPECT_EQ(scheduler_->GetCommitStats().retries, 2);
+
+  // The task is on the runqueue once: it is picked once, and nothing else is.
+  enclave_.commits.clear();
+  enclave_.result = [](const Cpu&) { return GHOST_TXN_COMPLETE; };
+  GlobalSchedule();
+  EXPECT_THAT(enclave_.commits, ElementsAre(Pair(1, task->gtid.id())));
+  EXPECT_TRUE(task->oncpu());
+}
+
+// Tests that a task is boosted and requeued, once, when its commit fails and
+// there is no other cpu to retry it on.
+TEST_F(FifoGlobalScheduleTest, RequeuedOnceWhenCpusRunOut) {
+  // One task per cpu, so no cpu is left for a retry.
+  std::vector<FifoTask*> tasks;
+  for (int i = 1; i < kNumCpus; i++) {
+    tasks.push_back(NewRunnableTask());
+  }
+  enclave_.result = [](const Cpu& cpu) {
+    return cpu.id() == 1 ? GHOST_TXN_CPU_UNAVAIL : GHOST_TXN_COMPLETE;
+  };
+
+  GlobalSchedule();
+
+  EXPECT_EQ(enclave_.commits.size(), kNumCpus - 1);
+  EXPECT_TRUE(tasks[0]->queued());
+  EXPECT_TRUE(tasks[0]->prio_boost);
+  for (int i = 1; i < tasks.size(); i++) {
+    EXPECT_TRUE(tasks[i]->oncpu()) << i;
+  }
+  EXPECT_EQ(scheduler_->GetCommitStats().retries, 0);
+}
+
+// Tests that a commit that failed because of the task is not retried in the
+// same pass, even with cpus to spare.
+TEST_F(FifoGlobalScheduleTest, StaleTaskNotRetried) {
+  FifoTask* task = NewRunnableTask();
+  enclave_.result = [](const Cpu&) { return GHOST_TXN_TARGET_STALE; };
+
+  GlobalSchedule();
+
+  EXPECT_THAT(enclave_.commits, ElementsAre(Pair(1, task->gtid.id())));
+  EXPECT_TRUE(task->queued());
+  EXPECT_TRUE(task->prio_boost);
+  EXPECT_EQ(scheduler_->GetCommitStats().retries, 0);
+}
+
+}  // namespace
+}  // namespace ghost
+
+int main(int argc, char** argv) {
+  testing::InitGoogleTest(&argc, argv);
+  return RUN_ALL_TESTS();
+}
@@ -0,0 +1,99 @@
+// Copyright 2022 Google LLC
+//
+// Use of this source code is governed by a BSD-style
+// license that can be found in the LICENSE file or at
+// https://developers.google.com/open-source/licenses/bsd
+
+#include "schedulers/flux/flux_hierarchy.h"
+
+#include "gmock/gmock.h"
+#include "gtest/gtest.h"
+
+namespace ghost {
+namespace {
+
+using ::testing::ElementsAre;
+
+TEST(FluxHierarchyTest, Default) {
+  FluxHierarchy h = FluxHierarchy::Default();
+  EXPECT_EQ(h.nr_scheds, 4);
+  EXPECT_EQ(h.nr_tiers, 3);
+  EXPECT_EQ(h.top, 1);
+  EXPECT_EQ(h.new_thread, 2);
+
+  EXPECT_EQ(h.type[FLUX_SCHED_NONE], FLUX_SCHED_TYPE_NONE);
+  EXPECT_EQ(h.Tier(FLUX_SCHED_NONE), 0);
+  EXPECT_STREQ(FluxHierarchy::TypeName(h.type[1]), "roci");
+  EXPECT_EQ(h.Parent(1), FLUX_SCHED_NONE);
+  EXPECT_EQ(h.Tier(1), 1);
+  EXPECT_STREQ(FluxHierarchy::TypeName(h.type[2]), "biff");
+  EXPECT_EQ(h.Parent(2), 1);
+  EXPECT_EQ(h.Tier(2), 2);
+  EXPECT_STREQ(FluxHierarchy::TypeName(h.type[3]), "idle");
+  EXPECT_EQ(h.Parent(3), 1);
+  EXPECT_EQ(h.Tier(3), 2);
+
+  EXPECT_THAT(h.Children(FLUX_SCHED_NONE), ElementsAre(1));
+  EXPECT_THAT(h.Children(1), ElementsAre(2, 3));
+  EXPECT_TRUE(h.Children(2).empty());
+
+  // Unknown ids are tier 0, like in bpf.
+  EXPECT_EQ(h.Tier(4), 0);
+  EXPECT_EQ(h.Tier(-1), 0);
+}
+
+// Tests that roci's children may come in either order, and that nothing can be
+// stacked below roci's children.
+TEST(FluxHierarchyTest, RociChildren) {
+  absl::StatusOr<FluxHierarchy> h = FluxHierarchy::Parse("roci,idle:1,biff:1");
+  ASSERT_TRUE(h.ok()) << h.status();
+  EXPECT_EQ(h->nr_tiers, 3);
+  EXPECT_EQ(h->Tier(3), 2);
+  EXPECT_EQ(h->new_thread, 3);
+  EXPECT_THAT(h->Children(1), ElementsAre(2, 3));
+
+  // Biff and idle never hand out cpus, so nothing can run below them, and roci
+  // has one primary.
+  for (const char* spec : {
+           "roci,biff:1,idle:2",
+           "roci,idle:1,biff:1,biff:1",
+       }) {
+    EXPECT_EQ(FluxHierarchy::Parse(spec).status().code(),
+              absl::StatusCode::kInvalidArgument)
+        << spec;
+  }
+}
+
+TEST(FluxHierarchyTest, Invalid) {
+  for (const char* spec : {
+           "",
+           "cfs",
+           "roci,biff:1:2",
+           // Two tops.
+           "roci,biff",
+           // Parents come first.
+           "biff:2,roci",
+           "roci,biff:0",
+           "roci,biff:x",
+           // An ancestor of the same type.
+           "roci,biff:1,roci:2",
+           // No one schedules threads.
+           "roci,idle:1",
+           // Roci without an idle child, or with two.
+           "roci,biff:1",
+           "roci,biff:1,idle:1,idle:1",
+           "roci,biff:1,idle:1,idle:1,idle:1,idle:1,idle:1,idle:1",
+       }) {
+    EXPECT_EQ(FluxHierarchy::Parse(spec).status().code(),
+              absl::StatusCode::kInvalidArgument)
+        << spec;
+  }
+}
+
+}  // namespace
+}  // namespace ghost
+
+int main(int argc, char** argv) {
+  testing::InitGoogleTest(&argc, argv);
+  return RUN_ALL_TESTS();
+}
@@ -17,9 +17,9 @@ class FluxTest : public testing::Test {
  protected:
   static void SetUpTestSuite() {
     Topology* t = MachineTopology();
-    AgentConfig cfg(t, t->all_cpus());
+    FluxConfig cfg(t, t->all_cpus());
 
-    uap_ = new AgentProcess<FullFluxAgent<LocalEnclave>, AgentConfig>(cfg);
+    uap_ = new AgentProcess<FullFluxAgent<LocalEnclave>, FluxConfig>(cfg);
   }
 
   static void TearDownTestSuite() {
@@ -27,10 +27,10 @@ class FluxTest : public testing::Test {
     uap_ = nullptr;
   }
 
-  static AgentProcess<FullFluxAgent<LocalEnclave>, AgentConfig>* uap_;
+  static AgentProcess<FullFluxAgent<LocalEnclave>, FluxConfig>* uap_;
 };
 
-AgentProcess<FullFluxAgent<LocalEnclave>, AgentConfig>* FluxTest::uap_;
+AgentProcess<FullFluxAgent<LocalEnclave>, FluxConfig>* FluxTest::uap_;
 
 TEST_F(FluxTest, Simple) {
   RemoteThreadTester(/*num_threads=*/1).Run(
@@ -0,0 +1,237 @@
+// Copyright 2022 Google LLC
+//
+// Use of this source code is governed by a BSD-style
+// license that can be found in the LICENSE file or at
+// https://developers.google.com/open-source/licenses/bsd
+
+#include "schedulers/flux/flux_tier_model.h"
+
+#include "gmock/gmock.h"
+#include "gtest/gtest.h"
+
+// Replays Flux's per-cpu tier state machine and checks the stats that
+// flux_api.bpf.c keeps along the way, in the default hierarchy: Roci is tier 1,
+// Biff and Idle tier 2.
+
+namespace ghost {
+namespace {
+
+using Event = FluxTierModel::Event;
+
+constexpr int kCpu = 0;
+// FluxHierarchy::kDefaultSpec's sched ids.
+constexpr int kRoci = 1;
+constexpr int kBiff = 2;
+constexpr int kIdle = 3;
+
+// Brings cpu 0 up and hands it to biff: NONE -> roci -> biff, at t=1100.
+// bpf_ktime_get_ns() is never 0, and neither are our timestamps.
+std::vector<Event> BringUpToBiff() {
+  return {
+      {Event::kCpuAvailable, 1000, kCpu},
+      {Event::kPnt, 1000, kCpu},
+      {Event::kGrant, 1100, kCpu, kBiff},
+  };
+}
+
+class FluxTierModelTest : public testing::Test {
+ protected:
+  FluxTierModelTest() : model_(FluxHierarchy::Default(), /*nr_cpus=*/2) {}
+
+  const __flux_sched_cpu_stats& Stats(int sched_id, int cpu = kCpu) const {
+    return model_.stats(cpu).sched[sched_id];
+  }
+
+  FluxTierModel model_;
+};
+
+TEST_F(FluxTierModelTest, BringUp) {
+  ASSERT_TRUE(model_.Replay(BringUpToBiff()).ok());
+  EXPECT_TRUE(model_.available(kCpu));
+  EXPECT_EQ(model_.current_sched(kCpu), kBiff);
+  EXPECT_EQ(model_.preempt_to(kCpu), FLUX_MAX_NR_TIERS);  // NO_PREEMPT
+  EXPECT_EQ(Stats(kRoci).grants, 1);
+  EXPECT_EQ(Stats(kBiff).grants, 1);
+  EXPECT_EQ(Stats(kRoci).residency_ns, 100);
+}
+
+// Biff kicks a task off its own cpu: no scheduler loses the cpu.
+TEST_F(FluxTierModelTest, SelfPreemption) {
+  ASSERT_TRUE(model_.Replay(BringUpToBiff()).ok());
+  ASSERT_TRUE(model_
+                  .Replay({
+                      {Event::kPreemptCpu, 1200, kCpu, kBiff},
+                      {Event::kPnt, 1300, kCpu},
+                  })
+                  .ok());
+  EXPECT_EQ(model_.current_sched(kCpu), kBiff);
+  EXPECT_EQ(Stats(kBiff).preempt_requests, 1);
+  EXPECT_EQ(Stats(kBiff).preempted, 0);
+  EXPECT_EQ(model_.stats(kCpu).preemptions[2], 1);
+  EXPECT_EQ(model_.stats(kCpu).preemptions[1], 0);
+}
+
+TEST_F(FluxTierModelTest, RociPreemptsBiff) {
+  ASSERT_TRUE(model_.Replay(BringUpToBiff()).ok());
+  // Roci asks from another cpu.
+  ASSERT_TRUE(model_
+                  .Replay({
+                      {Event::kPreemptCpu, 1200, kCpu, kRoci},
+                      {Event::kPnt, 1300, kCpu},
+                  })
+                  .ok());
+  EXPECT_EQ(model_.current_sched(kCpu), kRoci);
+  EXPECT_EQ(Stats(kRoci).preempt_requests, 1);
+  EXPECT_EQ(Stats(kBiff).preempted, 1);
+  EXPECT_EQ(model_.stats(kCpu).preemptions[1], 1);
+  EXPECT_EQ(Stats(kBiff).residency_ns, 200);
+
+  // Roci gives it to idle.
+  ASSERT_TRUE(
+      model_.Apply({Event::kGrant, 1400, kCpu, kIdle}).ok());
+  EXPECT_EQ(model_.current_sched(kCpu), kIdle);
+  EXPECT_EQ(Stats(kRoci).residency_ns, 100 + 100);
+}
+
+// A request to a lower tier is covered by a pending one to a higher tier, and
+// doesn't count.
+TEST_F(FluxTierModelTest, ConcurrentPreemptions) {
+  ASSERT_TRUE(model_.Replay(BringUpToBiff()).ok());
+  ASSERT_TRUE(model_
+                  .Replay({
+                      {Event::kPreemptCpu, 1200, kCpu, kRoci},
+                      {Event::kPreemptCpu, 1210, kCpu, kBiff},
+                      {Event::kPnt, 1300, kCpu},
+                  })
+                  .ok());
+  EXPECT_EQ(model_.current_sched(kCpu), kRoci);
+  EXPECT_EQ(Stats(kRoci).preempt_requests, 1);
+  EXPECT_EQ(Stats(kBiff).preempt_requests, 0);
+  EXPECT_EQ(model_.stats(kCpu).preemptions[1], 1);
+  EXPECT_EQ(model_.stats(kCpu).preemptions[2], 0);
+
+  // The other way around, roci's request wins too.
+  ASSERT_TRUE(model_
+                  .Replay({
+                      {Event::kGrant, 1400, kCpu, kBiff},
+                      {Event::kPreemptCpu, 1500, kCpu, kBiff},
+                      {Event::kPreemptCpu, 1510, kCpu, kRoci},
+                      {Event::kPnt, 1600, kCpu},
+                  })
+                  .ok());
+  EXPECT_EQ(model_.current_sched(kCpu), kRoci);
+  EXPECT_EQ(Stats(kRoci).preempt_requests, 2);
+  EXPECT_EQ(Stats(kBiff).preempt_requests, 1);
+  EXPECT_EQ(Stats(kBiff).preempted, 2);
+  EXPECT_EQ(model_.stats(kCpu).preemptions[1], 2);
+}
+
+// The kernel takes the cpu back from everyone.
+TEST_F(FluxTierModelTest, CpuBusy) {
+  ASSERT_TRUE(model_.Replay(BringUpToBiff()).ok());
+  ASSERT_TRUE(model_.Apply({Event::kCpuBusy, 1200, kCpu}).ok());
+  EXPECT_FALSE(model_.available(kCpu));
+  EXPECT_EQ(model_.current_sched(kCpu), FLUX_SCHED_NONE);
+  EXPECT_EQ(Stats(kBiff).preempted, 1);
+  EXPECT_EQ(Stats(kRoci).preempted, 1);
+  EXPECT_EQ(model_.stats(kCpu).preemptions[0], 1);
+
+  // Nobody can preempt the cpu further, and PNT does nothing until we get it
+  // back.
+  ASSERT_TRUE(
+      model_.Apply({Event::kPreemptCpu, 1300, kCpu, kRoci}).ok());
+  EXPECT_EQ(Stats(kRoci).preempt_requests, 0);
+  ASSERT_TRUE(model_.Apply({Event::kPnt, 1400, kCpu}).ok());
+  EXPECT_EQ(model_.current_sched(kCpu), FLUX_SCHED_NONE);
+
+  ASSERT_TRUE(model_
+                  .Replay({
+                      {Event::kCpuAvailable, 2000, kCpu},
+                      {Event::kPnt, 2200, kCpu},
+                  })
+                  .ok());
+  EXPECT_EQ(model_.current_sched(kCpu), kRoci);
+  EXPECT_EQ(Stats(kRoci).grants, 2);
+  EXPECT_EQ(Stats(FLUX_SCHED_NONE).residency_ns, 1000);
+}
+
+TEST_F(FluxTierModelTest, IllegalTransitions) {
+  // Roci doesn't have the cpu yet.
+  EXPECT_FALSE(
+      model_.Apply({Event::kGrant, 1000, kCpu, kBiff}).ok());
+  ASSERT_TRUE(model_.Replay(BringUpToBiff()).ok());
+  // Idle isn't biff's child, and only biff can yield the cpu.
+  EXPECT_FALSE(
+      model_.Apply({Event::kGrant, 1200, kCpu, kIdle}).ok());
+  EXPECT_FALSE(
+      model_.Apply({Event::kYield, 1200, kCpu, kRoci}).ok());
+  EXPECT_FALSE(
+      model_.Apply({Event::kYield, 1200, kCpu, FLUX_SCHED_NONE}).ok());
+  EXPECT_FALSE(model_.Apply({Event::kPnt, 1050, kCpu}).ok());
+  EXPECT_FALSE(model_.Apply({Event::kPnt, 1200, /*cpu=*/2}).ok());
+  EXPECT_FALSE(model_.Apply({Event::kPreemptCpu, 1200, kCpu, 42}).ok());
+
+  // None of them changed anything.
+  EXPECT_EQ(model_.current_sched(kCpu), kBiff);
+  EXPECT_EQ(Stats(kIdle).grants, 0);
+  EXPECT_EQ(Stats(kBiff).yields, 0);
+}
+
+TEST_F(FluxTierModelTest, Residency) {
+  ASSERT_TRUE(model_.Replay(BringUpToBiff()).ok());
+  // Biff holds the cpu for 500ns, 3us and 5ms.
+  uint64_t t = 1100;
+  for (uint64_t stint : {500, 3000, 5000000}) {
+    ASSERT_TRUE(model_
+                    .Replay({
+                        {Event::kYield, t + stint, kCpu, kBiff},
+                        {Event::kGrant, t + stint, kCpu, kBiff},
+                    })
+                    .ok());
+    t += stint;
+  }
+  const __flux_sched_cpu_stats& biff = Stats(kBiff);
+  EXPECT_EQ(biff.yields, 3);
+  EXPECT_EQ(biff.grants, 4);
+  EXPECT_EQ(biff.residency_ns, 500 + 3000 + 5000000);
+  EXPECT_EQ(biff.residency[0], 1);
+  EXPECT_EQ(biff.residency[flux_stats_residency_slot(3000)], 1);
+  EXPECT_EQ(flux_stats_residency_slot(3000), 2);  // [2, 4) usec
+  EXPECT_EQ(biff.residency[flux_stats_residency_slot(5000000)], 1);
+  EXPECT_EQ(flux_stats_residency_slot(~0ull), FLUX_STATS_RESIDENCY_SLOTS - 1);
+  // Roci's stints between the yields and grants took no time.
+  EXPECT_EQ(Stats(kRoci).residency[0], 1 + 3);
+}
+
+TEST_F(FluxTierModelTest, Report) {
+  ASSERT_TRUE(model_.Replay(BringUpToBiff()).ok());
+  ASSERT_TRUE(model_
+                  .Replay({
+                      {Event::kCpuAvailable, 1000, 1},
+                      {Event::kPnt, 1000, 1},
+                      {Event::kGrant, 1300, 1, kIdle},
+                      {Event::kCpuBusy, 2000, kCpu},
+                      {Event::kCpuBusy, 2000, 1},
+                  })
+                  .ok());
+  FluxTierReport report = model_.Report();
+  EXPECT_EQ(report.nr_cpus, 2);
+  EXPECT_EQ(report.nr_scheds, 4);
+  EXPECT_EQ(report.nr_tiers, 3);
+  EXPECT_EQ(report.tier[kIdle], 2);
+  EXPECT_EQ(report.sched[kRoci].grants, 2);
+  EXPECT_EQ(report.sched[kRoci].preempted, 2);
+  EXPECT_EQ(report.preemptions[0], 2);
+  EXPECT_EQ(report.tier_residency_ns[1], 100 + 300);
+  // Biff and idle share tier 2.
+  EXPECT_EQ(report.tier_residency_ns[2], 900 + 700);
+  EXPECT_EQ(report.sched[kIdle].residency_ns, 700);
+}
+
+}  // namespace
+}  // namespace ghost
+
+int main(int argc, char** argv) {
+  testing::InitGoogleTest(&argc, argv);
+  return RUN_ALL_TESTS();
+}
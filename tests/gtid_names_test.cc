@@ -0,0 +1,132 @@
+// Copyright 2022 Google LLC
+//
+// Use of this source code is governed by a BSD-style
+// license that can be found in the LICENSE file or at
+// https://developers.google.com/open-source/licenses/bsd
+
+#include "lib/gtid_names.h"
+
+#include <string>
+#include <thread>
+#include <vector>
+
+#include "gmock/gmock.h"
+#include "gtest/gtest.h"
+#include "absl/strings/str_cat.h"
+
+namespace ghost {
+namespace {
+
+using ::testing::Eq;
+using ::testing::IsEmpty;
+using ::testing::Ne;
+
+TEST(GtidNamesTest, AssignAndFind) {
+  GtidNameRegistry names;
+
+  EXPECT_THAT(names.Find(42), IsEmpty());
+  names.Assign(42, "worker");
+  EXPECT_THAT(names.Find(42), Eq("worker"));
+  EXPECT_THAT(names.Lookup(42), Eq("worker"));
+  EXPECT_THAT(names.size(), Eq(1));
+}
+
+// Tests that a view of the old name stays valid across one rename.
+TEST(GtidNamesTest, Rename) {
+  GtidNameRegistry names;
+
+  names.Assign(42, "first");
+  absl::string_view first = names.Find(42);
+  names.Assign(42, "second");
+  EXPECT_THAT(first, Eq("first"));
+  EXPECT_THAT(names.Find(42), Eq("second"));
+  EXPECT_THAT(names.size(), Eq(1));
+}
+
+TEST(GtidNamesTest, Truncate) {
+  GtidNameRegistry names;
+
+  const std::string name(GtidNameRegistry::kMaxNameLength + 10, 'x');
+  names.Assign(42, name);
+  EXPECT_THAT(names.Find(42),
+              Eq(name.substr(0, GtidNameRegistry::kMaxNameLength)));
+}
+
+// Tests that gtids without names get unique generated ones, which stick.
+TEST(GtidNamesTest, GeneratedNames) {
+  GtidNameRegistry names;
+
+  const std::string a(names.Lookup(1 << 20));
+  const std::string b(names.Lookup(2 << 20));
+  EXPECT_THAT(a, Ne(b));
+  EXPECT_THAT(names.Lookup(1 << 20), Eq(a));
+  EXPECT_THAT(names.Find(2 << 20), Eq(b));
+}
+
+// Tests that names survive the table growing many times over.
+TEST(GtidNamesTest, Grow) {
+  GtidNameRegistry names(/*initial_capacity=*/2);
+
+  constexpr int kNumGtids = 10000;
+  for (int i = 1; i <= kNumGtids; i++) {
+    names.Assign(i, absl::StrCat("task", i));
+  }
+  EXPECT_THAT(names.size(), Eq(kNumGtids));
+  for (int i = 1; i <= kNumGtids; i++) {
+    EXPECT_THAT(names.Find(i), Eq(absl::StrCat("task", i)));
+  }
+}
+
+// Tests that readers see either no name or the complete one while writers add
+// gtids and grow the table.
+TEST(GtidNamesTest, ConcurrentReadersAndWriters) {
+  GtidNameRegistry names(/*initial_capacity=*/16);
+
+  constexpr int kNumWriters = 4;
+  constexpr int kGtidsPerWriter = 5000;
+  std::atomic<bool> done = false;
+
+  std::vector<std::thread> readers;
+  for (int r = 0; r < 2; r++) {
+    readers.emplace_back([&names, &done]() {
+      while (!done.load(std::memory_order_relaxed)) {
+        for (int i = 1; i <= kNumWriters * kGtidsPerWriter; i += 97) {
+          absl::string_view name = names.Find(i);
+          if (!name.empty()) {
+            EXPECT_THAT(name, Eq(absl::StrCat("task", i)));
+          }
+        }
+      }
+    });
+  }
+
+  std::vector<std::thread> writers;
+  for (int w = 0; w < kNumWriters; w++) {
+    writers.emplace_back([&names, w]() {
+      for (int i = 0; i < kGtidsPerWriter; i++) {
+        const int gtid = 1 + w + i * kNumWriters;
+        names.Assign(gtid, absl::StrCat("task", gtid));
+      }
+    });
+  }
+  for (std::thread& t : writers) {
+    t.join();
+  }
+  done.store(true, std::memory_order_relaxed);
+  for (std::thread& t : readers) {
+    t.join();
+  }
+
+  EXPECT_THAT(names.size(), Eq(kNumWriters * kGtidsPerWriter));
+  for (int i = 1; i <= kNumWriters * kGtidsPerWriter; i++) {
+    EXPECT_THAT(names.Find(i), Eq(absl::StrCat("task", i)));
+  }
+}
+
+}  // namespace
+}  // namespace ghost
+
+int main(int argc, char** argv) {
+  testing::InitGoogleTest(&argc, argv);
+  return RUN_ALL_TESTS();
+}
@@ -0,0 +1,212 @@
+// Copyright 2022 Google LLC
+//
+// Use of this source code is governed by a BSD-style
+// license that can be found in the LICENSE file or at
+// https://developers.google.com/open-source/licenses/bsd
+
+#include "bpf/user/hist_stream.h"
+
+#include <errno.h>
+#include <stdio.h>
+
+#include <cstring>
+#include <string>
+#include <vector>
+
+#include "gmock/gmock.h"
+#include "gtest/gtest.h"
+
+// Tests the log-linear histograms of the BPF tracing tools and the streams
+// that the tools write.  Reading the BPF maps needs a kernel.
+
+namespace {
+
+using ::testing::ElementsAre;
+
+TEST(LlHistTest, Slots) {
+  // Small values get a slot each.
+  for (uint64_t v = 0; v < LL_HIST_NR_SUBS; ++v) {
+    EXPECT_EQ(ll_hist_slot(v), v);
+  }
+  EXPECT_EQ(ll_hist_slot(8), 8);
+  EXPECT_EQ(ll_hist_slot(15), 15);
+  EXPECT_EQ(ll_hist_slot(16), 16);
+  EXPECT_EQ(ll_hist_slot(17), 16);
+  EXPECT_EQ(ll_hist_slot(18), 17);
+  EXPECT_EQ(ll_hist_slot(1ull << LL_HIST_MAX_SHIFT), LL_HIST_NR_SLOTS - 1);
+  EXPECT_EQ(ll_hist_slot(~0ull), LL_HIST_NR_SLOTS - 1);
+}
+
+// Tests that every value lands in the slot whose bounds contain it, and that
+// the slots are contiguous.
+TEST(LlHistTest, Bounds) {
+  for (uint32_t slot = 0; slot < LL_HIST_NR_SLOTS - 1; ++slot) {
+    uint64_t lower = ll_hist_slot_lower(slot);
+    uint64_t upper = ll_hist_slot_upper(slot);
+    ASSERT_LT(lower, upper) << slot;
+    EXPECT_EQ(ll_hist_slot(lower), slot);
+    EXPECT_EQ(ll_hist_slot(upper - 1), slot);
+    EXPECT_EQ(ll_hist_slot(upper), slot + 1);
+    // At most 1/LL_HIST_NR_SUBS of the values in the slot wide.
+    EXPECT_LE((upper - lower) * LL_HIST_NR_SUBS, std::max<uint64_t>(lower, 8));
+  }
+  EXPECT_EQ(ll_hist_slot_lower(LL_HIST_NR_SLOTS - 1),
+            ll_hist_slot_upper(LL_HIST_NR_SLOTS - 1));
+}
+
+// Tests that sub-usec latencies that a log2 usec histogram lumps together get
+// slots of their own.
+TEST(LlHistTest, SubMicrosecond) {
+  EXPECT_NE(ll_hist_slot(500), ll_hist_slot(600));
+  EXPECT_NE(ll_hist_slot(1100), ll_hist_slot(1300));
+  EXPECT_EQ(ll_hist_slot(1000), ll_hist_slot(1010));
+}
+
+TEST(HistCountsTest, Percentile) {
+  hist_counts c = {};
+  EXPECT_EQ(hist_counts_percentile(&c, 50), 0);
+  EXPECT_EQ(hist_counts_max(&c), 0);
+
+  // 90 runs of 1us, 9 of 100us and 1 of 10ms.
+  c.slots[ll_hist_slot(1000)] = 90;
+  c.slots[ll_hist_slot(100000)] = 9;
+  c.slots[ll_hist_slot(10000000)] = 1;
+  EXPECT_EQ(hist_counts_total(&c), 100);
+  EXPECT_EQ(hist_counts_percentile(&c, 50),
+            ll_hist_slot_upper(ll_hist_slot(1000)));
+  EXPECT_EQ(hist_counts_percentile(&c, 90),
+            ll_hist_slot_upper(ll_hist_slot(1000)));
+  EXPECT_EQ(hist_counts_percentile(&c, 99),
+            ll_hist_slot_upper(ll_hist_slot(100000)));
+  EXPECT_EQ(hist_counts_percentile(&c, 99.9),
+            ll_hist_slot_upper(ll_hist_slot(10000000)));
+  EXPECT_EQ(hist_counts_max(&c), ll_hist_slot_upper(ll_hist_slot(10000000)));
+
+  // The bounds are within 12.5% of the values.
+  EXPECT_GT(hist_counts_percentile(&c, 50), 1000);
+  EXPECT_LE(hist_counts_percentile(&c, 50), 1125);
+}
+
+TEST(HistCountsTest, FoldLog2) {
+  hist_counts c = {};
+  // print_log2_hist()'s slots are 0-1us, 2-3us, 4-7us, etc.
+  c.slots[ll_hist_slot(500)] = 1;
+  c.slots[ll_hist_slot(1500)] = 2;
+  c.slots[ll_hist_slot(3000)] = 3;
+  c.slots[ll_hist_slot(3900)] = 4;
+  c.slots[ll_hist_slot(100000)] = 5;
+  c.slots[LL_HIST_NR_SLOTS - 1] = 6;
+
+  unsigned int log2_slots[HIST_STREAM_LOG2_SLOTS];
+  hist_counts_fold_log2_us(&c, log2_slots);
+  EXPECT_EQ(log2_slots[0], 3);
+  EXPECT_EQ(log2_slots[1], 7);
+  EXPECT_EQ(log2_slots[6], 5);
+  EXPECT_EQ(log2_slots[HIST_STREAM_LOG2_SLOTS - 1], 6);
+}
+
+// Runs `write(f)` on a memory stream and returns what it wrote.
+template <class F>
+std::string Capture(F write) {
+  char* buf = nullptr;
+  size_t len = 0;
+  FILE* f = open_memstream(&buf, &len);
+  write(f);
+  fclose(f);
+  std::string s(buf, len);
+  free(buf);
+  return s;
+}
+
+TEST(HistStreamTest, Csv) {
+  hist_counts c = {};
+  c.slots[3] = 2;
+  c.slots[ll_hist_slot(1000)] = 1;
+
+  std::string out = Capture([&c](FILE* f) {
+    hist_stream_write_csv(f, "runnable_to_run", 2000, 1000, &c);
+  });
+  EXPECT_EQ(out, "2000,1000,runnable_to_run,3,4,1024,1024,1024,1024,3:2 "
+                 "960:1\n");
+
+  hist_counts empty = {};
+  out = Capture([&empty](FILE* f) {
+    hist_stream_write_csv(f, "all", 2000, 1000, &empty);
+  });
+  EXPECT_EQ(out, "2000,1000,all,0,0,0,0,0,0,\n");
+}
+
+TEST(HistStreamTest, Binary) {
+  uint64_t slots[20] = {};
+  slots[2] = 7;
+  slots[19] = uint64_t{1} << 40;
+
+  std::string out = Capture([&slots](FILE* f) {
+    ASSERT_EQ(hist_stream_write_bin(f, /*hist_id=*/5, /*ts_ns=*/2000,
+                                    /*interval_ns=*/1000, slots, 20),
+              0);
+  });
+  ASSERT_EQ(out.size(),
+            sizeof(hist_stream_record) + 2 * sizeof(hist_stream_bucket));
+
+  hist_stream_record rec;
+  memcpy(&rec, out.data(), sizeof(rec));
+  EXPECT_EQ(rec.magic, HIST_STREAM_MAGIC);
+  EXPECT_EQ(rec.version, HIST_STREAM_VERSION);
+  EXPECT_EQ(rec.hist_id, 5);
+  EXPECT_EQ(rec.ts_ns, 2000);
+  EXPECT_EQ(rec.interval_ns, 1000);
+  EXPECT_EQ(rec.nr_slots, 20);
+  EXPECT_EQ(rec.nr_buckets, 2);
+
+  std::vector<std::pair<uint32_t, uint32_t>> buckets;
+  for (uint32_t i = 0; i < rec.nr_buckets; ++i) {
+    hist_stream_bucket b;
+    memcpy(&b, out.data() + sizeof(rec) + i * sizeof(b), sizeof(b));
+    buckets.push_back({b.slot, b.count});
+  }
+  // The count saturates.
+  EXPECT_THAT(buckets, ElementsAre(std::pair<uint32_t, uint32_t>{2, 7},
+                                   std::pair<uint32_t, uint32_t>{
+                                       19, UINT32_MAX}));
+}
+
+// Tests that a failed write is reported to the tool rather than dropped.
+TEST(HistStreamTest, EmitWriteError) {
+  const hist_desc desc = {.name = "runnable_to_run", .title = "Latency"};
+  hist_counts delta = {};
+  delta.slots[3] = 1;
+
+  // Writes to a stream opened for reading fail.
+  FILE* f = fopen("/dev/null", "r");
+  ASSERT_NE(f, nullptr);
+  for (hist_stream_format format : {HIST_STREAM_CSV, HIST_STREAM_BIN}) {
+    hist_stream hs = {};
+    hs.descs = &desc;
+    hs.nr_hists = 1;
+    hs.format = format;
+    hs.out = f;
+    hs.delta = &delta;
+    EXPECT_EQ(hist_stream_emit(&hs), -EIO) << format;
+  }
+  fclose(f);
+
+  std::string out = Capture([&desc, &delta](FILE* f) {
+    hist_stream hs = {};
+    hs.descs = &desc;
+    hs.nr_hists = 1;
+    hs.format = HIST_STREAM_BIN;
+    hs.out = f;
+    hs.delta = &delta;
+    EXPECT_EQ(hist_stream_emit(&hs), 0);
+  });
+  EXPECT_EQ(out.size(),
+            sizeof(hist_stream_record) + sizeof(hist_stream_bucket));
+}
+
+}  // namespace
+
+int main(int argc, char** argv) {
+  testing::InitGoogleTest(&argc, argv);
+  return RUN_ALL_TESTS();
+}
@@ -0,0 +1,164 @@
+// Copyright 2023 Google LLC
+//
+// Use of this source code is governed by a BSD-style
+// license that can be found in the LICENSE file or at
+// https://developers.google.com/open-source/licenses/bsd
+
+#include "orca/protocol.h"
+
+#include <cstring>
+
+#include "gmock/gmock.h"
+#include "gtest/gtest.h"
+
+namespace orca {
+namespace {
+
+TEST(OrcaProtocolTest, RoundTrip) {
+  FrameWriter<MetricRecord> writer(/*seq=*/7);
+  EXPECT_TRUE(writer.empty());
+  for (int i = 0; i < 3; ++i) {
+    MetricRecord* m = writer.append();
+    ASSERT_NE(m, nullptr);
+    m->gtid = 100 + i;
+    m->preempt_count = i;
+  }
+  EXPECT_EQ(writer.size(), sizeof(FrameHeader) + 3 * sizeof(MetricRecord));
+
+  FrameView frame;
+  ASSERT_EQ(frame.parse(writer.data(), writer.size()), nullptr);
+  EXPECT_EQ(frame.type(), MessageType::Metric);
+  EXPECT_EQ(frame.seq(), 7);
+  ASSERT_EQ(frame.count(), 3);
+  EXPECT_EQ(frame.size(), writer.size());
+  for (int i = 0; i < 3; ++i) {
+    EXPECT_EQ(frame.record<MetricRecord>(i).gtid, 100 + i);
+    EXPECT_EQ(frame.record<MetricRecord>(i).preempt_count, i);
+  }
+
+  writer.reset();
+  EXPECT_TRUE(writer.empty());
+  EXPECT_EQ(writer.size(), sizeof(FrameHeader));
+}
+
+TEST(OrcaProtocolTest, Full) {
+  FrameWriter<IngressHintRecord> writer;
+  for (size_t i = 0; i < FrameWriter<IngressHintRecord>::MAX_RECORDS; ++i) {
+    ASSERT_NE(writer.append(), nullptr);
+  }
+  EXPECT_TRUE(writer.full());
+  EXPECT_EQ(writer.append(), nullptr);
+  EXPECT_LE(writer.size(), MAX_FRAME_SIZE);
+}
+
+TEST(OrcaProtocolTest, SeveralFramesInADatagram) {
+  alignas(8) char buf[MAX_FRAME_SIZE];
+  FrameWriter<IngressHintRecord> hints;
+  hints.append()->hint = IngressHintRecord::ReqLength::Long;
+  FrameHeader empty = empty_frame(MessageType::DetermineScheduler, 3);
+  memcpy(buf, hints.data(), hints.size());
+  memcpy(buf + hints.size(), &empty, sizeof(empty));
+  const size_t len = hints.size() + sizeof(empty);
+
+  FrameView frame;
+  ASSERT_EQ(frame.parse(buf, len), nullptr);
+  EXPECT_EQ(frame.type(), MessageType::IngressHint);
+  EXPECT_EQ(frame.record<IngressHintRecord>(0).hint,
+            IngressHintRecord::ReqLength::Long);
+
+  const size_t offset = frame.size();
+  ASSERT_EQ(frame.parse(buf + offset, len - offset), nullptr);
+  EXPECT_EQ(frame.type(), MessageType::DetermineScheduler);
+  EXPECT_EQ(frame.seq(), 3);
+  EXPECT_EQ(frame.count(), 0);
+  EXPECT_EQ(offset + frame.size(), len);
+}
+
+// A newer sender may append fields to a record; we read the ones we know.
+TEST(OrcaProtocolTest, LargerRecords) {
+  struct NewerHint {
+    IngressHintRecord hint;
+    int64_t extra;
+  };
+  alignas(8) char buf[MAX_FRAME_SIZE];
+  FrameHeader h = empty_frame(MessageType::IngressHint);
+  h.count = 2;
+  h.record_size = sizeof(NewerHint);
+  h.length = sizeof(h) + 2 * sizeof(NewerHint);
+  memcpy(buf, &h, sizeof(h));
+  NewerHint records[2] = {{{IngressHintRecord::ReqLength::Short}, 1},
+                          {{IngressHintRecord::ReqLength::Long}, 2}};
+  memcpy(buf + sizeof(h), records, sizeof(records));
+
+  FrameView frame;
+  ASSERT_EQ(frame.parse(buf, h.length), nullptr);
+  EXPECT_EQ(frame.record<IngressHintRecord>(0).hint,
+            IngressHintRecord::ReqLength::Short);
+  EXPECT_EQ(frame.record<IngressHintRecord>(1).hint,
+            IngressHintRecord::ReqLength::Long);
+}
+
+// How a stream reader finds frames as their bytes trickle in.
+TEST(OrcaProtocolTest, FrameLength) {
+  FrameWriter<IngressHintRecord> writer;
+  writer.append();
+  const char* error;
+  EXPECT_EQ(frame_length(writer.data(), sizeof(FrameHeader) - 1, &error), 0);
+  EXPECT_EQ(error, nullptr);
+  EXPECT_EQ(frame_length(writer.data(), sizeof(FrameHeader), &error),
+            writer.size());
+  EXPECT_EQ(error, nullptr);
+
+  FrameHeader h = empty_frame(MessageType::GetStats);
+  h.length = MAX_FRAME_SIZE + 8;
+  EXPECT_EQ(frame_length(reinterpret_cast<const char*>(&h), sizeof(h), &error),
+            0);
+  EXPECT_NE(error, nullptr);
+}
+
+TEST(OrcaProtocolTest, Invalid) {
+  FrameWriter<MetricRecord> writer;
+  writer.append();
+  alignas(8) char buf[MAX_FRAME_SIZE];
+  auto* h = reinterpret_cast<FrameHeader*>(buf);
+  FrameView frame;
+
+  auto reset = [&] { memcpy(buf, writer.data(), writer.size()); };
+
+  reset();
+  EXPECT_NE(frame.parse(buf, sizeof(FrameHeader) - 1), nullptr);
+  EXPECT_NE(frame.parse(buf, writer.size() - 1), nullptr);
+
+  reset();
+  h->magic = 0;
+  EXPECT_NE(frame.parse(buf, writer.size()), nullptr);
+
+  reset();
+  h->version = PROTOCOL_VERSION + 1;
+  EXPECT_NE(frame.parse(buf, writer.size()), nullptr);
+
+  reset();
+  h->type = static_cast<MessageType>(100);
+  EXPECT_NE(frame.parse(buf, writer.size()), nullptr);
+
+  // Smaller than the records we know.
+  reset();
+  h->record_size = sizeof(MetricRecord) - 8;
+  EXPECT_NE(frame.parse(buf, writer.size()), nullptr);
+
+  // More records than the frame holds.
+  reset();
+  h->count = 2;
+  EXPECT_NE(frame.parse(buf, writer.size()), nullptr);
+
+  reset();
+  EXPECT_EQ(frame.parse(buf, writer.size()), nullptr);
+}
+
+}  // namespace
+}  // namespace orca
+
+int main(int argc, char** argv) {
+  testing::InitGoogleTest(&argc, argv);
+  return RUN_ALL_TESTS();
+}
@@ -0,0 +1,129 @@
+// Copyright 2022 Google LLC
+//
+// Use of this source code is governed by a BSD-style
+// license that can be found in the LICENSE file or at
+// https://developers.google.com/open-source/licenses/bsd
+
+#include "lib/phase_profiler.h"
+
+#include <thread>
+
+#include "gmock/gmock.h"
+#include "gtest/gtest.h"
+
+namespace ghost {
+namespace {
+
+using Histogram = PhaseProfile::Histogram;
+
+TEST(PhaseProfileTest, Percentile) {
+  Histogram h = {};
+  EXPECT_EQ(h.Percentile(50), 0);
+  EXPECT_EQ(h.Mean(), 0);
+
+  // 90 short phases, 9 around 1000 cycles and a very long one.
+  h.count = 100;
+  h.slots[ll_hist_slot(5)] = 90;
+  h.slots[ll_hist_slot(1000)] = 9;
+  h.slots[Histogram::kNumSlots - 1] = 1;
+  h.max = uint64_t{1} << 40;
+  EXPECT_EQ(h.Percentile(50), 6);
+  EXPECT_EQ(h.Percentile(90), 6);
+  // 1000 is in [960, 1024).
+  EXPECT_EQ(h.Percentile(99), 1024);
+  EXPECT_EQ(h.Percentile(100), h.max);
+
+  // The percentile never exceeds the max.
+  Histogram one = {};
+  one.count = 1;
+  one.max = 1000;
+  one.slots[ll_hist_slot(1000)] = 1;
+  EXPECT_EQ(one.Percentile(100), 1000);
+}
+
+TEST(PhaseProfilerTest, Record) {
+  PhaseProfiler profiler;
+  profiler.Record(PhaseProfile::kPick, 100);
+  profiler.Record(PhaseProfile::kPick, 300);
+  profiler.Record(PhaseProfile::kCommitFailure, 7);
+  for (uint64_t nr_msgs : {0, 1, 1, 20}) {
+    profiler.EndIteration(nr_msgs);
+  }
+
+  PhaseProfile profile = profiler.Snapshot();
+  EXPECT_GT(profile.cycles_per_us, 0);
+  EXPECT_EQ(profile.iterations, 4);
+
+  const Histogram& pick = profile.phases[PhaseProfile::kPick];
+  EXPECT_EQ(pick.count, 2);
+  EXPECT_EQ(pick.sum, 400);
+  EXPECT_EQ(pick.max, 300);
+  EXPECT_EQ(pick.Mean(), 200);
+  EXPECT_EQ(pick.slots[ll_hist_slot(100)], 1);
+  EXPECT_EQ(pick.slots[ll_hist_slot(300)], 1);
+  EXPECT_EQ(profile.phases[PhaseProfile::kCommitFailure].slots[7], 1);
+  EXPECT_EQ(profile.phases[PhaseProfile::kDispatch].count, 0);
+
+  EXPECT_EQ(profile.msgs.count, 4);
+  EXPECT_EQ(profile.msgs.slots[0], 1);
+  EXPECT_EQ(profile.msgs.slots[1], 2);
+  EXPECT_EQ(profile.msgs.max, 20);
+}
+
+TEST(PhaseProfilerTest, Lap) {
+  PhaseProfiler profiler;
+  uint64_t start = PhaseProfiler::Now();
+  uint64_t t = profiler.Lap(PhaseProfile::kDispatch, start);
+  EXPECT_GE(t, start);
+  const uint64_t end = profiler.Lap(PhaseProfile::kCommit, t);
+
+  PhaseProfile profile = profiler.Snapshot();
+  EXPECT_EQ(profile.phases[PhaseProfile::kDispatch].count, 1);
+  EXPECT_EQ(profile.phases[PhaseProfile::kCommit].count, 1);
+  EXPECT_EQ(profile.phases[PhaseProfile::kDispatch].sum +
+                profile.phases[PhaseProfile::kCommit].sum,
+            end - start);
+}
+
+TEST(PhaseProfilerTest, CyclesPerMicrosecond) {
+  const double cycles_per_us = PhaseProfiler::CyclesPerMicrosecond();
+  // Any TSC from 100 MHz to 10 GHz.
+  EXPECT_GT(cycles_per_us, 100);
+  EXPECT_LT(cycles_per_us, 10'000);
+  EXPECT_EQ(PhaseProfiler::CyclesPerMicrosecond(), cycles_per_us);
+}
+
+// Snapshots from another thread never go backwards, and see every update once
+// the writer is done.
+TEST(PhaseProfilerTest, ConcurrentSnapshot) {
+  constexpr uint64_t kIterations = 100'000;
+  PhaseProfiler profiler;
+
+  std::thread writer([&profiler] {
+    for (uint64_t i = 0; i < kIterations; ++i) {
+      profiler.Record(PhaseProfile::kDispatch, i);
+      profiler.EndIteration(i % 4);
+    }
+  });
+
+  uint64_t last = 0;
+  while (last < kIterations) {
+    PhaseProfile profile = profiler.Snapshot();
+    EXPECT_GE(profile.iterations, last);
+    last = profile.iterations;
+  }
+  writer.join();
+
+  PhaseProfile profile = profiler.Snapshot();
+  EXPECT_EQ(profile.phases[PhaseProfile::kDispatch].count, kIterations);
+  EXPECT_EQ(profile.phases[PhaseProfile::kDispatch].max, kIterations - 1);
+  EXPECT_EQ(profile.msgs.slots[3], kIterations / 4);
+}
+
+}  // namespace
+}  // namespace ghost
+
+int main(int argc, char** argv) {
+  testing::InitGoogleTest(&argc, argv);
+  return RUN_ALL_TESTS();
+}
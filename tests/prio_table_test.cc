@@ -6,9 +6,27 @@
 
 #include "shared/prio_table.h"
 
+#include <thread>
+#include <vector>
+
+#include "gmock/gmock.h"
 #include "gtest/gtest.h"
 
 namespace ghost {
+namespace {
+
+using ::testing::ElementsAre;
+using ::testing::IsEmpty;
+
+// Returns the indices that 'table.DrainUpdatedIndices()' passes, in order.
+std::vector<int> Drain(PrioTable& table) {
+  std::vector<int> indices;
+  EXPECT_TRUE(table.DrainUpdatedIndices(
+      [&indices](int idx) { indices.push_back(idx); }));
+  return indices;
+}
+
+}  // namespace
 
 TEST(PrioTableTest, Owner) {
   PrioTable _client_table(/*num_items=*/10, /*num_classes=*/4,
@@ -145,4 +163,131 @@ TEST(PrioTableTest, StressOrdering) {
   thread.join();
 }
 
+TEST(PrioTableTest, BatchThenDrain) {
+  PrioTable table(/*num_items=*/200, /*num_classes=*/4,
+                  PrioTable::StreamCapacity::kStreamCapacity19);
+
+  EXPECT_THAT(Drain(table), IsEmpty());
+  PrioTable::UpdateBatch batch(table);
+  for (int idx : {1, 5, 63, 64, 130, 199}) {
+    batch.Add(idx);
+  }
+  // Nothing is visible to the agent until the batch is published.
+  EXPECT_EQ(table.NextUpdatedIndex(), PrioTable::kStreamNoEntries);
+  batch.Publish();
+
+  EXPECT_THAT(Drain(table), ElementsAre(1, 5, 63, 64, 130, 199));
+  EXPECT_THAT(Drain(table), IsEmpty());
+}
+
+TEST(PrioTableTest, BatchThenNextUpdatedIndex) {
+  PrioTable table(/*num_items=*/200, /*num_classes=*/4,
+                  PrioTable::StreamCapacity::kStreamCapacity19);
+
+  PrioTable::UpdateBatch batch(table);
+  for (int idx : {3, 2, 150, 70}) {
+    batch.Add(idx);
+  }
+  batch.Publish();
+
+  std::vector<int> indices;
+  int next;
+  while ((next = table.NextUpdatedIndex()) != PrioTable::kStreamNoEntries) {
+    ASSERT_GE(next, 0);
+    indices.push_back(next);
+  }
+  EXPECT_THAT(indices, ElementsAre(2, 3, 70, 150));
+  EXPECT_THAT(Drain(table), IsEmpty());
+}
+
+// Tests that bitmap words that share a summary bit are all drained.
+TEST(PrioTableTest, BatchSharedSummaryBit) {
+  PrioTable table(/*num_items=*/64 * 64 * 2, /*num_classes=*/4,
+                  PrioTable::StreamCapacity::kStreamCapacity19);
+
+  PrioTable::UpdateBatch batch(table);
+  batch.Add(0);
+  batch.Add(64 * 64);
+  batch.Add(64 * 64 * 2 - 1);
+  batch.Publish();
+  EXPECT_THAT(Drain(table), ElementsAre(0, 64 * 64, 64 * 64 * 2 - 1));
+
+  batch.Add(64 * 64 + 1);
+  batch.Publish();
+  EXPECT_EQ(table.NextUpdatedIndex(), 64 * 64 + 1);
+  EXPECT_EQ(table.NextUpdatedIndex(), PrioTable::kStreamNoEntries);
+}
+
+TEST(PrioTableTest, DrainStreamAndBatch) {
+  PrioTable table(/*num_items=*/10, /*num_classes=*/4,
+                  PrioTable::StreamCapacity::kStreamCapacity19);
+
+  table.MarkUpdatedIndex(/*idx=*/7, /*num_retries=*/0);
+  PrioTable::UpdateBatch batch(table);
+  batch.Add(2);
+  batch.Add(7);
+  batch.Publish();
+  // The stream comes first and an index may be passed more than once.
+  EXPECT_THAT(Drain(table), ElementsAre(7, 2, 7));
+  EXPECT_THAT(Drain(table), IsEmpty());
+}
+
+TEST(PrioTableTest, DrainOverflow) {
+  PrioTable table(/*num_items=*/10, /*num_classes=*/4,
+                  PrioTable::StreamCapacity::kStreamCapacity19);
+
+  table.MarkUpdatedIndex(/*idx=*/0, /*num_retries=*/0);
+  table.MarkUpdatedIndex(/*idx=*/table.hdr()->st_cap, /*num_retries=*/0);
+  PrioTable::UpdateBatch batch(table);
+  batch.Add(4);
+  batch.Publish();
+
+  // The overflow covers everything, including the batch.
+  bool called = false;
+  EXPECT_FALSE(table.DrainUpdatedIndices([&called](int) { called = true; }));
+  EXPECT_FALSE(called);
+  EXPECT_THAT(Drain(table), IsEmpty());
+  EXPECT_EQ(table.NextUpdatedIndex(), PrioTable::kStreamNoEntries);
+}
+
+TEST(PrioTableTest, StressBatchOrdering) {
+  static const int kNumIterations = 1000;
+  static const int kNumItems = 300;
+  PrioTable table(kNumItems, 4, PrioTable::StreamCapacity::kStreamCapacity19);
+  std::atomic<int> round = 0;
+
+  // The writer publishes a batch of every third index, shifted by one each
+  // round, and waits for the agent to see all of it before the next round.
+  std::thread thread([&table, &round]() {
+    PrioTable::UpdateBatch batch(table);
+    for (int j = 0; j < kNumIterations; j++) {
+      for (int idx = j % 3; idx < kNumItems; idx += 3) {
+        batch.Add(idx);
+      }
+      round.store(j + 1, std::memory_order_relaxed);
+      batch.Publish();
+      while (round.load(std::memory_order_relaxed) > 0) {
+      }
+    }
+  });
+
+  for (int j = 0; j < kNumIterations; j++) {
+    std::vector<int> indices;
+    while (indices.size() < kNumItems / 3) {
+      for (int idx : Drain(table)) {
+        indices.push_back(idx);
+      }
+    }
+    ASSERT_EQ(indices.size(), kNumItems / 3);
+    for (int i = 0; i < indices.size(); i++) {
+      ASSERT_EQ(indices[i], j % 3 + 3 * i);
+    }
+    ASSERT_EQ(round.load(std::memory_order_relaxed), j + 1);
+    round.store(0, std::memory_order_relaxed);
+  }
+
+  thread.join();
+  EXPECT_THAT(Drain(table), IsEmpty());
+}
+
 }  // namespace ghost
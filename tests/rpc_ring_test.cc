@@ -0,0 +1,178 @@
+// Copyright 2021 Google LLC
+//
+// Use of this source code is governed by a BSD-style
+// license that can be found in the LICENSE file or at
+// https://developers.google.com/open-source/licenses/bsd
+
+#include "lib/rpc_ring.h"
+
+#include <atomic>
+#include <thread>
+#include <vector>
+
+#include "gmock/gmock.h"
+#include "gtest/gtest.h"
+
+// Tests `RpcRing` with a server thread in the same process.
+
+namespace ghost {
+namespace {
+
+using ::testing::ElementsAreArray;
+
+struct Request {
+  int client;
+  int seq;
+};
+
+struct Response {
+  int client = -1;
+  int seq = -1;
+  // Order in which the server handled the request.
+  int served = -1;
+};
+
+constexpr uint32_t kSlots = 4;
+using TestRing = RpcRing<Request, Response, kSlots>;
+
+// Runs a server thread for `ring` until destroyed. The server echoes requests
+// back and numbers them in the order it handles them.
+class Server {
+ public:
+  explicit Server(TestRing& ring)
+      : ring_(ring), thread_([this]() {
+          int served = 0;
+          while (true) {
+            ring_.WaitForRequest();
+            bool stop = false;
+            ring_.ServeOne([&](const Request& req, Response& resp) {
+              stop = req.client < 0;
+              resp.client = req.client;
+              resp.seq = req.seq;
+              resp.served = served++;
+            });
+            if (stop) {
+              return;
+            }
+          }
+        }) {}
+
+  ~Server() {
+    // A request with a negative client stops the server.
+    TestRing::Ticket t = ring_.Submit({-1, 0});
+    ring_.Complete(t, [](const Response&) { return 0; });
+    thread_.join();
+  }
+
+ private:
+  TestRing& ring_;
+  std::thread thread_;
+};
+
+// Tests a single round trip.
+TEST(RpcRingTest, RoundTrip) {
+  TestRing ring;
+  Server server(ring);
+
+  for (int i = 0; i < 100; ++i) {
+    TestRing::Ticket t = ring.Submit({0, i});
+    Response resp = ring.Complete(t, [](const Response& r) { return r; });
+    EXPECT_EQ(resp.client, 0);
+    EXPECT_EQ(resp.seq, i);
+    EXPECT_EQ(resp.served, i);
+  }
+}
+
+// Tests that `ServeOne` only handles submitted requests and that `Poll`
+// reflects completion, without a server thread.
+TEST(RpcRingTest, Poll) {
+  TestRing ring;
+  auto echo = [](const Request& req, Response& resp) { resp.seq = req.seq; };
+
+  EXPECT_FALSE(ring.ServeOne(echo));
+
+  TestRing::Ticket t0 = ring.Submit({0, 10});
+  TestRing::Ticket t1 = ring.Submit({0, 11});
+  EXPECT_FALSE(ring.Poll(t0));
+  EXPECT_FALSE(ring.Poll(t1));
+
+  ring.WaitForRequest();
+  EXPECT_TRUE(ring.ServeOne(echo));
+  EXPECT_TRUE(ring.Poll(t0));
+  EXPECT_FALSE(ring.Poll(t1));
+
+  EXPECT_TRUE(ring.ServeOne(echo));
+  EXPECT_FALSE(ring.ServeOne(echo));
+  EXPECT_TRUE(ring.Poll(t1));
+
+  // Completion may happen in any order.
+  EXPECT_EQ(ring.Complete(t1, [](const Response& r) { return r.seq; }), 11);
+  EXPECT_EQ(ring.Complete(t0, [](const Response& r) { return r.seq; }), 10);
+}
+
+// Tests that pipelined requests, more than there are slots, are handled in
+// submission order.
+TEST(RpcRingTest, Pipelined) {
+  TestRing ring;
+  Server server(ring);
+
+  constexpr int kRequests = 1000;
+  std::vector<TestRing::Ticket> tickets;
+  std::vector<int> expected, served;
+  for (int i = 0; i < kRequests; ++i) {
+    // Keep at most `kSlots` requests in flight so that `Submit` does not wait
+    // for a slot that only we can free.
+    if (tickets.size() - served.size() == kSlots) {
+      served.push_back(ring.Complete(tickets[served.size()],
+                                     [](const Response& r) { return r.served; }));
+    }
+    tickets.push_back(ring.Submit({0, i}));
+    expected.push_back(i);
+  }
+  while (served.size() < tickets.size()) {
+    served.push_back(ring.Complete(tickets[served.size()],
+                                   [](const Response& r) { return r.served; }));
+  }
+  EXPECT_THAT(served, ElementsAreArray(expected));
+}
+
+// Tests that concurrent clients each get their own responses and that every
+// request is handled exactly once.
+TEST(RpcRingTest, ManyClients) {
+  TestRing ring;
+  Server server(ring);
+
+  constexpr int kClients = 8;
+  constexpr int kRequests = 2000;
+  std::atomic<int> mismatches = 0;
+  std::vector<std::thread> clients;
+  for (int c = 0; c < kClients; ++c) {
+    clients.emplace_back([&ring, &mismatches, c]() {
+      for (int i = 0; i < kRequests; ++i) {
+        TestRing::Ticket t = ring.Submit({c, i});
+        Response resp = ring.Complete(t, [](const Response& r) { return r; });
+        if (resp.client != c || resp.seq != i) {
+          mismatches.fetch_add(1);
+        }
+      }
+    });
+  }
+  for (std::thread& t : clients) {
+    t.join();
+  }
+  EXPECT_EQ(mismatches.load(), 0);
+
+  // Every request so far has been handled, so the next one is numbered after
+  // all of them.
+  TestRing::Ticket t = ring.Submit({0, 0});
+  EXPECT_EQ(ring.Complete(t, [](const Response& r) { return r.served; }),
+            kClients * kRequests);
+}
+
+}  // namespace
+}  // namespace ghost
+
+int main(int argc, char** argv) {
+  testing::InitGoogleTest(&argc, argv);
+  return RUN_ALL_TESTS();
+}
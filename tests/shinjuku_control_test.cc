@@ -0,0 +1,143 @@
+// Copyright 2021 Google LLC
+//
+// Use of this source code is governed by a BSD-style
+// license that can be found in the LICENSE file or at
+// https://developers.google.com/open-source/licenses/bsd
+
+#include "schedulers/shinjuku/shinjuku_control.h"
+
+#include "gtest/gtest.h"
+
+// Tests the Shinjuku slice controller and the time slice encoding used by the
+// Shinjuku control RPCs.
+
+namespace ghost {
+namespace {
+
+constexpr absl::Duration kPeriod = absl::Milliseconds(10);
+
+ShinjukuSliceController::Params TestParams() {
+  ShinjukuSliceController::Params params;
+  params.target_wait_ns = absl::ToInt64Nanoseconds(absl::Microseconds(20));
+  params.min_slice_ns = absl::ToInt64Nanoseconds(absl::Microseconds(10));
+  params.max_slice_ns = absl::ToInt64Nanoseconds(absl::Microseconds(100));
+  params.period_ns = absl::ToInt64Nanoseconds(kPeriod);
+  return params;
+}
+
+// Tests that infinite and finite slices survive the conversion to nanoseconds.
+TEST(ShinjukuControlTest, SliceNanos) {
+  EXPECT_EQ(ShinjukuSliceToNanos(absl::InfiniteDuration()),
+            kShinjukuInfiniteSlice);
+  EXPECT_EQ(ShinjukuSliceFromNanos(kShinjukuInfiniteSlice),
+            absl::InfiniteDuration());
+  EXPECT_EQ(ShinjukuSliceFromNanos(
+                ShinjukuSliceToNanos(absl::Microseconds(30))),
+            absl::Microseconds(30));
+
+  ShinjukuTimeSlices slices;
+  for (uint32_t qos = 0; qos < kShinjukuNumQoSLevels; qos++) {
+    EXPECT_EQ(slices.qos_ns[qos], kShinjukuUseDefaultSlice);
+  }
+}
+
+// Tests that long waits shrink the slice and short waits grow it.
+TEST(ShinjukuControlTest, AdjustTowardsTarget) {
+  ShinjukuSliceController controller(TestParams());
+  absl::Time now = absl::UnixEpoch();
+
+  controller.AddWait(absl::Microseconds(50));
+  std::optional<absl::Duration> slice =
+      controller.MaybeAdjust(now, absl::Microseconds(40));
+  ASSERT_TRUE(slice.has_value());
+  EXPECT_EQ(*slice, absl::Microseconds(30));
+
+  now += kPeriod;
+  controller.AddWait(absl::Microseconds(1));
+  slice = controller.MaybeAdjust(now, absl::Microseconds(40));
+  ASSERT_TRUE(slice.has_value());
+  EXPECT_EQ(*slice, absl::Microseconds(50));
+
+  // A wait between half the target and the target leaves the slice alone.
+  now += kPeriod;
+  controller.AddWait(absl::Microseconds(15));
+  EXPECT_FALSE(controller.MaybeAdjust(now, absl::Microseconds(40)).has_value());
+}
+
+// Tests that the slice is adjusted at most once per period and only with
+// samples.
+TEST(ShinjukuControlTest, AdjustOncePerPeriod) {
+  ShinjukuSliceController controller(TestParams());
+  absl::Time now = absl::UnixEpoch();
+
+  // No samples.
+  EXPECT_FALSE(controller.MaybeAdjust(now, absl::Microseconds(40)).has_value());
+
+  controller.AddWait(absl::Microseconds(50));
+  EXPECT_FALSE(controller.MaybeAdjust(now + kPeriod / 2, absl::Microseconds(40))
+                   .has_value());
+  EXPECT_TRUE(
+      controller.MaybeAdjust(now + kPeriod, absl::Microseconds(40)).has_value());
+}
+
+// Tests that the slice stays within [min_slice, max_slice].
+TEST(ShinjukuControlTest, Clamp) {
+  ShinjukuSliceController controller(TestParams());
+  absl::Time now = absl::UnixEpoch();
+
+  controller.AddWait(absl::Milliseconds(1));
+  std::optional<absl::Duration> slice =
+      controller.MaybeAdjust(now, absl::Microseconds(11));
+  ASSERT_TRUE(slice.has_value());
+  EXPECT_EQ(*slice, absl::Microseconds(10));
+
+  // Already at the minimum.
+  now += kPeriod;
+  controller.AddWait(absl::Milliseconds(1));
+  EXPECT_FALSE(controller.MaybeAdjust(now, absl::Microseconds(10)).has_value());
+
+  now += kPeriod;
+  controller.AddWait(absl::ZeroDuration());
+  slice = controller.MaybeAdjust(now, absl::Microseconds(90));
+  ASSERT_TRUE(slice.has_value());
+  EXPECT_EQ(*slice, absl::Microseconds(100));
+
+  // An infinite slice is brought back within range.
+  now += kPeriod;
+  controller.AddWait(absl::Microseconds(15));
+  slice = controller.MaybeAdjust(now, absl::InfiniteDuration());
+  ASSERT_TRUE(slice.has_value());
+  EXPECT_EQ(*slice, absl::Microseconds(100));
+}
+
+// Tests that params the controller cannot run with are rejected.
+TEST(ShinjukuControlTest, ValidParams) {
+  EXPECT_TRUE(ShinjukuSliceController::Params().Valid());
+  EXPECT_TRUE(TestParams().Valid());
+
+  ShinjukuSliceController::Params params = TestParams();
+  params.min_slice_ns = params.max_slice_ns;
+  EXPECT_TRUE(params.Valid());
+  params.min_slice_ns = params.max_slice_ns + 1;
+  EXPECT_FALSE(params.Valid());
+
+  params = TestParams();
+  params.min_slice_ns = 0;
+  EXPECT_FALSE(params.Valid());
+
+  params = TestParams();
+  params.target_wait_ns = -1;
+  EXPECT_FALSE(params.Valid());
+
+  params = TestParams();
+  params.period_ns = 0;
+  EXPECT_FALSE(params.Valid());
+}
+
+}  // namespace
+}  // namespace ghost
+
+int main(int argc, char** argv) {
+  testing::InitGoogleTest(&argc, argv);
+  return RUN_ALL_TESTS();
+}
@@ -0,0 +1,185 @@
+// Copyright 2021 Google LLC
+//
+// Use of this source code is governed by a BSD-style
+// license that can be found in the LICENSE file or at
+// https://developers.google.com/open-source/licenses/bsd
+
+#include "schedulers/shinjuku/shinjuku_runqueue.h"
+
+#include <vector>
+
+#include "gmock/gmock.h"
+#include "gtest/gtest.h"
+
+// Tests `IntrusiveFifo` and `QosRunqueue`.
+
+namespace ghost {
+namespace {
+
+using ::testing::ElementsAre;
+using ::testing::IsEmpty;
+
+struct Elem {
+  int x = 0;
+  IntrusiveFifoHook<Elem> hook;
+  IntrusiveFifoHook<Elem> hook2;
+};
+
+using Fifo = IntrusiveFifo<Elem, &Elem::hook>;
+using Runqueue = QosRunqueue<Elem, &Elem::hook>;
+
+std::vector<int> Drain(Fifo& fifo) {
+  std::vector<int> out;
+  while (Elem* e = fifo.PopFront()) {
+    out.push_back(e->x);
+  }
+  return out;
+}
+
+std::vector<int> Drain(Runqueue& rq) {
+  std::vector<int> out;
+  while (Elem* e = rq.Dequeue()) {
+    out.push_back(e->x);
+  }
+  return out;
+}
+
+class ShinjukuRunqueueTest : public testing::Test {
+ protected:
+  static constexpr int kNrElems = 8;
+
+  void SetUp() override {
+    for (int i = 0; i < kNrElems; ++i) {
+      elems_[i].x = i;
+    }
+  }
+
+  Elem elems_[kNrElems];
+};
+
+// Tests that the FIFO preserves insertion order and supports pushing to the
+// front.
+TEST_F(ShinjukuRunqueueTest, FifoOrder) {
+  Fifo fifo;
+  EXPECT_TRUE(fifo.Empty());
+
+  fifo.PushBack(&elems_[1]);
+  fifo.PushBack(&elems_[2]);
+  fifo.PushFront(&elems_[0]);
+  fifo.PushBack(&elems_[3]);
+  EXPECT_EQ(fifo.Size(), 4);
+  EXPECT_EQ(fifo.Front(), &elems_[0]);
+
+  EXPECT_THAT(Drain(fifo), ElementsAre(0, 1, 2, 3));
+  EXPECT_TRUE(fifo.Empty());
+  EXPECT_EQ(fifo.Size(), 0);
+}
+
+// Tests removal from the head, the tail and the middle of the FIFO.
+TEST_F(ShinjukuRunqueueTest, FifoRemove) {
+  Fifo fifo;
+  for (int i = 0; i < 5; ++i) {
+    fifo.PushBack(&elems_[i]);
+  }
+
+  fifo.Remove(&elems_[2]);
+  EXPECT_FALSE(Fifo::Linked(&elems_[2]));
+  fifo.Remove(&elems_[0]);
+  fifo.Remove(&elems_[4]);
+  EXPECT_EQ(fifo.Size(), 2);
+
+  EXPECT_THAT(Drain(fifo), ElementsAre(1, 3));
+
+  // A removed element may be linked again.
+  fifo.PushBack(&elems_[2]);
+  EXPECT_THAT(Drain(fifo), ElementsAre(2));
+}
+
+// Tests that `ForEach` tolerates removal of the element being visited.
+TEST_F(ShinjukuRunqueueTest, FifoForEachRemove) {
+  Fifo fifo;
+  for (int i = 0; i < kNrElems; ++i) {
+    fifo.PushBack(&elems_[i]);
+  }
+
+  fifo.ForEach([&fifo](Elem* e) {
+    if (e->x % 2 == 0) {
+      fifo.Remove(e);
+    }
+  });
+
+  EXPECT_THAT(Drain(fifo), ElementsAre(1, 3, 5, 7));
+}
+
+// Tests that an element can be on two lists at once through different hooks.
+TEST_F(ShinjukuRunqueueTest, FifoTwoHooks) {
+  Fifo fifo;
+  IntrusiveFifo<Elem, &Elem::hook2> fifo2;
+
+  fifo.PushBack(&elems_[0]);
+  fifo.PushBack(&elems_[1]);
+  fifo2.PushBack(&elems_[1]);
+  fifo2.PushBack(&elems_[0]);
+
+  fifo.Remove(&elems_[1]);
+  EXPECT_THAT(Drain(fifo), ElementsAre(0));
+  EXPECT_EQ(fifo2.PopFront(), &elems_[1]);
+  EXPECT_EQ(fifo2.PopFront(), &elems_[0]);
+  EXPECT_TRUE(fifo2.Empty());
+}
+
+// Tests that the highest QoS level is always dequeued first and that each level
+// is FIFO.
+TEST_F(ShinjukuRunqueueTest, QosOrder) {
+  Runqueue rq;
+  EXPECT_TRUE(rq.Empty());
+  EXPECT_EQ(rq.Peek(), nullptr);
+  EXPECT_EQ(rq.Dequeue(), nullptr);
+
+  rq.Enqueue(&elems_[0], /*qos=*/1);
+  rq.Enqueue(&elems_[1], /*qos=*/5);
+  rq.Enqueue(&elems_[2], /*qos=*/1);
+  rq.Enqueue(&elems_[3], /*qos=*/0);
+  rq.Enqueue(&elems_[4], /*qos=*/5, /*back=*/false);
+  EXPECT_EQ(rq.Size(), 5);
+  EXPECT_EQ(rq.Peek(), &elems_[4]);
+
+  EXPECT_THAT(Drain(rq), ElementsAre(4, 1, 0, 2, 3));
+  EXPECT_TRUE(rq.Empty());
+}
+
+// Tests that removing the last element of a level clears it from the bitmap.
+TEST_F(ShinjukuRunqueueTest, QosRemove) {
+  Runqueue rq;
+  rq.Enqueue(&elems_[0], /*qos=*/3);
+  rq.Enqueue(&elems_[1], /*qos=*/7);
+  rq.Enqueue(&elems_[2], /*qos=*/3);
+
+  EXPECT_EQ(Runqueue::QueuedLevel(&elems_[1]), 7);
+  rq.Remove(&elems_[1]);
+  EXPECT_EQ(rq.Peek(), &elems_[0]);
+  rq.Remove(&elems_[0]);
+  EXPECT_EQ(rq.Size(), 1);
+
+  EXPECT_THAT(Drain(rq), ElementsAre(2));
+}
+
+// Tests that QoS values beyond the number of levels share the highest level.
+TEST_F(ShinjukuRunqueueTest, QosClamp) {
+  Runqueue rq;
+  rq.Enqueue(&elems_[0], /*qos=*/Runqueue::kNumQoSLevels - 1);
+  rq.Enqueue(&elems_[1], /*qos=*/1000);
+  rq.Enqueue(&elems_[2], /*qos=*/Runqueue::kNumQoSLevels - 2);
+
+  EXPECT_EQ(Runqueue::QueuedLevel(&elems_[1]), Runqueue::kNumQoSLevels - 1);
+  EXPECT_THAT(Drain(rq), ElementsAre(0, 1, 2));
+  EXPECT_THAT(Drain(rq), IsEmpty());
+}
+
+}  // namespace
+}  // namespace ghost
+
+int main(int argc, char** argv) {
+  testing::InitGoogleTest(&argc, argv);
+  return RUN_ALL_TESTS();
+}
@@ -0,0 +1,113 @@
+// Copyright 2021 Google LLC
+//
+// Use of this source code is governed by a BSD-style
+// license that can be found in the LICENSE file or at
+// https://developers.google.com/open-source/licenses/bsd
+
+#include <random>
+#include <vector>
+
+#include "gmock/gmock.h"
+#include "gtest/gtest.h"
+#include "lib/ghost.h"
+#include "tests/synthetic_status_word_table.h"
+
+// Tests the status word table scans used by task discovery, on a synthetic
+// table in ordinary memory.
+
+namespace ghost {
+namespace {
+
+using ::testing::ElementsAreArray;
+
+constexpr uint32_t kRegionId = 7;
+
+// Marks a random `num_tasks` status words as in use by tasks, and a few more as
+// in use by agents. Returns the task indices in increasing order.
+std::vector<uint32_t> Populate(SyntheticStatusWordTable& table,
+                               uint32_t num_tasks) {
+  std::mt19937 rng(0);
+  std::vector<uint32_t> tasks;
+  for (uint32_t i = 0; i < table.capacity(); ++i) {
+    if (rng() % table.capacity() < num_tasks) {
+      table.word(i).flags = GHOST_SW_F_INUSE;
+      table.word(i).gtid = i;
+      tasks.push_back(i);
+    } else if (rng() % 16 == 0) {
+      table.word(i).flags = GHOST_SW_F_INUSE | GHOST_SW_TASK_IS_AGENT;
+    } else if (rng() % 16 == 0) {
+      // Freed but not in use.
+      table.word(i).flags = GHOST_SW_F_CANFREE;
+    }
+  }
+  return tasks;
+}
+
+// Tests that the scan visits exactly the task status words, in order, for table
+// sizes that are and are not a multiple of the scan chunk.
+TEST(StatusWordTableTest, ForEachTaskStatusWord) {
+  for (uint32_t capacity : {1u, 63u, 64u, 65u, 1000u, 4096u}) {
+    SyntheticStatusWordTable table(capacity, kRegionId);
+    std::vector<uint32_t> expected = Populate(table, capacity / 3);
+
+    std::vector<uint32_t> visited;
+    table.ForEachTaskStatusWord(
+        [&visited, &table](ghost_status_word* sw, uint32_t region_id,
+                           uint32_t idx) {
+          EXPECT_EQ(region_id, kRegionId);
+          EXPECT_EQ(sw, table.get(idx));
+          visited.push_back(idx);
+        });
+    EXPECT_THAT(visited, ElementsAreArray(expected)) << capacity;
+  }
+}
+
+// Tests that a range scan only visits task status words within the range.
+TEST(StatusWordTableTest, ForEachTaskStatusWordInRange) {
+  SyntheticStatusWordTable table(1000, kRegionId);
+  std::vector<uint32_t> all = Populate(table, 500);
+
+  std::vector<uint32_t> expected;
+  for (uint32_t idx : all) {
+    if (idx >= 100 && idx < 900) {
+      expected.push_back(idx);
+    }
+  }
+
+  std::vector<uint32_t> visited;
+  table.ForEachTaskStatusWordInRange(
+      100, 900, [&visited](ghost_status_word* sw, uint32_t, uint32_t idx) {
+        visited.push_back(idx);
+      });
+  EXPECT_THAT(visited, ElementsAreArray(expected));
+}
+
+// Tests that the parallel scan visits every task status word exactly once and
+// that concatenating the per-worker results preserves index order.
+TEST(StatusWordTableTest, ForEachTaskStatusWordParallel) {
+  for (int num_workers : {1, 2, 3, 8, 64}) {
+    SyntheticStatusWordTable table(10000, kRegionId);
+    std::vector<uint32_t> expected = Populate(table, 3000);
+
+    std::vector<std::vector<uint32_t>> per_worker(num_workers);
+    table.ForEachTaskStatusWordParallel(
+        num_workers, [&per_worker](int worker, ghost_status_word* sw,
+                                   uint32_t region_id, uint32_t idx) {
+          per_worker[worker].push_back(idx);
+        });
+
+    std::vector<uint32_t> visited;
+    for (const std::vector<uint32_t>& v : per_worker) {
+      visited.insert(visited.end(), v.begin(), v.end());
+    }
+    EXPECT_THAT(visited, ElementsAreArray(expected)) << num_workers;
+  }
+}
+
+}  // namespace
+}  // namespace ghost
+
+int main(int argc, char** argv) {
+  testing::InitGoogleTest(&argc, argv);
+  return RUN_ALL_TESTS();
+}
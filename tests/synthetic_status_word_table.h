@@ -0,0 +1,38 @@
+// Copyright 2022 Google LLC
+//
+// Use of this source code is governed by a BSD-style
+// license that can be found in the LICENSE file or at
+// https://developers.google.com/open-source/licenses/bsd
+
+#ifndef GHOST_TESTS_SYNTHETIC_STATUS_WORD_TABLE_H_
+#define GHOST_TESTS_SYNTHETIC_STATUS_WORD_TABLE_H_
+
+#include <memory>
+
+#include "lib/ghost.h"
+
+namespace ghost {
+
+// A `StatusWordTable` in ordinary memory, for testing and measuring the status
+// word scans without a ghOSt kernel. All status words start out unused; callers
+// fill them in through `word()`.
+class SyntheticStatusWordTable : public StatusWordTable {
+ public:
+  explicit SyntheticStatusWordTable(uint32_t capacity, int region_id = 0)
+      : words_(std::make_unique<ghost_status_word[]>(capacity)) {
+    header_storage_.id = region_id;
+    header_storage_.capacity = capacity;
+    header_ = &header_storage_;
+    table_ = words_.get();
+  }
+
+  ghost_status_word& word(uint32_t idx) { return *get(idx); }
+
+ private:
+  ghost_sw_region_header header_storage_ = {};
+  std::unique_ptr<ghost_status_word[]> words_;
+};
+
+}  // namespace ghost
+
+#endif  // GHOST_TESTS_SYNTHETIC_STATUS_WORD_TABLE_H_
@@ -13,6 +13,7 @@
 #include "absl/flags/parse.h"
 #include "absl/strings/numbers.h"
 #include "lib/ghost.h"
+#include "lib/idle_cpu_index.h"
 
 // These tests check that the `Topology` functions return expected values.
 
@@ -431,6 +432,56 @@ TEST(TopologyTest, IteratorBoundary) {
   EXPECT_THAT(index, Eq(cpus.size()));
 }
 
+// Tests that iterating over a `CpuList`, which reads its bitmap directly, visits
+// the same CPUs as iterating over it as a `CpuMap`, and that `GetNthCpu()`,
+// `Size()` and `Empty()` agree with both.
+TEST(TopologyTest, CpuListMatchesCpuMap) {
+  UpdateTestTopology(absl::GetFlag(FLAGS_test_tmpdir), /*has_l3_cache=*/true);
+  const Topology& topology = *TestTopology();
+
+  for (int mask = 0; mask < 64; mask++) {
+    CpuList list = topology.EmptyCpuList();
+    // Sets CPUs in each 64-bit slot (and across slot boundaries) in a pattern
+    // that changes with `mask`.
+    for (int i = 0; i < topology.num_cpus(); i++) {
+      if ((i * 7 + mask) % 11 < mask % 6) {
+        list.Set(i);
+      }
+    }
+
+    std::vector<int> from_list;
+    for (const Cpu& cpu : list) {
+      from_list.push_back(cpu.id());
+    }
+    std::vector<int> from_map;
+    for (const Cpu& cpu : static_cast<const CpuMap&>(list)) {
+      from_map.push_back(cpu.id());
+    }
+    EXPECT_THAT(from_list, Eq(from_map));
+    EXPECT_THAT(list.Size(), Eq(from_map.size()));
+    EXPECT_THAT(list.Empty(), Eq(from_map.empty()));
+    for (int i = 0; i < from_map.size(); i++) {
+      EXPECT_THAT(list.GetNthCpu(i).id(), Eq(from_map[i]));
+    }
+    EXPECT_THAT(list.GetNthCpu(from_map.size()).valid(), IsFalse());
+  }
+}
+
+// Tests that CPUs cleared from a `CpuList` while iterating over it are skipped.
+TEST(TopologyTest, IteratorClearDuringLoop) {
+  UpdateTestTopology(absl::GetFlag(FLAGS_test_tmpdir), /*has_l3_cache=*/true);
+  CpuList list =
+      TestTopology()->ToCpuList(std::vector<int>{3, 4, 63, 64, 65, 100});
+
+  std::vector<int> visited;
+  for (const Cpu& cpu : list) {
+    visited.push_back(cpu.id());
+    // Clears the next CPU, in the same slot or in the next one.
+    list.Clear(cpu.id() + 1);
+  }
+  EXPECT_THAT(visited, Eq(std::vector<int>({3, 63, 65, 100})));
+}
+
 static std::string StripCommas(const std::string s) {
   std::string ret;
   for (const char c : s) {
@@ -564,6 +615,9 @@ int GetRawNumaNode(int cpu) {
 // If `has_l3_cache` is true, an L3 cache is created. All CPUs in a NUMA node
 // share the same L3 cache. If `has_l3_cache` is false, then the topology is
 // configured as though the microarchitecture does not have an L3 cache.
+//
+// Pairs of physical cores (0-1, 2-3, ...) share an L2 cluster, each NUMA node
+// is its own die, and both dies are in one package.
 std::vector<Cpu::Raw> GetRawCustomTopology(bool has_l3_cache) {
   std::vector<Cpu::Raw> raw_cpus;
 
@@ -591,11 +645,170 @@ std::vector<Cpu::Raw> GetRawCustomTopology(bool has_l3_cache) {
       }
     }
 
+    for (int j = 0; j < Topology::kNumTestCpus; j++) {
+      if (GetRawCore(/*cpu=*/j) / 2 == raw_cpu.core / 2) {
+        raw_cpu.cluster_siblings.push_back(j);
+      }
+      if (GetRawNumaNode(/*cpu=*/j) == raw_cpu.numa_node) {
+        raw_cpu.die_siblings.push_back(j);
+      }
+      raw_cpu.package_siblings.push_back(j);
+    }
+
     raw_cpus.push_back(raw_cpu);
   }
   return raw_cpus;
 }
 
+// Checks that `cpu`'s CPUs at each distance are disjoint, don't include `cpu`,
+// and together cover every other CPU, and that each level is the union of the
+// nearer ones.
+void CheckLevels(const Topology& topology, const Cpu& cpu) {
+  CpuList seen = topology.EmptyCpuList();
+  seen.Set(cpu);
+  for (TopologyLevel level : kTopologyLevels) {
+    const CpuList& at_distance = cpu.cpus_at_distance(level);
+    CpuList overlap = at_distance;
+    overlap.Intersection(seen);
+    EXPECT_THAT(overlap.Empty(), IsTrue()) << cpu << " " << level;
+    seen += at_distance;
+    EXPECT_THAT(cpu.level_cpus(level), Eq(seen)) << cpu << " " << level;
+  }
+  EXPECT_THAT(seen, Eq(topology.all_cpus()));
+}
+
+// Tests that the L2 cluster, die, and package siblings are read from sysfs.
+TEST(TopologyTest, CheckOuterSiblings) {
+  UpdateTestTopology(absl::GetFlag(FLAGS_test_tmpdir), /*has_l3_cache=*/true);
+
+  const Cpu cpu = TestTopology()->cpu(2);
+  EXPECT_THAT(cpu.cluster_siblings(),
+              Eq(TestTopology()->ToCpuList(std::vector<int>{2, 3, 58, 59})));
+  EXPECT_THAT(cpu.die_siblings(), Eq(TestTopology()->CpusOnNode(0)));
+  EXPECT_THAT(cpu.package_siblings(), Eq(TestTopology()->all_cpus()));
+}
+
+// Tests that the CPUs at each distance from a CPU in the test topology are the
+// ones that it shares that level with and no nearer one.
+TEST(TopologyTest, CpusAtDistance) {
+  UpdateTestTopology(absl::GetFlag(FLAGS_test_tmpdir), /*has_l3_cache=*/true);
+  const Topology& topology = *TestTopology();
+  const Cpu cpu = topology.cpu(0);
+
+  EXPECT_THAT(cpu.cpus_at_distance(TopologyLevel::kSmt),
+              Eq(topology.ToCpuList(std::vector<int>{56})));
+  EXPECT_THAT(cpu.cpus_at_distance(TopologyLevel::kCluster),
+              Eq(topology.ToCpuList(std::vector<int>{1, 57})));
+  EXPECT_THAT(cpu.cpus_at_distance(TopologyLevel::kL3),
+              Eq(topology.CpusOnNode(0) -
+                 topology.ToCpuList(std::vector<int>{0, 1, 56, 57})));
+  // The L3 cache, NUMA node, and die are the same.
+  EXPECT_THAT(cpu.cpus_at_distance(TopologyLevel::kNumaNode).Empty(),
+              IsTrue());
+  EXPECT_THAT(cpu.cpus_at_distance(TopologyLevel::kDie).Empty(), IsTrue());
+  EXPECT_THAT(cpu.cpus_at_distance(TopologyLevel::kPackage),
+              Eq(topology.CpusOnNode(1)));
+  EXPECT_THAT(cpu.cpus_at_distance(TopologyLevel::kMachine).Empty(), IsTrue());
+
+  for (const Cpu& c : topology.all_cpus()) {
+    CheckLevels(topology, c);
+  }
+}
+
+// Tests that without an L3 cache, the rest of the NUMA node is the next level
+// out from the L2 cluster.
+TEST(TopologyTest, CpusAtDistanceWithNoL3Cache) {
+  UpdateTestTopology(absl::GetFlag(FLAGS_test_tmpdir), /*has_l3_cache=*/false);
+  const Topology& topology = *TestTopology();
+  const Cpu cpu = topology.cpu(0);
+
+  EXPECT_THAT(cpu.cpus_at_distance(TopologyLevel::kL3).Empty(), IsTrue());
+  EXPECT_THAT(cpu.cpus_at_distance(TopologyLevel::kNumaNode),
+              Eq(topology.CpusOnNode(0) -
+                 topology.ToCpuList(std::vector<int>{0, 1, 56, 57})));
+
+  for (const Cpu& c : topology.all_cpus()) {
+    CheckLevels(topology, c);
+  }
+}
+
+// Tests `Distance()` between CPUs in the test topology.
+TEST(TopologyTest, Distance) {
+  UpdateTestTopology(absl::GetFlag(FLAGS_test_tmpdir), /*has_l3_cache=*/true);
+  const Topology& topology = *TestTopology();
+
+  EXPECT_THAT(topology.Distance(topology.cpu(0), topology.cpu(0)),
+              Eq(TopologyLevel::kSmt));
+  EXPECT_THAT(topology.Distance(topology.cpu(0), topology.cpu(56)),
+              Eq(TopologyLevel::kSmt));
+  EXPECT_THAT(topology.Distance(topology.cpu(0), topology.cpu(57)),
+              Eq(TopologyLevel::kCluster));
+  EXPECT_THAT(topology.Distance(topology.cpu(0), topology.cpu(27)),
+              Eq(TopologyLevel::kL3));
+  EXPECT_THAT(topology.Distance(topology.cpu(0), topology.cpu(28)),
+              Eq(TopologyLevel::kPackage));
+  EXPECT_THAT(topology.Distance(topology.cpu(84), topology.cpu(0)),
+              Eq(TopologyLevel::kPackage));
+}
+
+// Tests that `num_ccxs()` counts the L3 caches.
+TEST(TopologyTest, NumCcxs) {
+  UpdateTestTopology(absl::GetFlag(FLAGS_test_tmpdir), /*has_l3_cache=*/true);
+  EXPECT_THAT(TestTopology()->num_ccxs(), Eq(2));
+
+  UpdateTestTopology(absl::GetFlag(FLAGS_test_tmpdir), /*has_l3_cache=*/false);
+  EXPECT_THAT(TestTopology()->num_ccxs(), Eq(0));
+}
+
+// Tests the levels of a chiplet CPU with several L3 caches per NUMA node and 4
+// hardware threads per core, which the kernel reports no clusters or dies for.
+TEST(TopologyTest, CustomChipletLevels) {
+  constexpr int kNumCpus = 64;
+  constexpr int kSmt = 4;
+  // 4 cores, so 16 CPUs, per L3 cache and 2 L3 caches per NUMA node.
+  constexpr int kCpusPerL3 = 16;
+  constexpr int kCpusPerNode = 32;
+
+  std::vector<Cpu::Raw> cpus;
+  for (int i = 0; i < kNumCpus; i++) {
+    Cpu::Raw cpu;
+    cpu.cpu = i;
+    cpu.core = i / kSmt * kSmt;
+    cpu.smt_idx = i % kSmt;
+    cpu.numa_node = i / kCpusPerNode;
+    for (int j = 0; j < kNumCpus; j++) {
+      if (j / kSmt == i / kSmt) {
+        cpu.siblings.push_back(j);
+      }
+      if (j / kCpusPerL3 == i / kCpusPerL3) {
+        cpu.l3_siblings.push_back(j);
+      }
+      cpu.package_siblings.push_back(j);
+    }
+    cpus.push_back(cpu);
+  }
+  UpdateCustomTopology(cpus);
+  const Topology& topology = *CustomTopology();
+
+  EXPECT_THAT(topology.num_ccxs(), Eq(kNumCpus / kCpusPerL3));
+  const Cpu cpu = topology.cpu(5);
+  EXPECT_THAT(cpu.cpus_at_distance(TopologyLevel::kSmt).Size(), Eq(kSmt - 1));
+  EXPECT_THAT(cpu.cpus_at_distance(TopologyLevel::kCluster).Empty(), IsTrue());
+  EXPECT_THAT(cpu.cpus_at_distance(TopologyLevel::kL3).Size(),
+              Eq(kCpusPerL3 - kSmt));
+  EXPECT_THAT(cpu.cpus_at_distance(TopologyLevel::kNumaNode).Size(),
+              Eq(kCpusPerNode - kCpusPerL3));
+  EXPECT_THAT(cpu.cpus_at_distance(TopologyLevel::kDie).Empty(), IsTrue());
+  EXPECT_THAT(cpu.cpus_at_distance(TopologyLevel::kPackage).Size(),
+              Eq(kNumCpus - kCpusPerNode));
+  EXPECT_THAT(topology.Distance(cpu, topology.cpu(17)),
+              Eq(TopologyLevel::kNumaNode));
+
+  for (const Cpu& c : topology.all_cpus()) {
+    CheckLevels(topology, c);
+  }
+}
+
 // Tests that `num_cpus()` returns number of CPUs in the custom topology.
 TEST(TopologyTest, CustomTopologyNumCpus) {
   UpdateCustomTopology(GetRawCustomTopology(/*has_l3_cache=*/true));
@@ -1087,6 +1300,77 @@ TEST(TopologyTest, CpuMapEmpty) {
   EXPECT_THAT(l.Empty(), IsFalse());
 }
 
+// Tests that `IdleCpuIndex` finds the nearest idle CPU, level by level.
+TEST(TopologyTest, IdleCpuIndexFindNearestIdle) {
+  UpdateTestTopology(absl::GetFlag(FLAGS_test_tmpdir), /*has_l3_cache=*/true);
+  const Topology& topology = *TestTopology();
+  const CpuList& all = topology.all_cpus();
+  IdleCpuIndex index(topology);
+  const Cpu cpu0 = topology.cpu(0);
+
+  EXPECT_THAT(index.FindNearestIdle(cpu0, all).valid(), IsFalse());
+  EXPECT_THAT(index.FindIdle(all).valid(), IsFalse());
+  EXPECT_THAT(index.LlcHasIdle(cpu0), IsFalse());
+
+  // CPU 100 is on the other NUMA node, CPU 20 shares the L3 cache with CPU 0,
+  // CPU 57 shares its L2 cluster, and CPU 56 is its hardware thread sibling.
+  for (int cpu : {100, 20, 57, 56, 0}) {
+    index.SetIdle(topology.cpu(cpu));
+    EXPECT_THAT(index.FindNearestIdle(cpu0, all).id(), Eq(cpu));
+  }
+  EXPECT_THAT(index.FindIdle(all).id(), Eq(0));
+  EXPECT_THAT(
+      index.FindNearestIdle(cpu0, topology.ToCpuList(std::vector<int>{20, 100}))
+          .id(),
+      Eq(20));
+  EXPECT_THAT(
+      index.FindNearestIdle(cpu0, topology.ToCpuList(std::vector<int>{1, 99}))
+          .valid(),
+      IsFalse());
+
+  for (int cpu : {0, 56, 57, 20}) {
+    index.SetBusy(topology.cpu(cpu));
+  }
+  EXPECT_THAT(index.LlcHasIdle(cpu0), IsFalse());
+  EXPECT_THAT(index.LlcHasIdle(topology.cpu(100)), IsTrue());
+  EXPECT_THAT(index.FindNearestIdle(cpu0, all).id(), Eq(100));
+  EXPECT_THAT(index.FindIdle(all).id(), Eq(100));
+}
+
+// Tests that the per-LLC summary stays right while threads mark CPUs in the
+// same LLC idle and busy at the same time.
+TEST(TopologyTest, IdleCpuIndexConcurrent) {
+  UpdateTestTopology(absl::GetFlag(FLAGS_test_tmpdir), /*has_l3_cache=*/true);
+  const Topology& topology = *TestTopology();
+  IdleCpuIndex index(topology);
+
+  // CPUs 0-3 share an L3 cache. Each thread ends with its CPU busy, except for
+  // the last one.
+  constexpr int kNumThreads = 4;
+  std::vector<std::unique_ptr<GhostThread>> threads;
+  for (int i = 0; i < kNumThreads; i++) {
+    threads.emplace_back(new GhostThread(
+        GhostThread::KernelScheduler::kCfs, [&index, &topology, i] {
+          const Cpu cpu = topology.cpu(i);
+          for (int j = 0; j < 10000; j++) {
+            index.SetIdle(cpu);
+            index.SetBusy(cpu);
+          }
+          if (i == kNumThreads - 1) {
+            index.SetIdle(cpu);
+          }
+        }));
+  }
+  for (std::unique_ptr<GhostThread>& t : threads) t->Join();
+
+  EXPECT_THAT(index.LlcHasIdle(topology.cpu(0)), IsTrue());
+  EXPECT_THAT(index.FindNearestIdle(topology.cpu(0), topology.all_cpus()).id(),
+              Eq(kNumThreads - 1));
+
+  index.SetBusy(topology.cpu(kNumThreads - 1));
+  EXPECT_THAT(index.LlcHasIdle(topology.cpu(0)), IsFalse());
+}
+
 }  // namespace
 }  // namespace ghost
 
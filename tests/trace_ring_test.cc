@@ -0,0 +1,209 @@
+// Copyright 2022 Google LLC
+//
+// Use of this source code is governed by a BSD-style
+// license that can be found in the LICENSE file or at
+// https://developers.google.com/open-source/licenses/bsd
+
+#include "lib/trace_ring.h"
+
+#include <fstream>
+#include <string>
+#include <thread>
+#include <vector>
+
+#include "absl/flags/declare.h"
+#include "absl/flags/flag.h"
+#include "absl/strings/str_cat.h"
+#include "gmock/gmock.h"
+#include "gtest/gtest.h"
+#include "lib/base.h"
+
+ABSL_DECLARE_FLAG(std::string, dprint_trace);
+ABSL_DECLARE_FLAG(int32_t, dprint_trace_ring_size);
+ABSL_DECLARE_FLAG(absl::Duration, dprint_trace_flush_interval);
+
+namespace ghost {
+namespace {
+
+using ::testing::ElementsAre;
+using ::testing::Eq;
+using ::testing::Ge;
+using ::testing::IsEmpty;
+using ::testing::Ne;
+
+// Drains `ring` and returns its records formatted with `format`.
+std::vector<std::string> DrainText(TraceRing& ring, const char* format) {
+  std::vector<std::string> text;
+  ring.Drain([&text, format](const TraceRecord& r, absl::string_view strings) {
+    text.push_back(FormatTraceArgs(r, format, strings));
+  });
+  return text;
+}
+
+TEST(TraceRingTest, RecordAndFormat) {
+  TraceRing ring(/*capacity=*/64);
+  const uint64_t before = TscClock::Now();
+  const std::string name = "worker/7";
+  EXPECT_TRUE(ring.Record(/*format_id=*/0, name, 25, 1.5, 3, "idle"));
+
+  std::vector<TraceRecord> records;
+  std::vector<std::string> text;
+  EXPECT_THAT(ring.Drain([&](const TraceRecord& r, absl::string_view strings) {
+    records.push_back(r);
+    text.push_back(FormatTraceArgs(
+        r, "%s ran for %d us (%.1f) on cpu %d then %s", strings));
+  }),
+              Eq(1));
+  ASSERT_THAT(records.size(), Eq(1));
+  EXPECT_THAT(records[0].ticks, Ge(before));
+  EXPECT_THAT(records[0].num_args, Eq(5));
+  EXPECT_THAT(records[0].arg_type(0), Eq(TraceArgType::kString));
+  EXPECT_THAT(records[0].arg_type(1), Eq(TraceArgType::kInt));
+  EXPECT_THAT(records[0].arg_type(2), Eq(TraceArgType::kDouble));
+  EXPECT_THAT(text,
+              ElementsAre("worker/7 ran for 25 us (1.5) on cpu 3 then idle"));
+  EXPECT_THAT(ring.tid(), Eq(GetTID()));
+
+  // The ring is empty now.
+  EXPECT_THAT(DrainText(ring, "%d"), IsEmpty());
+}
+
+// Tests that records whose format does not match their arguments come out raw
+// rather than not at all.
+TEST(TraceRingTest, BadFormat) {
+  TraceRing ring(/*capacity=*/64);
+  ring.Record(/*format_id=*/7, "three", 3);
+  EXPECT_THAT(DrainText(ring, "%d %d"), ElementsAre("<format 7> three 3"));
+
+  ring.Record(/*format_id=*/7, 3);
+  EXPECT_THAT(DrainText(ring, nullptr), ElementsAre("<format 7> 3"));
+}
+
+TEST(TraceRingTest, TruncateLongStrings) {
+  TraceRing ring(/*capacity=*/64);
+  const std::string s(1000, 'x');
+  ring.Record(/*format_id=*/0, s, 1);
+  EXPECT_THAT(
+      DrainText(ring, "%s %d"),
+      ElementsAre(std::string(kMaxTraceStringLength, 'x') + " 1"));
+}
+
+TEST(TraceRingTest, DropWhenFull) {
+  // Rounded up so that the largest record fits.
+  TraceRing ring(/*capacity=*/1);
+  const size_t capacity = ring.capacity();
+  ASSERT_THAT(capacity, Ge(1 + kMaxTraceArgs * kMaxTraceStringLength /
+                                   sizeof(TraceRecord)));
+
+  for (size_t i = 0; i < capacity + 2; i++) {
+    ring.Record(/*format_id=*/0, i);
+  }
+  EXPECT_THAT(ring.dropped(), Eq(2));
+  EXPECT_THAT(DrainText(ring, "%d").size(), Eq(capacity));
+
+  // There is room again.
+  EXPECT_TRUE(ring.Record(/*format_id=*/0, 1));
+}
+
+// Tests that strings that wrap around the end of the ring come out whole.
+TEST(TraceRingTest, StringsWrap) {
+  TraceRing ring(/*capacity=*/1);
+  for (int i = 0; i < 100; i++) {
+    const std::string s(50 + i, 'a' + i % 26);
+    ASSERT_TRUE(ring.Record(/*format_id=*/0, i, s));
+    EXPECT_THAT(DrainText(ring, "%d %s"),
+                ElementsAre(absl::StrCat(i, " ", s)));
+  }
+}
+
+// Tests that no records are lost or torn with a writer and a reader that
+// drains as it goes.
+TEST(TraceRingTest, ConcurrentReader) {
+  TraceRing ring(/*capacity=*/256);
+  constexpr int kNumRecords = 20000;
+
+  std::thread writer([&ring]() {
+    for (int i = 0; i < kNumRecords; i++) {
+      const std::string s = absl::StrCat("record ", i);
+      // Retry until the reader makes room, so that nothing is dropped.
+      while (!ring.Record(/*format_id=*/0, i, s)) {
+        Pause();
+      }
+    }
+  });
+
+  int next = 0;
+  while (next < kNumRecords) {
+    ring.Drain([&next](const TraceRecord& r, absl::string_view strings) {
+      ASSERT_THAT(r.args[0], Eq(next));
+      ASSERT_THAT(strings, Eq(absl::StrCat("record ", next)));
+      next++;
+    });
+  }
+  writer.join();
+}
+
+TEST(TraceRingTest, DecodeNotATraceFile) {
+  const std::string path = testing::TempDir() + "/not_a_trace";
+  std::ofstream(path) << "hello, this is not a trace file at all";
+  EXPECT_FALSE(DecodeTraceFile(path).ok());
+  EXPECT_FALSE(DecodeTraceFile(path + ".missing").ok());
+}
+
+// Records into the tracer the way `GHOST_DPRINT` does.
+template <typename... Args>
+void Dprint(const char* format, const Args&... args) {
+  DprintTracer::Get()->Record(TraceFormats::Register(format), args...);
+}
+
+// There is one tracer per process, so this is the only test that starts it.
+TEST(TraceRingTest, DprintTracer) {
+  const std::string path = testing::TempDir() + "/dprint_trace";
+  // A GHOST_DPRINT before flags are parsed doesn't keep the tracer off.
+  EXPECT_THAT(DprintTracer::Get(), Eq(nullptr));
+  absl::SetFlag(&FLAGS_dprint_trace, path);
+  absl::SetFlag(&FLAGS_dprint_trace_ring_size, 256);
+  absl::SetFlag(&FLAGS_dprint_trace_flush_interval, absl::InfiniteDuration());
+  DprintTracer* tracer = DprintTracer::Get();
+  ASSERT_THAT(tracer, Ne(nullptr));
+  EXPECT_THAT(tracer->path(), Eq(path));
+  EXPECT_THAT(DprintTracer::StartFromFlags(), Eq(tracer));
+
+  Dprint("COMMIT(%d): %s %d", 3, "task/12", 4);
+  std::thread([] { Dprint("Task %s oncpu %d", absl::string_view("b"), 5); })
+      .join();
+  Dprint("DCFS: [%.6f] cpu %d: %s", 0.25, 1, std::string("picked"));
+  tracer->Flush();
+
+  absl::StatusOr<DecodedTrace> trace = DecodeTraceFile(path);
+  ASSERT_TRUE(trace.ok()) << trace.status();
+  std::vector<std::string> text;
+  for (const DecodedTraceRecord& r : trace->records) {
+    text.push_back(r.text);
+  }
+  EXPECT_THAT(text, ElementsAre("COMMIT(3): task/12 4", "Task b oncpu 5",
+                                "DCFS: [0.250000] cpu 1: picked"));
+  EXPECT_THAT(trace->records[0].tid, Eq(GetTID()));
+  EXPECT_THAT(trace->records[1].tid, Ne(GetTID()));
+  EXPECT_THAT(trace->dropped, Eq(0));
+
+  // Records that a dump writes out are appended to the flushed ones.
+  for (int i = 0; i < 300; i++) {
+    Dprint("%d", i);
+  }
+  tracer->Dump();
+  trace = DecodeTraceFile(path);
+  ASSERT_TRUE(trace.ok()) << trace.status();
+  EXPECT_THAT(trace->records.size(), Ge(3 + 1));
+  EXPECT_THAT(trace->records[3].text, Eq("0"));
+  EXPECT_THAT(trace->dropped, Eq(300 - tracer->ring()->capacity()));
+  EXPECT_THAT(tracer->dropped(), Eq(trace->dropped));
+}
+
+}  // namespace
+}  // namespace ghost
+
+int main(int argc, char** argv) {
+  testing::InitGoogleTest(&argc, argv);
+  return RUN_ALL_TESTS();
+}
@@ -0,0 +1,84 @@
+// Copyright 2022 Google LLC
+//
+// Use of this source code is governed by a BSD-style
+// license that can be found in the LICENSE file or at
+// https://developers.google.com/open-source/licenses/bsd
+
+#include "lib/tsc_clock.h"
+
+#include "absl/time/clock.h"
+#include "gmock/gmock.h"
+#include "gtest/gtest.h"
+#include "lib/base.h"
+
+namespace ghost {
+namespace {
+
+TEST(TscClockTest, Monotonic) {
+  uint64_t last = TscClock::Now();
+  for (int i = 0; i < 1000; ++i) {
+    const uint64_t now = TscClock::Now();
+    EXPECT_GE(now, last);
+    last = now;
+  }
+}
+
+TEST(TscClockTest, Rate) {
+  // Any TSC from 100 MHz to 10 GHz, or nanoseconds.
+  const double ticks_per_us = TscClock::TicksPerMicrosecond();
+  EXPECT_GT(ticks_per_us, 100);
+  EXPECT_LT(ticks_per_us, 10'000);
+  if (!TscClock::Invariant()) {
+    EXPECT_EQ(ticks_per_us, 1000);
+  }
+}
+
+TEST(TscClockTest, Conversions) {
+  EXPECT_EQ(TscClock::FromDuration(absl::ZeroDuration()), 0);
+  EXPECT_EQ(TscClock::FromDuration(-absl::Seconds(1)), 0);
+  EXPECT_EQ(TscClock::FromDuration(absl::InfiniteDuration()),
+            TscClock::kInfiniteTicks);
+
+  const absl::Duration d = absl::Milliseconds(5);
+  const uint64_t ticks = TscClock::FromDuration(d);
+  EXPECT_NEAR(ticks, 5000 * TscClock::TicksPerMicrosecond(), 1);
+  // Within a tick.
+  EXPECT_LE(absl::AbsDuration(TscClock::ToDuration(ticks) - d),
+            absl::Nanoseconds(1));
+}
+
+// Ticks measure the same intervals as CLOCK_MONOTONIC.
+TEST(TscClockTest, MatchesMonotonicClock) {
+  const absl::Time start = MonotonicNow();
+  const uint64_t start_ticks = TscClock::Now();
+  absl::SleepFor(absl::Milliseconds(50));
+  const uint64_t end_ticks = TscClock::Now();
+  const absl::Duration elapsed = MonotonicNow() - start;
+
+  EXPECT_LE(absl::AbsDuration(TscClock::ToDuration(end_ticks - start_ticks) -
+                              elapsed),
+            absl::Microseconds(100));
+}
+
+TEST(TscClockTest, ToTime) {
+  const absl::Time before = absl::Now();
+  const uint64_t ticks = TscClock::Now();
+  const absl::Time after = absl::Now();
+
+  const absl::Time t = TscClock::ToTime(ticks);
+  EXPECT_GE(t, before - absl::Milliseconds(1));
+  EXPECT_LE(t, after + absl::Milliseconds(1));
+  // FromDuration() rounds down.
+  const absl::Duration second =
+      TscClock::ToTime(ticks + TscClock::FromDuration(absl::Seconds(1))) - t;
+  EXPECT_LE(second, absl::Seconds(1));
+  EXPECT_GE(second, absl::Seconds(1) - absl::Nanoseconds(1));
+}
+
+}  // namespace
+}  // namespace ghost
+
+int main(int argc, char** argv) {
+  testing::InitGoogleTest(&argc, argv);
+  return RUN_ALL_TESTS();
+}
@@ -19,6 +19,11 @@
  * the global queue.  You can do all of this in probably 100 lines of code.
  * I've commented the policy bits with "POLICY" for easy grepping.
  *
+ * A single global queue doesn't scale, though: every cpu's bpf-pnt contends on
+ * it, and tasks bounce across the machine.  So Biff has a FIFO per last-level
+ * cache (LLC) domain instead, and cpus only steal from remote LLCs when their
+ * own is empty.
+ *
  * But any real scheduler will want more, so Biff has a few extras:
  * - want to know when tasks block, run, etc, so handle the other message types
  * - want data structures to track that info, such as "which task is on which
@@ -43,13 +48,16 @@
  *   many cpus to wake up.  (If you do this, make sure to handle the EBUSY case
  *   below by rescheding your cpu).
  *
- * - What happens if any of the bpf operations fail?  You're out of luck.  If
- *   the global_rq overflows (65k tasks) or bpf_ghost_run_gtid() fails with an
- *   esoteric error code, we might lose track of a task.  As far as the kernel
- *   is concerned, the task is sitting on the runqueue, but bpf will never run
- *   it.  There are a few ways out:
- *   - if we detect an error, add infrastructure to pass the task to userspace,
- *   which can try to handle it in a more forgiving environment than bpf.
+ * - What happens if any of the bpf operations fail?  If we run out of room
+ *   for a task in our maps, can't find a task's rq or bpf_ghost_run_gtid()
+ *   fails with an esoteric error code, we might lose track of a task.  As far
+ *   as the kernel is concerned, the task is sitting on the runqueue, but bpf
+ *   will never run it.  There are a few ways out:
+ *   - if we detect an error, pass the task to userspace, which can try to
+ *   handle it in a more forgiving environment than bpf.  We do this with the
+ *   rescue channel (rescue.bpf.h): userspace pushes the task back to us on
+ *   the rescue_rq, and bpf-pnt runs it from there.  If the ring to userspace
+ *   overflows too, we're out of luck.
  *   - userspace can periodically poll the status word table for runnable tasks
  *   that aren't getting cpu time.
  *   - make sure userspace sets an enclave runnable_timeout.  If bpf fails to
@@ -93,13 +101,26 @@
 // clang-format on
 
 #include "third_party/bpf/biff_bpf.h"
+#include "third_party/bpf/biff_rq.bpf.h"
 #include "third_party/bpf/common.bpf.h"
+#include "third_party/bpf/rescue.bpf.h"
 #include "third_party/bpf/topology.bpf.h"
 
 #include <asm-generic/errno.h>
 
 bool initialized;
 
+/*
+ * Set by userspace before loading.  cpu_to_llc[cpu] is 1 + the cpu's LLC
+ * domain, numbered from 0 to nr_llcs - 1, or 0 if the cpu is not in the
+ * enclave.
+ *
+ * topology.bpf.h's ccx_of() doesn't know about LLCs yet, so we carry our own
+ * table.
+ */
+const volatile u32 nr_llcs = 1;
+const volatile u32 cpu_to_llc[BIFF_MAX_CPUS];
+
 /*
  * You can't hold bpf spinlocks and make helper calls, which include looking up
  * map elements.  To use 'intrusive' list struct embedded cpu_data and sw_data
@@ -177,12 +198,18 @@ static struct biff_bpf_cpu_data *cpu_to_pcpu(u32 cpu)
 	return &__ca->e[cpu];
 }
 
+static struct __sw_arr *get_sw_arr(void)
+{
+	u32 zero = 0;
+
+	return bpf_map_lookup_elem(&sw_data, &zero);
+}
+
 /* Helper, from gtid to per-task sw_data blob */
 static struct biff_bpf_sw_data *gtid_to_swd(u64 gtid)
 {
 	struct task_sw_info *swi;
 	struct __sw_arr *__swa;
-	u32 zero = 0;
 	u32 idx;
 
 	swi = bpf_map_lookup_elem(&sw_lookup, &gtid);
@@ -191,12 +218,34 @@ static struct biff_bpf_sw_data *gtid_to_swd(u64 gtid)
 	idx = swi->index;
 	if (idx >= BIFF_MAX_GTIDS)
 		return NULL;
-	__swa = bpf_map_lookup_elem(&sw_data, &zero);
+	__swa = get_sw_arr();
 	if (!__swa)
 		return NULL;
 	return &__swa->e[idx];
 }
 
+static bool cpu_in_enclave(u32 cpu)
+{
+	BPF_MUST_CHECK(cpu);
+	if (cpu >= BIFF_MAX_CPUS)
+		return false;
+	return cpu_to_llc[cpu] != 0;
+}
+
+/* Cpus outside the enclave (e.g. for a task_new) use the first LLC. */
+static u32 llc_of(u32 cpu)
+{
+	u32 llc;
+
+	BPF_MUST_CHECK(cpu);
+	if (cpu >= BIFF_MAX_CPUS)
+		return 0;
+	llc = cpu_to_llc[cpu];
+	if (llc == 0 || llc > BIFF_MAX_LLCS)
+		return 0;
+	return llc - 1;
+}
+
 static void task_started(u64 gtid, int cpu, u64 cpu_seqnum)
 {
 	struct biff_bpf_cpu_data *pcpu;
@@ -238,50 +287,129 @@ static int resched_cpu(int cpu)
 	return bpf_ghost_resched_cpu2(cpu, flags);
 }
 
-/* Biff POLICY: dumb global fifo.  No locality, etc. */
+/*
+ * Biff POLICY: a fifo per LLC.  Tasks are queued in the LLC of the cpu they
+ * stopped on (or, for wakeups, the cpu picked by biff_select_rq()).  A cpu
+ * runs tasks from its own LLC and only steals from other LLCs when its own is
+ * empty.
+ *
+ * Each rq is its own map element, since a map value can only have one
+ * bpf_spin_lock.  The tasks are linked through the sw_data array, which we
+ * must look up before grabbing the lock.
+ */
+struct biff_bpf_rq {
+	struct bpf_spin_lock lock;
+	struct biff_rq rq;
+};
+
+struct {
+	__uint(type, BPF_MAP_TYPE_ARRAY);
+	__uint(max_entries, BIFF_MAX_LLCS);
+	__type(key, u32);
+	__type(value, struct biff_bpf_rq);
+} llc_rqs SEC(".maps");
+
+static struct biff_bpf_rq *llc_to_rq(u32 llc)
+{
+	return bpf_map_lookup_elem(&llc_rqs, &llc);
+}
+
+/* POLICY */
+static void enqueue_task(struct biff_bpf_sw_data *swd, u32 task_barrier,
+			 u32 cpu)
+{
+	struct __sw_arr *__swa = get_sw_arr();
+	u32 llc = llc_of(cpu);
+	struct biff_bpf_rq *rq = llc_to_rq(llc);
+
+	if (!__swa || !rq) {
+		/* Let userspace shove the task back into bpf-pnt. */
+		rescue_task(swd->gtid, task_barrier, BPF_RESCUE_NO_RQ);
+		return;
+	}
+	bpf_spin_lock(&rq->lock);
+	biff_rq_push(&rq->rq, __swa->e, swd, llc, task_barrier);
+	bpf_spin_unlock(&rq->lock);
+}
+
+/* Takes swd off its rq, if it is on one, e.g. when the task departs. */
+static void dequeue_task(struct biff_bpf_sw_data *swd)
+{
+	struct __sw_arr *__swa = get_sw_arr();
+	struct biff_bpf_rq *rq;
+	u32 llc = swd->rq_llc;
+
+	if (!llc || !__swa)
+		return;
+	llc -= 1;
+	rq = llc_to_rq(llc);
+	if (!rq)
+		return;
+	bpf_spin_lock(&rq->lock);
+	/* Fails if the task was popped after we read rq_llc. */
+	biff_rq_remove(&rq->rq, __swa->e, swd, llc);
+	bpf_spin_unlock(&rq->lock);
+}
 
 struct rq_item {
 	u64 gtid;
 	u32 task_barrier;
 };
 
-struct {
-	__uint(type, BPF_MAP_TYPE_QUEUE);
-	__uint(max_entries, BIFF_MAX_GTIDS);
-	__type(value, struct rq_item);
-} global_rq SEC(".maps");
-
-/* POLICY */
-static void enqueue_task(u64 gtid, u32 task_barrier)
+/*
+ * Pops the first task from llc's rq into next.  Returns false if the rq was
+ * empty.
+ */
+static bool pop_task(u32 llc, struct __sw_arr *__swa, struct rq_item *next)
 {
+	struct biff_bpf_rq *rq = llc_to_rq(llc);
+	struct biff_bpf_sw_data *swd;
+
+	if (!rq)
+		return false;
 	/*
-	 * Need to explicitly zero the entire struct, otherwise you get
-	 * "invalid indirect read from stack".  Explicitly setting .gtid and
-	 * .task_barrier in the definition (whether p is an array or just a
-	 * struct) isn't enough.  I guess the verifier can't tell we aren't
-	 * passing uninitialized stack data to some function.
+	 * Don't grab the lock of an empty rq.  For remote LLCs, that would
+	 * pull the rq's cacheline across the machine for nothing.
 	 */
-	struct rq_item p[1] = {0};
-	int err;
+	if (!READ_ONCE(rq->rq.nr_queued))
+		return false;
+	bpf_spin_lock(&rq->lock);
+	swd = biff_rq_pop(&rq->rq, __swa->e);
+	if (swd) {
+		next->gtid = swd->gtid;
+		next->task_barrier = swd->task_barrier;
+	}
+	bpf_spin_unlock(&rq->lock);
+	return swd != NULL;
+}
 
-	p->gtid = gtid;
-	p->task_barrier = task_barrier;
-        err = bpf_map_push_elem(&global_rq, p, 0);
-	if (err) {
+/* Reenqueues a task that we popped but failed to run. */
+static void requeue_task(struct rq_item *item, u32 cpu)
+{
+	struct biff_bpf_sw_data *swd = gtid_to_swd(item->gtid);
+
+	if (!swd) {
 		/*
-		 * If we fail, we'll lose the task permanently.  This is where
-		 * it's helpful to have userspace involved, even if just epolled
-		 * on a bpf ring_buffer map to handle it by trying to shove the
-		 * task into the queue again.
+		 * Either the task departed, in which case userspace's retry
+		 * will fail harmlessly, or it came from the rescue_rq and we
+		 * never had room for it.
 		 */
-		bpf_printd("failed to enqueue %p, err %d\n", gtid, err);
+		rescue_task(item->gtid, item->task_barrier,
+			    BPF_RESCUE_RUN_FAILED);
+		return;
 	}
+	enqueue_task(swd, item->task_barrier, cpu);
 }
 
 SEC("ghost_sched/pnt")
 int biff_pnt(struct bpf_ghost_sched *ctx)
 {
-	struct rq_item next[1];
+	struct rq_item next[1] = {0};
+	struct bpf_rescue_msg rescued[1] = {0};
+	struct __sw_arr *__swa;
+	u32 cpu = bpf_get_smp_processor_id();
+	u32 local, i;
+	bool found = false;
 	int err;
 
 	if (!initialized) {
@@ -310,16 +438,29 @@ int biff_pnt(struct bpf_ghost_sched *ctx)
 		return 0;
 	}
 
-	/* POLICY */
-	err = bpf_map_pop_elem(&global_rq, next);
-	if (err) {
-		switch (-err) {
-		case ENOENT:
-			break;
-		default:
-			bpf_printd("failed to dequeue, err %d\n", err);
+	/*
+	 * POLICY: tasks that userspace rescued first, since they have been
+	 * waiting a while.  Then our LLC, then steal from the others.
+	 */
+	if (rescue_pop(rescued)) {
+		next->gtid = rescued->gtid;
+		next->task_barrier = rescued->task_barrier;
+		found = true;
+	}
+	if (!found) {
+		__swa = get_sw_arr();
+		if (!__swa)
+			goto done;
+		local = llc_of(cpu);
+		for (i = 0; i < BIFF_MAX_LLCS && i < nr_llcs; i++) {
+			if (pop_task(biff_llc_probe(local, i, nr_llcs), __swa,
+				     next)) {
+				found = true;
+				break;
+			}
 		}
-		goto done;
+		if (!found)
+			goto done;
 	}
 
 	err = bpf_ghost_run_gtid(next->gtid, next->task_barrier,
@@ -357,7 +498,7 @@ int biff_pnt(struct bpf_ghost_sched *ctx)
 			 * or resched ourselves, we'll rerun bpf-pnt after the
 			 * task got off cpu.
 			 */
-			enqueue_task(next->gtid, next->task_barrier);
+			requeue_task(next, cpu);
 			break;
 		case ERANGE:
 		case EXDEV:
@@ -382,7 +523,7 @@ int biff_pnt(struct bpf_ghost_sched *ctx)
 			 *   be reachable from bpf-pnt.
 			 */
 			bpf_printd("failed to run %p, err %d\n", next->gtid, err);
-			enqueue_task(next->gtid, next->task_barrier);
+			requeue_task(next, cpu);
 			break;
 		}
 	}
@@ -414,11 +555,24 @@ static void __attribute__((noinline)) handle_new(struct bpf_ghost_msg *msg)
 	struct biff_bpf_sw_data *swd;
 	u64 gtid = new->gtid;
 	u64 now = bpf_ktime_get_us();
+	int err;
 
 	swi->id = new->sw_info.id;
 	swi->index = new->sw_info.index;
 
-	if (bpf_map_update_elem(&sw_lookup, &gtid, swi, BPF_NOEXIST)) {
+	err = bpf_map_update_elem(&sw_lookup, &gtid, swi, BPF_NOEXIST);
+	if (err) {
+		if (err != -EEXIST) {
+			/*
+			 * Out of room (more than BIFF_MAX_GTIDS tasks).  We
+			 * can't track the task, but userspace can still get it
+			 * run.
+			 */
+			if (new->runnable)
+				rescue_task(gtid, msg->seqnum,
+					    BPF_RESCUE_NO_SLOT);
+			return;
+		}
 		/*
 		 * We already knew about this task.  If a task joins the enclave
 		 * during Discovery, we'll get a task_new message.  Then
@@ -440,9 +594,11 @@ static void __attribute__((noinline)) handle_new(struct bpf_ghost_msg *msg)
 		return;
 	swd->parent = new->parent_gtid;
 	swd->ran_until = now;
+	/* Dead and departed tasks were taken off their rq, so rq_llc is 0. */
+	swd->gtid = gtid;
 	if (new->runnable) {
 		swd->runnable_at = now;
-		enqueue_task(gtid, msg->seqnum);
+		enqueue_task(swd, msg->seqnum, bpf_get_smp_processor_id());
 	}
 }
 
@@ -474,6 +630,17 @@ static void __attribute__((noinline)) handle_blocked(struct bpf_ghost_msg *msg)
 	task_stopped(blocked->cpu);
 }
 
+/*
+ * A runnable task we have no sw_data for.  Before Discovery completes, that's
+ * expected: we'll get a task_new for it.  After that, it is a task we had no
+ * room for, and only userspace can get it run.
+ */
+static void runnable_untracked(u64 gtid, u32 task_barrier)
+{
+	if (initialized)
+		rescue_task(gtid, task_barrier, BPF_RESCUE_NO_SLOT);
+}
+
 static void __attribute__((noinline)) handle_wakeup(struct bpf_ghost_msg *msg)
 {
 	struct ghost_msg_payload_task_wakeup *wakeup = &msg->wakeup;
@@ -482,11 +649,14 @@ static void __attribute__((noinline)) handle_wakeup(struct bpf_ghost_msg *msg)
 	u64 now = bpf_ktime_get_us();
 
 	swd = gtid_to_swd(gtid);
-	if (!swd)
+	if (!swd) {
+		runnable_untracked(gtid, msg->seqnum);
 		return;
+	}
 	swd->runnable_at = now;
 
-	enqueue_task(gtid, msg->seqnum);
+	/* POLICY: biff_select_rq() picked the wake_up_cpu. */
+	enqueue_task(swd, msg->seqnum, wakeup->wake_up_cpu);
 }
 
 static void __attribute__((noinline)) handle_preempt(struct bpf_ghost_msg *msg)
@@ -498,14 +668,16 @@ static void __attribute__((noinline)) handle_preempt(struct bpf_ghost_msg *msg)
 	u64 now = bpf_ktime_get_us();
 
 	swd = gtid_to_swd(gtid);
-	if (!swd)
+	if (!swd) {
+		runnable_untracked(gtid, msg->seqnum);
 		return;
+	}
 	swd->ran_until = now;
 	swd->runnable_at = now;
 
 	task_stopped(cpu);
 
-	enqueue_task(gtid, msg->seqnum);
+	enqueue_task(swd, msg->seqnum, cpu);
 }
 
 static void __attribute__((noinline)) handle_yield(struct bpf_ghost_msg *msg)
@@ -517,14 +689,16 @@ static void __attribute__((noinline)) handle_yield(struct bpf_ghost_msg *msg)
 	u64 now = bpf_ktime_get_us();
 
 	swd = gtid_to_swd(gtid);
-	if (!swd)
+	if (!swd) {
+		runnable_untracked(gtid, msg->seqnum);
 		return;
+	}
 	swd->ran_until = now;
 	swd->runnable_at = now;
 
 	task_stopped(cpu);
 
-	enqueue_task(gtid, msg->seqnum);
+	enqueue_task(swd, msg->seqnum, cpu);
 }
 
 static void __attribute__((noinline)) handle_switchto(struct bpf_ghost_msg *msg)
@@ -548,19 +722,28 @@ static void __attribute__((noinline)) handle_switchto(struct bpf_ghost_msg *msg)
 static void __attribute__((noinline)) handle_dead(struct bpf_ghost_msg *msg)
 {
 	struct ghost_msg_payload_task_dead *dead = &msg->dead;
+	struct biff_bpf_sw_data *swd;
 	u64 gtid = dead->gtid;
 
+	swd = gtid_to_swd(gtid);
+	if (swd)
+		dequeue_task(swd);
 	bpf_map_delete_elem(&sw_lookup, &gtid);
 }
 
 static void __attribute__((noinline)) handle_departed(struct bpf_ghost_msg *msg)
 {
 	struct ghost_msg_payload_task_departed *departed = &msg->departed;
+	struct biff_bpf_sw_data *swd;
 	u64 gtid = departed->gtid;
 
 	if (departed->was_current)
 		task_stopped(departed->cpu);
 
+	/* A runnable task can depart while on an rq. */
+	swd = gtid_to_swd(gtid);
+	if (swd)
+		dequeue_task(swd);
 	bpf_map_delete_elem(&sw_lookup, &gtid);
 }
 
@@ -662,6 +845,9 @@ int biff_select_rq(struct bpf_ghost_select_rq *ctx)
 	u64 gtid = ctx->gtid;
 	/* Can't pass ctx->gtid to gtid_to_thread (swd) directly.  (verifier) */
 	struct biff_bpf_sw_data *t = gtid_to_swd(gtid);
+	u32 task_cpu = ctx->task_cpu;
+	u32 waker_cpu = ctx->waker_cpu;
+	struct biff_bpf_rq *task_rq, *waker_rq;
 
 	if (!t) {
 		bpf_printd("Got select_rq without a task!");
@@ -677,7 +863,21 @@ int biff_select_rq(struct bpf_ghost_select_rq *ctx)
 	 */
 	ctx->skip_ttwu_queue = true;
 
-	return ctx->task_cpu;
+	/*
+	 * POLICY: the cpu we return is the wakeup's wake_up_cpu, whose LLC
+	 * handle_wakeup() queues the task in.  Keep the task in the LLC it last
+	 * ran in, unless that one is much busier than the waker's.
+	 */
+	if (!cpu_in_enclave(waker_cpu) || llc_of(task_cpu) == llc_of(waker_cpu))
+		return task_cpu;
+	task_rq = llc_to_rq(llc_of(task_cpu));
+	waker_rq = llc_to_rq(llc_of(waker_cpu));
+	if (!task_rq || !waker_rq)
+		return task_cpu;
+	if (biff_wake_on_waker_llc(READ_ONCE(task_rq->rq.nr_queued),
+				   READ_ONCE(waker_rq->rq.nr_queued)))
+		return waker_cpu;
+	return task_cpu;
 }
 
 char LICENSE[] SEC("license") = "GPL";
@@ -18,8 +18,12 @@
 #include <stdint.h>
 #endif
 
+#include "lib/queue.bpf.h"
+
 #define BIFF_MAX_CPUS	1024
 #define BIFF_MAX_GTIDS 65536
+/* Max number of last-level cache domains, each with its own runqueue. */
+#define BIFF_MAX_LLCS 64
 
 /*
  * The array map of these, called `cpu_data`, can be mmapped by userspace.
@@ -59,6 +63,11 @@ struct biff_bpf_sw_data {
 	uint64_t ran_until;
 	uint64_t runnable_at;
 	uint64_t parent;
+	/* Runqueue state, protected by the lock of the rq the task is on. */
+	uint64_t gtid;
+	uint32_t task_barrier;
+	uint32_t rq_llc;	/* 1 + the LLC whose rq holds us, or 0 */
+	struct arr_list_entry link;
 } __attribute__((aligned(8)));
 
 
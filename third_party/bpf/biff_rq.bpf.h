@@ -0,0 +1,127 @@
+/*
+ * Copyright 2022 Google LLC
+ *
+ * This program is free software; you can redistribute it and/or
+ * modify it under the terms of the GNU General Public License
+ * version 2 as published by the Free Software Foundation.
+ *
+ * This program is distributed in the hope that it will be useful,
+ * but WITHOUT ANY WARRANTY; without even the implied warranty of
+ * MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE. See the
+ * GNU General Public License for more details.
+ *
+ * Biff's runqueues: one FIFO per last-level cache (LLC) domain, linked through
+ * the tasks' sw_data with an arr_list.
+ *
+ * The caller holds the rq's lock (a bpf_spin_lock in the map value next to the
+ * biff_rq).  These helpers make no bpf helper calls and are always inlined, so
+ * they are usable under a bpf_spin_lock.  They also compile in userspace, which
+ * is how we test them.
+ */
+
+#ifndef GHOST_LIB_BPF_BIFF_RQ_BPF_H_
+#define GHOST_LIB_BPF_BIFF_RQ_BPF_H_
+
+#include "lib/queue.bpf.h"
+#include "third_party/bpf/biff_bpf.h"
+
+#ifndef __always_inline
+#define __always_inline inline __attribute__((always_inline))
+#endif
+
+/*
+ * POLICY: a waking task goes to the waker's LLC instead of its own if its own
+ * rq has more than this many tasks than the waker's.
+ */
+#define BIFF_LLC_IMBALANCE 4
+
+struct biff_rq {
+	struct arr_list list;
+	/* Read without the lock as a hint, e.g. to skip empty rqs. */
+	unsigned int nr_queued;
+};
+
+/*
+ * Enqueues swd at the tail of rq, the rq of `llc`.  arr is the sw_data array
+ * that swd is in.
+ *
+ * If the task is already on a runqueue, this only updates its barrier and
+ * returns false.  That happens when bpf-pnt requeues a task it failed to run
+ * and we got a message for the task in the meantime.  The newer barrier is the
+ * one that will let us run the task.
+ */
+static __always_inline bool biff_rq_push(struct biff_rq *rq,
+					 struct biff_bpf_sw_data *arr,
+					 struct biff_bpf_sw_data *swd,
+					 unsigned int llc,
+					 uint32_t task_barrier)
+{
+	swd->task_barrier = task_barrier;
+	if (swd->rq_llc)
+		return false;
+	arr_list_insert_tail(arr, BIFF_MAX_GTIDS, &rq->list, swd, link);
+	swd->rq_llc = llc + 1;
+	rq->nr_queued++;
+	return true;
+}
+
+/* Dequeues and returns the task at the head of rq, or NULL. */
+static __always_inline struct biff_bpf_sw_data *
+biff_rq_pop(struct biff_rq *rq, struct biff_bpf_sw_data *arr)
+{
+	struct biff_bpf_sw_data *swd;
+
+	swd = arr_list_pop_first(arr, BIFF_MAX_GTIDS, &rq->list, link);
+	if (swd) {
+		swd->rq_llc = 0;
+		rq->nr_queued--;
+	}
+	return swd;
+}
+
+/*
+ * Removes swd from rq, the rq of `llc`, if it is on it.  Returns true if it
+ * was.
+ */
+static __always_inline bool biff_rq_remove(struct biff_rq *rq,
+					   struct biff_bpf_sw_data *arr,
+					   struct biff_bpf_sw_data *swd,
+					   unsigned int llc)
+{
+	if (swd->rq_llc != llc + 1)
+		return false;
+	arr_list_remove(arr, BIFF_MAX_GTIDS, &rq->list, swd, link);
+	swd->rq_llc = 0;
+	rq->nr_queued--;
+	return true;
+}
+
+/*
+ * POLICY: the order in which a cpu in `local` looks for work.  Returns the i'th
+ * LLC to check, for i in [0, nr_llcs): first our own, then the others round
+ * robin, starting with our neighbor, so that idle LLCs don't all steal from
+ * the same victim.  Avoids division, which is slow in bpf.
+ */
+static __always_inline unsigned int biff_llc_probe(unsigned int local,
+						   unsigned int i,
+						   unsigned int nr_llcs)
+{
+	unsigned int llc = local + i;
+
+	if (llc >= nr_llcs)
+		llc -= nr_llcs;
+	return llc;
+}
+
+/*
+ * POLICY: whether a task waking up should go to the waker's LLC instead of the
+ * LLC it last ran in, given the lengths of their runqueues.  We prefer the
+ * task's LLC for its warm cache, unless it is much busier.
+ */
+static __always_inline bool biff_wake_on_waker_llc(unsigned int task_nr_queued,
+						   unsigned int waker_nr_queued)
+{
+	return task_nr_queued > waker_nr_queued + BIFF_LLC_IMBALANCE;
+}
+
+#endif  // GHOST_LIB_BPF_BIFF_RQ_BPF_H_
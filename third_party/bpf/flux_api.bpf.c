@@ -20,7 +20,7 @@
  * In general:
  * - s is the caller's sched struct (s == self).
  * - The child_id is an int: the ID of a particular scheduler, e.g.
- *   FLUX_SCHED_BIFF.
+ *   roci's r->roci.primary.
  * - A scheduler's callbacks will take its self pointer (s), but typically refer
  *   to other schedulers by ID.
  */
@@ -35,15 +35,42 @@ static int flux_request_cpus(struct flux_sched *s, int nr_cpus)
 	return flux_request_for_cpus(p, s->f.id, nr_cpus);
 }
 
+/*
+ * All changes to a cpu's current_sched go through here, so that we can account
+ * for the time the cpu spent in each scheduler.
+ */
+static void flux_set_current_sched(struct flux_cpu *cpu, int sched_id)
+{
+	struct flux_cpu_stats *st = get_cpu_stats(cpu->f.id);
+
+	if (st)
+		flux_stats_switch(st, cpu->f.current_sched, bpf_ktime_get_ns());
+	cpu->f.current_sched = sched_id;
+}
+
+static struct __flux_sched_cpu_stats *flux_sched_stats(struct flux_cpu *cpu,
+						       int sched_id)
+{
+	struct flux_cpu_stats *st = get_cpu_stats(cpu->f.id);
+
+	if (!st)
+		return NULL;
+	return flux_stats_sched(st, sched_id);
+}
+
 static void flux_cpu_grant(struct flux_sched *s, int child_id,
 			   struct flux_cpu *cpu)
 {
 	struct flux_sched *child = get_sched(child_id);
+	struct __flux_sched_cpu_stats *ss;
 
 	if (!child)
 		return;
 	__sync_fetch_and_add(&child->f.nr_cpus, 1);
-	cpu->f.current_sched = child_id;
+	flux_set_current_sched(cpu, child_id);
+	ss = flux_sched_stats(cpu, child_id);
+	if (ss)
+		ss->grants++;
 	flux_cpu_allocated(child, cpu);
 }
 
@@ -62,6 +89,8 @@ static void flux_cpu_grant(struct flux_sched *s, int child_id,
 static void flux_preempt_up_to(struct flux_cpu *cpu, int tier)
 {
 	struct flux_sched *s;
+	struct flux_cpu_stats *st;
+	struct __flux_sched_cpu_stats *ss;
 	int prev_child_id = FLUX_SCHED_NONE;
 
 	for (int i = 0; i < FLUX_MAX_NR_TIERS; i++) {
@@ -79,13 +108,19 @@ static void flux_preempt_up_to(struct flux_cpu *cpu, int tier)
 
 		__sync_fetch_and_add(&s->f.nr_cpus, -1);
 		flux_cpu_preempted(s, prev_child_id, cpu);
+		ss = flux_sched_stats(cpu, cpu->f.current_sched);
+		if (ss)
+			ss->preempted++;
 
 		prev_child_id = cpu->f.current_sched;
-		cpu->f.current_sched = get_parent_id(s);
+		flux_set_current_sched(cpu, get_parent_id(s));
 	}
 	if (sched_id_to_tier(cpu->f.current_sched) != tier)
 		bpf_printd("cpu failed to preempt_to tier %d, current_sched %d",
 			   tier, cpu->f.current_sched);
+	st = get_cpu_stats(cpu->f.id);
+	if (st)
+		flux_stats_preempted_to(st, tier);
 	s = get_sched(cpu->f.current_sched);
 	if (!s)
 		return;
@@ -129,6 +164,12 @@ static void flux_preempt_cpu(struct flux_sched *s, struct flux_cpu *cpu)
 			break;
 		if (__sync_bool_compare_and_swap(&cpu->f.preempt_to, preempt_to,
 						 my_tier)) {
+			struct __flux_sched_cpu_stats *ss;
+
+			/* cpu is likely remote: other cpus count here too. */
+			ss = flux_sched_stats(cpu, s->f.id);
+			if (ss)
+				__sync_fetch_and_add(&ss->preempt_requests, 1);
 			/*
 			 * RESCHED_ANY: in the off chance the cpu is in CFS,
 			 * this might be an excessive IPI.  But if/when we have
@@ -144,10 +185,14 @@ static void flux_preempt_cpu(struct flux_sched *s, struct flux_cpu *cpu)
 static void flux_cpu_yield(struct flux_sched *s, struct flux_cpu *cpu)
 {
 	struct flux_sched *p = get_parent(s);
+	struct __flux_sched_cpu_stats *ss;
 
 	if (!p)
 		return;
-	cpu->f.current_sched = p->f.id;
+	ss = flux_sched_stats(cpu, s->f.id);
+	if (ss)
+		ss->yields++;
+	flux_set_current_sched(cpu, p->f.id);
 	__sync_fetch_and_add(&s->f.nr_cpus, -1);
 	flux_cpu_returned(p, s->f.id, cpu);
 }
@@ -475,6 +520,7 @@ static void __attribute__((noinline)) handle_new(struct bpf_ghost_msg *msg)
 	struct task_sw_info swi[1] = {0};
 	struct flux_thread *t;
 	u64 gtid = new->gtid;
+	int err;
 
 	/*
 	 * TODO: there's a race where a task can depart, and if a new task
@@ -486,7 +532,18 @@ static void __attribute__((noinline)) handle_new(struct bpf_ghost_msg *msg)
 	swi->id = new->sw_info.id;
 	swi->index = new->sw_info.index;
 
-	if (bpf_map_update_elem(&sw_lookup, &gtid, swi, BPF_NOEXIST)) {
+	err = bpf_map_update_elem(&sw_lookup, &gtid, swi, BPF_NOEXIST);
+	if (err && err != -EEXIST) {
+		/*
+		 * sw_lookup is full.  If the task is runnable, we would lose
+		 * it, so hand it to userspace, which will ask for task_news
+		 * again once we have room.
+		 */
+		if (new->runnable)
+			rescue_task(gtid, msg->seqnum, BPF_RESCUE_NO_SLOT);
+		return;
+	}
+	if (err) {
 		/*
 		 * We already knew about this task.  If a task joins the enclave
 		 * during Discovery, we'll get a task_new message.  Then
@@ -515,10 +572,33 @@ static void __attribute__((noinline)) handle_new(struct bpf_ghost_msg *msg)
 	t->f.on_rq = new->runnable;
 	t->f.on_cpu = false;
 	t->f.pending_latch = false;
+	t->f.runnable_at = new->runnable ? bpf_ktime_get_us() : 0;
+	t->f.ran_at = 0;
 
 	flux_join_scheduler(t, new_thread_sched_id(new), new->runnable);
 }
 
+/*
+ * Tracks which thread is on which cpu, for userspace's telemetry.  Only clear
+ * current if it is still us: the next thread's on_cpu might have beaten our
+ * message.
+ */
+static void flux_cpu_started(u32 cpu_id, u64 gtid)
+{
+	struct flux_cpu *cpu = cpuid_to_cpu(cpu_id);
+
+	if (cpu)
+		WRITE_ONCE(cpu->f.current, gtid);
+}
+
+static void flux_cpu_stopped(u32 cpu_id, u64 gtid)
+{
+	struct flux_cpu *cpu = cpuid_to_cpu(cpu_id);
+
+	if (cpu)
+		__sync_val_compare_and_swap(&cpu->f.current, gtid, 0);
+}
+
 static void __attribute__((noinline)) handle_on_cpu(struct bpf_ghost_msg *msg)
 {
 	struct ghost_msg_payload_task_on_cpu *on_cpu = &msg->on_cpu;
@@ -526,6 +606,8 @@ static void __attribute__((noinline)) handle_on_cpu(struct bpf_ghost_msg *msg)
 
 	t = flux_thread_on_cpu(on_cpu->gtid, msg->seqnum, on_cpu);
 	t->f.on_cpu = true;
+	t->f.ran_at = bpf_ktime_get_us();
+	flux_cpu_started(on_cpu->cpu, on_cpu->gtid);
 }
 
 static void __attribute__((noinline)) handle_blocked(struct bpf_ghost_msg *msg)
@@ -541,6 +623,7 @@ static void __attribute__((noinline)) handle_blocked(struct bpf_ghost_msg *msg)
 	 */
 	t->f.on_rq = false;
 	t->f.on_cpu = false;
+	flux_cpu_stopped(blocked->cpu, blocked->gtid);
 }
 
 static void __attribute__((noinline)) handle_wakeup(struct bpf_ghost_msg *msg)
@@ -554,6 +637,7 @@ static void __attribute__((noinline)) handle_wakeup(struct bpf_ghost_msg *msg)
 	t = flux_thread_wakeup(wakeup->gtid, msg->seqnum, &wakeup_f);
 
 	t->f.on_rq = true;
+	t->f.runnable_at = bpf_ktime_get_us();
 }
 
 static void __attribute__((noinline)) handle_preempt(struct bpf_ghost_msg *msg)
@@ -565,6 +649,8 @@ static void __attribute__((noinline)) handle_preempt(struct bpf_ghost_msg *msg)
 	if (preempt->from_switchto)
 		t->f.on_rq = true;
 	t->f.on_cpu = false;
+	t->f.runnable_at = bpf_ktime_get_us();
+	flux_cpu_stopped(preempt->cpu, preempt->gtid);
 }
 
 static void __attribute__((noinline)) handle_yield(struct bpf_ghost_msg *msg)
@@ -576,6 +662,8 @@ static void __attribute__((noinline)) handle_yield(struct bpf_ghost_msg *msg)
 	if (yield->from_switchto)
 		t->f.on_rq = true;
 	t->f.on_cpu = false;
+	t->f.runnable_at = bpf_ktime_get_us();
+	flux_cpu_stopped(yield->cpu, yield->gtid);
 }
 
 static void __attribute__((noinline)) handle_switchto(struct bpf_ghost_msg *msg)
@@ -602,6 +690,7 @@ static void __attribute__((noinline)) handle_switchto(struct bpf_ghost_msg *msg)
 	 */
 	t->f.on_rq = false;
 	t->f.on_cpu = false;
+	flux_cpu_stopped(switchto->cpu, switchto->gtid);
 }
 
 static void __attribute__((noinline))
@@ -668,6 +757,7 @@ static void __attribute__((noinline)) handle_departed(struct bpf_ghost_msg *msg)
 	struct flux_thread *t;
 
 	t = flux_thread_departed(departed->gtid, msg->seqnum, departed);
+	flux_cpu_stopped(departed->cpu, departed->gtid);
 	/*
 	 * Note that this thread could be pending_latch and will get a
 	 * LATCH_FAILURE as soon as we return and unlock.  By clearing the
@@ -20,6 +20,36 @@
 #include "third_party/bpf/roci_flux_bpf.h"
 #include "lib/queue.bpf.h"
 
+/*
+ * The scheduler types of agent_flux, as X(name, NAME, ...).  A type 'name' has
+ * a name_flux_bpf.h with struct name_flux_sched and struct name_flux_cpu, and a
+ * name_flux.bpf.c with the name_cpu_* ops, name_request_for_cpus() and
+ * name_pick_next_task().  Types that schedule threads also have a struct
+ * name_flux_thread and the name_thread_* ops, and are listed again in
+ * FLUX_FOR_EACH_THREAD_SCHED_TYPE.
+ *
+ * Everything else (the type enum, the unions, op dispatch) is generated from
+ * these lists, and how the types are stacked is up to userspace.
+ */
+#define FLUX_FOR_EACH_SCHED_TYPE(X, ...)				\
+	X(roci, ROCI, __VA_ARGS__)					\
+	X(biff, BIFF, __VA_ARGS__)					\
+	X(idle, IDLE, __VA_ARGS__)
+
+#define FLUX_FOR_EACH_THREAD_SCHED_TYPE(X, ...)				\
+	X(biff, BIFF, __VA_ARGS__)
+
+#define __FLUX_SCHED_TYPE_ENUM(name, NAME, ...) FLUX_SCHED_TYPE_##NAME,
+#define __FLUX_SCHED_MEMBER(name, NAME, ...) struct name##_flux_sched name;
+#define __FLUX_CPU_MEMBER(name, NAME, ...) struct name##_flux_cpu name;
+#define __FLUX_THREAD_MEMBER(name, NAME, ...) struct name##_flux_thread name;
+
+enum {
+	FLUX_SCHED_TYPE_NONE,
+	FLUX_FOR_EACH_SCHED_TYPE(__FLUX_SCHED_TYPE_ENUM)
+	FLUX_NR_SCHED_TYPES,
+};
+
 struct flux_sched {
 	struct __flux_sched f;
 
@@ -33,29 +63,11 @@ struct flux_sched {
 	uint32_t lock;
 #endif
 	union {
-		struct roci_flux_sched roci;
-		struct biff_flux_sched biff;
-		struct idle_flux_sched idle;
+		FLUX_FOR_EACH_SCHED_TYPE(__FLUX_SCHED_MEMBER)
 	};
 } __attribute__((aligned(8)));
 /* aligned(8) since this is a bpf map value. */
 
-enum {
-	FLUX_SCHED_NONE,
-	FLUX_SCHED_ROCI,
-	FLUX_SCHED_BIFF,
-	FLUX_SCHED_IDLE,
-	FLUX_NR_SCHEDS,
-};
-
-enum {
-	FLUX_SCHED_TYPE_NONE,
-	FLUX_SCHED_TYPE_ROCI,
-	FLUX_SCHED_TYPE_BIFF,
-	FLUX_SCHED_TYPE_IDLE,
-	FLUX_NR_SCHED_TYPES,
-};
-
 struct flux_cpu {
 	struct __flux_cpu f;
 
@@ -64,9 +76,7 @@ struct flux_cpu {
 	 * can both use cpu fields, since roci allocs the cpu to biff.  Thus we
 	 * don't use a union.
 	 */
-	struct roci_flux_cpu roci;
-	struct biff_flux_cpu biff;
-	struct idle_flux_cpu idle;
+	FLUX_FOR_EACH_SCHED_TYPE(__FLUX_CPU_MEMBER)
 } __attribute__((aligned(64)));
 /* aligned(64) for per-cpu caching */
 
@@ -75,7 +85,7 @@ struct flux_thread {
 
 	/* A thread belongs to a single scheduler at a time. */
 	union {
-		struct biff_flux_thread biff;
+		FLUX_FOR_EACH_THREAD_SCHED_TYPE(__FLUX_THREAD_MEMBER)
 	};
 } __attribute__((aligned(8)));
 /* aligned(8) since this is a bpf map value. */
@@ -12,9 +12,8 @@
  */
 
 /*
- * Manually #include this C file in your BPF program after your scheduler
- * helpers (e.g. get_sched()) and your gen_case macros, and before your sched
- * ops.
+ * Manually #include this C file in your BPF program after your gen_case
+ * macros, and before your sched ops.
  */
 
 /*
@@ -57,6 +56,18 @@ struct {
 	__uint(map_flags, BPF_F_MMAPABLE);
 } thread_data SEC(".maps");
 
+/*
+ * One element per cpu, unlike cpu_data: the stats are only touched outside of
+ * scheduler locks, so we can afford a lookup each time.
+ */
+struct {
+	__uint(type, BPF_MAP_TYPE_ARRAY);
+	__uint(max_entries, FLUX_MAX_CPUS);
+	__type(key, u32);
+	__type(value, struct flux_cpu_stats);
+	__uint(map_flags, BPF_F_MMAPABLE);
+} cpu_stats SEC(".maps");
+
 /*
  * Hash map of task_sw_info, indexed by gtid, used for getting the SW info to
  * lookup the *real* per-task data: the thread_data.
@@ -75,6 +86,73 @@ struct {
 	__type(value, struct task_sw_info);
 } sw_lookup SEC(".maps");
 
+/*
+ * The hierarchy: one flux_sched per sched id, written by userspace before it
+ * sets user_initialized.  See flux_header_bpf.h.
+ */
+struct {
+	__uint(type, BPF_MAP_TYPE_ARRAY);
+	__uint(max_entries, FLUX_MAX_NR_SCHEDS);
+	__type(key, u32);
+	__type(value, struct flux_sched);
+} schedulers SEC(".maps");
+
+/* Set by userspace before loading.  PNT grants newly available cpus to it. */
+const volatile int flux_top_sched_id;
+
+static inline struct flux_sched *get_sched(int id)
+{
+	return bpf_map_lookup_elem(&schedulers, &id);
+}
+
+static inline int get_parent_id(struct flux_sched *s)
+{
+	return s->f.parent;
+}
+
+/*
+ * The 'tier' is where a scheduler is in the hierarchy of schedulers: 0 is the
+ * kernel (FLUX_SCHED_NONE), 1 is the top scheduler, 2 its children, etc.
+ *
+ * Schedulers can preempt their cpus, and you can have preemptions at every tier
+ * concurrently.  e.g. in agent_flux's default hierarchy:
+ * - biff can preempt its own cpu to kick a thread off cpu (tier = 2)
+ * - roci can preempt that cpu to kick biff off (tier = 1)
+ * - the kernel can preempt the cpu completely (availability change, tier = 0)
+ *
+ * When preempt_to is FLUX_MAX_NR_TIERS (aka FLUX_TIER_NO_PREEMPT), there are
+ * no preemption requests.
+ *
+ * Keep in mind that it's always OK for us to preempt a cpu.  If there's some
+ * corner case where we accidentally preempt a cpu unintentionally, that's fine.
+ * The schedulers will just reallocate it.
+ *
+ * Quick example: roci on cpu A wants to preempt cpu B.  It does its
+ * bookkeeping, plans to preempt, then calls flux_preempt_cpu.  At that point,
+ * the kernel preempts the cpu, then reallocates it, and the cpu is roci's
+ * again.  Then cpu A writes preempt_to and sends the IPI.  Next time we run
+ * PNT, we'll preempt that cpu up to roci, which can then hand it back to
+ * biff/idle/whoever.
+ *
+ * This is a map lookup, so don't call it while holding a bpf_spin_lock.
+ */
+static inline int sched_id_to_tier(int id)
+{
+	struct flux_sched *s;
+
+	if (id == FLUX_SCHED_NONE)
+		return 0;
+	s = get_sched(id);
+	if (!s)
+		return 0;
+	return s->f.tier;
+}
+
+static inline int top_tier_sched_id(void)
+{
+	return flux_top_sched_id;
+}
+
 static struct flux_cpu *get_cpus(void)
 {
 	struct __cpu_arr *__ca;
@@ -113,6 +191,11 @@ static struct flux_cpu *get_this_cpu(void)
 	return cpuid_to_cpu(bpf_get_smp_processor_id());
 }
 
+static struct flux_cpu_stats *get_cpu_stats(u32 cpu_id)
+{
+	return bpf_map_lookup_elem(&cpu_stats, &cpu_id);
+}
+
 static struct flux_thread *get_thread_array(void)
 {
 	struct __thread_arr *__t_arr;
@@ -18,6 +18,8 @@
 #include <stdint.h>
 #endif
 
+#include "third_party/bpf/ll_hist.h"
+
 /*
  * Flux is a framework for cooperative, preemptive hierarchical scheduling.
  * With Flux, you can compose an overall scheduler from "sub schedulers".  For
@@ -37,13 +39,7 @@
  *   embed in them the __flux structs below with the name 'f'.  e.g.  inside
  *   struct flux_sched, embed "struct __flux_sched f;".
  *
- * - set up the hierarchy and define your schedulers:
- *   - declare an integer id for FLUX_SCHED_NONE.
- *   - define FLUX_MAX_NR_TIERS
- *   - implement sched_id_to_tier()
- *   - implement top_tier_sched_id()
- *   - implement get_sched() and define a map for the flux_sched structs
- *   - implement get_parent_id()
+ * - define your scheduler types:
  *   - implement new_thread_sched_id()
  *   - define macros to generate cases: __gen_thread_op_cases and
  *   __gen_cpu_op_cases
@@ -53,17 +49,36 @@
  * - then add your sched ops
  *
  * - then #include flux_api.bpf.c
+ *
+ * The hierarchy itself is not compiled in.  Userspace writes one flux_sched
+ * per scheduler into the schedulers map before it sets user_initialized: its
+ * type, its parent and its tier.  Sched ids are indexes into that map, and id
+ * FLUX_SCHED_NONE (the kernel) is tier 0 and the parent of the top scheduler.
+ * A scheduler's tier is one more than its parent's.  Userspace also sets
+ * flux_top_sched_id, in rodata, before loading the program.
+ *
+ * A cpu has one struct per scheduler *type* (e.g. cpu->roci), not per
+ * scheduler, so a scheduler can't have an ancestor of its own type: both would
+ * use the same struct for the same cpu.  Siblings and cousins are fine, since
+ * only one of them holds a cpu at a time.
  */
 
 #define FLUX_MAX_CPUS	1024
 #define FLUX_MAX_GTIDS 65536
 
-/* Userspace initializes the id and type fields. */
+#define FLUX_SCHED_NONE 0
+#define FLUX_MAX_NR_SCHEDS 8
+/* Including tier 0.  Bounds the loops that walk up the hierarchy. */
+#define FLUX_MAX_NR_TIERS 4
+
+/* Userspace initializes the id, type, parent and tier fields. */
 struct __flux_sched {
 	int64_t nr_cpus;
 	int64_t nr_cpus_wanted;
 	int id;		/* like a pointer to the struct itself */
 	int type;	/* like a pointer to a struct ops */
+	int parent;	/* sched id, FLUX_SCHED_NONE for the top scheduler */
+	int tier;	/* parent's tier + 1 */
 };
 
 struct __flux_cpu {
@@ -73,6 +88,7 @@ struct __flux_cpu {
 	bool available;
 	bool pnt_success;
 	uint64_t latched_seqnum;	/* for use in PNT */
+	uint64_t current;	/* gtid on cpu, or 0.  For telemetry. */
 };
 
 struct __flux_thread {
@@ -84,8 +100,85 @@ struct __flux_thread {
 	bool on_rq;		/* runnable and/or running. */
 	bool on_cpu;		/* running */
 	bool pending_latch;	/* in PNT limbo, trying to latch */
+	/* bpf_ktime_get_us() timestamps, for telemetry. */
+	uint64_t runnable_at;
+	uint64_t ran_at;
+};
+
+/*
+ * Per-cpu stats, kept by flux_api.bpf.c in the cpu_stats map, which userspace
+ * mmaps.  They are indexed by sched id and by tier.
+ *
+ * A cpu 'resides' in its current_sched, i.e. the lowest scheduler holding it.
+ * e.g. when roci grants a cpu to biff, the cpu's time in roci ends and its time
+ * in biff starts.  FLUX_SCHED_NONE's residency is the time the cpu was not
+ * available to us.
+ *
+ * The helpers below are shared with userspace, which replays the tier state
+ * machine offline (schedulers/flux/flux_tier_model.h).
+ */
+/* Slot 0 counts stints under 1 usec and slot i > 0 [2^(i-1), 2^i) usec. */
+#define FLUX_STATS_RESIDENCY_SLOTS 32
+
+struct __flux_sched_cpu_stats {
+	uint64_t grants;		/* got the cpu from its parent */
+	uint64_t yields;		/* gave the cpu back to its parent */
+	uint64_t preempted;		/* lost the cpu to a preemption */
+	uint64_t preempt_requests;	/* asked to preempt the cpu */
+	uint64_t residency_ns;
+	uint64_t residency[FLUX_STATS_RESIDENCY_SLOTS];
 };
 
+struct flux_cpu_stats {
+	uint64_t current_since;		/* bpf_ktime_get_ns(), or 0 */
+	/* Preemptions of the cpu up to a tier, e.g. [0] is from cpu_busy. */
+	uint64_t preemptions[FLUX_MAX_NR_TIERS];
+	struct __flux_sched_cpu_stats sched[FLUX_MAX_NR_SCHEDS];
+} __attribute__((aligned(64)));
+/* aligned(64) for per-cpu caching */
+
+static inline struct __flux_sched_cpu_stats *
+flux_stats_sched(struct flux_cpu_stats *st, int sched_id)
+{
+	if ((unsigned int)sched_id >= FLUX_MAX_NR_SCHEDS)
+		return (struct __flux_sched_cpu_stats *)0;
+	return &st->sched[sched_id];
+}
+
+static inline uint32_t flux_stats_residency_slot(uint64_t ns)
+{
+	uint64_t us = ns / 1000;
+	uint32_t slot = us ? ll_hist_msb(us) + 1 : 0;
+
+	if (slot >= FLUX_STATS_RESIDENCY_SLOTS)
+		slot = FLUX_STATS_RESIDENCY_SLOTS - 1;
+	return slot;
+}
+
+/*
+ * Ends the cpu's stint in its current sched, old_id, at 'now' and starts the
+ * next one.
+ */
+static inline void flux_stats_switch(struct flux_cpu_stats *st, int old_id,
+				     uint64_t now)
+{
+	struct __flux_sched_cpu_stats *ss = flux_stats_sched(st, old_id);
+	uint64_t since = st->current_since;
+
+	st->current_since = now;
+	if (!ss || !since || now < since)
+		return;
+	ss->residency_ns += now - since;
+	ss->residency[flux_stats_residency_slot(now - since)]++;
+}
+
+static inline void flux_stats_preempted_to(struct flux_cpu_stats *st, int tier)
+{
+	if ((unsigned int)tier >= FLUX_MAX_NR_TIERS)
+		return;
+	st->preemptions[tier]++;
+}
+
 /*
  * A more lengthy note on structures:
  *
@@ -0,0 +1,108 @@
+/* Copyright 2022 Google LLC
+ *
+ * This program is free software; you can redistribute it and/or
+ * modify it under the terms of the GNU General Public License
+ * version 2 as published by the Free Software Foundation.
+ *
+ * This program is distributed in the hope that it will be useful,
+ * but WITHOUT ANY WARRANTY; without even the implied warranty of
+ * MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE. See the
+ * GNU General Public License for more details.
+ */
+
+/*
+ * Log-linear histograms, shared by the BPF tracing programs and their
+ * userspace tools.
+ *
+ * Each power of 2 is split into LL_HIST_NR_SUBS linear sub-buckets, so a
+ * bucket is at most 1/LL_HIST_NR_SUBS (12.5%) of its values wide.  Values are
+ * in nsec: around 1 usec the buckets are 64-128 nsec wide, which is fine
+ * enough to tell ghOSt policies apart that a log2 usec histogram lumps
+ * together.
+ *
+ * Values below LL_HIST_NR_SUBS get a slot of their own.  Everything at or above
+ * 2^LL_HIST_MAX_SHIFT nsec (~17 sec) lands in the last slot.
+ */
+
+#ifndef GHOST_LIB_BPF_BPF_LL_HIST_H_
+#define GHOST_LIB_BPF_BPF_LL_HIST_H_
+
+#ifndef __BPF__
+#include <stdint.h>
+#endif
+
+#define LL_HIST_SUB_BITS 3
+#define LL_HIST_NR_SUBS (1 << LL_HIST_SUB_BITS)
+#define LL_HIST_MAX_SHIFT 34
+#define LL_HIST_NR_SLOTS \
+	((LL_HIST_MAX_SHIFT - LL_HIST_SUB_BITS + 1) * LL_HIST_NR_SUBS)
+
+/*
+ * This struct must be at least 8-byte aligned, since it is a value for a BPF
+ * map.  The kernel will round up the size of any map value to 8 bytes
+ * internally.  If we have an array of these objects, the kernel will think each
+ * object is 8-byte aligned each.  When we read a per-cpu map from userspace, we
+ * get an array of struct ll_hist.  The compiler needs to agree with the kernel
+ * on the size of the objects, or you'll corrupt your stats.
+ */
+struct ll_hist {
+	uint32_t slots[LL_HIST_NR_SLOTS];
+} __attribute__((aligned(8)));
+
+/*
+ * Returns the index of the most significant bit of v, which must not be 0.
+ * Same as bits.bpf.h's log2l(), which we can't include from userspace.
+ */
+static inline uint32_t ll_hist_msb(uint64_t v)
+{
+	uint32_t r = 0;
+
+	if (v >> 32) { v >>= 32; r += 32; }
+	if (v >> 16) { v >>= 16; r += 16; }
+	if (v >> 8) { v >>= 8; r += 8; }
+	if (v >> 4) { v >>= 4; r += 4; }
+	if (v >> 2) { v >>= 2; r += 2; }
+	if (v >> 1) r += 1;
+
+	return r;
+}
+
+static inline uint32_t ll_hist_slot(uint64_t v)
+{
+	uint32_t msb, sub, slot;
+
+	if (v < LL_HIST_NR_SUBS)
+		return v;
+	msb = ll_hist_msb(v);
+	if (msb >= LL_HIST_MAX_SHIFT)
+		return LL_HIST_NR_SLOTS - 1;
+	/* The LL_HIST_SUB_BITS bits below the msb pick the sub-bucket. */
+	sub = (v >> (msb - LL_HIST_SUB_BITS)) & (LL_HIST_NR_SUBS - 1);
+	slot = (msb - LL_HIST_SUB_BITS + 1) * LL_HIST_NR_SUBS + sub;
+
+	return slot;
+}
+
+/* Returns the smallest value that lands in slot. */
+static inline uint64_t ll_hist_slot_lower(uint32_t slot)
+{
+	uint32_t group = slot / LL_HIST_NR_SUBS;
+	uint64_t sub = slot % LL_HIST_NR_SUBS;
+
+	if (!group)
+		return sub;
+	return (LL_HIST_NR_SUBS + sub) << (group - 1);
+}
+
+/*
+ * Returns the smallest value past slot.  The last slot is open-ended, so we
+ * return its lower bound instead.
+ */
+static inline uint64_t ll_hist_slot_upper(uint32_t slot)
+{
+	if (slot >= LL_HIST_NR_SLOTS - 1)
+		return ll_hist_slot_lower(LL_HIST_NR_SLOTS - 1);
+	return ll_hist_slot_lower(slot + 1);
+}
+
+#endif  // GHOST_LIB_BPF_BPF_LL_HIST_H_
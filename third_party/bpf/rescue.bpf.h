@@ -0,0 +1,112 @@
+/*
+ * Copyright 2022 Google LLC
+ *
+ * This program is free software; you can redistribute it and/or
+ * modify it under the terms of the GNU General Public License
+ * version 2 as published by the Free Software Foundation.
+ *
+ * This program is distributed in the hope that it will be useful,
+ * but WITHOUT ANY WARRANTY; without even the implied warranty of
+ * MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE. See the
+ * GNU General Public License for more details.
+ *
+ * Rescue channel: a way for bpf schedulers to hand userspace the tasks they
+ * failed to track or enqueue, instead of losing them.  e.g. when a burst of
+ * tasks overflows the task maps.
+ *
+ * - bpf calls rescue_task(), which writes a bpf_rescue_msg to the rescue_ring
+ *   BPF_MAP_TYPE_RINGBUF.
+ * - The agent epolls on the ring and drains it (see lib/bpf_rescue.h).
+ * - The agent reinjects the tasks.  It may push them to the rescue_rq, from
+ *   which bpf-pnt can pop them with rescue_pop(), or it may do something else,
+ *   such as asking the kernel for new task_news.
+ *
+ * The counters in rescue_stats live in the bss, which userspace can mmap.
+ * Userspace increments nr_queued before pushing to rescue_rq, so bpf-pnt can
+ * skip the (locked) queue map when it is empty.
+ */
+
+#ifndef GHOST_LIB_BPF_RESCUE_BPF_H_
+#define GHOST_LIB_BPF_RESCUE_BPF_H_
+
+#ifndef __BPF__
+#include <stdint.h>
+#endif
+
+/* Must be a power of 2 and a multiple of the page size. */
+#define BPF_RESCUE_RING_SIZE (256 * 1024)
+#define BPF_RESCUE_RQ_SIZE 4096
+
+/* Why bpf gave up on a task. */
+enum {
+	BPF_RESCUE_NO_SLOT = 1,		/* Couldn't track it: maps are full */
+	BPF_RESCUE_NO_RQ = 2,		/* Couldn't enqueue it */
+	BPF_RESCUE_RUN_FAILED = 3,	/* Couldn't run or requeue it */
+};
+
+struct bpf_rescue_msg {
+	uint64_t gtid;
+	uint32_t task_barrier;
+	uint32_t reason;
+	uint64_t rescued_at;	/* bpf_ktime_get_ns(), i.e. CLOCK_MONOTONIC */
+};
+
+struct bpf_rescue_stats {
+	uint64_t nr_rescued;	/* Sent to userspace */
+	uint64_t nr_dropped;	/* Lost: the ring was full */
+	uint64_t nr_reinjected;	/* Popped from rescue_rq */
+	uint64_t nr_queued;	/* In rescue_rq (a hint) */
+};
+
+#ifdef __BPF__
+
+struct {
+	__uint(type, BPF_MAP_TYPE_RINGBUF);
+	__uint(max_entries, BPF_RESCUE_RING_SIZE);
+} rescue_ring SEC(".maps");
+
+struct {
+	__uint(type, BPF_MAP_TYPE_QUEUE);
+	__uint(max_entries, BPF_RESCUE_RQ_SIZE);
+	__type(value, struct bpf_rescue_msg);
+} rescue_rq SEC(".maps");
+
+struct bpf_rescue_stats rescue_stats;
+
+static void rescue_task(u64 gtid, u32 task_barrier, u32 reason)
+{
+	/* Zeroed for the verifier; see enqueue_task() in biff.bpf.c. */
+	struct bpf_rescue_msg msg[1] = {0};
+
+	msg->gtid = gtid;
+	msg->task_barrier = task_barrier;
+	msg->reason = reason;
+	msg->rescued_at = bpf_ktime_get_ns();
+	if (bpf_ringbuf_output(&rescue_ring, msg, sizeof(msg), 0)) {
+		/*
+		 * The agent fell behind by BPF_RESCUE_RING_SIZE worth of
+		 * tasks.  We're out of options.  Hopefully the enclave's
+		 * runnable_timeout will catch it.
+		 */
+		__sync_fetch_and_add(&rescue_stats.nr_dropped, 1);
+		bpf_printd("failed to rescue %p, reason %d\n", gtid, reason);
+		return;
+	}
+	__sync_fetch_and_add(&rescue_stats.nr_rescued, 1);
+}
+
+/* Pops a task reinjected by userspace into msg.  Returns false if none. */
+static bool rescue_pop(struct bpf_rescue_msg *msg)
+{
+	if (!READ_ONCE(rescue_stats.nr_queued))
+		return false;
+	if (bpf_map_pop_elem(&rescue_rq, msg))
+		return false;
+	__sync_fetch_and_add(&rescue_stats.nr_queued, -1);
+	__sync_fetch_and_add(&rescue_stats.nr_reinjected, 1);
+	return true;
+}
+
+#endif  // __BPF__
+
+#endif  // GHOST_LIB_BPF_RESCUE_BPF_H_
@@ -37,7 +37,7 @@ static void roci_request_for_cpus(struct flux_sched *r, int child_id,
 	struct flux_cpu *victim;
 
 	/* Idle should never make cpu requests. */
-	if (child_id == __roci_idle_sched_id()) {
+	if (child_id == r->roci.idle) {
 		*ret = -1;
 		return;
 	}
@@ -93,7 +93,7 @@ static void __roci_cpu_returned(struct flux_sched *r, int child_id,
 	struct arr_list *child_list;
 	struct flux_cpu *cpus = get_cpus();
 
-	if (child_id == __roci_primary_sched_id())
+	if (child_id == r->roci.primary)
 		child_list = &r->roci.primary_cpus;
 	else
 		child_list = &r->roci.idle_cpus;
@@ -171,7 +171,7 @@ static void roci_cpu_ticked(struct flux_sched *r, int child_id,
 static void roci_pick_next_task(struct flux_sched *r, struct flux_cpu *cpu,
 				struct bpf_ghost_sched *ctx)
 {
-	struct flux_sched *b = get_sched(__roci_primary_sched_id());
+	struct flux_sched *b = get_sched(r->roci.primary);
 	int child_id;
 	struct arr_list *child_list;
 	struct flux_cpu *cpus = get_cpus();
@@ -182,7 +182,7 @@ static void roci_pick_next_task(struct flux_sched *r, struct flux_cpu *cpu,
 		child_id = b->f.id;
 		child_list = &r->roci.primary_cpus;
 	} else {
-		child_id = __roci_idle_sched_id();
+		child_id = r->roci.idle;
 		child_list = &r->roci.idle_cpus;
 	}
 
@@ -23,6 +23,9 @@
 struct roci_flux_sched {
 	struct arr_list primary_cpus;
 	struct arr_list idle_cpus;
+	/* Sched ids of our two children, set by userspace. */
+	int primary;
+	int idle;
 };
 
 struct roci_flux_cpu {
@@ -17,7 +17,6 @@
 #include "libbpf/bpf_tracing.h"
 // clang-format on
 
-#include "third_party/iovisor_bcc/bits.bpf.h"
 #include "third_party/bpf/common.bpf.h"
 #include "third_party/bpf/schedlat.h"
 
@@ -38,11 +37,14 @@ struct {
 
 struct {
 	__uint(type, BPF_MAP_TYPE_PERCPU_ARRAY);
-	__uint(max_entries, NR_HISTS);
+	__uint(max_entries, NR_HIST_SETS * NR_HISTS);
 	__type(key, u32);
-	__type(value, struct hist);
+	__type(value, struct ll_hist);
 } hists SEC(".maps");
 
+/* Userspace bumps this to switch histogram sets.  See schedlat.h. */
+u32 hist_gen;
+
 static void task_runnable(struct task_struct *p)
 {
 	struct task_stat stat[1] = {0};
@@ -52,7 +54,7 @@ static void task_runnable(struct task_struct *p)
 		return;
 
 	pid = BPF_CORE_READ(p, pid);
-	stat->runnable_at = bpf_ktime_get_us();
+	stat->runnable_at = bpf_ktime_get_ns();
 
 	bpf_map_update_elem(&task_stats, &pid, stat, BPF_ANY);
 }
@@ -65,20 +67,22 @@ static void task_latched(struct task_struct *p)
 	stat = bpf_map_lookup_elem(&task_stats, &pid);
 	if (!stat)
 		return;
-	stat->latched_at = bpf_ktime_get_us();
+	stat->latched_at = bpf_ktime_get_ns();
 }
 
 static void increment_hist(u32 hist_id, u64 value)
 {
+	u32 idx = (READ_ONCE(hist_gen) % NR_HIST_SETS) * NR_HISTS + hist_id;
 	u64 slot; /* Gotta love BPF.  slot needs to be a u64, not a u32. */
-	struct hist *hist;
+	struct ll_hist *hist;
 
-	hist = bpf_map_lookup_elem(&hists, &hist_id);
+	hist = bpf_map_lookup_elem(&hists, &idx);
 	if (!hist)
 		return;
-	slot = log2l(value);
-	if (slot >= MAX_NR_HIST_SLOTS)
-		slot = MAX_NR_HIST_SLOTS - 1;
+	/* ll_hist_slot() caps the slot, but the verifier can't tell. */
+	slot = ll_hist_slot(value);
+	if (slot >= LL_HIST_NR_SLOTS)
+		slot = LL_HIST_NR_SLOTS - 1;
 	hist->slots[slot]++;
 }
 
@@ -90,7 +94,7 @@ static void task_ran(struct task_struct *p)
 	stat = bpf_map_lookup_elem(&task_stats, &pid);
 	if (!stat)
 		return;
-	stat->ran_at = bpf_ktime_get_us();
+	stat->ran_at = bpf_ktime_get_ns();
 
 	/*
 	 * Not all tasks are latched/committed.  The agent can yield and
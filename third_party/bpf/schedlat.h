@@ -17,8 +17,9 @@
 #include <stdint.h>
 #endif
 
+#include "third_party/bpf/ll_hist.h"
+
 #define MAX_PIDS 102400
-#define MAX_NR_HIST_SLOTS 25
 
 struct task_stat {
 	uint64_t runnable_at;
@@ -26,19 +27,6 @@ struct task_stat {
 	uint64_t ran_at;
 };
 
-/*
- * Power of 2 histogram, <=1 us, 2us, 4us, etc.  This struct must be at least
- * 8-byte aligned, since it is a value for a BPF map.  The kernel will round up
- * the size of any map value to 8 bytes internally.  If we have an array of
- * these objects, the kernel will think each object is 8-byte aligned each.
- * When we read the per-cpu map in schedlat.c, we get an array of struct hist.
- * The compiler needs to agree with the kernel on the size of the objects, or
- * you'll corrupt your stats.
- */
-struct hist {
-	uint32_t slots[MAX_NR_HIST_SLOTS];
-} __attribute__((aligned(8)));
-
 enum {
 	RUNNABLE_TO_LATCHED,
 	LATCHED_TO_RUN,
@@ -46,4 +34,10 @@ enum {
 	NR_HISTS,
 };
 
+/*
+ * The hists map holds two sets of NR_HISTS histograms.  The BPF programs count
+ * into set (hist_gen % NR_HIST_SETS) while userspace drains the other one.
+ */
+#define NR_HIST_SETS 2
+
 #endif  // GHOST_LIB_BPF_BPF_SCHEDLAT_H_
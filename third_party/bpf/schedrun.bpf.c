@@ -17,7 +17,6 @@
 #include "libbpf/bpf_tracing.h"
 // clang-format on
 
-#include "third_party/iovisor_bcc/bits.bpf.h"
 #include "third_party/bpf/common.bpf.h"
 #include "third_party/bpf/schedrun.h"
 
@@ -34,30 +33,35 @@ struct {
 
 struct {
 	__uint(type, BPF_MAP_TYPE_PERCPU_ARRAY);
-	__uint(max_entries, NR_HISTS);
+	__uint(max_entries, NR_HIST_SETS * NR_HISTS);
 	__type(key, u32);
-	__type(value, struct hist);
+	__type(value, struct ll_hist);
 } hists SEC(".maps");
 
+/* Userspace bumps this to switch histogram sets.  See schedlat.h. */
+u32 hist_gen;
+
 // TODO: refactor (copied from schedlat.bpf.c).
 static void update_hist(u32 hist_id, u64 value)
 {
+	u32 idx = (READ_ONCE(hist_gen) % NR_HIST_SETS) * NR_HISTS + hist_id;
 	u64 slot; /* Gotta love BPF.  slot needs to be a u64, not a u32. */
-	struct hist *hist;
+	struct ll_hist *hist;
 
-	hist = bpf_map_lookup_elem(&hists, &hist_id);
+	hist = bpf_map_lookup_elem(&hists, &idx);
 	if (!hist)
 		return;
-	slot = log2l(value);
-	if (slot >= MAX_NR_HIST_SLOTS)
-		slot = MAX_NR_HIST_SLOTS - 1;
+	/* ll_hist_slot() caps the slot, but the verifier can't tell. */
+	slot = ll_hist_slot(value);
+	if (slot >= LL_HIST_NR_SLOTS)
+		slot = LL_HIST_NR_SLOTS - 1;
 	hist->slots[slot]++;
 }
 
 static void task_stop(struct task_struct *p)
 {
 	u32 pid = BPF_CORE_READ(p, pid);
-	u64 stop = bpf_ktime_get_us();
+	u64 stop = bpf_ktime_get_ns();
 	u64 *start = bpf_map_lookup_elem(&task_start_times, &pid);
 
 	if (start) {
@@ -78,7 +82,7 @@ static void task_stop(struct task_struct *p)
 static void task_run(struct task_struct *p)
 {
 	u32 pid = BPF_CORE_READ(p, pid);
-	u64 start = bpf_ktime_get_us();
+	u64 start = bpf_ktime_get_ns();
 
 	bpf_map_update_elem(&task_start_times, &pid, &start, BPF_ANY);
 }
@@ -17,16 +17,9 @@
 #include <stdint.h>
 #endif
 
-#define MAX_PIDS 102400
-#define MAX_NR_HIST_SLOTS 25
+#include "third_party/bpf/ll_hist.h"
 
-/*
- * Power of 2 histogram, <=1 us, 2us, 4us, etc.  This struct must be at least
- * 8-byte aligned, since it is a value for a BPF map.
- */
-struct hist {
-	uint32_t slots[MAX_NR_HIST_SLOTS];
-} __attribute__((aligned(64)));
+#define MAX_PIDS 102400
 
 enum {
 	RUNTIMES_PREEMPTED_YIELDED,
@@ -35,4 +28,7 @@ enum {
 	NR_HISTS,
 };
 
+/* See schedlat.h. */
+#define NR_HIST_SETS 2
+
 #endif  // GHOST_LIB_BPF_BPF_SCHEDRUN_H_
@@ -0,0 +1,94 @@
+// Copyright 2022 Google LLC
+//
+// Use of this source code is governed by a BSD-style
+// license that can be found in the LICENSE file or at
+// https://developers.google.com/open-source/licenses/bsd
+
+// Prints the live telemetry of a BPF agent (see lib/bpf_telemetry.h) once per
+// interval: the utilization of each cpu and the runnable-to-run latencies over
+// the interval.
+
+#include <stdio.h>
+
+#include <memory>
+
+#include "absl/flags/parse.h"
+#include "absl/time/clock.h"
+#include "lib/bpf_telemetry.h"
+
+ABSL_FLAG(int32_t, agent_pid, -1, "PID of the BPF agent");
+ABSL_FLAG(absl::Duration, interval, absl::Seconds(1),
+          "How often to print the stats");
+ABSL_FLAG(int32_t, count, 0, "Number of intervals to print (0 for forever)");
+
+namespace {
+
+using ghost::BpfTelemetryStats;
+
+void PrintInterval(const BpfTelemetryStats& prev,
+                   const BpfTelemetryStats& cur) {
+  printf("samples %lu\n", cur.nr_samples - prev.nr_samples);
+
+  printf("cpu util:");
+  int nr_printed = 0;
+  for (uint32_t i = 0; i < cur.nr_cpus; ++i) {
+    uint64_t samples = cur.cpus[i].samples - prev.cpus[i].samples;
+    if (!samples) {
+      continue;
+    }
+    uint64_t busy = cur.cpus[i].busy_samples - prev.cpus[i].busy_samples;
+    if (nr_printed++ % 8 == 0) {
+      printf("\n ");
+    }
+    printf(" %4u:%3lu%%", i, 100 * busy / samples);
+  }
+  printf("\n");
+
+  BpfTelemetryStats::LatencyStats lat;
+  lat.count = cur.latency.count - prev.latency.count;
+  lat.sum_us = cur.latency.sum_us - prev.latency.sum_us;
+  // The max is cumulative; this is the best we can do.
+  lat.max_us = cur.latency.max_us;
+  for (int i = 0; i < BpfTelemetryStats::kLatencyBuckets; ++i) {
+    lat.buckets[i] = cur.latency.buckets[i] - prev.latency.buckets[i];
+  }
+  printf("latency: runs %lu", lat.count);
+  if (lat.count) {
+    printf(" avg %luus p50 <%luus p99 <%luus", lat.sum_us / lat.count,
+           BpfTelemetryStats::LatencyPercentile(lat, 50),
+           BpfTelemetryStats::LatencyPercentile(lat, 99));
+  }
+  printf("\n\n");
+  fflush(stdout);
+}
+
+}  // namespace
+
+int main(int argc, char* argv[]) {
+  absl::ParseCommandLine(argc, argv);
+
+  pid_t pid = absl::GetFlag(FLAGS_agent_pid);
+  if (pid == -1) {
+    fprintf(stderr, "need an agent, e.g. --agent_pid $(pidof agent_biff)\n");
+    return 1;
+  }
+  std::unique_ptr<ghost::BpfTelemetryReader> reader =
+      ghost::BpfTelemetryReader::Attach(pid);
+  if (!reader) {
+    fprintf(stderr, "pid %d does not publish BPF telemetry\n", pid);
+    return 1;
+  }
+
+  // The stats are too big for the stack.
+  auto prev = std::make_unique<BpfTelemetryStats>();
+  auto cur = std::make_unique<BpfTelemetryStats>();
+  reader->Read(prev.get());
+  const int count = absl::GetFlag(FLAGS_count);
+  for (int i = 0; count == 0 || i < count; ++i) {
+    absl::SleepFor(absl::GetFlag(FLAGS_interval));
+    reader->Read(cur.get());
+    PrintInterval(*prev, *cur);
+    std::swap(prev, cur);
+  }
+  return 0;
+}
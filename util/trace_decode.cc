@@ -0,0 +1,55 @@
+// Copyright 2022 Google LLC
+//
+// Use of this source code is governed by a BSD-style
+// license that can be found in the LICENSE file or at
+// https://developers.google.com/open-source/licenses/bsd
+
+// Prints the `GHOST_DPRINT`s in a trace file that an agent run with
+// --dprint_trace wrote, oldest first, the way they would have been printed.
+//
+// $ trace_decode [--timestamps] /tmp/agent.trace
+
+#include <stdio.h>
+
+#include <string>
+#include <vector>
+
+#include "absl/flags/flag.h"
+#include "absl/flags/parse.h"
+#include "absl/strings/str_format.h"
+#include "absl/time/time.h"
+#include "lib/trace_ring.h"
+
+ABSL_FLAG(bool, timestamps, false,
+          "Prefix each line with its time, cpu and thread");
+
+int main(int argc, char* argv[]) {
+  std::vector<char*> args = absl::ParseCommandLine(argc, argv);
+  if (args.size() != 2) {
+    fprintf(stderr, "usage: %s [--timestamps] <trace file>\n", args[0]);
+    return 1;
+  }
+
+  absl::StatusOr<ghost::DecodedTrace> trace = ghost::DecodeTraceFile(args[1]);
+  if (!trace.ok()) {
+    fprintf(stderr, "%s\n", trace.status().ToString().c_str());
+    return 1;
+  }
+
+  const bool timestamps = absl::GetFlag(FLAGS_timestamps);
+  for (const ghost::DecodedTraceRecord& record : trace->records) {
+    if (timestamps) {
+      absl::PrintF("[%s] cpu %d tid %d: ",
+                   absl::FormatTime("%H:%M:%E6S", record.time,
+                                    absl::LocalTimeZone()),
+                   record.cpu, record.tid);
+    }
+    absl::PrintF("%s\n", record.text);
+  }
+
+  if (trace->dropped > 0) {
+    absl::FPrintF(stderr, "%u records were dropped because a ring was full\n",
+                  trace->dropped);
+  }
+  return 0;
+}